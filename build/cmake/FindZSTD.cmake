@@ -0,0 +1,25 @@
+# - Find zstd
+# Find the native Zstandard includes and library
+#
+#  ZSTD_INCLUDE_DIR    - where to find zstd.h, etc.
+#  ZSTD_LIBRARIES      - List of libraries when using libzstd.
+#  ZSTD_FOUND          - True if libzstd found.
+
+IF (ZSTD_INCLUDE_DIR)
+  # Already in cache, be silent
+  SET(ZSTD_FIND_QUIETLY TRUE)
+ENDIF (ZSTD_INCLUDE_DIR)
+
+FIND_PATH(ZSTD_INCLUDE_DIR zstd.h)
+FIND_LIBRARY(ZSTD_LIBRARY NAMES zstd libzstd)
+
+# handle the QUIETLY and REQUIRED arguments and set ZSTD_FOUND to TRUE if 
+# all listed variables are TRUE
+INCLUDE(FindPackageHandleStandardArgs)
+FIND_PACKAGE_HANDLE_STANDARD_ARGS(ZSTD DEFAULT_MSG ZSTD_LIBRARY ZSTD_INCLUDE_DIR)
+
+IF(ZSTD_FOUND)
+  SET( ZSTD_LIBRARIES ${ZSTD_LIBRARY} )
+ELSE(ZSTD_FOUND)
+  SET( ZSTD_LIBRARIES )
+ENDIF(ZSTD_FOUND)
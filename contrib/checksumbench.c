@@ -0,0 +1,127 @@
+/*
+ * "checksumbench" times libarchive's internal CAB (XOR) and LHA
+ * (CRC-16) checksums against the byte-at-a-time loops the readers
+ * used to have, and checks that they agree.
+ *
+ * It reaches into libarchive's internals, so build it against a
+ * libarchive build tree rather than an installed library.  From the
+ * top of the source tree, with a CMake build in "build_dir":
+ *
+ *    cc -O2 -o checksumbench -Ilibarchive -Ibuild_dir \
+ *        contrib/checksumbench.c build_dir/libarchive/libarchive.a
+ *
+ * (add -lpthread and whatever else libarchive was linked with).
+ * Setting LIBARCHIVE_CPU_MASK=ffff times the portable code.
+ *
+ * Usage:  checksumbench [megabytes [rounds]]
+ *
+ * Released into the public domain.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define	__LIBARCHIVE_BUILD 1
+#include "archive_checksum_private.h"
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void
+report(const char *name, double secs, size_t bytes, int rounds)
+{
+	printf("%-24s %9.1f MB/s\n", name,
+	    (double)bytes * rounds / secs / (1024 * 1024));
+}
+
+static uint32_t
+old_xor32le(uint32_t sum, const unsigned char *p, size_t len)
+{
+	for (; len >= 4; len -= 4, p += 4)
+		sum ^= p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	return (sum);
+}
+
+static uint16_t old_tbl[256];
+
+static uint16_t
+old_crc16(uint16_t crc, const unsigned char *p, size_t len)
+{
+	while (len--)
+		crc = old_tbl[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return (crc);
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned char *buff;
+	uint32_t x_old, x_new;
+	uint16_t c_old, c_new;
+	unsigned int seed = 1;
+	size_t size, i;
+	int rounds, r, k;
+	double t;
+
+	size = (argc > 1 ? (size_t)atoi(argv[1]) : 64) * 1024 * 1024;
+	rounds = argc > 2 ? atoi(argv[2]) : 10;
+	if (size == 0 || rounds <= 0) {
+		fprintf(stderr, "usage: checksumbench [megabytes [rounds]]\n");
+		return (2);
+	}
+	if ((buff = malloc(size)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return (1);
+	}
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		buff[i] = (unsigned char)(seed >> 16);
+	}
+	for (i = 0; i < 256; i++) {
+		c_old = (uint16_t)i;
+		for (k = 0; k < 8; k++)
+			c_old = (c_old & 1) ? (c_old >> 1) ^ 0xa001 : c_old >> 1;
+		old_tbl[i] = c_old;
+	}
+
+	/* Warm up; this also picks the implementation. */
+	x_new = __archive_xor32le(0, buff, size);
+	c_new = __archive_crc16(0, buff, size);
+
+	t = now();
+	for (r = 0; r < rounds; r++)
+		x_old = old_xor32le(r, buff, size);
+	report("xor32le, word at a time", now() - t, size, rounds);
+
+	t = now();
+	for (r = 0; r < rounds; r++)
+		x_new = __archive_xor32le(r, buff, size);
+	report("__archive_xor32le", now() - t, size, rounds);
+
+	t = now();
+	for (r = 0; r < rounds; r++)
+		c_old = old_crc16(r, buff, size);
+	report("crc16, byte at a time", now() - t, size, rounds);
+
+	t = now();
+	for (r = 0; r < rounds; r++)
+		c_new = __archive_crc16(r, buff, size);
+	report("__archive_crc16", now() - t, size, rounds);
+
+	free(buff);
+	if (x_old != x_new || c_old != c_new) {
+		printf("MISMATCH: xor %08x/%08x, crc16 %04x/%04x\n",
+		    x_old, x_new, c_old, c_new);
+		return (1);
+	}
+	return (0);
+}
@@ -0,0 +1,93 @@
+/*
+ * "crc32bench" times libarchive's internal CRC-32 against zlib's
+ * crc32() on the same buffer and checks that they agree.
+ *
+ * It reaches into libarchive's internals, so build it against a
+ * libarchive build tree rather than an installed library.  From the
+ * top of the source tree, with a CMake build in "build_dir":
+ *
+ *    cc -O2 -o crc32bench -Ilibarchive -Ibuild_dir \
+ *        contrib/crc32bench.c build_dir/libarchive/libarchive.a -lz
+ *
+ * Usage:  crc32bench [megabytes [rounds]]
+ *
+ * Released into the public domain.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <zlib.h>
+
+#define	__LIBARCHIVE_BUILD 1
+#include "archive_crc32.h"
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static void
+report(const char *name, double secs, size_t bytes, int rounds)
+{
+	printf("%-24s %9.1f MB/s\n", name,
+	    (double)bytes * rounds / secs / (1024 * 1024));
+}
+
+int
+main(int argc, char **argv)
+{
+	unsigned char *buff;
+	unsigned long c_zlib, c_fast, c_table;
+	unsigned int seed = 1;
+	size_t size, i;
+	int rounds, r;
+	double t;
+
+	size = (argc > 1 ? (size_t)atoi(argv[1]) : 64) * 1024 * 1024;
+	rounds = argc > 2 ? atoi(argv[2]) : 10;
+	if (size == 0 || rounds <= 0) {
+		fprintf(stderr, "usage: crc32bench [megabytes [rounds]]\n");
+		return (2);
+	}
+	if ((buff = malloc(size)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return (1);
+	}
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		buff[i] = (unsigned char)(seed >> 16);
+	}
+
+	/* Warm up; this also picks the implementation. */
+	c_fast = __archive_crc32(0, buff, size);
+
+	t = now();
+	for (r = 0; r < rounds; r++)
+		c_zlib = crc32(0, buff, (uInt)size);
+	report("zlib crc32", now() - t, size, rounds);
+
+	t = now();
+	for (r = 0; r < rounds; r++)
+		c_fast = __archive_crc32(0, buff, size);
+	report("__archive_crc32", now() - t, size, rounds);
+
+	t = now();
+	for (r = 0; r < rounds; r++)
+		c_table = __archive_crc32_portable(0, buff, size);
+	report("  (slice-by-16 tables)", now() - t, size, rounds);
+
+	free(buff);
+	if (c_zlib != c_fast || c_zlib != c_table) {
+		printf("MISMATCH: zlib %08lx, fast %08lx, tables %08lx\n",
+		    c_zlib, c_fast, c_table);
+		return (1);
+	}
+	return (0);
+}
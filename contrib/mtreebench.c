@@ -0,0 +1,123 @@
+/*
+ * "mtreebench" times the mtree writer's checksum keywords: it writes
+ * a manifest for synthetic files with the given keywords and reports
+ * the cost per byte of file data.
+ *
+ * It uses only the public API.  From the top of the source tree, with
+ * a CMake build in "build_dir":
+ *
+ *    cc -O2 -o mtreebench -Ilibarchive contrib/mtreebench.c \
+ *        build_dir/libarchive/libarchive.a -lz -lpthread
+ *
+ * (add whatever else libarchive was linked with, such as -lcrypto).
+ *
+ * Usage:  mtreebench [megabytes [options]]
+ *
+ * The options are passed to archive_write_set_options(); the default,
+ * "mtree:all", enables every keyword.  Each run is repeated with
+ * mtree:threads=0, 2 and 4 appended.
+ *
+ * Released into the public domain.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "archive.h"
+#include "archive_entry.h"
+
+#define	FILE_SIZE	(16 * 1024 * 1024)
+#define	BLOCK_SIZE	(64 * 1024)
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec / 1e9);
+}
+
+static ssize_t
+discard(struct archive *a, void *client_data, const void *buff, size_t n)
+{
+	(void)a; (void)client_data; (void)buff;
+	return (n);
+}
+
+static int
+run(const char *options, const unsigned char *data, size_t total)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[32];
+	size_t done, n, left;
+	double t;
+	int i;
+
+	a = archive_write_new();
+	archive_write_set_format_mtree(a);
+	if (archive_write_set_options(a, options) != ARCHIVE_OK) {
+		fprintf(stderr, "%s: %s\n", options, archive_error_string(a));
+		return (1);
+	}
+	archive_write_open(a, NULL, NULL, discard, NULL);
+
+	t = now();
+	for (i = 0, left = total; left > 0; i++) {
+		n = left < FILE_SIZE ? left : FILE_SIZE;
+		left -= n;
+		ae = archive_entry_new();
+		snprintf(path, sizeof(path), "./file%d", i);
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, n);
+		archive_write_header(a, ae);
+		archive_entry_free(ae);
+		for (done = 0; done < n; done += BLOCK_SIZE)
+			archive_write_data(a, data + done % FILE_SIZE,
+			    n - done < BLOCK_SIZE ? n - done : BLOCK_SIZE);
+	}
+	archive_write_close(a);
+	t = now() - t;
+	archive_write_free(a);
+
+	printf("%-40s %7.2f ns/byte %9.1f MB/s\n", options,
+	    t * 1e9 / total, total / t / (1024 * 1024));
+	return (0);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const char *threads[] = { "", ",mtree:threads=2",
+	    ",mtree:threads=4" };
+	const char *keys = argc > 2 ? argv[2] : "mtree:all";
+	unsigned char *data;
+	unsigned int seed = 1;
+	char options[256];
+	size_t total, i;
+
+	total = (argc > 1 ? (size_t)atoi(argv[1]) : 256) * 1024 * 1024;
+	if (total == 0) {
+		fprintf(stderr, "usage: mtreebench [megabytes [options]]\n");
+		return (2);
+	}
+	if ((data = malloc(FILE_SIZE)) == NULL) {
+		fprintf(stderr, "out of memory\n");
+		return (1);
+	}
+	for (i = 0; i < FILE_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = (unsigned char)(seed >> 16);
+	}
+	for (i = 0; i < sizeof(threads) / sizeof(threads[0]); i++) {
+		snprintf(options, sizeof(options), "%s%s", keys, threads[i]);
+		if (run(options, data, total) != 0)
+			return (1);
+	}
+	free(data);
+	return (0);
+}
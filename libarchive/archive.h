@@ -207,6 +207,8 @@ typedef int	archive_close_callback(struct archive *, void *_client_data);
 #define	ARCHIVE_FILTER_UU	7
 #define	ARCHIVE_FILTER_RPM	8
 #define	ARCHIVE_FILTER_LZIP	9
+#define	ARCHIVE_FILTER_LZ4	10
+#define	ARCHIVE_FILTER_ZSTD	11
 
 #if ARCHIVE_VERSION_NUMBER < 4000000
 #define	ARCHIVE_COMPRESSION_NONE	ARCHIVE_FILTER_NONE
@@ -313,6 +315,7 @@ __LA_DECL int archive_read_support_filter_all(struct archive *);
 __LA_DECL int archive_read_support_filter_bzip2(struct archive *);
 __LA_DECL int archive_read_support_filter_compress(struct archive *);
 __LA_DECL int archive_read_support_filter_gzip(struct archive *);
+__LA_DECL int archive_read_support_filter_lz4(struct archive *);
 __LA_DECL int archive_read_support_filter_lzip(struct archive *);
 __LA_DECL int archive_read_support_filter_lzma(struct archive *);
 __LA_DECL int archive_read_support_filter_none(struct archive *);
@@ -325,6 +328,7 @@ __LA_DECL int archive_read_support_filter_program_signature
 __LA_DECL int archive_read_support_filter_rpm(struct archive *);
 __LA_DECL int archive_read_support_filter_uu(struct archive *);
 __LA_DECL int archive_read_support_filter_xz(struct archive *);
+__LA_DECL int archive_read_support_filter_zstd(struct archive *);
 
 __LA_DECL int archive_read_support_format_7zip(struct archive *);
 __LA_DECL int archive_read_support_format_all(struct archive *);
@@ -342,6 +346,12 @@ __LA_DECL int archive_read_support_format_raw(struct archive *);
 __LA_DECL int archive_read_support_format_tar(struct archive *);
 __LA_DECL int archive_read_support_format_xar(struct archive *);
 __LA_DECL int archive_read_support_format_zip(struct archive *);
+/* Reads Zip archives as stream from beginning to end.  Doesn't
+ * correctly handle SFX ZIP files or ZIP archives that have been modified
+ * in-place. */
+__LA_DECL int archive_read_support_format_zip_streamable(struct archive *);
+/* Reads starting from central directory; requires seekable input. */
+__LA_DECL int archive_read_support_format_zip_seekable(struct archive *);
 
 /* Set various callbacks. */
 __LA_DECL int archive_read_set_open_callback(struct archive *,
@@ -401,12 +411,52 @@ __LA_DECL int archive_read_next_header(struct archive *,
 __LA_DECL int archive_read_next_header2(struct archive *,
 		     struct archive_entry *);
 
+/*
+ * Jumps directly to the entry with the given pathname, or the given
+ * index in archive order (starting at zero), for formats that can do
+ * so.  Returns ARCHIVE_FAILED if there is no such entry or the format
+ * or data source doesn't support random access.
+ */
+__LA_DECL int archive_read_seek_entry(struct archive *, const char *,
+		     struct archive_entry **);
+__LA_DECL int archive_read_seek_entry_index(struct archive *,
+		     __LA_INT64_T, struct archive_entry **);
+
+/*
+ * Names a sidecar index that lets archive_read_seek_entry() work for
+ * tar and cpio archives.  If the file exists, it is loaded; otherwise
+ * it is built as the archive is read and written out when the archive
+ * is closed after reading all of it.  Must be called before opening.
+ */
+__LA_DECL int archive_read_set_index_file(struct archive *,
+		     const char *_filename);
+
 /*
  * Retrieve the byte offset in UNCOMPRESSED data where last-read
  * header started.
  */
 __LA_DECL __LA_INT64_T		 archive_read_header_position(struct archive *);
 
+/*
+ * Counters kept for each filter in the read pipeline, to help find
+ * out which stage limits throughput.  Filters are numbered as for
+ * archive_filter_bytes().  Times are in microseconds and include time
+ * spent waiting on upstream filters that run on the same thread.
+ */
+struct archive_read_stats {
+	__LA_INT64_T	bytes_zero_copy; /* Handed out from the read buffer. */
+	__LA_INT64_T	bytes_copied;	/* Copied into the look-ahead buffer. */
+	__LA_INT64_T	buffer_reallocs; /* Growth of the look-ahead buffer. */
+	__LA_INT64_T	skip_calls;	/* Skips past all buffered data, */
+	__LA_INT64_T	skip_bytes;	/* and the bytes they passed over. */
+	__LA_INT64_T	seek_calls;
+	__LA_INT64_T	read_calls;	/* Calls to the read callback, */
+	__LA_INT64_T	read_wall_usec;	/* elapsed time in them, */
+	__LA_INT64_T	read_cpu_usec;	/* and CPU time used by them. */
+};
+__LA_DECL int		 archive_read_get_stats(struct archive *, int,
+				    struct archive_read_stats *);
+
 /* Read data from the body of an entry.  Similar to read(2). */
 __LA_DECL __LA_SSIZE_T		 archive_read_data(struct archive *,
 				    void *, size_t);
@@ -546,6 +596,10 @@ __LA_DECL int archive_write_get_bytes_in_last_block(struct archive *);
 __LA_DECL int archive_write_set_skip_file(struct archive *,
     __LA_INT64_T, __LA_INT64_T);
 
+/* Write a sidecar index for archive_read_set_index_file() on close. */
+__LA_DECL int archive_write_set_index_file(struct archive *,
+    const char *_filename);
+
 #if ARCHIVE_VERSION_NUMBER < 4000000
 __LA_DECL int archive_write_set_compression_bzip2(struct archive *);
 __LA_DECL int archive_write_set_compression_compress(struct archive *);
@@ -561,12 +615,14 @@ __LA_DECL int archive_write_set_compression_xz(struct archive *);
 __LA_DECL int archive_write_add_filter_bzip2(struct archive *);
 __LA_DECL int archive_write_add_filter_compress(struct archive *);
 __LA_DECL int archive_write_add_filter_gzip(struct archive *);
+__LA_DECL int archive_write_add_filter_lz4(struct archive *);
 __LA_DECL int archive_write_add_filter_lzip(struct archive *);
 __LA_DECL int archive_write_add_filter_lzma(struct archive *);
 __LA_DECL int archive_write_add_filter_none(struct archive *);
 __LA_DECL int archive_write_add_filter_program(struct archive *,
 		     const char *cmd);
 __LA_DECL int archive_write_add_filter_xz(struct archive *);
+__LA_DECL int archive_write_add_filter_zstd(struct archive *);
 
 
 /* A convenience function to set the format based on the code or name. */
@@ -0,0 +1,240 @@
+/*-
+ * Copyright (c) 2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#include "archive_platform.h"
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "archive_checksum_private.h"
+#include "archive_cpu_private.h"
+#include "archive_endian.h"
+
+#if defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define	XOR_SSE2
+#include <emmintrin.h>
+#endif
+#if defined(ARCHIVE_CPU_X86)
+#define	XOR_AVX2
+#include <immintrin.h>
+#endif
+#if defined(__aarch64__) && defined(__ARM_NEON)
+#define	XOR_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+ * XOR checksum.
+ *
+ * XOR works lane by lane, so the words can be folded in any width and
+ * any byte order: each kernel XORs whole blocks into a 32-byte
+ * accumulator in memory order, and only the final fold down to one
+ * 32-bit word has to know that the words are little-endian.
+ *
+ * The kernels take a multiple of 32 (AVX2: 64) bytes.
+ */
+typedef void (*xor_func)(unsigned char *acc, const unsigned char *, size_t);
+
+static void
+xor_words(unsigned char *acc, const unsigned char *p, size_t n)
+{
+	uint64_t a0, a1, a2, a3, v;
+
+	memcpy(&a0, acc, 8);
+	memcpy(&a1, acc + 8, 8);
+	memcpy(&a2, acc + 16, 8);
+	memcpy(&a3, acc + 24, 8);
+	for (; n > 0; n -= 32, p += 32) {
+		memcpy(&v, p, 8);
+		a0 ^= v;
+		memcpy(&v, p + 8, 8);
+		a1 ^= v;
+		memcpy(&v, p + 16, 8);
+		a2 ^= v;
+		memcpy(&v, p + 24, 8);
+		a3 ^= v;
+	}
+	memcpy(acc, &a0, 8);
+	memcpy(acc + 8, &a1, 8);
+	memcpy(acc + 16, &a2, 8);
+	memcpy(acc + 24, &a3, 8);
+}
+
+#ifdef XOR_SSE2
+static void
+xor_sse2(unsigned char *acc, const unsigned char *p, size_t n)
+{
+	__m128i a0, a1;
+
+	a0 = _mm_loadu_si128((const __m128i *)acc);
+	a1 = _mm_loadu_si128((const __m128i *)(acc + 16));
+	for (; n > 0; n -= 32, p += 32) {
+		a0 = _mm_xor_si128(a0, _mm_loadu_si128((const __m128i *)p));
+		a1 = _mm_xor_si128(a1,
+		    _mm_loadu_si128((const __m128i *)(p + 16)));
+	}
+	_mm_storeu_si128((__m128i *)acc, a0);
+	_mm_storeu_si128((__m128i *)(acc + 16), a1);
+}
+#endif
+
+#ifdef XOR_AVX2
+__attribute__((target("avx2")))
+static void
+xor_avx2(unsigned char *acc, const unsigned char *p, size_t n)
+{
+	__m256i a0, a1;
+
+	a0 = _mm256_loadu_si256((const __m256i *)acc);
+	a1 = _mm256_setzero_si256();
+	for (; n > 0; n -= 64, p += 64) {
+		a0 = _mm256_xor_si256(a0,
+		    _mm256_loadu_si256((const __m256i *)p));
+		a1 = _mm256_xor_si256(a1,
+		    _mm256_loadu_si256((const __m256i *)(p + 32)));
+	}
+	_mm256_storeu_si256((__m256i *)acc, _mm256_xor_si256(a0, a1));
+}
+#endif
+
+#ifdef XOR_NEON
+static void
+xor_neon(unsigned char *acc, const unsigned char *p, size_t n)
+{
+	uint8x16_t a0, a1;
+
+	a0 = vld1q_u8(acc);
+	a1 = vld1q_u8(acc + 16);
+	for (; n > 0; n -= 32, p += 32) {
+		a0 = veorq_u8(a0, vld1q_u8(p));
+		a1 = veorq_u8(a1, vld1q_u8(p + 16));
+	}
+	vst1q_u8(acc, a0);
+	vst1q_u8(acc + 16, a1);
+}
+#endif
+
+uint32_t
+__archive_xor32le(uint32_t seed, const void *pp, size_t len)
+{
+	const unsigned char *p = pp;
+	unsigned char acc[32];
+	xor_func f = xor_words;
+	size_t block = 32, n;
+	int i;
+
+#ifdef XOR_SSE2
+	f = xor_sse2;
+#endif
+#ifdef XOR_NEON
+	f = xor_neon;
+#endif
+#ifdef XOR_AVX2
+	/* Not worth the dispatch for a few blocks. */
+	if (len >= 1024 && (__archive_cpu_features() & ARCHIVE_CPU_AVX2)) {
+		f = xor_avx2;
+		block = 64;
+	}
+#endif
+	memset(acc, 0, sizeof(acc));
+	n = len & ~(block - 1);
+	if (n > 0) {
+		(*f)(acc, p, n);
+		p += n;
+		len -= n;
+	}
+	for (i = 4; i < 32; i++)
+		acc[i & 3] ^= acc[i];
+	seed ^= archive_le32dec(acc);
+	for (; len >= 4; len -= 4, p += 4)
+		seed ^= archive_le32dec(p);
+	return (seed);
+}
+
+/*
+ * CRC-16, eight bytes at a time ("slicing-by-8"): crc16_tbl[k][b] is
+ * the CRC of byte b followed by k zero bytes, so the contributions of
+ * eight bytes can be looked up independently and XORed together.
+ */
+static uint16_t crc16_tbl[8][256];
+
+static void
+crc16_init(void)
+{
+	uint16_t crc;
+	int b, i, k;
+
+	for (b = 0; b < 256; b++) {
+		crc = (uint16_t)b;
+		for (i = 0; i < 8; i++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xa001 : crc >> 1;
+		crc16_tbl[0][b] = crc;
+	}
+	for (b = 0; b < 256; b++) {
+		crc = crc16_tbl[0][b];
+		for (k = 1; k < 8; k++) {
+			crc = crc16_tbl[0][crc & 0xff] ^ (crc >> 8);
+			crc16_tbl[k][b] = crc;
+		}
+	}
+}
+
+#ifdef HAVE_PTHREAD_H
+static pthread_once_t crc16_once = PTHREAD_ONCE_INIT;
+#define	CRC16_SETUP()	pthread_once(&crc16_once, crc16_init)
+#else
+static volatile int crc16_inited;
+#define	CRC16_SETUP()	do {			\
+	if (!crc16_inited) {			\
+		crc16_init();			\
+		crc16_inited = 1;		\
+	}					\
+} while (0)
+#endif
+
+uint16_t
+__archive_crc16(uint16_t crc, const void *pp, size_t len)
+{
+	const unsigned char *p = pp;
+	uint32_t c;
+
+	CRC16_SETUP();
+	for (; len >= 8; len -= 8, p += 8) {
+		c = crc ^ archive_le16dec(p);
+		crc = crc16_tbl[7][c & 0xff] ^ crc16_tbl[6][c >> 8] ^
+		    crc16_tbl[5][p[2]] ^ crc16_tbl[4][p[3]] ^
+		    crc16_tbl[3][p[4]] ^ crc16_tbl[2][p[5]] ^
+		    crc16_tbl[1][p[6]] ^ crc16_tbl[0][p[7]];
+	}
+	while (len--)
+		crc = crc16_tbl[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return (crc);
+}
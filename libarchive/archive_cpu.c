@@ -0,0 +1,103 @@
+/*-
+ * Copyright (c) 2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#include "archive_cpu_private.h"
+
+#ifdef ARCHIVE_CPU_X86
+#include <cpuid.h>
+#endif
+
+/*
+ * -1 until probed.  Probing is idempotent, so racing threads at
+ * worst do it twice and store the same answer.
+ */
+static volatile int cpu_features = -1;
+
+static int
+probe(void)
+{
+	int f = 0;
+#ifdef ARCHIVE_CPU_X86
+	unsigned int eax, ebx, ecx = 0, edx, max;
+	int ymm = 0;
+
+	max = __get_cpuid_max(0, NULL);
+	if (max >= 1 && __get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+		if (edx & (1U << 26))
+			f |= ARCHIVE_CPU_SSE2;
+		if (ecx & (1U << 9))
+			f |= ARCHIVE_CPU_SSSE3;
+		if (ecx & (1U << 19))
+			f |= ARCHIVE_CPU_SSE41;
+		if (ecx & (1U << 1))
+			f |= ARCHIVE_CPU_PCLMUL;
+	}
+	if (max >= 1 && (ecx & (1U << 27)) != 0) {
+		/* OSXSAVE: ask the OS whether it saves the YMM state. */
+		__asm__ ("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+		if ((eax & 6) == 6)
+			ymm = 1;
+	}
+	if (max >= 7) {
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+		if ((ebx & (1U << 5)) && ymm)
+			f |= ARCHIVE_CPU_AVX2;
+		/* The SHA kernels also use SSSE3 and SSE4.1. */
+		if ((ebx & (1U << 29)) &&
+		    (f & (ARCHIVE_CPU_SSSE3 | ARCHIVE_CPU_SSE41)) ==
+		    (ARCHIVE_CPU_SSSE3 | ARCHIVE_CPU_SSE41))
+			f |= ARCHIVE_CPU_SHA;
+	}
+#endif
+	/*
+	 * LIBARCHIVE_CPU_MASK=<hex> turns features off, which is how
+	 * the portable code is tested on machines that would never
+	 * run it otherwise.
+	 */
+	{
+		const char *mask = getenv("LIBARCHIVE_CPU_MASK");
+
+		if (mask != NULL)
+			f &= ~(int)strtol(mask, NULL, 16);
+	}
+	return (f);
+}
+
+int
+__archive_cpu_features(void)
+{
+	int f = cpu_features;
+
+	if (f < 0)
+		cpu_features = f = probe();
+	return (f);
+}
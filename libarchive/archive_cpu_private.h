@@ -0,0 +1,62 @@
+/*-
+ * Copyright (c) 2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#ifndef __LIBARCHIVE_BUILD
+#error This header is only to be used internally to libarchive.
+#endif
+
+#ifndef ARCHIVE_CPU_PRIVATE_H_INCLUDED
+#define	ARCHIVE_CPU_PRIVATE_H_INCLUDED
+
+/*
+ * Run-time CPU feature detection for the few places that have
+ * hand-written kernels (checksums and digests).
+ *
+ * ARCHIVE_CPU_X86 is defined when the compiler can build such kernels
+ * for this target (with per-function target attributes, so the rest
+ * of the library is built for the baseline CPU).
+ * __archive_cpu_features() then says which of them the CPU we're
+ * actually running on can execute.  A kernel should only be used when
+ * both agree.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    defined(HAVE_CPUID_H) && (defined(__clang__) || __GNUC__ >= 5)
+#define	ARCHIVE_CPU_X86 1
+#endif
+
+/* x86 */
+#define	ARCHIVE_CPU_SSE2	0x0001
+#define	ARCHIVE_CPU_SSSE3	0x0002
+#define	ARCHIVE_CPU_SSE41	0x0004
+#define	ARCHIVE_CPU_PCLMUL	0x0008
+#define	ARCHIVE_CPU_AVX2	0x0010
+#define	ARCHIVE_CPU_SHA		0x0020	/* SHA-1 and SHA-256 */
+
+/* Probed once; cheap to call after that. */
+int	__archive_cpu_features(void);
+
+#endif
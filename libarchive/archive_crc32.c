@@ -0,0 +1,341 @@
+/*-
+ * Copyright (c) 2009 Joerg  Sonnenberger
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#ifdef HAVE_ZLIB_H
+#include <zlib.h>
+#endif
+
+#include "archive_cpu_private.h"
+
+/* Carry-less multiplication on x86. */
+#if defined(ARCHIVE_CPU_X86) && defined(HAVE_WMMINTRIN_H)
+#define	CRC32_PCLMUL
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#include "archive_crc32.h"
+
+/*
+ * Every implementation works on the CRC register itself, that is,
+ * with the pre- and post-conditioning (the inversions) left to
+ * __archive_crc32().
+ */
+typedef uint32_t (*crc32_func)(uint32_t, const unsigned char *, size_t);
+
+#define	CRC32_POLY	0xedb88320UL
+
+/*
+ * crc_tbl[0] is the classic byte-at-a-time table; crc_tbl[k][b] is
+ * the register after feeding byte b followed by k zero bytes.  That
+ * lets sixteen input bytes be handled with sixteen independent
+ * lookups instead of a chain of sixteen dependent ones.
+ */
+static uint32_t crc_tbl[16][256];
+
+/* x^(2^k) mod P(x), for crc32_combine. */
+static uint32_t x2n_tbl[32];
+
+static crc32_func crc32_best;
+
+static uint32_t	crc32_slice16(uint32_t, const unsigned char *, size_t);
+static uint32_t	multmodp(uint32_t, uint32_t);
+
+static uint32_t
+le32(const unsigned char *p)
+{
+	return ((uint32_t)p[0] | ((uint32_t)p[1] << 8) |
+	    ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+static uint32_t
+crc32_slice16(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uint32_t a, b, c, d;
+
+	for (; len >= 16; len -= 16, p += 16) {
+		a = crc ^ le32(p);
+		b = le32(p + 4);
+		c = le32(p + 8);
+		d = le32(p + 12);
+		crc = crc_tbl[15][a & 0xff] ^ crc_tbl[14][(a >> 8) & 0xff] ^
+		    crc_tbl[13][(a >> 16) & 0xff] ^ crc_tbl[12][a >> 24] ^
+		    crc_tbl[11][b & 0xff] ^ crc_tbl[10][(b >> 8) & 0xff] ^
+		    crc_tbl[9][(b >> 16) & 0xff] ^ crc_tbl[8][b >> 24] ^
+		    crc_tbl[7][c & 0xff] ^ crc_tbl[6][(c >> 8) & 0xff] ^
+		    crc_tbl[5][(c >> 16) & 0xff] ^ crc_tbl[4][c >> 24] ^
+		    crc_tbl[3][d & 0xff] ^ crc_tbl[2][(d >> 8) & 0xff] ^
+		    crc_tbl[1][(d >> 16) & 0xff] ^ crc_tbl[0][d >> 24];
+	}
+	while (len--)
+		crc = crc_tbl[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+	return (crc);
+}
+
+#ifdef CRC32_PCLMUL
+/*
+ * Fold the input four 128-bit lanes at a time with carry-less
+ * multiplication, then reduce to 32 bits with Barrett reduction.  See
+ * "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ
+ * Instruction" (Gopal et al., Intel, 2009); the constants are the
+ * bit-reflected ones for the zlib polynomial given there.
+ *
+ * Handles a multiple of 16 bytes, at least 64.
+ */
+__attribute__((target("sse2,pclmul")))
+static uint32_t
+crc32_pclmul_fold(uint32_t crc, const unsigned char *p, size_t len)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596LL, 0x0154442bd4LL);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009eLL, 0x01751997d0LL);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124LL);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641LL, 0x01db710641LL);
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(p + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(p + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(p + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(p + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	p += 64;
+	len -= 64;
+
+	/* Four lanes in parallel. */
+	for (; len >= 64; len -= 64, p += 64) {
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+		    _mm_loadu_si128((const __m128i *)(p + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+		    _mm_loadu_si128((const __m128i *)(p + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+		    _mm_loadu_si128((const __m128i *)(p + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+		    _mm_loadu_si128((const __m128i *)(p + 0x30)));
+	}
+
+	/* Fold the four lanes into one. */
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	/* Then any remaining 16-byte blocks. */
+	for (; len >= 16; len -= 16, p += 16) {
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1,
+		    _mm_loadu_si128((const __m128i *)p)), x5);
+	}
+
+	/* 128 bits down to 64. */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	/* Barrett reduction to 32 bits. */
+	x2 = _mm_and_si128(x1, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask32);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	return ((uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(x1, 4)));
+}
+
+static uint32_t
+crc32_pclmul(uint32_t crc, const unsigned char *p, size_t len)
+{
+	size_t n;
+
+	if (len >= 64) {
+		n = len & ~(size_t)15;
+		crc = crc32_pclmul_fold(crc, p, n);
+		p += n;
+		len -= n;
+	}
+	return (crc32_slice16(crc, p, len));
+}
+
+#endif /* CRC32_PCLMUL */
+
+#ifdef HAVE_ZLIB_H
+/* zlib's crc32() beats slice-by-16 where we have no kernel of our own. */
+static uint32_t
+crc32_zlib(uint32_t crc, const unsigned char *p, size_t len)
+{
+	uLong c = crc ^ 0xffffffffUL;
+	uInt n;
+
+	while (len > 0) {
+		n = len > 0x40000000 ? 0x40000000 : (uInt)len;
+		c = crc32(c, p, n);
+		p += n;
+		len -= n;
+	}
+	return ((uint32_t)c ^ 0xffffffffUL);
+}
+#endif
+
+static void
+crc32_init(void)
+{
+	uint32_t crc, p;
+	int b, i, k;
+
+	for (b = 0; b < 256; ++b) {
+		crc = b;
+		for (i = 8; i > 0; --i) {
+			if (crc & 1)
+				crc = (crc >> 1) ^ CRC32_POLY;
+			else
+				crc = (crc >> 1);
+		}
+		crc_tbl[0][b] = crc;
+	}
+	for (b = 0; b < 256; ++b) {
+		crc = crc_tbl[0][b];
+		for (k = 1; k < 16; k++) {
+			crc = crc_tbl[0][crc & 0xff] ^ (crc >> 8);
+			crc_tbl[k][b] = crc;
+		}
+	}
+
+	/* In this bit order, x^1 is bit 30. */
+	p = (uint32_t)1 << 30;
+	x2n_tbl[0] = p;
+	for (k = 1; k < 32; k++)
+		x2n_tbl[k] = p = multmodp(p, p);
+
+#ifdef HAVE_ZLIB_H
+	crc32_best = crc32_zlib;
+#else
+	crc32_best = crc32_slice16;
+#endif
+#ifdef CRC32_PCLMUL
+	if ((__archive_cpu_features() &
+	    (ARCHIVE_CPU_SSE2 | ARCHIVE_CPU_PCLMUL)) ==
+	    (ARCHIVE_CPU_SSE2 | ARCHIVE_CPU_PCLMUL))
+		crc32_best = crc32_pclmul;
+#endif
+}
+
+#ifdef HAVE_PTHREAD_H
+static pthread_once_t crc32_once = PTHREAD_ONCE_INIT;
+#define	CRC32_SETUP()	pthread_once(&crc32_once, crc32_init)
+#else
+static volatile int crc32_inited;
+#define	CRC32_SETUP()	do {			\
+	if (!crc32_inited) {			\
+		crc32_init();			\
+		crc32_inited = 1;		\
+	}					\
+} while (0)
+#endif
+
+unsigned long
+__archive_crc32(unsigned long crc, const void *p, size_t len)
+{
+	if (p == NULL)
+		return (0);
+	CRC32_SETUP();
+	return ((*crc32_best)((uint32_t)crc ^ 0xffffffffUL, p, len)
+	    ^ 0xffffffffUL);
+}
+
+unsigned long
+__archive_crc32_portable(unsigned long crc, const void *p, size_t len)
+{
+	if (p == NULL)
+		return (0);
+	CRC32_SETUP();
+	return (crc32_slice16((uint32_t)crc ^ 0xffffffffUL, p, len)
+	    ^ 0xffffffffUL);
+}
+
+/*
+ * Multiply a and b modulo P(x); both are polynomials in the reflected
+ * bit order the CRC register uses.
+ */
+static uint32_t
+multmodp(uint32_t a, uint32_t b)
+{
+	uint32_t m, p;
+
+	m = (uint32_t)1 << 31;
+	p = 0;
+	for (;;) {
+		if (a & m) {
+			p ^= b;
+			if ((a & (m - 1)) == 0)
+				break;
+		}
+		m >>= 1;
+		b = (b & 1) ? (b >> 1) ^ CRC32_POLY : b >> 1;
+	}
+	return (p);
+}
+
+/*
+ * Appending len2 bytes multiplies the first CRC by x^(8 * len2); the
+ * factor is assembled from powers x^(2^k) in O(log len2) steps.
+ */
+unsigned long
+__archive_crc32_combine(unsigned long crc1, unsigned long crc2, int64_t len2)
+{
+	uint32_t p;
+	uint64_t n;
+	int k;
+
+	if (len2 <= 0)
+		return (crc1);
+	CRC32_SETUP();
+	p = (uint32_t)1 << 31;		/* x^0 */
+	for (n = (uint64_t)len2, k = 3; n != 0; n >>= 1, k++) {
+		if (n & 1)
+			p = multmodp(x2n_tbl[k & 31], p);
+	}
+	return (multmodp(p, (uint32_t)crc1) ^ ((uint32_t)crc2));
+}
@@ -29,50 +29,34 @@
 #error This header is only to be used internally to libarchive.
 #endif
 
+#ifndef ARCHIVE_CRC32_H_INCLUDED
+#define ARCHIVE_CRC32_H_INCLUDED
+
+/*
+ * CRC-32 as used by zip, gzip, 7-Zip and RAR; the same function as
+ * crc32() and crc32_combine() from zlib, so existing values and the
+ * crc32(0, NULL, 0) idiom carry over unchanged.
+ *
+ * __archive_crc32() picks the fastest implementation this CPU
+ * supports the first time it is called: carry-less multiplication
+ * (PCLMULQDQ) on x86, and otherwise zlib's crc32() or, without zlib,
+ * a slice-by-16 table lookup that runs several times faster than the
+ * classic byte-at-a-time loop.
+ */
+unsigned long	__archive_crc32(unsigned long crc, const void *, size_t);
+
 /*
- * When zlib is unavailable, we should still be able to validate
- * uncompressed zip archives.  That requires us to be able to compute
- * the CRC32 check value.  This is a drop-in compatible replacement
- * for crc32() from zlib.  It's slower than the zlib implementation,
- * but still pretty fast: This runs about 300MB/s on my 3GHz P4
- * compared to about 800MB/s for the zlib implementation.
+ * CRC of the concatenation of two blocks, given the CRC of each and
+ * the length of the second.  Lets blocks be checked in parallel.
  */
-static unsigned long
-crc32(unsigned long crc, const void *_p, size_t len)
-{
-	unsigned long crc2, b, i;
-	const unsigned char *p = _p;
-	static volatile int crc_tbl_inited = 0;
-	static unsigned long crc_tbl[256];
+unsigned long	__archive_crc32_combine(unsigned long crc1,
+		    unsigned long crc2, int64_t len2);
 
-	if (!crc_tbl_inited) {
-		for (b = 0; b < 256; ++b) {
-			crc2 = b;
-			for (i = 8; i > 0; --i) {
-				if (crc2 & 1)
-					crc2 = (crc2 >> 1) ^ 0xedb88320UL;
-				else    
-					crc2 = (crc2 >> 1);
-			}
-			crc_tbl[b] = crc2;
-		}
-		crc_tbl_inited = 1;
-	}
+/*
+ * The portable table implementation alone, for tests and benchmarks
+ * that want to compare it with the accelerated one.
+ */
+unsigned long	__archive_crc32_portable(unsigned long crc, const void *,
+		    size_t);
 
-	crc = crc ^ 0xffffffffUL;
-	/* A use of this loop is about 20% - 30% faster than
-	 * no use version in any optimization option of gcc.  */
-	for (;len >= 8; len -= 8) {
-		crc = crc_tbl[(crc ^ *p++) & 0xff] ^ (crc >> 8);
-		crc = crc_tbl[(crc ^ *p++) & 0xff] ^ (crc >> 8);
-		crc = crc_tbl[(crc ^ *p++) & 0xff] ^ (crc >> 8);
-		crc = crc_tbl[(crc ^ *p++) & 0xff] ^ (crc >> 8);
-		crc = crc_tbl[(crc ^ *p++) & 0xff] ^ (crc >> 8);
-		crc = crc_tbl[(crc ^ *p++) & 0xff] ^ (crc >> 8);
-		crc = crc_tbl[(crc ^ *p++) & 0xff] ^ (crc >> 8);
-		crc = crc_tbl[(crc ^ *p++) & 0xff] ^ (crc >> 8);
-	}
-	while (len--)
-		crc = crc_tbl[(crc ^ *p++) & 0xff] ^ (crc >> 8);
-	return (crc ^ 0xffffffffUL);
-}
+#endif
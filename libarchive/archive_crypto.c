@@ -252,7 +252,7 @@ __archive_windowsapi_md5final(archive_md5_ctx *ctx, void *md)
   return (win_crypto_Final(md, 16, ctx));
 }
 
-#else
+#elif !defined(ARCHIVE_CRYPTO_MD5_BUILTIN)
 
 static int
 __archive_stub_md5init(archive_md5_ctx *ctx)
@@ -378,7 +378,7 @@ __archive_openssl_ripemd160final(archive_rmd160_ctx *ctx, void *md)
   return (ARCHIVE_OK);
 }
 
-#else
+#elif !defined(ARCHIVE_CRYPTO_RMD160_BUILTIN)
 
 static int
 __archive_stub_ripemd160init(archive_rmd160_ctx *ctx)
@@ -554,7 +554,7 @@ __archive_windowsapi_sha1final(archive_sha1_ctx *ctx, void *md)
   return (win_crypto_Final(md, 20, ctx));
 }
 
-#else
+#elif !defined(ARCHIVE_CRYPTO_SHA1_BUILTIN)
 
 static int
 __archive_stub_sha1init(archive_sha1_ctx *ctx)
@@ -773,7 +773,7 @@ __archive_windowsapi_sha256final(archive_sha256_ctx *ctx, void *md)
   return (win_crypto_Final(md, 32, ctx));
 }
 
-#else
+#elif !defined(ARCHIVE_CRYPTO_SHA256_BUILTIN)
 
 static int
 __archive_stub_sha256init(archive_sha256_ctx *ctx)
@@ -968,7 +968,7 @@ __archive_windowsapi_sha384final(archive_sha384_ctx *ctx, void *md)
   return (win_crypto_Final(md, 48, ctx));
 }
 
-#else
+#elif !defined(ARCHIVE_CRYPTO_SHA384_BUILTIN)
 
 static int
 __archive_stub_sha384init(archive_sha384_ctx *ctx)
@@ -1187,7 +1187,7 @@ __archive_windowsapi_sha512final(archive_sha512_ctx *ctx, void *md)
   return (win_crypto_Final(md, 64, ctx));
 }
 
-#else
+#elif !defined(ARCHIVE_CRYPTO_SHA512_BUILTIN)
 
 static int
 __archive_stub_sha512init(archive_sha512_ctx *ctx)
@@ -1224,6 +1224,7 @@ __archive_stub_sha512final(archive_sha512_ctx *ctx, void *md)
  * 4. libSystem
  * 5. OpenSSL
  * 6. Windows API
+ * 7. Built-in (archive_crypto_builtin.c)
  */
 const struct archive_crypto __archive_crypto =
 {
@@ -1252,6 +1253,10 @@ const struct archive_crypto __archive_crypto =
   &__archive_windowsapi_md5init,
   &__archive_windowsapi_md5update,
   &__archive_windowsapi_md5final,
+#elif defined(ARCHIVE_CRYPTO_MD5_BUILTIN)
+  &__archive_builtin_md5init,
+  &__archive_builtin_md5update,
+  &__archive_builtin_md5final,
 #elif !defined(ARCHIVE_MD5_COMPILE_TEST)
   &__archive_stub_md5init,
   &__archive_stub_md5update,
@@ -1275,6 +1280,10 @@ const struct archive_crypto __archive_crypto =
   &__archive_openssl_ripemd160init,
   &__archive_openssl_ripemd160update,
   &__archive_openssl_ripemd160final,
+#elif defined(ARCHIVE_CRYPTO_RMD160_BUILTIN)
+  &__archive_builtin_ripemd160init,
+  &__archive_builtin_ripemd160update,
+  &__archive_builtin_ripemd160final,
 #elif !defined(ARCHIVE_RMD160_COMPILE_TEST)
   &__archive_stub_ripemd160init,
   &__archive_stub_ripemd160update,
@@ -1306,6 +1315,10 @@ const struct archive_crypto __archive_crypto =
   &__archive_windowsapi_sha1init,
   &__archive_windowsapi_sha1update,
   &__archive_windowsapi_sha1final,
+#elif defined(ARCHIVE_CRYPTO_SHA1_BUILTIN)
+  &__archive_builtin_sha1init,
+  &__archive_builtin_sha1update,
+  &__archive_builtin_sha1final,
 #elif !defined(ARCHIVE_SHA1_COMPILE_TEST)
   &__archive_stub_sha1init,
   &__archive_stub_sha1update,
@@ -1345,6 +1358,10 @@ const struct archive_crypto __archive_crypto =
   &__archive_windowsapi_sha256init,
   &__archive_windowsapi_sha256update,
   &__archive_windowsapi_sha256final,
+#elif defined(ARCHIVE_CRYPTO_SHA256_BUILTIN)
+  &__archive_builtin_sha256init,
+  &__archive_builtin_sha256update,
+  &__archive_builtin_sha256final,
 #elif !defined(ARCHIVE_SHA256_COMPILE_TEST)
   &__archive_stub_sha256init,
   &__archive_stub_sha256update,
@@ -1380,6 +1397,10 @@ const struct archive_crypto __archive_crypto =
   &__archive_windowsapi_sha384init,
   &__archive_windowsapi_sha384update,
   &__archive_windowsapi_sha384final,
+#elif defined(ARCHIVE_CRYPTO_SHA384_BUILTIN)
+  &__archive_builtin_sha384init,
+  &__archive_builtin_sha384update,
+  &__archive_builtin_sha384final,
 #elif !defined(ARCHIVE_SHA384_COMPILE_TEST)
   &__archive_stub_sha384init,
   &__archive_stub_sha384update,
@@ -1419,6 +1440,10 @@ const struct archive_crypto __archive_crypto =
   &__archive_windowsapi_sha512init,
   &__archive_windowsapi_sha512update,
   &__archive_windowsapi_sha512final
+#elif defined(ARCHIVE_CRYPTO_SHA512_BUILTIN)
+  &__archive_builtin_sha512init,
+  &__archive_builtin_sha512update,
+  &__archive_builtin_sha512final,
 #elif !defined(ARCHIVE_SHA512_COMPILE_TEST)
   &__archive_stub_sha512init,
   &__archive_stub_sha512update,
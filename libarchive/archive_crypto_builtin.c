@@ -0,0 +1,1162 @@
+/*-
+ * Copyright (c) 2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "archive.h"
+#include "archive_crypto_private.h"
+#include "archive_cpu_private.h"
+#include "archive_endian.h"
+
+/*
+ * Message digests for builds that found no crypto library to use.
+ * archive_crypto_private.h selects these per algorithm, so a system
+ * that has, say, MD5 and SHA-1 in libc but no SHA-2 gets only the
+ * latter from here.
+ *
+ * Everything is written for the compiler to do well with: the rounds
+ * are unrolled with macros, and the block functions take any number
+ * of whole blocks so that large updates don't go through the buffer.
+ * SHA-1 and SHA-256 also have kernels for the x86 SHA extensions,
+ * picked at run time when each context is initialized.
+ */
+
+#if defined(ARCHIVE_CRYPTO_SHA1_BUILTIN) || \
+    defined(ARCHIVE_CRYPTO_SHA256_BUILTIN)
+#if defined(ARCHIVE_CPU_X86)
+#define	DIGEST_SHANI
+#include <immintrin.h>
+#endif
+#endif
+
+#define	ROTL32(x, n)	(((x) << (n)) | ((x) >> (32 - (n))))
+#define	ROTR32(x, n)	(((x) >> (n)) | ((x) << (32 - (n))))
+#define	ROTR64(x, n)	(((x) >> (n)) | ((x) << (64 - (n))))
+
+#if defined(ARCHIVE_CRYPTO_MD5_BUILTIN) || \
+    defined(ARCHIVE_CRYPTO_RMD160_BUILTIN) || \
+    defined(ARCHIVE_CRYPTO_SHA1_BUILTIN) || \
+    defined(ARCHIVE_CRYPTO_SHA256_BUILTIN)
+/*
+ * Buffering shared by the algorithms with 64-byte blocks.  The 64-bit
+ * message length goes at the end of the padding, little-endian for
+ * MD5 and RIPEMD-160 and big-endian for the SHAs.
+ */
+static void
+update32(struct archive_builtin_ctx32 *ctx, const void *data, size_t n)
+{
+	const unsigned char *p = data;
+	size_t used = (size_t)(ctx->len & 63), take;
+
+	ctx->len += n;
+	if (used > 0) {
+		take = 64 - used;
+		if (take > n)
+			take = n;
+		memcpy(ctx->buf + used, p, take);
+		p += take;
+		n -= take;
+		if (used + take < 64)
+			return;
+		(*ctx->blocks)(ctx->h, ctx->buf, 1);
+	}
+	if (n >= 64) {
+		(*ctx->blocks)(ctx->h, p, n / 64);
+		p += n & ~(size_t)63;
+		n &= 63;
+	}
+	if (n > 0)
+		memcpy(ctx->buf, p, n);
+}
+
+static int
+final32(struct archive_builtin_ctx32 *ctx, void *md, int words,
+    int big_endian)
+{
+	unsigned char pad[72], *out = md;
+	uint64_t bits;
+	size_t padlen;
+	int i;
+
+	/* Finalizing a context that was never initialized (the xar
+	 * writer does this) is a no-op, as with OpenSSL. */
+	if (ctx->blocks == NULL)
+		return (ARCHIVE_OK);
+	bits = ctx->len << 3;
+	padlen = (ctx->len & 63) < 56 ? 56 - (size_t)(ctx->len & 63)
+	    : 120 - (size_t)(ctx->len & 63);
+	memset(pad, 0, sizeof(pad));
+	pad[0] = 0x80;
+	if (big_endian)
+		archive_be64enc(pad + padlen, bits);
+	else
+		archive_le64enc(pad + padlen, bits);
+	update32(ctx, pad, padlen + 8);
+	if (out != NULL) {
+		for (i = 0; i < words; i++) {
+			if (big_endian)
+				archive_be32enc(out + 4 * i, ctx->h[i]);
+			else
+				archive_le32enc(out + 4 * i, ctx->h[i]);
+		}
+	}
+	memset(ctx, 0, sizeof(*ctx));
+	return (ARCHIVE_OK);
+}
+#endif
+
+#if defined(ARCHIVE_CRYPTO_MD5_BUILTIN)
+
+/* MD5, RFC 1321. */
+
+#define	MD5_F(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define	MD5_G(x, y, z)	((y) ^ ((z) & ((x) ^ (y))))
+#define	MD5_H(x, y, z)	((x) ^ (y) ^ (z))
+#define	MD5_I(x, y, z)	((y) ^ ((x) | ~(z)))
+#define	MD5_STEP(f, a, b, c, d, x, t, s) do {				\
+	(a) += f((b), (c), (d)) + (x) + (uint32_t)(t);			\
+	(a) = ROTL32((a), (s)) + (b);					\
+} while (0)
+
+static void
+md5_blocks(uint32_t *h, const unsigned char *p, size_t n)
+{
+	uint32_t a, b, c, d, x[16];
+	int i;
+
+	for (; n > 0; n--, p += 64) {
+		for (i = 0; i < 16; i++)
+			x[i] = archive_le32dec(p + 4 * i);
+		a = h[0]; b = h[1]; c = h[2]; d = h[3];
+
+		MD5_STEP(MD5_F, a, b, c, d, x[ 0], 0xd76aa478,  7);
+		MD5_STEP(MD5_F, d, a, b, c, x[ 1], 0xe8c7b756, 12);
+		MD5_STEP(MD5_F, c, d, a, b, x[ 2], 0x242070db, 17);
+		MD5_STEP(MD5_F, b, c, d, a, x[ 3], 0xc1bdceee, 22);
+		MD5_STEP(MD5_F, a, b, c, d, x[ 4], 0xf57c0faf,  7);
+		MD5_STEP(MD5_F, d, a, b, c, x[ 5], 0x4787c62a, 12);
+		MD5_STEP(MD5_F, c, d, a, b, x[ 6], 0xa8304613, 17);
+		MD5_STEP(MD5_F, b, c, d, a, x[ 7], 0xfd469501, 22);
+		MD5_STEP(MD5_F, a, b, c, d, x[ 8], 0x698098d8,  7);
+		MD5_STEP(MD5_F, d, a, b, c, x[ 9], 0x8b44f7af, 12);
+		MD5_STEP(MD5_F, c, d, a, b, x[10], 0xffff5bb1, 17);
+		MD5_STEP(MD5_F, b, c, d, a, x[11], 0x895cd7be, 22);
+		MD5_STEP(MD5_F, a, b, c, d, x[12], 0x6b901122,  7);
+		MD5_STEP(MD5_F, d, a, b, c, x[13], 0xfd987193, 12);
+		MD5_STEP(MD5_F, c, d, a, b, x[14], 0xa679438e, 17);
+		MD5_STEP(MD5_F, b, c, d, a, x[15], 0x49b40821, 22);
+
+		MD5_STEP(MD5_G, a, b, c, d, x[ 1], 0xf61e2562,  5);
+		MD5_STEP(MD5_G, d, a, b, c, x[ 6], 0xc040b340,  9);
+		MD5_STEP(MD5_G, c, d, a, b, x[11], 0x265e5a51, 14);
+		MD5_STEP(MD5_G, b, c, d, a, x[ 0], 0xe9b6c7aa, 20);
+		MD5_STEP(MD5_G, a, b, c, d, x[ 5], 0xd62f105d,  5);
+		MD5_STEP(MD5_G, d, a, b, c, x[10], 0x02441453,  9);
+		MD5_STEP(MD5_G, c, d, a, b, x[15], 0xd8a1e681, 14);
+		MD5_STEP(MD5_G, b, c, d, a, x[ 4], 0xe7d3fbc8, 20);
+		MD5_STEP(MD5_G, a, b, c, d, x[ 9], 0x21e1cde6,  5);
+		MD5_STEP(MD5_G, d, a, b, c, x[14], 0xc33707d6,  9);
+		MD5_STEP(MD5_G, c, d, a, b, x[ 3], 0xf4d50d87, 14);
+		MD5_STEP(MD5_G, b, c, d, a, x[ 8], 0x455a14ed, 20);
+		MD5_STEP(MD5_G, a, b, c, d, x[13], 0xa9e3e905,  5);
+		MD5_STEP(MD5_G, d, a, b, c, x[ 2], 0xfcefa3f8,  9);
+		MD5_STEP(MD5_G, c, d, a, b, x[ 7], 0x676f02d9, 14);
+		MD5_STEP(MD5_G, b, c, d, a, x[12], 0x8d2a4c8a, 20);
+
+		MD5_STEP(MD5_H, a, b, c, d, x[ 5], 0xfffa3942,  4);
+		MD5_STEP(MD5_H, d, a, b, c, x[ 8], 0x8771f681, 11);
+		MD5_STEP(MD5_H, c, d, a, b, x[11], 0x6d9d6122, 16);
+		MD5_STEP(MD5_H, b, c, d, a, x[14], 0xfde5380c, 23);
+		MD5_STEP(MD5_H, a, b, c, d, x[ 1], 0xa4beea44,  4);
+		MD5_STEP(MD5_H, d, a, b, c, x[ 4], 0x4bdecfa9, 11);
+		MD5_STEP(MD5_H, c, d, a, b, x[ 7], 0xf6bb4b60, 16);
+		MD5_STEP(MD5_H, b, c, d, a, x[10], 0xbebfbc70, 23);
+		MD5_STEP(MD5_H, a, b, c, d, x[13], 0x289b7ec6,  4);
+		MD5_STEP(MD5_H, d, a, b, c, x[ 0], 0xeaa127fa, 11);
+		MD5_STEP(MD5_H, c, d, a, b, x[ 3], 0xd4ef3085, 16);
+		MD5_STEP(MD5_H, b, c, d, a, x[ 6], 0x04881d05, 23);
+		MD5_STEP(MD5_H, a, b, c, d, x[ 9], 0xd9d4d039,  4);
+		MD5_STEP(MD5_H, d, a, b, c, x[12], 0xe6db99e5, 11);
+		MD5_STEP(MD5_H, c, d, a, b, x[15], 0x1fa27cf8, 16);
+		MD5_STEP(MD5_H, b, c, d, a, x[ 2], 0xc4ac5665, 23);
+
+		MD5_STEP(MD5_I, a, b, c, d, x[ 0], 0xf4292244,  6);
+		MD5_STEP(MD5_I, d, a, b, c, x[ 7], 0x432aff97, 10);
+		MD5_STEP(MD5_I, c, d, a, b, x[14], 0xab9423a7, 15);
+		MD5_STEP(MD5_I, b, c, d, a, x[ 5], 0xfc93a039, 21);
+		MD5_STEP(MD5_I, a, b, c, d, x[12], 0x655b59c3,  6);
+		MD5_STEP(MD5_I, d, a, b, c, x[ 3], 0x8f0ccc92, 10);
+		MD5_STEP(MD5_I, c, d, a, b, x[10], 0xffeff47d, 15);
+		MD5_STEP(MD5_I, b, c, d, a, x[ 1], 0x85845dd1, 21);
+		MD5_STEP(MD5_I, a, b, c, d, x[ 8], 0x6fa87e4f,  6);
+		MD5_STEP(MD5_I, d, a, b, c, x[15], 0xfe2ce6e0, 10);
+		MD5_STEP(MD5_I, c, d, a, b, x[ 6], 0xa3014314, 15);
+		MD5_STEP(MD5_I, b, c, d, a, x[13], 0x4e0811a1, 21);
+		MD5_STEP(MD5_I, a, b, c, d, x[ 4], 0xf7537e82,  6);
+		MD5_STEP(MD5_I, d, a, b, c, x[11], 0xbd3af235, 10);
+		MD5_STEP(MD5_I, c, d, a, b, x[ 2], 0x2ad7d2bb, 15);
+		MD5_STEP(MD5_I, b, c, d, a, x[ 9], 0xeb86d391, 21);
+
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+	}
+}
+
+int
+__archive_builtin_md5init(archive_md5_ctx *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->h[0] = 0x67452301;
+	ctx->h[1] = 0xefcdab89;
+	ctx->h[2] = 0x98badcfe;
+	ctx->h[3] = 0x10325476;
+	ctx->blocks = md5_blocks;
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_builtin_md5update(archive_md5_ctx *ctx, const void *indata,
+    size_t insize)
+{
+	update32(ctx, indata, insize);
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_builtin_md5final(archive_md5_ctx *ctx, void *md)
+{
+	return (final32(ctx, md, 4, 0));
+}
+
+#endif /* ARCHIVE_CRYPTO_MD5_BUILTIN */
+
+#if defined(ARCHIVE_CRYPTO_RMD160_BUILTIN)
+
+/* RIPEMD-160, Dobbertin, Bosselaers and Preneel, 1996. */
+
+static const unsigned char rmd_r[2][80] = {
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	  7, 4, 13, 1, 10, 6, 15, 3, 12, 0, 9, 5, 2, 14, 11, 8,
+	  3, 10, 14, 4, 9, 15, 8, 1, 2, 7, 0, 6, 13, 11, 5, 12,
+	  1, 9, 11, 10, 0, 8, 12, 4, 13, 3, 7, 15, 14, 5, 6, 2,
+	  4, 0, 5, 9, 7, 12, 2, 10, 14, 1, 3, 8, 11, 6, 15, 13 },
+	{ 5, 14, 7, 0, 9, 2, 11, 4, 13, 6, 15, 8, 1, 10, 3, 12,
+	  6, 11, 3, 7, 0, 13, 5, 10, 14, 15, 8, 12, 4, 9, 1, 2,
+	  15, 5, 1, 3, 7, 14, 6, 9, 11, 8, 12, 2, 10, 0, 4, 13,
+	  8, 6, 4, 1, 3, 11, 15, 0, 5, 12, 2, 13, 9, 7, 10, 14,
+	  12, 15, 10, 4, 1, 5, 8, 7, 6, 2, 13, 14, 0, 3, 9, 11 }
+};
+static const unsigned char rmd_s[2][80] = {
+	{ 11, 14, 15, 12, 5, 8, 7, 9, 11, 13, 14, 15, 6, 7, 9, 8,
+	  7, 6, 8, 13, 11, 9, 7, 15, 7, 12, 15, 9, 11, 7, 13, 12,
+	  11, 13, 6, 7, 14, 9, 13, 15, 14, 8, 13, 6, 5, 12, 7, 5,
+	  11, 12, 14, 15, 14, 15, 9, 8, 9, 14, 5, 6, 8, 6, 5, 12,
+	  9, 15, 5, 11, 6, 8, 13, 12, 5, 12, 13, 14, 11, 8, 5, 6 },
+	{ 8, 9, 9, 11, 13, 15, 15, 5, 7, 7, 8, 11, 14, 14, 12, 6,
+	  9, 13, 15, 7, 12, 8, 9, 11, 7, 7, 12, 7, 6, 15, 13, 11,
+	  9, 7, 15, 11, 8, 6, 6, 14, 12, 13, 5, 14, 13, 13, 7, 5,
+	  15, 5, 8, 11, 14, 14, 6, 14, 6, 9, 12, 9, 12, 5, 15, 8,
+	  8, 5, 12, 9, 12, 5, 14, 6, 8, 13, 6, 5, 15, 13, 11, 11 }
+};
+static const uint32_t rmd_k[2][5] = {
+	{ 0x00000000, 0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xa953fd4e },
+	{ 0x50a28be6, 0x5c4dd124, 0x6d703ef3, 0x7a6d76e9, 0x00000000 }
+};
+
+#define	RMD_F1(x, y, z)	((x) ^ (y) ^ (z))
+#define	RMD_F2(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define	RMD_F3(x, y, z)	(((x) | ~(y)) ^ (z))
+#define	RMD_F4(x, y, z)	((y) ^ ((z) & ((x) ^ (y))))
+#define	RMD_F5(x, y, z)	((x) ^ ((y) | ~(z)))
+
+/*
+ * Sixteen steps of one line: "side" is 0 for the left line and 1 for
+ * the right, which applies the functions in the opposite order.
+ */
+#define	RMD_ROUND(f, side, round, a, b, c, d, e) do {			\
+	uint32_t t_;							\
+	int j_;								\
+	for (j_ = (round) * 16; j_ < (round) * 16 + 16; j_++) {		\
+		t_ = ROTL32(a + f(b, c, d) + x[rmd_r[side][j_]] +	\
+		    rmd_k[side][round], rmd_s[side][j_]) + e;		\
+		a = e; e = d; d = ROTL32(c, 10); c = b; b = t_;		\
+	}								\
+} while (0)
+
+static void
+rmd160_blocks(uint32_t *h, const unsigned char *p, size_t n)
+{
+	uint32_t al, bl, cl, dl, el, ar, br, cr, dr, er, t, x[16];
+	int i;
+
+	for (; n > 0; n--, p += 64) {
+		for (i = 0; i < 16; i++)
+			x[i] = archive_le32dec(p + 4 * i);
+		al = ar = h[0]; bl = br = h[1]; cl = cr = h[2];
+		dl = dr = h[3]; el = er = h[4];
+
+		RMD_ROUND(RMD_F1, 0, 0, al, bl, cl, dl, el);
+		RMD_ROUND(RMD_F2, 0, 1, al, bl, cl, dl, el);
+		RMD_ROUND(RMD_F3, 0, 2, al, bl, cl, dl, el);
+		RMD_ROUND(RMD_F4, 0, 3, al, bl, cl, dl, el);
+		RMD_ROUND(RMD_F5, 0, 4, al, bl, cl, dl, el);
+		RMD_ROUND(RMD_F5, 1, 0, ar, br, cr, dr, er);
+		RMD_ROUND(RMD_F4, 1, 1, ar, br, cr, dr, er);
+		RMD_ROUND(RMD_F3, 1, 2, ar, br, cr, dr, er);
+		RMD_ROUND(RMD_F2, 1, 3, ar, br, cr, dr, er);
+		RMD_ROUND(RMD_F1, 1, 4, ar, br, cr, dr, er);
+
+		t = h[1] + cl + dr;
+		h[1] = h[2] + dl + er;
+		h[2] = h[3] + el + ar;
+		h[3] = h[4] + al + br;
+		h[4] = h[0] + bl + cr;
+		h[0] = t;
+	}
+}
+
+int
+__archive_builtin_ripemd160init(archive_rmd160_ctx *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->h[0] = 0x67452301;
+	ctx->h[1] = 0xefcdab89;
+	ctx->h[2] = 0x98badcfe;
+	ctx->h[3] = 0x10325476;
+	ctx->h[4] = 0xc3d2e1f0;
+	ctx->blocks = rmd160_blocks;
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_builtin_ripemd160update(archive_rmd160_ctx *ctx,
+    const void *indata, size_t insize)
+{
+	update32(ctx, indata, insize);
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_builtin_ripemd160final(archive_rmd160_ctx *ctx, void *md)
+{
+	return (final32(ctx, md, 5, 0));
+}
+
+#endif /* ARCHIVE_CRYPTO_RMD160_BUILTIN */
+
+#if defined(ARCHIVE_CRYPTO_SHA1_BUILTIN)
+
+/* SHA-1, FIPS 180-4. */
+
+static const uint32_t sha1_K[4] = {
+	0x5a827999, 0x6ed9eba1, 0x8f1bbcdc, 0xca62c1d6
+};
+
+#define	SHA1_F0(b, c, d)	((d) ^ ((b) & ((c) ^ (d))))
+#define	SHA1_F1(b, c, d)	((b) ^ (c) ^ (d))
+#define	SHA1_F2(b, c, d)	(((b) & (c)) | ((d) & ((b) | (c))))
+#define	SHA1_F3(b, c, d)	((b) ^ (c) ^ (d))
+/* The message schedule, kept in a 16-word ring. */
+#define	SHA1_W(i)	(w[(i) & 15] = ROTL32(w[((i) + 13) & 15] ^	\
+	w[((i) + 8) & 15] ^ w[((i) + 2) & 15] ^ w[(i) & 15], 1))
+#define	SHA1_STEP(f, k, a, b, c, d, e, x) do {				\
+	(e) += ROTL32((a), 5) + f((b), (c), (d)) + (k) + (x);		\
+	(b) = ROTL32((b), 30);						\
+} while (0)
+/* Five steps, rotating the roles instead of moving the values. */
+#define	SHA1_5(f, k, i, x) do {						\
+	SHA1_STEP(f, k, a, b, c, d, e, x(i));				\
+	SHA1_STEP(f, k, e, a, b, c, d, x((i) + 1));			\
+	SHA1_STEP(f, k, d, e, a, b, c, x((i) + 2));			\
+	SHA1_STEP(f, k, c, d, e, a, b, x((i) + 3));			\
+	SHA1_STEP(f, k, b, c, d, e, a, x((i) + 4));			\
+} while (0)
+/* The first sixteen words are the block itself. */
+#define	SHA1_XW(i)	((i) < 16 ? w[(i)] : SHA1_W(i))
+
+static void
+sha1_blocks(uint32_t *h, const unsigned char *p, size_t n)
+{
+	uint32_t a, b, c, d, e, w[16];
+	int i;
+
+	for (; n > 0; n--, p += 64) {
+		for (i = 0; i < 16; i++)
+			w[i] = archive_be32dec(p + 4 * i);
+		a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+
+		SHA1_5(SHA1_F0, sha1_K[0], 0, SHA1_XW);
+		SHA1_5(SHA1_F0, sha1_K[0], 5, SHA1_XW);
+		SHA1_5(SHA1_F0, sha1_K[0], 10, SHA1_XW);
+		SHA1_5(SHA1_F0, sha1_K[0], 15, SHA1_XW);
+		SHA1_5(SHA1_F1, sha1_K[1], 20, SHA1_W);
+		SHA1_5(SHA1_F1, sha1_K[1], 25, SHA1_W);
+		SHA1_5(SHA1_F1, sha1_K[1], 30, SHA1_W);
+		SHA1_5(SHA1_F1, sha1_K[1], 35, SHA1_W);
+		SHA1_5(SHA1_F2, sha1_K[2], 40, SHA1_W);
+		SHA1_5(SHA1_F2, sha1_K[2], 45, SHA1_W);
+		SHA1_5(SHA1_F2, sha1_K[2], 50, SHA1_W);
+		SHA1_5(SHA1_F2, sha1_K[2], 55, SHA1_W);
+		SHA1_5(SHA1_F3, sha1_K[3], 60, SHA1_W);
+		SHA1_5(SHA1_F3, sha1_K[3], 65, SHA1_W);
+		SHA1_5(SHA1_F3, sha1_K[3], 70, SHA1_W);
+		SHA1_5(SHA1_F3, sha1_K[3], 75, SHA1_W);
+
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+	}
+}
+
+#ifdef DIGEST_SHANI
+__attribute__((target("sse2,ssse3,sse4.1,sha")))
+static void
+sha1_blocks_shani(uint32_t *h, const unsigned char *p, size_t n)
+{
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL,
+	    0x08090a0b0c0d0e0fULL);
+	__m128i abcd, abcd_save, e0, e0_save, e1;
+	__m128i W0, W1, W2, W3;
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)h), 0x1b);
+	e0 = _mm_set_epi32((int)h[4], 0, 0, 0);
+	for (; n > 0; n--, p += 64) {
+		abcd_save = abcd;
+		e0_save = e0;
+
+		/* Rounds 0-3 */
+		W0 = _mm_shuffle_epi8(_mm_loadu_si128(
+		    (const __m128i *)(p + 0)), mask);
+		e0 = _mm_add_epi32(e0, W0);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		/* Rounds 4-7 */
+		W1 = _mm_shuffle_epi8(_mm_loadu_si128(
+		    (const __m128i *)(p + 16)), mask);
+		e1 = _mm_sha1nexte_epu32(e1, W1);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		W0 = _mm_sha1msg1_epu32(W0, W1);
+		/* Rounds 8-11 */
+		W2 = _mm_shuffle_epi8(_mm_loadu_si128(
+		    (const __m128i *)(p + 32)), mask);
+		e0 = _mm_sha1nexte_epu32(e0, W2);
+		e1 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		W1 = _mm_sha1msg1_epu32(W1, W2);
+		W0 = _mm_xor_si128(W0, W2);
+		/* Rounds 12-15 */
+		W3 = _mm_shuffle_epi8(_mm_loadu_si128(
+		    (const __m128i *)(p + 48)), mask);
+		e1 = _mm_sha1nexte_epu32(e1, W3);
+		e0 = abcd;
+		W0 = _mm_sha1msg2_epu32(W0, W3);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 0);
+		W2 = _mm_sha1msg1_epu32(W2, W3);
+		W1 = _mm_xor_si128(W1, W3);
+		/* Rounds 16-19 */
+		e0 = _mm_sha1nexte_epu32(e0, W0);
+		e1 = abcd;
+		W1 = _mm_sha1msg2_epu32(W1, W0);
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 0);
+		W3 = _mm_sha1msg1_epu32(W3, W0);
+		W2 = _mm_xor_si128(W2, W0);
+		/* Rounds 20-23 */
+		e1 = _mm_sha1nexte_epu32(e1, W1);
+		e0 = abcd;
+		W2 = _mm_sha1msg2_epu32(W2, W1);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+		W0 = _mm_sha1msg1_epu32(W0, W1);
+		W3 = _mm_xor_si128(W3, W1);
+		/* Rounds 24-27 */
+		e0 = _mm_sha1nexte_epu32(e0, W2);
+		e1 = abcd;
+		W3 = _mm_sha1msg2_epu32(W3, W2);
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 1);
+		W1 = _mm_sha1msg1_epu32(W1, W2);
+		W0 = _mm_xor_si128(W0, W2);
+		/* Rounds 28-31 */
+		e1 = _mm_sha1nexte_epu32(e1, W3);
+		e0 = abcd;
+		W0 = _mm_sha1msg2_epu32(W0, W3);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+		W2 = _mm_sha1msg1_epu32(W2, W3);
+		W1 = _mm_xor_si128(W1, W3);
+		/* Rounds 32-35 */
+		e0 = _mm_sha1nexte_epu32(e0, W0);
+		e1 = abcd;
+		W1 = _mm_sha1msg2_epu32(W1, W0);
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 1);
+		W3 = _mm_sha1msg1_epu32(W3, W0);
+		W2 = _mm_xor_si128(W2, W0);
+		/* Rounds 36-39 */
+		e1 = _mm_sha1nexte_epu32(e1, W1);
+		e0 = abcd;
+		W2 = _mm_sha1msg2_epu32(W2, W1);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 1);
+		W0 = _mm_sha1msg1_epu32(W0, W1);
+		W3 = _mm_xor_si128(W3, W1);
+		/* Rounds 40-43 */
+		e0 = _mm_sha1nexte_epu32(e0, W2);
+		e1 = abcd;
+		W3 = _mm_sha1msg2_epu32(W3, W2);
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+		W1 = _mm_sha1msg1_epu32(W1, W2);
+		W0 = _mm_xor_si128(W0, W2);
+		/* Rounds 44-47 */
+		e1 = _mm_sha1nexte_epu32(e1, W3);
+		e0 = abcd;
+		W0 = _mm_sha1msg2_epu32(W0, W3);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 2);
+		W2 = _mm_sha1msg1_epu32(W2, W3);
+		W1 = _mm_xor_si128(W1, W3);
+		/* Rounds 48-51 */
+		e0 = _mm_sha1nexte_epu32(e0, W0);
+		e1 = abcd;
+		W1 = _mm_sha1msg2_epu32(W1, W0);
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+		W3 = _mm_sha1msg1_epu32(W3, W0);
+		W2 = _mm_xor_si128(W2, W0);
+		/* Rounds 52-55 */
+		e1 = _mm_sha1nexte_epu32(e1, W1);
+		e0 = abcd;
+		W2 = _mm_sha1msg2_epu32(W2, W1);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 2);
+		W0 = _mm_sha1msg1_epu32(W0, W1);
+		W3 = _mm_xor_si128(W3, W1);
+		/* Rounds 56-59 */
+		e0 = _mm_sha1nexte_epu32(e0, W2);
+		e1 = abcd;
+		W3 = _mm_sha1msg2_epu32(W3, W2);
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 2);
+		W1 = _mm_sha1msg1_epu32(W1, W2);
+		W0 = _mm_xor_si128(W0, W2);
+		/* Rounds 60-63 */
+		e1 = _mm_sha1nexte_epu32(e1, W3);
+		e0 = abcd;
+		W0 = _mm_sha1msg2_epu32(W0, W3);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+		W2 = _mm_sha1msg1_epu32(W2, W3);
+		W1 = _mm_xor_si128(W1, W3);
+		/* Rounds 64-67 */
+		e0 = _mm_sha1nexte_epu32(e0, W0);
+		e1 = abcd;
+		W1 = _mm_sha1msg2_epu32(W1, W0);
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+		W3 = _mm_sha1msg1_epu32(W3, W0);
+		W2 = _mm_xor_si128(W2, W0);
+		/* Rounds 68-71 */
+		e1 = _mm_sha1nexte_epu32(e1, W1);
+		e0 = abcd;
+		W2 = _mm_sha1msg2_epu32(W2, W1);
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+		W3 = _mm_xor_si128(W3, W1);
+		/* Rounds 72-75 */
+		e0 = _mm_sha1nexte_epu32(e0, W2);
+		e1 = abcd;
+		W3 = _mm_sha1msg2_epu32(W3, W2);
+		abcd = _mm_sha1rnds4_epu32(abcd, e0, 3);
+		/* Rounds 76-79 */
+		e1 = _mm_sha1nexte_epu32(e1, W3);
+		e0 = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e1, 3);
+
+		e0 = _mm_sha1nexte_epu32(e0, e0_save);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+	}
+	_mm_storeu_si128((__m128i *)h, _mm_shuffle_epi32(abcd, 0x1b));
+	h[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+#endif /* DIGEST_SHANI */
+
+int
+__archive_builtin_sha1init(archive_sha1_ctx *ctx)
+{
+	int cpu = __archive_cpu_features();
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->h[0] = 0x67452301;
+	ctx->h[1] = 0xefcdab89;
+	ctx->h[2] = 0x98badcfe;
+	ctx->h[3] = 0x10325476;
+	ctx->h[4] = 0xc3d2e1f0;
+	ctx->blocks = sha1_blocks;
+#ifdef DIGEST_SHANI
+	if (cpu & ARCHIVE_CPU_SHA)
+		ctx->blocks = sha1_blocks_shani;
+#endif
+	(void)cpu; /* UNUSED */
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_builtin_sha1update(archive_sha1_ctx *ctx, const void *indata,
+    size_t insize)
+{
+	update32(ctx, indata, insize);
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_builtin_sha1final(archive_sha1_ctx *ctx, void *md)
+{
+	return (final32(ctx, md, 5, 1));
+}
+
+#endif /* ARCHIVE_CRYPTO_SHA1_BUILTIN */
+
+#if defined(ARCHIVE_CRYPTO_SHA256_BUILTIN)
+
+/* SHA-256, FIPS 180-4. */
+
+static const uint32_t sha256_K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+	0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+	0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+	0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+	0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+	0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+	0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+	0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+	0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define	SHA2_CH(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define	SHA2_MAJ(x, y, z)	(((x) & (y)) | ((z) & ((x) | (y))))
+#define	SHA256_S0(x)	(ROTR32(x, 2) ^ ROTR32(x, 13) ^ ROTR32(x, 22))
+#define	SHA256_S1(x)	(ROTR32(x, 6) ^ ROTR32(x, 11) ^ ROTR32(x, 25))
+#define	SHA256_s0(x)	(ROTR32(x, 7) ^ ROTR32(x, 18) ^ ((x) >> 3))
+#define	SHA256_s1(x)	(ROTR32(x, 17) ^ ROTR32(x, 19) ^ ((x) >> 10))
+/* The message schedule, kept in a 16-word ring. */
+#define	SHA256_W(i)	(w[(i) & 15] += SHA256_s1(w[((i) + 14) & 15]) +	\
+	w[((i) + 9) & 15] + SHA256_s0(w[((i) + 1) & 15]))
+#define	SHA256_STEP(a, b, c, d, e, f, g, h, k, x) do {			\
+	uint32_t t_ = (h) + SHA256_S1(e) + SHA2_CH((e), (f), (g)) +	\
+	    (k) + (x);						\
+	(d) += t_;							\
+	(h) = t_ + SHA256_S0(a) + SHA2_MAJ((a), (b), (c));		\
+} while (0)
+/*
+ * Sixteen steps, rotating the roles instead of moving the values.  The
+ * schedule ring is indexed with constants so that it can live in
+ * registers.
+ */
+#define	SHA256_16(i, x) do {						\
+	const uint32_t *K_ = sha256_K + (i);				\
+	SHA256_STEP(a, b, c, d, e, f, g, h, K_[0], x(0));		\
+	SHA256_STEP(h, a, b, c, d, e, f, g, K_[1], x(1));		\
+	SHA256_STEP(g, h, a, b, c, d, e, f, K_[2], x(2));		\
+	SHA256_STEP(f, g, h, a, b, c, d, e, K_[3], x(3));		\
+	SHA256_STEP(e, f, g, h, a, b, c, d, K_[4], x(4));		\
+	SHA256_STEP(d, e, f, g, h, a, b, c, K_[5], x(5));		\
+	SHA256_STEP(c, d, e, f, g, h, a, b, K_[6], x(6));		\
+	SHA256_STEP(b, c, d, e, f, g, h, a, K_[7], x(7));		\
+	SHA256_STEP(a, b, c, d, e, f, g, h, K_[8], x(8));		\
+	SHA256_STEP(h, a, b, c, d, e, f, g, K_[9], x(9));		\
+	SHA256_STEP(g, h, a, b, c, d, e, f, K_[10], x(10));		\
+	SHA256_STEP(f, g, h, a, b, c, d, e, K_[11], x(11));		\
+	SHA256_STEP(e, f, g, h, a, b, c, d, K_[12], x(12));		\
+	SHA256_STEP(d, e, f, g, h, a, b, c, K_[13], x(13));		\
+	SHA256_STEP(c, d, e, f, g, h, a, b, K_[14], x(14));		\
+	SHA256_STEP(b, c, d, e, f, g, h, a, K_[15], x(15));		\
+} while (0)
+#define	SHA256_X(j)	(w[(j)])
+
+static void
+sha256_blocks(uint32_t *state, const unsigned char *p, size_t n)
+{
+	uint32_t a, b, c, d, e, f, g, h, w[16];
+	int i;
+
+	for (; n > 0; n--, p += 64) {
+		for (i = 0; i < 16; i++)
+			w[i] = archive_be32dec(p + 4 * i);
+		a = state[0]; b = state[1]; c = state[2]; d = state[3];
+		e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+		SHA256_16(0, SHA256_X);
+		SHA256_16(16, SHA256_W);
+		SHA256_16(32, SHA256_W);
+		SHA256_16(48, SHA256_W);
+
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+	}
+}
+
+#ifdef DIGEST_SHANI
+__attribute__((target("sse2,ssse3,sse4.1,sha")))
+static void
+sha256_blocks_shani(uint32_t *state, const unsigned char *p, size_t n)
+{
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+	    0x0405060700010203ULL);
+	__m128i abef, cdgh, abef_save, cdgh_save, m, t;
+	__m128i W0, W1, W2, W3;
+
+	/* The instructions want the state as ABEF and CDGH. */
+	t = _mm_shuffle_epi32(
+	    _mm_loadu_si128((const __m128i *)&state[0]), 0xb1);
+	cdgh = _mm_shuffle_epi32(
+	    _mm_loadu_si128((const __m128i *)&state[4]), 0x1b);
+	abef = _mm_alignr_epi8(t, cdgh, 8);
+	cdgh = _mm_blend_epi16(cdgh, t, 0xf0);
+	for (; n > 0; n--, p += 64) {
+		abef_save = abef;
+		cdgh_save = cdgh;
+
+		/* Rounds 0-3 */
+		W0 = _mm_shuffle_epi8(_mm_loadu_si128(
+		    (const __m128i *)(p + 0)), mask);
+		m = _mm_add_epi32(W0,
+		    _mm_loadu_si128((const __m128i *)&sha256_K[0]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, m);
+		m = _mm_shuffle_epi32(m, 0x0e);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, m);
+		/* Rounds 4-7 */
+		W1 = _mm_shuffle_epi8(_mm_loadu_si128(
+		    (const __m128i *)(p + 16)), mask);
+		m = _mm_add_epi32(W1,
+		    _mm_loadu_si128((const __m128i *)&sha256_K[4]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, m);
+		m = _mm_shuffle_epi32(m, 0x0e);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, m);
+		W0 = _mm_sha256msg1_epu32(W0, W1);
+		/* Rounds 8-11 */
+		W2 = _mm_shuffle_epi8(_mm_loadu_si128(
+		    (const __m128i *)(p + 32)), mask);
+		m = _mm_add_epi32(W2,
+		    _mm_loadu_si128((const __m128i *)&sha256_K[8]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, m);
+		m = _mm_shuffle_epi32(m, 0x0e);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, m);
+		W1 = _mm_sha256msg1_epu32(W1, W2);
+		/* Rounds 12-15 */
+		W3 = _mm_shuffle_epi8(_mm_loadu_si128(
+		    (const __m128i *)(p + 48)), mask);
+		m = _mm_add_epi32(W3,
+		    _mm_loadu_si128((const __m128i *)&sha256_K[12]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, m);
+		W0 = _mm_sha256msg2_epu32(_mm_add_epi32(W0,
+		    _mm_alignr_epi8(W3, W2, 4)), W3);
+		m = _mm_shuffle_epi32(m, 0x0e);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, m);
+		W2 = _mm_sha256msg1_epu32(W2, W3);
+		/* Rounds 16-19 */
+		m = _mm_add_epi32(W0,
+		    _mm_loadu_si128((const __m128i *)&sha256_K[16]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, m);
+		W1 = _mm_sha256msg2_epu32(_mm_add_epi32(W1,
+		    _mm_alignr_epi8(W0, W3, 4)), W0);
+		m = _mm_shuffle_epi32(m, 0x0e);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, m);
+		W3 = _mm_sha256msg1_epu32(W3, W0);
+		/* Rounds 20-23 */
+		m = _mm_add_epi32(W1,
+		    _mm_loadu_si128((const __m128i *)&sha256_K[20]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, m);
+		W2 = _mm_sha256msg2_epu32(_mm_add_epi32(W2,
+		    _mm_alignr_epi8(W1, W0, 4)), W1);
+		m = _mm_shuffle_epi32(m, 0x0e);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, m);
+		W0 = _mm_sha256msg1_epu32(W0, W1);
+		/* Rounds 24-27 */
+		m = _mm_add_epi32(W2,
+		    _mm_loadu_si128((const __m128i *)&sha256_K[24]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, m);
+		W3 = _mm_sha256msg2_epu32(_mm_add_epi32(W3,
+		    _mm_alignr_epi8(W2, W1, 4)), W2);
+		m = _mm_shuffle_epi32(m, 0x0e);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, m);
+		W1 = _mm_sha256msg1_epu32(W1, W2);
+		/* Rounds 28-31 */
+		m = _mm_add_epi32(W3,
+		    _mm_loadu_si128((const __m128i *)&sha256_K[28]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, m);
+		W0 = _mm_sha256msg2_epu32(_mm_add_epi32(W0,
+		    _mm_alignr_epi8(W3, W2, 4)), W3);
+		m = _mm_shuffle_epi32(m, 0x0e);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, m);
+		W2 = _mm_sha256msg1_epu32(W2, W3);
+		/* Rounds 32-35 */
+		m = _mm_add_epi32(W0,
+		    _mm_loadu_si128((const __m128i *)&sha256_K[32]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, m);
+		W1 = _mm_sha256msg2_epu32(_mm_add_epi32(W1,
+		    _mm_alignr_epi8(W0, W3, 4)), W0);
+		m = _mm_shuffle_epi32(m, 0x0e);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, m);
+		W3 = _mm_sha256msg1_epu32(W3, W0);
+		/* Rounds 36-39 */
+		m = _mm_add_epi32(W1,
+		    _mm_loadu_si128((const __m128i *)&sha256_K[36]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, m);
+		W2 = _mm_sha256msg2_epu32(_mm_add_epi32(W2,
+		    _mm_alignr_epi8(W1, W0, 4)), W1);
+		m = _mm_shuffle_epi32(m, 0x0e);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, m);
+		W0 = _mm_sha256msg1_epu32(W0, W1);
+		/* Rounds 40-43 */
+		m = _mm_add_epi32(W2,
+		    _mm_loadu_si128((const __m128i *)&sha256_K[40]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, m);
+		W3 = _mm_sha256msg2_epu32(_mm_add_epi32(W3,
+		    _mm_alignr_epi8(W2, W1, 4)), W2);
+		m = _mm_shuffle_epi32(m, 0x0e);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, m);
+		W1 = _mm_sha256msg1_epu32(W1, W2);
+		/* Rounds 44-47 */
+		m = _mm_add_epi32(W3,
+		    _mm_loadu_si128((const __m128i *)&sha256_K[44]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, m);
+		W0 = _mm_sha256msg2_epu32(_mm_add_epi32(W0,
+		    _mm_alignr_epi8(W3, W2, 4)), W3);
+		m = _mm_shuffle_epi32(m, 0x0e);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, m);
+		W2 = _mm_sha256msg1_epu32(W2, W3);
+		/* Rounds 48-51 */
+		m = _mm_add_epi32(W0,
+		    _mm_loadu_si128((const __m128i *)&sha256_K[48]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, m);
+		W1 = _mm_sha256msg2_epu32(_mm_add_epi32(W1,
+		    _mm_alignr_epi8(W0, W3, 4)), W0);
+		m = _mm_shuffle_epi32(m, 0x0e);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, m);
+		W3 = _mm_sha256msg1_epu32(W3, W0);
+		/* Rounds 52-55 */
+		m = _mm_add_epi32(W1,
+		    _mm_loadu_si128((const __m128i *)&sha256_K[52]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, m);
+		W2 = _mm_sha256msg2_epu32(_mm_add_epi32(W2,
+		    _mm_alignr_epi8(W1, W0, 4)), W1);
+		m = _mm_shuffle_epi32(m, 0x0e);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, m);
+		/* Rounds 56-59 */
+		m = _mm_add_epi32(W2,
+		    _mm_loadu_si128((const __m128i *)&sha256_K[56]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, m);
+		W3 = _mm_sha256msg2_epu32(_mm_add_epi32(W3,
+		    _mm_alignr_epi8(W2, W1, 4)), W2);
+		m = _mm_shuffle_epi32(m, 0x0e);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, m);
+		/* Rounds 60-63 */
+		m = _mm_add_epi32(W3,
+		    _mm_loadu_si128((const __m128i *)&sha256_K[60]));
+		cdgh = _mm_sha256rnds2_epu32(cdgh, abef, m);
+		m = _mm_shuffle_epi32(m, 0x0e);
+		abef = _mm_sha256rnds2_epu32(abef, cdgh, m);
+
+		abef = _mm_add_epi32(abef, abef_save);
+		cdgh = _mm_add_epi32(cdgh, cdgh_save);
+	}
+	t = _mm_shuffle_epi32(abef, 0x1b);
+	cdgh = _mm_shuffle_epi32(cdgh, 0xb1);
+	_mm_storeu_si128((__m128i *)&state[0], _mm_blend_epi16(t, cdgh, 0xf0));
+	_mm_storeu_si128((__m128i *)&state[4], _mm_alignr_epi8(cdgh, t, 8));
+}
+#endif /* DIGEST_SHANI */
+
+int
+__archive_builtin_sha256init(archive_sha256_ctx *ctx)
+{
+	int cpu = __archive_cpu_features();
+
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->h[0] = 0x6a09e667;
+	ctx->h[1] = 0xbb67ae85;
+	ctx->h[2] = 0x3c6ef372;
+	ctx->h[3] = 0xa54ff53a;
+	ctx->h[4] = 0x510e527f;
+	ctx->h[5] = 0x9b05688c;
+	ctx->h[6] = 0x1f83d9ab;
+	ctx->h[7] = 0x5be0cd19;
+	ctx->blocks = sha256_blocks;
+#ifdef DIGEST_SHANI
+	if (cpu & ARCHIVE_CPU_SHA)
+		ctx->blocks = sha256_blocks_shani;
+#endif
+	(void)cpu; /* UNUSED */
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_builtin_sha256update(archive_sha256_ctx *ctx, const void *indata,
+    size_t insize)
+{
+	update32(ctx, indata, insize);
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_builtin_sha256final(archive_sha256_ctx *ctx, void *md)
+{
+	return (final32(ctx, md, 8, 1));
+}
+
+#endif /* ARCHIVE_CRYPTO_SHA256_BUILTIN */
+
+#if defined(ARCHIVE_CRYPTO_SHA384_BUILTIN) || \
+    defined(ARCHIVE_CRYPTO_SHA512_BUILTIN)
+
+/* SHA-384 and SHA-512, FIPS 180-4. */
+
+static const uint64_t sha512_K[80] = {
+	0x428a2f98d728ae22ULL, 0x7137449123ef65cdULL,
+	0xb5c0fbcfec4d3b2fULL, 0xe9b5dba58189dbbcULL,
+	0x3956c25bf348b538ULL, 0x59f111f1b605d019ULL,
+	0x923f82a4af194f9bULL, 0xab1c5ed5da6d8118ULL,
+	0xd807aa98a3030242ULL, 0x12835b0145706fbeULL,
+	0x243185be4ee4b28cULL, 0x550c7dc3d5ffb4e2ULL,
+	0x72be5d74f27b896fULL, 0x80deb1fe3b1696b1ULL,
+	0x9bdc06a725c71235ULL, 0xc19bf174cf692694ULL,
+	0xe49b69c19ef14ad2ULL, 0xefbe4786384f25e3ULL,
+	0x0fc19dc68b8cd5b5ULL, 0x240ca1cc77ac9c65ULL,
+	0x2de92c6f592b0275ULL, 0x4a7484aa6ea6e483ULL,
+	0x5cb0a9dcbd41fbd4ULL, 0x76f988da831153b5ULL,
+	0x983e5152ee66dfabULL, 0xa831c66d2db43210ULL,
+	0xb00327c898fb213fULL, 0xbf597fc7beef0ee4ULL,
+	0xc6e00bf33da88fc2ULL, 0xd5a79147930aa725ULL,
+	0x06ca6351e003826fULL, 0x142929670a0e6e70ULL,
+	0x27b70a8546d22ffcULL, 0x2e1b21385c26c926ULL,
+	0x4d2c6dfc5ac42aedULL, 0x53380d139d95b3dfULL,
+	0x650a73548baf63deULL, 0x766a0abb3c77b2a8ULL,
+	0x81c2c92e47edaee6ULL, 0x92722c851482353bULL,
+	0xa2bfe8a14cf10364ULL, 0xa81a664bbc423001ULL,
+	0xc24b8b70d0f89791ULL, 0xc76c51a30654be30ULL,
+	0xd192e819d6ef5218ULL, 0xd69906245565a910ULL,
+	0xf40e35855771202aULL, 0x106aa07032bbd1b8ULL,
+	0x19a4c116b8d2d0c8ULL, 0x1e376c085141ab53ULL,
+	0x2748774cdf8eeb99ULL, 0x34b0bcb5e19b48a8ULL,
+	0x391c0cb3c5c95a63ULL, 0x4ed8aa4ae3418acbULL,
+	0x5b9cca4f7763e373ULL, 0x682e6ff3d6b2b8a3ULL,
+	0x748f82ee5defb2fcULL, 0x78a5636f43172f60ULL,
+	0x84c87814a1f0ab72ULL, 0x8cc702081a6439ecULL,
+	0x90befffa23631e28ULL, 0xa4506cebde82bde9ULL,
+	0xbef9a3f7b2c67915ULL, 0xc67178f2e372532bULL,
+	0xca273eceea26619cULL, 0xd186b8c721c0c207ULL,
+	0xeada7dd6cde0eb1eULL, 0xf57d4f7fee6ed178ULL,
+	0x06f067aa72176fbaULL, 0x0a637dc5a2c898a6ULL,
+	0x113f9804bef90daeULL, 0x1b710b35131c471bULL,
+	0x28db77f523047d84ULL, 0x32caab7b40c72493ULL,
+	0x3c9ebe0a15c9bebcULL, 0x431d67c49c100d4cULL,
+	0x4cc5d4becb3e42b6ULL, 0x597f299cfc657e2aULL,
+	0x5fcb6fab3ad6faecULL, 0x6c44198c4a475817ULL
+};
+
+#ifndef SHA2_CH
+#define	SHA2_CH(x, y, z)	((z) ^ ((x) & ((y) ^ (z))))
+#define	SHA2_MAJ(x, y, z)	(((x) & (y)) | ((z) & ((x) | (y))))
+#endif
+#define	SHA512_S0(x)	(ROTR64(x, 28) ^ ROTR64(x, 34) ^ ROTR64(x, 39))
+#define	SHA512_S1(x)	(ROTR64(x, 14) ^ ROTR64(x, 18) ^ ROTR64(x, 41))
+#define	SHA512_s0(x)	(ROTR64(x, 1) ^ ROTR64(x, 8) ^ ((x) >> 7))
+#define	SHA512_s1(x)	(ROTR64(x, 19) ^ ROTR64(x, 61) ^ ((x) >> 6))
+#define	SHA512_W(i)	(w[(i) & 15] += SHA512_s1(w[((i) + 14) & 15]) +	\
+	w[((i) + 9) & 15] + SHA512_s0(w[((i) + 1) & 15]))
+#define	SHA512_STEP(a, b, c, d, e, f, g, h, k, x) do {			\
+	uint64_t t_ = (h) + SHA512_S1(e) + SHA2_CH((e), (f), (g)) +	\
+	    (k) + (x);						\
+	(d) += t_;							\
+	(h) = t_ + SHA512_S0(a) + SHA2_MAJ((a), (b), (c));		\
+} while (0)
+/*
+ * Sixteen steps, rotating the roles instead of moving the values.  The
+ * schedule ring is indexed with constants so that it can live in
+ * registers.
+ */
+#define	SHA512_16(i, x) do {						\
+	const uint64_t *K_ = sha512_K + (i);				\
+	SHA512_STEP(a, b, c, d, e, f, g, h, K_[0], x(0));		\
+	SHA512_STEP(h, a, b, c, d, e, f, g, K_[1], x(1));		\
+	SHA512_STEP(g, h, a, b, c, d, e, f, K_[2], x(2));		\
+	SHA512_STEP(f, g, h, a, b, c, d, e, K_[3], x(3));		\
+	SHA512_STEP(e, f, g, h, a, b, c, d, K_[4], x(4));		\
+	SHA512_STEP(d, e, f, g, h, a, b, c, K_[5], x(5));		\
+	SHA512_STEP(c, d, e, f, g, h, a, b, K_[6], x(6));		\
+	SHA512_STEP(b, c, d, e, f, g, h, a, K_[7], x(7));		\
+	SHA512_STEP(a, b, c, d, e, f, g, h, K_[8], x(8));		\
+	SHA512_STEP(h, a, b, c, d, e, f, g, K_[9], x(9));		\
+	SHA512_STEP(g, h, a, b, c, d, e, f, K_[10], x(10));		\
+	SHA512_STEP(f, g, h, a, b, c, d, e, K_[11], x(11));		\
+	SHA512_STEP(e, f, g, h, a, b, c, d, K_[12], x(12));		\
+	SHA512_STEP(d, e, f, g, h, a, b, c, K_[13], x(13));		\
+	SHA512_STEP(c, d, e, f, g, h, a, b, K_[14], x(14));		\
+	SHA512_STEP(b, c, d, e, f, g, h, a, K_[15], x(15));		\
+} while (0)
+#define	SHA512_X(j)	(w[(j)])
+
+static void
+sha512_blocks(uint64_t *state, const unsigned char *p, size_t n)
+{
+	uint64_t a, b, c, d, e, f, g, h, w[16];
+	int i;
+
+	for (; n > 0; n--, p += 128) {
+		for (i = 0; i < 16; i++)
+			w[i] = archive_be64dec(p + 8 * i);
+		a = state[0]; b = state[1]; c = state[2]; d = state[3];
+		e = state[4]; f = state[5]; g = state[6]; h = state[7];
+
+		SHA512_16(0, SHA512_X);
+		SHA512_16(16, SHA512_W);
+		SHA512_16(32, SHA512_W);
+		SHA512_16(48, SHA512_W);
+		SHA512_16(64, SHA512_W);
+
+		state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+		state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+	}
+}
+
+static void
+update64(struct archive_builtin_ctx64 *ctx, const void *data, size_t n)
+{
+	const unsigned char *p = data;
+	size_t used = (size_t)(ctx->len & 127), take;
+
+	ctx->len += n;
+	if (used > 0) {
+		take = 128 - used;
+		if (take > n)
+			take = n;
+		memcpy(ctx->buf + used, p, take);
+		p += take;
+		n -= take;
+		if (used + take < 128)
+			return;
+		sha512_blocks(ctx->h, ctx->buf, 1);
+	}
+	if (n >= 128) {
+		sha512_blocks(ctx->h, p, n / 128);
+		p += n & ~(size_t)127;
+		n &= 127;
+	}
+	if (n > 0)
+		memcpy(ctx->buf, p, n);
+}
+
+static int
+final64(struct archive_builtin_ctx64 *ctx, void *md, int words)
+{
+	unsigned char pad[144], *out = md;
+	size_t padlen;
+	int i;
+
+	if (!ctx->valid)
+		return (ARCHIVE_OK);
+	/* The length field is 128 bits; ctx->len counts bytes. */
+	padlen = (ctx->len & 127) < 112 ? 112 - (size_t)(ctx->len & 127)
+	    : 240 - (size_t)(ctx->len & 127);
+	memset(pad, 0, sizeof(pad));
+	pad[0] = 0x80;
+	archive_be64enc(pad + padlen, ctx->len >> 61);
+	archive_be64enc(pad + padlen + 8, ctx->len << 3);
+	update64(ctx, pad, padlen + 16);
+	if (out != NULL) {
+		for (i = 0; i < words; i++)
+			archive_be64enc(out + 8 * i, ctx->h[i]);
+	}
+	memset(ctx, 0, sizeof(*ctx));
+	return (ARCHIVE_OK);
+}
+
+#endif
+
+#if defined(ARCHIVE_CRYPTO_SHA384_BUILTIN)
+
+int
+__archive_builtin_sha384init(archive_sha384_ctx *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->h[0] = 0xcbbb9d5dc1059ed8ULL;
+	ctx->h[1] = 0x629a292a367cd507ULL;
+	ctx->h[2] = 0x9159015a3070dd17ULL;
+	ctx->h[3] = 0x152fecd8f70e5939ULL;
+	ctx->h[4] = 0x67332667ffc00b31ULL;
+	ctx->h[5] = 0x8eb44a8768581511ULL;
+	ctx->h[6] = 0xdb0c2e0d64f98fa7ULL;
+	ctx->h[7] = 0x47b5481dbefa4fa4ULL;
+	ctx->valid = 1;
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_builtin_sha384update(archive_sha384_ctx *ctx, const void *indata,
+    size_t insize)
+{
+	update64(ctx, indata, insize);
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_builtin_sha384final(archive_sha384_ctx *ctx, void *md)
+{
+	return (final64(ctx, md, 6));
+}
+
+#endif /* ARCHIVE_CRYPTO_SHA384_BUILTIN */
+
+#if defined(ARCHIVE_CRYPTO_SHA512_BUILTIN)
+
+int
+__archive_builtin_sha512init(archive_sha512_ctx *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->h[0] = 0x6a09e667f3bcc908ULL;
+	ctx->h[1] = 0xbb67ae8584caa73bULL;
+	ctx->h[2] = 0x3c6ef372fe94f82bULL;
+	ctx->h[3] = 0xa54ff53a5f1d36f1ULL;
+	ctx->h[4] = 0x510e527fade682d1ULL;
+	ctx->h[5] = 0x9b05688c2b3e6c1fULL;
+	ctx->h[6] = 0x1f83d9abfb41bd6bULL;
+	ctx->h[7] = 0x5be0cd19137e2179ULL;
+	ctx->valid = 1;
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_builtin_sha512update(archive_sha512_ctx *ctx, const void *indata,
+    size_t insize)
+{
+	update64(ctx, indata, insize);
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_builtin_sha512final(archive_sha512_ctx *ctx, void *md)
+{
+	return (final64(ctx, md, 8));
+}
+
+#endif /* ARCHIVE_CRYPTO_SHA512_BUILTIN */
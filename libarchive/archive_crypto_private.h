@@ -54,6 +54,9 @@
  *
  * Windows:
  * - MD5, SHA1 and SHA2 in archive_crypto.c using Windows crypto API
+ *
+ * Anything else, or any algorithm none of the above provides:
+ * - MD5, RMD160, SHA1 and SHA2 in archive_crypto_builtin.c
  */
 
 /* libc crypto headers */
@@ -151,6 +154,35 @@ typedef struct {
 } Digest_CTX;
 #endif
 
+/*
+ * Contexts for archive_crypto_builtin.c.  The configure probes compile
+ * archive_crypto.c by itself to test one library at a time, so they
+ * must not refer to it.
+ */
+#if defined(ARCHIVE_MD5_COMPILE_TEST) ||\
+  defined(ARCHIVE_RMD160_COMPILE_TEST) ||\
+  defined(ARCHIVE_SHA1_COMPILE_TEST) ||\
+  defined(ARCHIVE_SHA256_COMPILE_TEST) ||\
+  defined(ARCHIVE_SHA384_COMPILE_TEST) ||\
+  defined(ARCHIVE_SHA512_COMPILE_TEST)
+#define	ARCHIVE_CRYPTO_COMPILE_TEST 1
+#else
+/* MD5, RMD160, SHA1 and SHA256 */
+struct archive_builtin_ctx32 {
+  uint32_t	h[8];
+  uint64_t	len;
+  void		(*blocks)(uint32_t *, const unsigned char *, size_t);
+  unsigned char	buf[64];
+};
+/* SHA384 and SHA512 */
+struct archive_builtin_ctx64 {
+  uint64_t	h[8];
+  uint64_t	len;
+  int		valid;
+  unsigned char	buf[128];
+};
+#endif
+
 /* typedefs */
 #if defined(ARCHIVE_CRYPTO_MD5_LIBC)
 typedef MD5_CTX archive_md5_ctx;
@@ -164,6 +196,9 @@ typedef struct md5_ctx archive_md5_ctx;
 typedef EVP_MD_CTX archive_md5_ctx;
 #elif defined(ARCHIVE_CRYPTO_MD5_WIN)
 typedef Digest_CTX archive_md5_ctx;
+#elif !defined(ARCHIVE_CRYPTO_COMPILE_TEST)
+#define	ARCHIVE_CRYPTO_MD5_BUILTIN 1
+typedef struct archive_builtin_ctx32 archive_md5_ctx;
 #else
 typedef unsigned char archive_md5_ctx;
 #endif
@@ -176,6 +211,9 @@ typedef RIPEMD160_CTX archive_rmd160_ctx;
 typedef struct ripemd160_ctx archive_rmd160_ctx;
 #elif defined(ARCHIVE_CRYPTO_RMD160_OPENSSL)
 typedef EVP_MD_CTX archive_rmd160_ctx;
+#elif !defined(ARCHIVE_CRYPTO_COMPILE_TEST)
+#define	ARCHIVE_CRYPTO_RMD160_BUILTIN 1
+typedef struct archive_builtin_ctx32 archive_rmd160_ctx;
 #else
 typedef unsigned char archive_rmd160_ctx;
 #endif
@@ -192,6 +230,9 @@ typedef struct sha1_ctx archive_sha1_ctx;
 typedef EVP_MD_CTX archive_sha1_ctx;
 #elif defined(ARCHIVE_CRYPTO_SHA1_WIN)
 typedef Digest_CTX archive_sha1_ctx;
+#elif !defined(ARCHIVE_CRYPTO_COMPILE_TEST)
+#define	ARCHIVE_CRYPTO_SHA1_BUILTIN 1
+typedef struct archive_builtin_ctx32 archive_sha1_ctx;
 #else
 typedef unsigned char archive_sha1_ctx;
 #endif
@@ -212,6 +253,9 @@ typedef struct sha256_ctx archive_sha256_ctx;
 typedef EVP_MD_CTX archive_sha256_ctx;
 #elif defined(ARCHIVE_CRYPTO_SHA256_WIN)
 typedef Digest_CTX archive_sha256_ctx;
+#elif !defined(ARCHIVE_CRYPTO_COMPILE_TEST)
+#define	ARCHIVE_CRYPTO_SHA256_BUILTIN 1
+typedef struct archive_builtin_ctx32 archive_sha256_ctx;
 #else
 typedef unsigned char archive_sha256_ctx;
 #endif
@@ -230,6 +274,9 @@ typedef struct sha384_ctx archive_sha384_ctx;
 typedef EVP_MD_CTX archive_sha384_ctx;
 #elif defined(ARCHIVE_CRYPTO_SHA384_WIN)
 typedef Digest_CTX archive_sha384_ctx;
+#elif !defined(ARCHIVE_CRYPTO_COMPILE_TEST)
+#define	ARCHIVE_CRYPTO_SHA384_BUILTIN 1
+typedef struct archive_builtin_ctx64 archive_sha384_ctx;
 #else
 typedef unsigned char archive_sha384_ctx;
 #endif
@@ -250,6 +297,9 @@ typedef struct sha512_ctx archive_sha512_ctx;
 typedef EVP_MD_CTX archive_sha512_ctx;
 #elif defined(ARCHIVE_CRYPTO_SHA512_WIN)
 typedef Digest_CTX archive_sha512_ctx;
+#elif !defined(ARCHIVE_CRYPTO_COMPILE_TEST)
+#define	ARCHIVE_CRYPTO_SHA512_BUILTIN 1
+typedef struct archive_builtin_ctx64 archive_sha512_ctx;
 #else
 typedef unsigned char archive_sha512_ctx;
 #endif
@@ -260,7 +310,8 @@ typedef unsigned char archive_sha512_ctx;
   defined(ARCHIVE_CRYPTO_MD5_LIBSYSTEM) ||\
   defined(ARCHIVE_CRYPTO_MD5_NETTLE) ||\
   defined(ARCHIVE_CRYPTO_MD5_OPENSSL) ||\
-  defined(ARCHIVE_CRYPTO_MD5_WIN)
+  defined(ARCHIVE_CRYPTO_MD5_WIN) ||\
+  defined(ARCHIVE_CRYPTO_MD5_BUILTIN)
 #define ARCHIVE_HAS_MD5
 #endif
 #define archive_md5_init(ctx)\
@@ -272,7 +323,8 @@ typedef unsigned char archive_sha512_ctx;
 
 #if defined(ARCHIVE_CRYPTO_RMD160_LIBC) ||\
   defined(ARCHIVE_CRYPTO_RMD160_NETTLE) ||\
-  defined(ARCHIVE_CRYPTO_RMD160_OPENSSL)
+  defined(ARCHIVE_CRYPTO_RMD160_OPENSSL) ||\
+  defined(ARCHIVE_CRYPTO_RMD160_BUILTIN)
 #define ARCHIVE_HAS_RMD160
 #endif
 #define archive_rmd160_init(ctx)\
@@ -287,7 +339,8 @@ typedef unsigned char archive_sha512_ctx;
   defined(ARCHIVE_CRYPTO_SHA1_LIBSYSTEM) ||\
   defined(ARCHIVE_CRYPTO_SHA1_NETTLE) ||\
   defined(ARCHIVE_CRYPTO_SHA1_OPENSSL) ||\
-  defined(ARCHIVE_CRYPTO_SHA1_WIN)
+  defined(ARCHIVE_CRYPTO_SHA1_WIN) ||\
+  defined(ARCHIVE_CRYPTO_SHA1_BUILTIN)
 #define ARCHIVE_HAS_SHA1
 #endif
 #define archive_sha1_init(ctx)\
@@ -304,7 +357,8 @@ typedef unsigned char archive_sha512_ctx;
   defined(ARCHIVE_CRYPTO_SHA256_LIBSYSTEM) ||\
   defined(ARCHIVE_CRYPTO_SHA256_NETTLE) ||\
   defined(ARCHIVE_CRYPTO_SHA256_OPENSSL) ||\
-  defined(ARCHIVE_CRYPTO_SHA256_WIN)
+  defined(ARCHIVE_CRYPTO_SHA256_WIN) ||\
+  defined(ARCHIVE_CRYPTO_SHA256_BUILTIN)
 #define ARCHIVE_HAS_SHA256
 #endif
 #define archive_sha256_init(ctx)\
@@ -320,7 +374,8 @@ typedef unsigned char archive_sha512_ctx;
   defined(ARCHIVE_CRYPTO_SHA384_LIBSYSTEM) ||\
   defined(ARCHIVE_CRYPTO_SHA384_NETTLE) ||\
   defined(ARCHIVE_CRYPTO_SHA384_OPENSSL) ||\
-  defined(ARCHIVE_CRYPTO_SHA384_WIN)
+  defined(ARCHIVE_CRYPTO_SHA384_WIN) ||\
+  defined(ARCHIVE_CRYPTO_SHA384_BUILTIN)
 #define ARCHIVE_HAS_SHA384
 #endif
 #define archive_sha384_init(ctx)\
@@ -337,7 +392,8 @@ typedef unsigned char archive_sha512_ctx;
   defined(ARCHIVE_CRYPTO_SHA512_LIBSYSTEM) ||\
   defined(ARCHIVE_CRYPTO_SHA512_NETTLE) ||\
   defined(ARCHIVE_CRYPTO_SHA512_OPENSSL) ||\
-  defined(ARCHIVE_CRYPTO_SHA512_WIN)
+  defined(ARCHIVE_CRYPTO_SHA512_WIN) ||\
+  defined(ARCHIVE_CRYPTO_SHA512_BUILTIN)
 #define ARCHIVE_HAS_SHA512
 #endif
 #define archive_sha512_init(ctx)\
@@ -347,6 +403,38 @@ typedef unsigned char archive_sha512_ctx;
 #define archive_sha512_update(ctx, buf, n)\
   __archive_crypto.sha512update(ctx, buf, n)
 
+/* Provided by archive_crypto_builtin.c */
+#if defined(ARCHIVE_CRYPTO_MD5_BUILTIN)
+int __archive_builtin_md5init(archive_md5_ctx *);
+int __archive_builtin_md5update(archive_md5_ctx *, const void *, size_t);
+int __archive_builtin_md5final(archive_md5_ctx *, void *);
+#endif
+#if defined(ARCHIVE_CRYPTO_RMD160_BUILTIN)
+int __archive_builtin_ripemd160init(archive_rmd160_ctx *);
+int __archive_builtin_ripemd160update(archive_rmd160_ctx *, const void *, size_t);
+int __archive_builtin_ripemd160final(archive_rmd160_ctx *, void *);
+#endif
+#if defined(ARCHIVE_CRYPTO_SHA1_BUILTIN)
+int __archive_builtin_sha1init(archive_sha1_ctx *);
+int __archive_builtin_sha1update(archive_sha1_ctx *, const void *, size_t);
+int __archive_builtin_sha1final(archive_sha1_ctx *, void *);
+#endif
+#if defined(ARCHIVE_CRYPTO_SHA256_BUILTIN)
+int __archive_builtin_sha256init(archive_sha256_ctx *);
+int __archive_builtin_sha256update(archive_sha256_ctx *, const void *, size_t);
+int __archive_builtin_sha256final(archive_sha256_ctx *, void *);
+#endif
+#if defined(ARCHIVE_CRYPTO_SHA384_BUILTIN)
+int __archive_builtin_sha384init(archive_sha384_ctx *);
+int __archive_builtin_sha384update(archive_sha384_ctx *, const void *, size_t);
+int __archive_builtin_sha384final(archive_sha384_ctx *, void *);
+#endif
+#if defined(ARCHIVE_CRYPTO_SHA512_BUILTIN)
+int __archive_builtin_sha512init(archive_sha512_ctx *);
+int __archive_builtin_sha512update(archive_sha512_ctx *, const void *, size_t);
+int __archive_builtin_sha512final(archive_sha512_ctx *, void *);
+#endif
+
 /* Minimal interface to crypto functionality for internal use in libarchive */
 struct archive_crypto
 {
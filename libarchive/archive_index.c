@@ -0,0 +1,373 @@
+/*-
+ * Copyright (c) 2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Sidecar index files.
+ *
+ * Streaming formats such as tar and cpio have no central directory,
+ * so finding one entry normally means reading every header in front
+ * of it.  While an archive is read or written, we note where each
+ * entry starts; saved next to the archive, that list lets a later
+ * reader go straight to any entry with a single seek.
+ *
+ * The file is little-endian:
+ *    8 bytes   magic "LAINDEX1"
+ *    8 bytes   number of entries
+ *    8 bytes   size of the pathname table
+ *   24 bytes   per entry: header position, data offset and
+ *              offset of the pathname in the table
+ *              the pathname table; NUL-terminated strings
+ *
+ * Positions are offsets in the uncompressed archive, as reported by
+ * archive_read_header_position().
+ */
+
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+#ifdef HAVE_STDIO_H
+#include <stdio.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "archive.h"
+#include "archive_endian.h"
+#include "archive_index_private.h"
+#include "archive_private.h"
+
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+#define	INDEX_MAGIC		"LAINDEX1"
+#define	INDEX_HEADER_SIZE	24
+#define	INDEX_ENTRY_SIZE	24
+
+struct archive_index *
+__archive_index_new(void)
+{
+	return (calloc(1, sizeof(struct archive_index)));
+}
+
+void
+__archive_index_free(struct archive_index *idx)
+{
+	if (idx == NULL)
+		return;
+	free(idx->entries);
+	free(idx->sorted);
+	archive_string_free(&idx->names);
+	free(idx);
+}
+
+int
+__archive_index_add(struct archive_index *idx, const char *pathname,
+    int64_t header_position, int64_t data_offset)
+{
+	struct archive_index_entry *e;
+
+	if (idx->count >= idx->allocated) {
+		size_t n = idx->allocated < 64 ? 64 : idx->allocated * 2;
+
+		e = realloc(idx->entries, n * sizeof(*e));
+		if (e == NULL)
+			return (ARCHIVE_FATAL);
+		idx->entries = e;
+		idx->allocated = n;
+	}
+	e = &idx->entries[idx->count];
+	e->header_position = header_position;
+	e->data_offset = data_offset;
+	e->name_offset = archive_strlen(&idx->names);
+	if (archive_strncat(&idx->names, pathname, strlen(pathname)) == NULL
+	    || archive_strappend_char(&idx->names, '\0') == NULL)
+		return (ARCHIVE_FATAL);
+	idx->count++;
+	/* The sort order is rebuilt on the next lookup. */
+	free(idx->sorted);
+	idx->sorted = NULL;
+	return (ARCHIVE_OK);
+}
+
+static int
+cmp_name(const void *p1, const void *p2)
+{
+	const struct archive_index_sorted *s1 = p1, *s2 = p2;
+	int r;
+
+	r = strcmp(s1->name, s2->name);
+	if (r != 0)
+		return (r);
+	return (s1->i < s2->i ? -1 : s1->i > s2->i);
+}
+
+/*
+ * Look an entry up by pathname or, if pathname is NULL, by its
+ * position in the archive.  If a pathname occurs more than once, the
+ * last copy wins, just as it would if the archive were extracted.
+ */
+const struct archive_index_entry *
+__archive_index_find(struct archive_index *idx, const char *pathname,
+    int64_t index)
+{
+	size_t lo, hi, mid, i;
+	int r;
+
+	if (pathname == NULL) {
+		if (index < 0 || (uint64_t)index >= idx->count)
+			return (NULL);
+		return (&idx->entries[index]);
+	}
+	if (idx->count == 0)
+		return (NULL);
+	if (idx->sorted == NULL) {
+		idx->sorted = malloc(idx->count * sizeof(idx->sorted[0]));
+		if (idx->sorted == NULL)
+			return (NULL);
+		for (i = 0; i < idx->count; i++) {
+			idx->sorted[i].name =
+			    __archive_index_name(idx, &idx->entries[i]);
+			idx->sorted[i].i = i;
+		}
+		qsort(idx->sorted, idx->count, sizeof(idx->sorted[0]),
+		    cmp_name);
+	}
+
+	/* Find the first entry past the last one with this name. */
+	lo = 0;
+	hi = idx->count;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		r = strcmp(idx->sorted[mid].name, pathname);
+		if (r <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return (NULL);
+	if (strcmp(idx->sorted[lo - 1].name, pathname) != 0)
+		return (NULL);
+	return (&idx->entries[idx->sorted[lo - 1].i]);
+}
+
+/*
+ * Read an index file.  Returns ARCHIVE_WARN, without setting an
+ * error, if the file does not exist.
+ */
+int
+__archive_index_load(struct archive *a, struct archive_index *idx,
+    const char *filename)
+{
+	struct archive_index_entry *e;
+	struct stat st;
+	unsigned char *buff, *p;
+	uint64_t count, names_size;
+	size_t size, done, i;
+	ssize_t bytes;
+	int fd;
+
+	fd = open(filename, O_RDONLY | O_BINARY);
+	if (fd < 0) {
+		if (errno == ENOENT)
+			return (ARCHIVE_WARN);
+		archive_set_error(a, errno, "Failed to open '%s'", filename);
+		return (ARCHIVE_FATAL);
+	}
+	if (fstat(fd, &st) != 0) {
+		archive_set_error(a, errno, "Can't stat '%s'", filename);
+		close(fd);
+		return (ARCHIVE_FATAL);
+	}
+	if (st.st_size < INDEX_HEADER_SIZE || (uint64_t)st.st_size > SIZE_MAX)
+		goto corrupt;
+	size = (size_t)st.st_size;
+	buff = malloc(size);
+	if (buff == NULL) {
+		archive_set_error(a, ENOMEM, "Can't allocate index buffer");
+		close(fd);
+		return (ARCHIVE_FATAL);
+	}
+	for (done = 0; done < size; done += bytes) {
+		bytes = read(fd, buff + done, size - done);
+		if (bytes <= 0) {
+			if (bytes < 0)
+				archive_set_error(a, errno,
+				    "Error reading '%s'", filename);
+			else
+				archive_set_error(a, ARCHIVE_ERRNO_FILE_FORMAT,
+				    "Truncated index file '%s'", filename);
+			free(buff);
+			close(fd);
+			return (ARCHIVE_FATAL);
+		}
+	}
+	close(fd);
+	fd = -1;
+
+	count = archive_le64dec(buff + 8);
+	names_size = archive_le64dec(buff + 16);
+	if (memcmp(buff, INDEX_MAGIC, 8) != 0
+	    || count > (size - INDEX_HEADER_SIZE) / INDEX_ENTRY_SIZE
+	    || names_size != size - INDEX_HEADER_SIZE
+		- count * INDEX_ENTRY_SIZE
+	    || (names_size > 0 && buff[size - 1] != '\0')) {
+		free(buff);
+		goto corrupt;
+	}
+
+	idx->count = 0;
+	free(idx->sorted);
+	idx->sorted = NULL;
+	archive_string_empty(&idx->names);
+	e = realloc(idx->entries, (count ? count : 1) * sizeof(*e));
+	if (e != NULL) {
+		idx->entries = e;
+		idx->allocated = count ? count : 1;
+	}
+	if (e == NULL
+	    || archive_string_ensure(&idx->names, names_size + 1) == NULL) {
+		archive_set_error(a, ENOMEM, "Can't allocate index");
+		free(buff);
+		return (ARCHIVE_FATAL);
+	}
+	/* The table is full of NULs; archive_strncat() would stop early. */
+	memcpy(idx->names.s, buff + size - names_size, names_size);
+	idx->names.length = names_size;
+	p = buff + INDEX_HEADER_SIZE;
+	for (i = 0; i < count; i++, p += INDEX_ENTRY_SIZE) {
+		e[i].header_position = (int64_t)archive_le64dec(p);
+		e[i].data_offset = (int64_t)archive_le64dec(p + 8);
+		e[i].name_offset = (size_t)archive_le64dec(p + 16);
+		if (e[i].header_position < 0
+		    || e[i].data_offset < e[i].header_position
+		    || archive_le64dec(p + 16) >= names_size) {
+			free(buff);
+			goto corrupt;
+		}
+	}
+	idx->count = (size_t)count;
+	free(buff);
+	return (ARCHIVE_OK);
+
+corrupt:
+	if (fd >= 0)
+		close(fd);
+	archive_set_error(a, ARCHIVE_ERRNO_FILE_FORMAT,
+	    "'%s' is not a valid index file", filename);
+	return (ARCHIVE_FATAL);
+}
+
+int
+__archive_index_save(struct archive *a, struct archive_index *idx,
+    const char *filename)
+{
+	struct archive_string s, tmp;
+	unsigned char *p;
+	size_t i, done;
+	ssize_t bytes;
+	int fd, r = ARCHIVE_OK;
+
+	archive_string_init(&s);
+	if (archive_string_ensure(&s, INDEX_HEADER_SIZE
+	    + idx->count * INDEX_ENTRY_SIZE + archive_strlen(&idx->names))
+	    == NULL) {
+		archive_set_error(a, ENOMEM, "Can't allocate index buffer");
+		return (ARCHIVE_FATAL);
+	}
+	p = (unsigned char *)s.s;
+	memcpy(p, INDEX_MAGIC, 8);
+	archive_le64enc(p + 8, idx->count);
+	archive_le64enc(p + 16, archive_strlen(&idx->names));
+	p += INDEX_HEADER_SIZE;
+	for (i = 0; i < idx->count; i++, p += INDEX_ENTRY_SIZE) {
+		archive_le64enc(p, idx->entries[i].header_position);
+		archive_le64enc(p + 8, idx->entries[i].data_offset);
+		archive_le64enc(p + 16, idx->entries[i].name_offset);
+	}
+	if (archive_strlen(&idx->names) > 0)
+		memcpy(p, idx->names.s, archive_strlen(&idx->names));
+	s.length = p - (unsigned char *)s.s + archive_strlen(&idx->names);
+
+	/*
+	 * Write a temporary file and rename it over the old index, so
+	 * a crash or a full disk never leaves a truncated index behind.
+	 */
+	archive_string_init(&tmp);
+	archive_strcpy(&tmp, filename);
+	archive_strcat(&tmp, ".tmp");
+	fd = open(tmp.s, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666);
+	if (fd < 0) {
+		archive_set_error(a, errno, "Failed to open '%s'", tmp.s);
+		archive_string_free(&tmp);
+		archive_string_free(&s);
+		return (ARCHIVE_FATAL);
+	}
+	for (done = 0; done < s.length; done += bytes) {
+		bytes = write(fd, s.s + done, s.length - done);
+		if (bytes <= 0) {
+			archive_set_error(a, errno,
+			    "Error writing '%s'", tmp.s);
+			r = ARCHIVE_FATAL;
+			break;
+		}
+	}
+	if (close(fd) != 0 && r == ARCHIVE_OK) {
+		archive_set_error(a, errno, "Error writing '%s'", tmp.s);
+		r = ARCHIVE_FATAL;
+	}
+#if defined(_WIN32) && !defined(__CYGWIN__)
+	/* rename() won't replace an existing file here. */
+	if (r == ARCHIVE_OK)
+		unlink(filename);
+#endif
+	if (r == ARCHIVE_OK && rename(tmp.s, filename) != 0) {
+		archive_set_error(a, errno, "Failed to rename '%s' to '%s'",
+		    tmp.s, filename);
+		r = ARCHIVE_FATAL;
+	}
+	if (r != ARCHIVE_OK)
+		unlink(tmp.s);
+	archive_string_free(&tmp);
+	archive_string_free(&s);
+	return (r);
+}
@@ -0,0 +1,78 @@
+/*-
+ * Copyright (c) 2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#ifndef __LIBARCHIVE_BUILD
+#error This header is only to be used internally to libarchive.
+#endif
+
+#ifndef ARCHIVE_INDEX_PRIVATE_H_INCLUDED
+#define	ARCHIVE_INDEX_PRIVATE_H_INCLUDED
+
+#include "archive.h"
+#include "archive_string.h"
+
+/*
+ * A list of the entries of a streaming archive and where each one
+ * starts, kept in a sidecar file so that a later reader can jump
+ * straight to an entry instead of scanning the archive.
+ */
+
+struct archive_index_entry {
+	int64_t		 header_position; /* First header record. */
+	int64_t		 data_offset;	/* First byte of the body. */
+	size_t		 name_offset;	/* Pathname, in archive_index.names. */
+};
+
+/* An entry's pathname and number, for looking entries up by name. */
+struct archive_index_sorted {
+	const char	*name;
+	size_t		 i;
+};
+
+struct archive_index {
+	struct archive_index_entry *entries;
+	size_t			 count;
+	size_t			 allocated;
+	struct archive_string	 names;
+	/* Entries sorted by pathname; built on first lookup. */
+	struct archive_index_sorted *sorted;
+};
+
+struct archive_index *__archive_index_new(void);
+void	__archive_index_free(struct archive_index *);
+int	__archive_index_add(struct archive_index *, const char *pathname,
+	    int64_t header_position, int64_t data_offset);
+/* Returns the entry, or NULL if there is no such entry. */
+const struct archive_index_entry *__archive_index_find(
+	    struct archive_index *, const char *pathname, int64_t index);
+#define	__archive_index_name(idx, e)	((idx)->names.s + (e)->name_offset)
+int	__archive_index_load(struct archive *, struct archive_index *,
+	    const char *filename);
+int	__archive_index_save(struct archive *, struct archive_index *,
+	    const char *filename);
+
+#endif
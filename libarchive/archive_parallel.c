@@ -0,0 +1,271 @@
+/*-
+ * Copyright (c) 2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Ordered worker pool.
+ *
+ * Jobs are kept on a single list in submission order.  Workers take
+ * the first job nobody has started; the consumer waits for the first
+ * job on the list to be finished.  Worker threads are started as jobs
+ * arrive, up to the limit given to __archive_parallel_new().
+ */
+
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#include "archive.h"
+#include "archive_parallel_private.h"
+
+#ifdef HAVE_PTHREAD_H
+
+struct parallel_job {
+	struct parallel_job	*next;
+	void			(*run)(void *);
+	void			*job;
+	char			 done;
+};
+
+struct archive_parallel {
+	int			 max_threads;
+	int			 nthreads;
+	pthread_t		*threads;
+
+	/* Submission order; 'ready' is the first job not yet started. */
+	struct parallel_job	*first;
+	struct parallel_job	*last;
+	struct parallel_job	*ready;
+	int			 pending;
+
+	char			 stop;
+	pthread_mutex_t		 lock;
+	pthread_cond_t		 work;	/* Signalled when a job arrives. */
+	pthread_cond_t		 done;	/* Signalled when a job finishes. */
+};
+
+static void	*parallel_worker(void *);
+
+struct archive_parallel *
+__archive_parallel_new(int threads)
+{
+	struct archive_parallel *p;
+
+	if (threads <= 0)
+		return (NULL);
+	p = calloc(1, sizeof(*p));
+	if (p == NULL)
+		return (NULL);
+	p->threads = calloc(threads, sizeof(p->threads[0]));
+	if (p->threads == NULL) {
+		free(p);
+		return (NULL);
+	}
+	p->max_threads = threads;
+	if (pthread_mutex_init(&p->lock, NULL) != 0)
+		goto fail_mutex;
+	if (pthread_cond_init(&p->work, NULL) != 0)
+		goto fail_work;
+	if (pthread_cond_init(&p->done, NULL) != 0)
+		goto fail_done;
+	return (p);
+fail_done:
+	pthread_cond_destroy(&p->work);
+fail_work:
+	pthread_mutex_destroy(&p->lock);
+fail_mutex:
+	free(p->threads);
+	free(p);
+	return (NULL);
+}
+
+void
+__archive_parallel_free(struct archive_parallel *p)
+{
+	struct parallel_job *j;
+	int i;
+
+	if (p == NULL)
+		return;
+	pthread_mutex_lock(&p->lock);
+	p->stop = 1;
+	pthread_cond_broadcast(&p->work);
+	pthread_mutex_unlock(&p->lock);
+	for (i = 0; i < p->nthreads; i++)
+		pthread_join(p->threads[i], NULL);
+	/* The jobs themselves belong to the caller. */
+	while ((j = p->first) != NULL) {
+		p->first = j->next;
+		free(j);
+	}
+	pthread_cond_destroy(&p->done);
+	pthread_cond_destroy(&p->work);
+	pthread_mutex_destroy(&p->lock);
+	free(p->threads);
+	free(p);
+}
+
+static void *
+parallel_worker(void *arg)
+{
+	struct archive_parallel *p = arg;
+	struct parallel_job *j;
+
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		while (!p->stop && p->ready == NULL)
+			pthread_cond_wait(&p->work, &p->lock);
+		if (p->stop)
+			break;
+		j = p->ready;
+		p->ready = j->next;
+		pthread_mutex_unlock(&p->lock);
+		(j->run)(j->job);
+		pthread_mutex_lock(&p->lock);
+		j->done = 1;
+		pthread_cond_broadcast(&p->done);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return (NULL);
+}
+
+int
+__archive_parallel_submit(struct archive_parallel *p, void (*run)(void *),
+    void *job)
+{
+	struct parallel_job *j;
+
+	j = calloc(1, sizeof(*j));
+	if (j == NULL)
+		return (ARCHIVE_FATAL);
+	j->run = run;
+	j->job = job;
+	pthread_mutex_lock(&p->lock);
+	if (p->last != NULL)
+		p->last->next = j;
+	else
+		p->first = j;
+	p->last = j;
+	if (p->ready == NULL)
+		p->ready = j;
+	p->pending++;
+	/* Start another worker if everyone is busy. */
+	if (p->nthreads < p->max_threads && p->pending > p->nthreads
+	    && pthread_create(&p->threads[p->nthreads], NULL,
+		parallel_worker, p) == 0)
+		p->nthreads++;
+	if (p->nthreads == 0) {
+		/* Couldn't start any thread; do it ourselves. */
+		p->ready = j->next;
+		pthread_mutex_unlock(&p->lock);
+		(run)(job);
+		pthread_mutex_lock(&p->lock);
+		j->done = 1;
+	} else
+		pthread_cond_signal(&p->work);
+	pthread_mutex_unlock(&p->lock);
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_parallel_pending(struct archive_parallel *p)
+{
+	int pending;
+
+	pthread_mutex_lock(&p->lock);
+	pending = p->pending;
+	pthread_mutex_unlock(&p->lock);
+	return (pending);
+}
+
+void *
+__archive_parallel_next(struct archive_parallel *p)
+{
+	struct parallel_job *j;
+	void *job;
+
+	pthread_mutex_lock(&p->lock);
+	j = p->first;
+	if (j == NULL) {
+		pthread_mutex_unlock(&p->lock);
+		return (NULL);
+	}
+	while (!j->done)
+		pthread_cond_wait(&p->done, &p->lock);
+	p->first = j->next;
+	if (p->first == NULL)
+		p->last = NULL;
+	p->pending--;
+	pthread_mutex_unlock(&p->lock);
+	job = j->job;
+	free(j);
+	return (job);
+}
+
+#else
+
+struct archive_parallel *
+__archive_parallel_new(int threads)
+{
+	(void)threads; /* UNUSED */
+	return (NULL);
+}
+
+void
+__archive_parallel_free(struct archive_parallel *p)
+{
+	(void)p; /* UNUSED */
+}
+
+int
+__archive_parallel_submit(struct archive_parallel *p, void (*run)(void *),
+    void *job)
+{
+	(void)p; /* UNUSED */
+	(void)run; /* UNUSED */
+	(void)job; /* UNUSED */
+	return (ARCHIVE_FATAL);
+}
+
+int
+__archive_parallel_pending(struct archive_parallel *p)
+{
+	(void)p; /* UNUSED */
+	return (0);
+}
+
+void *
+__archive_parallel_next(struct archive_parallel *p)
+{
+	(void)p; /* UNUSED */
+	return (NULL);
+}
+
+#endif /* HAVE_PTHREAD_H */
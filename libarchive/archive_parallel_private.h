@@ -0,0 +1,59 @@
+/*-
+ * Copyright (c) 2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *
+ * $FreeBSD$
+ */
+
+#ifndef __LIBARCHIVE_BUILD
+#error This header is only to be used internally to libarchive.
+#endif
+
+#ifndef ARCHIVE_PARALLEL_PRIVATE_H_INCLUDED
+#define	ARCHIVE_PARALLEL_PRIVATE_H_INCLUDED
+
+/*
+ * A pool of worker threads that run independent jobs and hand them
+ * back in the order they were submitted.  Filters use this to
+ * (de)compress several blocks at once while still producing their
+ * output in sequence.
+ *
+ * A job is just a pointer owned by the caller; the pool calls
+ * run(job) on some worker thread.  Every submitted job must be
+ * collected with __archive_parallel_next() before the pool is freed.
+ *
+ * Without pthreads, __archive_parallel_new() returns NULL and callers
+ * do the work themselves.
+ */
+struct archive_parallel;
+
+struct archive_parallel *__archive_parallel_new(int threads);
+void	__archive_parallel_free(struct archive_parallel *);
+int	__archive_parallel_submit(struct archive_parallel *,
+	    void (*run)(void *), void *job);
+/* Number of jobs submitted but not yet collected. */
+int	__archive_parallel_pending(struct archive_parallel *);
+/* Wait for the oldest job to finish and return it; NULL if none. */
+void	*__archive_parallel_next(struct archive_parallel *);
+
+#endif
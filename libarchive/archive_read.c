@@ -37,6 +37,9 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read.c 201157 2009-12-29 05:30:2
 #ifdef HAVE_ERRNO_H
 #include <errno.h>
 #endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
 #include <stdio.h>
 #ifdef HAVE_STDLIB_H
 #include <stdlib.h>
@@ -44,12 +47,15 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read.c 201157 2009-12-29 05:30:2
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
+#include <time.h>
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
 
 #include "archive.h"
 #include "archive_entry.h"
+#include "archive_entry_private.h"
+#include "archive_index_private.h"
 #include "archive_private.h"
 #include "archive_read_private.h"
 
@@ -73,6 +79,12 @@ static int	_archive_read_next_header(struct archive *,
 static int	_archive_read_next_header2(struct archive *,
 		    struct archive_entry *);
 static int64_t  advance_file_pointer(struct archive_read_filter *, int64_t);
+static ssize_t	filter_read(struct archive_read_filter *, const void **);
+struct pipeline_stage;
+static void	setup_pipeline(struct archive_read *);
+static void	stop_pipeline(struct archive_read *);
+static void	free_pipeline_stage(struct pipeline_stage *);
+static ssize_t	pipeline_read(struct archive_read_filter *, const void **);
 
 static struct archive_vtable *
 archive_read_vtable(void)
@@ -170,21 +182,26 @@ archive_read_open2(struct archive *a, void *client_data,
 static ssize_t
 client_read_proxy(struct archive_read_filter *self, const void **buff)
 {
+	struct archive_read_client *client =
+	    (struct archive_read_client *)self->data;
 	ssize_t r;
-	r = (self->archive->client.reader)(&self->archive->archive,
-	    self->data, buff);
+	r = (client->reader)(&self->archive->archive,
+	    client->data, buff);
 	return (r);
 }
 
 static int64_t
 client_skip_proxy(struct archive_read_filter *self, int64_t request)
 {
+	struct archive_read_client *client =
+	    (struct archive_read_client *)self->data;
+
 	if (request < 0)
 		__archive_errx(1, "Negative skip requested.");
 	if (request == 0)
 		return 0;
 
-	if (self->archive->client.skipper != NULL) {
+	if (client->skipper != NULL) {
 		/* Seek requests over 1GiB are broken down into
 		 * multiple seeks.  This avoids overflows when the
 		 * requests get passed through 32-bit arguments. */
@@ -194,15 +211,15 @@ client_skip_proxy(struct archive_read_filter *self, int64_t request)
 			int64_t get, ask = request;
 			if (ask > skip_limit)
 				ask = skip_limit;
-			get = (self->archive->client.skipper)(&self->archive->archive,
-			    self->data, ask);
+			get = (client->skipper)(&self->archive->archive,
+			    client->data, ask);
 			if (get == 0)
 				return (total);
 			request -= get;
 			total += get;
 		}
 		return total;
-	} else if (self->archive->client.seeker != NULL
+	} else if (client->seeker != NULL
 		&& request > 64 * 1024) {
 		/* If the client provided a seeker but not a skipper,
 		 * we can use the seeker to skip forward.
@@ -216,8 +233,8 @@ client_skip_proxy(struct archive_read_filter *self, int64_t request)
 		 * only do this for skips of over 64k.
 		 */
 		int64_t before = self->position;
-		int64_t after = (self->archive->client.seeker)(&self->archive->archive,
-		    self->data, request, SEEK_CUR);
+		int64_t after = (client->seeker)(&self->archive->archive,
+		    client->data, request, SEEK_CUR);
 		if (after != before + request)
 			return ARCHIVE_FATAL;
 		return after - before;
@@ -228,25 +245,30 @@ client_skip_proxy(struct archive_read_filter *self, int64_t request)
 static int64_t
 client_seek_proxy(struct archive_read_filter *self, int64_t offset, int whence)
 {
+	struct archive_read_client *client =
+	    (struct archive_read_client *)self->data;
+
 	/* DO NOT use the skipper here!  If we transparently handled
 	 * forward seek here by using the skipper, that will break
 	 * other libarchive code that assumes a successful forward
 	 * seek means it can also seek backwards.
 	 */
-	if (self->archive->client.seeker == NULL)
+	if (client->seeker == NULL)
 		return (ARCHIVE_FAILED);
-	return (self->archive->client.seeker)(&self->archive->archive,
-	    self->data, offset, whence);
+	return (client->seeker)(&self->archive->archive,
+	    client->data, offset, whence);
 }
 
 static int
 client_close_proxy(struct archive_read_filter *self)
 {
+	struct archive_read_client *client =
+	    (struct archive_read_client *)self->data;
 	int r = ARCHIVE_OK;
 
-	if (self->archive->client.closer != NULL)
-		r = (self->archive->client.closer)((struct archive *)self->archive,
-		    self->data);
+	if (client->closer != NULL)
+		r = (client->closer)((struct archive *)self->archive,
+		    client->data);
 	return (r);
 }
 
@@ -350,7 +372,12 @@ archive_read_open1(struct archive *_a)
 	filter->bidder = NULL;
 	filter->upstream = NULL;
 	filter->archive = a;
-	filter->data = a->client.data;
+	/*
+	 * The callbacks are found through the filter rather than
+	 * filter->archive, which is a private error sink when the
+	 * client runs on a pipeline thread.
+	 */
+	filter->data = &a->client;
 	filter->read = client_read_proxy;
 	filter->skip = client_skip_proxy;
 	filter->seek = client_seek_proxy;
@@ -365,6 +392,8 @@ archive_read_open1(struct archive *_a)
 		a->archive.state = ARCHIVE_STATE_FATAL;
 		return (ARCHIVE_FATAL);
 	}
+	if (a->client_options.pipeline > 0)
+		setup_pipeline(a);
 
 	slot = choose_format(a);
 	if (slot < 0) {
@@ -440,6 +469,193 @@ choose_filters(struct archive_read *a)
 	}
 }
 
+/*
+ * Pipelined filter chain.
+ *
+ * Normally every filter runs on the caller's thread, pulling data
+ * through the chain only when the format reader asks for it.  With
+ * the "pipeline" read option, each transforming filter instead runs
+ * on its own helper thread that keeps a few blocks of output queued
+ * for the next stage.  The client read callback runs on the thread
+ * of the lowest filter.
+ *
+ * Each filter F is hidden behind a proxy filter P that takes its
+ * place in the chain.  P hands out blocks from the queue; the helper
+ * thread fills the queue by pulling on F with the usual
+ * __archive_read_filter_ahead()/__archive_read_filter_consume().
+ * So every filter structure is only ever touched by one thread.
+ *
+ * Filters report errors through filter->archive.  To keep helper
+ * threads from racing on the error string of the real archive, each
+ * helper thread gets a private archive object to report errors to;
+ * the proxy copies the error to the downstream archive object when
+ * it hands the failure on.
+ */
+#define PIPELINE_BLOCK_SIZE	(128 * 1024)
+
+struct pipeline_stage {
+	struct archive_read_filter	*filter;	/* The hidden filter. */
+	struct archive_read		*shadow;	/* Its error sink. */
+	struct archive_read_prefetch	*queue;
+#ifdef HAVE_PTHREAD_H
+	/* Copy of the hidden filter's statistics for other threads. */
+	pthread_mutex_t			 stats_lock;
+	struct archive_read_stats	 stats;
+	char				 timing; /* Turned on later. */
+#endif
+};
+
+/* Runs on the helper thread: copy the next block of output. */
+static ssize_t
+pipeline_fill(void *cookie, void *buff, size_t size)
+{
+	struct pipeline_stage *stage = (struct pipeline_stage *)cookie;
+	struct archive_read_filter *f = stage->filter;
+	const void *p;
+	ssize_t avail;
+
+	p = __archive_read_filter_ahead(f, 1, &avail);
+#ifdef HAVE_PTHREAD_H
+	pthread_mutex_lock(&stage->stats_lock);
+	stage->stats = f->stats;
+	stage->shadow->client_options.timing = stage->timing;
+	pthread_mutex_unlock(&stage->stats_lock);
+#endif
+	if (p == NULL)
+		return (avail < 0 ? -1 : 0);
+	if ((size_t)avail > size)
+		avail = size;
+	memcpy(buff, p, avail);
+	if (__archive_read_filter_consume(f, avail) < 0)
+		return (-1);
+	return (avail);
+}
+
+static ssize_t
+pipeline_read(struct archive_read_filter *self, const void **buff)
+{
+	struct pipeline_stage *stage = (struct pipeline_stage *)self->data;
+	ssize_t bytes_read;
+
+	bytes_read = __archive_read_prefetch_read(stage->queue, buff);
+	/* The helper thread has stopped; its error is safe to read. */
+	if (bytes_read < 0)
+		archive_copy_error(&self->archive->archive,
+		    &stage->shadow->archive);
+	return (bytes_read);
+}
+
+static int64_t
+pipeline_seek(struct archive_read_filter *self, int64_t offset, int whence)
+{
+	struct pipeline_stage *stage = (struct pipeline_stage *)self->data;
+	int64_t r;
+
+	/* Park the helper thread; it restarts on the next read. */
+	__archive_read_prefetch_stop(stage->queue);
+	r = __archive_read_filter_seek(stage->filter, offset, whence);
+	if (r < 0)
+		archive_copy_error(&self->archive->archive,
+		    &stage->shadow->archive);
+	return (r);
+}
+
+static void
+free_pipeline_stage(struct pipeline_stage *stage)
+{
+	if (stage == NULL)
+		return;
+#ifdef HAVE_PTHREAD_H
+	if (stage->queue != NULL)
+		pthread_mutex_destroy(&stage->stats_lock);
+#endif
+	__archive_read_prefetch_free(stage->queue);
+	if (stage->shadow != NULL) {
+		archive_string_free(&stage->shadow->archive.error_string);
+		free(stage->shadow);
+	}
+	free(stage);
+}
+
+/*
+ * Put a proxy in front of every transforming filter.  If anything
+ * fails, we just leave the remaining filters synchronous.
+ */
+static void
+setup_pipeline(struct archive_read *a)
+{
+	struct archive_read_filter **fp, *f, *proxy;
+	struct archive_read *consumer = a;
+	struct pipeline_stage *stage;
+
+	for (fp = &a->filter; (f = *fp) != NULL && f->bidder != NULL;
+	    fp = &f->upstream) {
+		proxy = calloc(1, sizeof(*proxy));
+		stage = calloc(1, sizeof(*stage));
+		if (stage != NULL) {
+			stage->filter = f;
+			stage->shadow = calloc(1, sizeof(*stage->shadow));
+			stage->queue = __archive_read_prefetch_new2(
+			    PIPELINE_BLOCK_SIZE, a->client_options.pipeline,
+			    pipeline_fill, stage);
+#ifdef HAVE_PTHREAD_H
+			if (stage->queue != NULL)
+				pthread_mutex_init(&stage->stats_lock, NULL);
+#endif
+		}
+		if (proxy == NULL || stage == NULL || stage->shadow == NULL
+		    || stage->queue == NULL) {
+			free_pipeline_stage(stage);
+			free(proxy);
+			break;
+		}
+		stage->shadow->archive.magic = ARCHIVE_READ_MAGIC;
+		stage->shadow->archive.state = ARCHIVE_STATE_DATA;
+		stage->shadow->archive.vtable = a->archive.vtable;
+		stage->shadow->client_options.timing = a->client_options.timing;
+#ifdef HAVE_PTHREAD_H
+		stage->timing = a->client_options.timing;
+#endif
+
+		proxy->upstream = f;
+		proxy->archive = consumer;
+		proxy->data = stage;
+		proxy->read = pipeline_read;
+		if (f->seek != NULL)
+			proxy->seek = pipeline_seek;
+		proxy->name = f->name;
+		proxy->code = f->code;
+		proxy->position = f->position;
+		*fp = proxy;
+
+		f->piped = 1;
+		f->archive = stage->shadow;
+		consumer = stage->shadow;
+	}
+	/* Whatever feeds the lowest stage now runs on its thread. */
+	if (f != NULL)
+		f->archive = consumer;
+}
+
+/*
+ * Stop all helper threads, top stage first so each one can finish
+ * the block it is working on, and hand the filters back to the
+ * caller's thread.
+ */
+static void
+stop_pipeline(struct archive_read *a)
+{
+	struct archive_read_filter *f;
+
+	for (f = a->filter; f != NULL; f = f->upstream) {
+		if (f->read == pipeline_read && f->data != NULL)
+			__archive_read_prefetch_stop(
+			    ((struct pipeline_stage *)f->data)->queue);
+	}
+	for (f = a->filter; f != NULL; f = f->upstream)
+		f->archive = a;
+}
+
 /*
  * Read header of next entry.
  */
@@ -500,6 +716,22 @@ _archive_read_next_header2(struct archive *_a, struct archive_entry *entry)
 		break;
 	}
 
+	if (a->index_filename != NULL && a->archive.state == ARCHIVE_STATE_DATA
+	    && archive_entry_pathname(entry) != NULL) {
+		/* Entries revisited after a seek are already there. */
+		size_t n = a->index->count;
+		if ((n == 0 || a->index->entries[n - 1].header_position
+		    < a->header_position)
+		    && __archive_index_add(a->index,
+			archive_entry_pathname(entry), a->header_position,
+			a->filter->position) != ARCHIVE_OK) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "Can't allocate index entry");
+			a->archive.state = ARCHIVE_STATE_FATAL;
+			return (ARCHIVE_FATAL);
+		}
+	}
+
 	a->read_data_output_offset = 0;
 	a->read_data_remaining = 0;
 	/* EOF always wins; otherwise return the worst error. */
@@ -517,6 +749,188 @@ _archive_read_next_header(struct archive *_a, struct archive_entry **entryp)
 	return ret;
 }
 
+/*
+ * Jump straight to an entry.  Only formats that keep a directory of
+ * all entries in memory and read from a seekable source can do this.
+ */
+static int
+read_seek_entry(struct archive *_a, const char *pathname, int64_t index,
+    struct archive_entry **entryp, const char *fn)
+{
+	struct archive_read *a = (struct archive_read *)_a;
+	struct archive_entry *entry, tmp;
+	int r;
+
+	*entryp = NULL;
+	archive_check_magic(_a, ARCHIVE_READ_MAGIC,
+	    ARCHIVE_STATE_HEADER | ARCHIVE_STATE_DATA | ARCHIVE_STATE_EOF,
+	    fn);
+	archive_clear_error(&a->archive);
+	if (a->format == NULL || a->format->seek_entry == NULL) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Random access to entries is not supported "
+		    "for this archive");
+		return (ARCHIVE_FAILED);
+	}
+
+	/* The format reads the header into a scratch entry, so a failed
+	 * lookup leaves the current entry and its data alone. */
+	entry = archive_entry_new2(&a->archive);
+	if (entry == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate entry");
+		return (ARCHIVE_FATAL);
+	}
+	r = (a->format->seek_entry)(a, entry, pathname, index);
+	switch (r) {
+	case ARCHIVE_EOF:
+		/* Formats should not do this, but be safe. */
+		r = ARCHIVE_FAILED;
+		break;
+	case ARCHIVE_OK:
+	case ARCHIVE_WARN:
+		/* Swap the contents, so that a->entry stays the entry
+		 * the client already has a pointer to. */
+		tmp = *a->entry;
+		*a->entry = *entry;
+		*entry = tmp;
+		++_a->file_count;
+		a->archive.state = ARCHIVE_STATE_DATA;
+		a->read_data_output_offset = 0;
+		a->read_data_remaining = 0;
+		*entryp = a->entry;
+		break;
+	case ARCHIVE_FATAL:
+		a->archive.state = ARCHIVE_STATE_FATAL;
+		break;
+	}
+	archive_entry_free(entry);
+	return (r);
+}
+
+int
+archive_read_seek_entry(struct archive *_a, const char *pathname,
+    struct archive_entry **entryp)
+{
+	return (read_seek_entry(_a, pathname, 0, entryp,
+	    "archive_read_seek_entry"));
+}
+
+int
+archive_read_seek_entry_index(struct archive *_a, int64_t index,
+    struct archive_entry **entryp)
+{
+	if (index < 0) {
+		*entryp = NULL;
+		archive_set_error(_a, EINVAL, "Negative entry index");
+		return (ARCHIVE_FAILED);
+	}
+	return (read_seek_entry(_a, NULL, index, entryp,
+	    "archive_read_seek_entry_index"));
+}
+
+/*
+ * Use a sidecar index to jump to entries in formats that have no
+ * directory of their own.  An existing index is loaded right away;
+ * otherwise one is built while the archive is read and written out
+ * by archive_read_close() once the end of the archive is reached.
+ */
+int
+archive_read_set_index_file(struct archive *_a, const char *filename)
+{
+	struct archive_read *a = (struct archive_read *)_a;
+	int r;
+
+	archive_check_magic(_a, ARCHIVE_READ_MAGIC, ARCHIVE_STATE_NEW,
+	    "archive_read_set_index_file");
+	__archive_index_free(a->index);
+	free(a->index_filename);
+	a->index_filename = NULL;
+	a->index = __archive_index_new();
+	if (a->index == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate index");
+		return (ARCHIVE_FATAL);
+	}
+	r = __archive_index_load(_a, a->index, filename);
+	if (r == ARCHIVE_WARN) {
+		/* No index yet; build one. */
+		a->index_filename = strdup(filename);
+		if (a->index_filename == NULL) {
+			archive_set_error(&a->archive, ENOMEM,
+			    "Can't allocate index");
+			return (ARCHIVE_FATAL);
+		}
+		r = ARCHIVE_OK;
+	}
+	if (r != ARCHIVE_OK) {
+		__archive_index_free(a->index);
+		a->index = NULL;
+	}
+	return (r);
+}
+
+/*
+ * Helpers for a format's seek_entry method.  The first one moves the
+ * read position to the first header of the indexed entry and returns
+ * the pathname recorded for it; once the format has read the header,
+ * the second one makes sure the index really describes this archive.
+ */
+int
+__archive_read_index_seek(struct archive_read *a, const char *pathname,
+    int64_t index, const char **name)
+{
+	const struct archive_index_entry *e;
+	int64_t r;
+
+	if (a->index == NULL) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Random access to entries requires an index");
+		return (ARCHIVE_FAILED);
+	}
+	e = __archive_index_find(a->index, pathname, index);
+	if (e == NULL) {
+		if (pathname != NULL)
+			archive_set_error(&a->archive, ENOENT,
+			    "%s: not found in index", pathname);
+		else
+			archive_set_error(&a->archive, ENOENT,
+			    "Entry %jd: not found in index", (intmax_t)index);
+		return (ARCHIVE_FAILED);
+	}
+	r = __archive_read_seek(a, e->header_position, SEEK_SET);
+	if (r == ARCHIVE_FAILED) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Random access to entries requires a seekable "
+		    "uncompressed archive");
+		return (ARCHIVE_FAILED);
+	}
+	if (r < 0)
+		return (ARCHIVE_FATAL);
+	a->header_position = e->header_position;
+	*name = __archive_index_name(a->index, e);
+	return (ARCHIVE_OK);
+}
+
+int
+__archive_read_index_verify(struct archive_read *a,
+    struct archive_entry *entry, const char *name, int r)
+{
+	const char *p;
+
+	p = archive_entry_pathname(entry);
+	if (r < ARCHIVE_WARN || r == ARCHIVE_EOF || r == ARCHIVE_RETRY
+	    || p == NULL || strcmp(p, name) != 0) {
+		/* There is no telling where we are now. */
+		if (r >= ARCHIVE_WARN || archive_error_string(&a->archive)
+		    == NULL)
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "Index does not match the archive");
+		return (ARCHIVE_FATAL);
+	}
+	return (r);
+}
+
 /*
  * Allow each registered format to bid on whether it wants to handle
  * the next entry.  Return index of winning bidder.
@@ -730,6 +1144,8 @@ close_filters(struct archive_read *a)
 {
 	struct archive_read_filter *f = a->filter;
 	int r = ARCHIVE_OK;
+	if (a->client_options.pipeline > 0)
+		stop_pipeline(a);
 	/* Close each filter in the pipeline. */
 	while (f != NULL) {
 		struct archive_read_filter *t = f->upstream;
@@ -749,8 +1165,14 @@ close_filters(struct archive_read *a)
 static void
 free_filters(struct archive_read *a)
 {
+	/* We may get here without a close if the archive went fatal. */
+	if (a->client_options.pipeline > 0)
+		stop_pipeline(a);
 	while (a->filter != NULL) {
 		struct archive_read_filter *t = a->filter->upstream;
+		if (a->filter->read == pipeline_read)
+			free_pipeline_stage(
+			    (struct pipeline_stage *)a->filter->data);
 		free(a->filter);
 		a->filter = t;
 	}
@@ -766,7 +1188,8 @@ _archive_filter_count(struct archive *_a)
 	struct archive_read_filter *p = a->filter;
 	int count = 0;
 	while(p) {
-		count++;
+		if (!p->piped)
+			count++;
 		p = p->upstream;
 	}
 	return count;
@@ -786,6 +1209,11 @@ _archive_read_close(struct archive *_a)
 	if (a->archive.state == ARCHIVE_STATE_CLOSED)
 		return (ARCHIVE_OK);
 	archive_clear_error(&a->archive);
+
+	/* An index is only useful if it covers the whole archive. */
+	if (a->index_filename != NULL
+	    && a->archive.state == ARCHIVE_STATE_EOF)
+		r = __archive_index_save(_a, a->index, a->index_filename);
 	a->archive.state = ARCHIVE_STATE_CLOSED;
 
 	/* TODO: Clean up the formatters. */
@@ -842,6 +1270,8 @@ _archive_read_free(struct archive *_a)
 		}
 	}
 
+	__archive_index_free(a->index);
+	free(a->index_filename);
 	archive_string_free(&a->archive.error_string);
 	if (a->entry)
 		archive_entry_free(a->entry);
@@ -868,9 +1298,12 @@ get_filter(struct archive *_a, int n)
 	}
 	if (n < 0)
 		return NULL;
-	while (n > 0 && f != NULL) {
+	/* Filters running on a pipeline thread are reported through
+	 * the proxy in front of them. */
+	while (f != NULL && (n > 0 || f->piped)) {
+		if (!f->piped)
+			--n;
 		f = f->upstream;
-		--n;
 	}
 	return (f);
 }
@@ -896,6 +1329,58 @@ _archive_filter_bytes(struct archive *_a, int n)
 	return f == NULL ? -1 : f->position;
 }
 
+int
+archive_read_get_stats(struct archive *_a, int n,
+    struct archive_read_stats *stats)
+{
+	struct archive_read *a = (struct archive_read *)_a;
+	struct archive_read_filter *f;
+
+	archive_check_magic(_a, ARCHIVE_READ_MAGIC,
+	    ARCHIVE_STATE_ANY, "archive_read_get_stats");
+	/*
+	 * Reading the clocks costs more than the other counters
+	 * together, so they are only read once someone is looking.
+	 */
+	if (!a->client_options.timing) {
+		a->client_options.timing = 1;
+#ifdef HAVE_PTHREAD_H
+		for (f = a->filter; f != NULL; f = f->upstream) {
+			struct pipeline_stage *stage;
+
+			if (f->read != pipeline_read || f->data == NULL)
+				continue;
+			stage = (struct pipeline_stage *)f->data;
+			pthread_mutex_lock(&stage->stats_lock);
+			stage->timing = 1;
+			pthread_mutex_unlock(&stage->stats_lock);
+		}
+#endif
+	}
+	f = get_filter(_a, n);
+	if (f == NULL) {
+		archive_set_error(_a, EINVAL, "No filter %d", n);
+		return (ARCHIVE_FAILED);
+	}
+	*stats = f->stats;
+#ifdef HAVE_PTHREAD_H
+	if (f->read == pipeline_read && f->data != NULL) {
+		/*
+		 * The proxy only waits for the helper thread; report
+		 * the time the hidden filter spent doing the work.
+		 */
+		struct pipeline_stage *stage = (struct pipeline_stage *)f->data;
+
+		pthread_mutex_lock(&stage->stats_lock);
+		stats->read_calls = stage->stats.read_calls;
+		stats->read_wall_usec = stage->stats.read_wall_usec;
+		stats->read_cpu_usec = stage->stats.read_cpu_usec;
+		pthread_mutex_unlock(&stage->stats_lock);
+	}
+#endif
+	return (ARCHIVE_OK);
+}
+
 /*
  * Used internally by read format handlers to register their bid and
  * initialization functions.
@@ -909,6 +1394,8 @@ __archive_read_register_format(struct archive_read *a,
     int (*read_header)(struct archive_read *, struct archive_entry *),
     int (*read_data)(struct archive_read *, const void **, size_t *, int64_t *),
     int (*read_data_skip)(struct archive_read *),
+    int (*seek_entry)(struct archive_read *, struct archive_entry *,
+	const char *, int64_t),
     int (*cleanup)(struct archive_read *))
 {
 	int i, number_slots;
@@ -928,6 +1415,7 @@ __archive_read_register_format(struct archive_read *a,
 			a->formats[i].read_header = read_header;
 			a->formats[i].read_data = read_data;
 			a->formats[i].read_data_skip = read_data_skip;
+			a->formats[i].seek_entry = seek_entry;
 			a->formats[i].cleanup = cleanup;
 			a->formats[i].data = format_data;
 			a->formats[i].name = name;
@@ -999,6 +1487,55 @@ __archive_read_get_bidder(struct archive_read *a,
  *    code that has uncertain look-ahead needs.
  */
 
+/*
+ * Elapsed and CPU time of the calling thread, in microseconds.
+ */
+static void
+stats_clock(int64_t *wall, int64_t *cpu)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+
+#ifdef CLOCK_MONOTONIC
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+	clock_gettime(CLOCK_REALTIME, &ts);
+#endif
+	*wall = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#ifdef CLOCK_THREAD_CPUTIME_ID
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	*cpu = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+	return;
+#endif
+#else
+	*wall = (int64_t)time(NULL) * 1000000;
+#endif
+	/* Fall back to the CPU time of the whole process. */
+	*cpu = (int64_t)((double)clock() * 1000000 / CLOCKS_PER_SEC);
+}
+
+/*
+ * Call the read callback of a filter, keeping track of the time
+ * spent in it if the "timing" option or archive_read_get_stats()
+ * asked for that.
+ */
+static ssize_t
+filter_read(struct archive_read_filter *filter, const void **buff)
+{
+	int64_t wall, cpu, wall_end, cpu_end;
+	ssize_t bytes_read;
+
+	filter->stats.read_calls++;
+	if (!filter->archive->client_options.timing)
+		return ((filter->read)(filter, buff));
+	stats_clock(&wall, &cpu);
+	bytes_read = (filter->read)(filter, buff);
+	stats_clock(&wall_end, &cpu_end);
+	filter->stats.read_wall_usec += wall_end - wall;
+	filter->stats.read_cpu_usec += cpu_end - cpu;
+	return (bytes_read);
+}
+
 /*
  * Looks ahead in the input stream:
  *  * If 'avail' pointer is provided, that returns number of bytes available
@@ -1085,8 +1622,7 @@ __archive_read_filter_ahead(struct archive_read_filter *filter,
 					*avail = 0;
 				return (NULL);
 			}
-			bytes_read = (filter->read)(filter,
-			    &filter->client_buff);
+			bytes_read = filter_read(filter, &filter->client_buff);
 			if (bytes_read < 0) {		/* Read error. */
 				filter->client_total = filter->client_avail = 0;
 				filter->client_next = filter->client_buff = NULL;
@@ -1158,6 +1694,7 @@ __archive_read_filter_ahead(struct archive_read_filter *filter,
 				free(filter->buffer);
 				filter->next = filter->buffer = p;
 				filter->buffer_size = s;
+				filter->stats.buffer_reallocs++;
 			}
 
 			/* We can add client data to copy buffer. */
@@ -1178,6 +1715,7 @@ __archive_read_filter_ahead(struct archive_read_filter *filter,
 			filter->client_avail -= tocopy;
 			/* add it to copy buffer. */
 			filter->avail += tocopy;
+			filter->stats.bytes_copied += tocopy;
 		}
 	}
 }
@@ -1247,9 +1785,11 @@ advance_file_pointer(struct archive_read_filter *filter, int64_t request)
 		request -= min;
 		filter->position += min;
 		total_bytes_skipped += min;
+		filter->stats.bytes_zero_copy += min;
 	}
 	if (request == 0)
 		return (total_bytes_skipped);
+	filter->stats.skip_calls++;
 
 	/* If there's an optimized skip function, use it. */
 	if (filter->skip != NULL) {
@@ -1259,6 +1799,7 @@ advance_file_pointer(struct archive_read_filter *filter, int64_t request)
 			return (bytes_skipped);
 		}
 		filter->position += bytes_skipped;
+		filter->stats.skip_bytes += bytes_skipped;
 		total_bytes_skipped += bytes_skipped;
 		request -= bytes_skipped;
 		if (request == 0)
@@ -1267,7 +1808,7 @@ advance_file_pointer(struct archive_read_filter *filter, int64_t request)
 
 	/* Use ordinary reads as necessary to complete the request. */
 	for (;;) {
-		bytes_read = (filter->read)(filter, &filter->client_buff);
+		bytes_read = filter_read(filter, &filter->client_buff);
 		if (bytes_read < 0) {
 			filter->client_buff = NULL;
 			filter->fatal = 1;
@@ -1287,10 +1828,12 @@ advance_file_pointer(struct archive_read_filter *filter, int64_t request)
 			filter->client_total = bytes_read;
 			total_bytes_skipped += request;
 			filter->position += request;
+			filter->stats.skip_bytes += request;
 			return (total_bytes_skipped);
 		}
 
 		filter->position += bytes_read;
+		filter->stats.skip_bytes += bytes_read;
 		total_bytes_skipped += bytes_read;
 		request -= bytes_read;
 	}
@@ -1314,6 +1857,7 @@ __archive_read_filter_seek(struct archive_read_filter *filter, int64_t offset, i
 		return (ARCHIVE_FATAL);
 	if (filter->seek == NULL)
 		return (ARCHIVE_FAILED);
+	filter->stats.seek_calls++;
 	r = filter->seek(filter, offset, whence);
 	if (r >= 0) {
 		/*
@@ -49,12 +49,16 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read_open_fd.c 201103 2009-12-28
 #endif
 
 #include "archive.h"
+#include "archive_private.h"
+#include "archive_read_private.h"
 
 struct read_fd_data {
 	int	 fd;
 	size_t	 block_size;
 	char	 use_lseek;
 	void	*buffer;
+	/* Blocks read ahead on a helper thread, if requested. */
+	struct archive_read_prefetch *prefetch;
 };
 
 static int	file_close(struct archive *, void *);
@@ -85,6 +89,9 @@ archive_read_open_fd(struct archive *a, int fd, size_t block_size)
 	mine->block_size = block_size;
 	mine->buffer = b;
 	mine->fd = fd;
+	/* If this fails, we just read synchronously. */
+	mine->prefetch = __archive_read_prefetch_new(fd, block_size,
+	    ((struct archive_read *)a)->client_options.prefetch);
 	/*
 	 * Skip support is a performance optimization for anything
 	 * that supports lseek().  On FreeBSD, only regular files and
@@ -115,7 +122,12 @@ file_read(struct archive *a, void *client_data, const void **buff)
 
 	*buff = mine->buffer;
 	for (;;) {
-		bytes_read = read(mine->fd, mine->buffer, mine->block_size);
+		if (mine->prefetch != NULL)
+			bytes_read = __archive_read_prefetch_read(
+			    mine->prefetch, buff);
+		else
+			bytes_read = read(mine->fd, mine->buffer,
+			    mine->block_size);
 		if (bytes_read < 0) {
 			if (errno == EINTR)
 				continue;
@@ -149,7 +161,9 @@ file_skip(struct archive *a, void *client_data, int64_t request)
 	if (request == 0)
 		return (0);
 
-	if (((old_offset = lseek(mine->fd, 0, SEEK_CUR)) >= 0) &&
+	if ((mine->prefetch == NULL
+	    || __archive_read_prefetch_reset(mine->prefetch) == 0) &&
+	    ((old_offset = lseek(mine->fd, 0, SEEK_CUR)) >= 0) &&
 	    ((new_offset = lseek(mine->fd, skip, SEEK_CUR)) >= 0))
 		return (new_offset - old_offset);
 
@@ -175,6 +189,7 @@ file_close(struct archive *a, void *client_data)
 	struct read_fd_data *mine = (struct read_fd_data *)client_data;
 
 	(void)a; /* UNUSED */
+	__archive_read_prefetch_free(mine->prefetch);
 	free(mine->buffer);
 	free(mine);
 	return (ARCHIVE_OK);
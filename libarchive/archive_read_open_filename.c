@@ -29,6 +29,9 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read_open_filename.c 201093 2009
 #ifdef HAVE_SYS_IOCTL_H
 #include <sys/ioctl.h>
 #endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 #ifdef HAVE_SYS_STAT_H
 #include <sys/stat.h>
 #endif
@@ -60,6 +63,8 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read_open_filename.c 201093 2009
 #endif
 
 #include "archive.h"
+#include "archive_private.h"
+#include "archive_read_private.h"
 #include "archive_string.h"
 
 #ifndef O_BINARY
@@ -72,6 +77,12 @@ struct read_file_data {
 	void	*buffer;
 	mode_t	 st_mode;  /* Mode bits for opened file. */
 	char	 use_lseek;
+	/* If the file is mapped, reads just hand out views of it. */
+	const char *map;
+	size_t	 map_size;
+	int64_t	 map_offset;
+	/* Blocks read ahead on a helper thread, if requested. */
+	struct archive_read_prefetch *prefetch;
 	enum fnt_e { FNT_STDIN, FNT_MBS, FNT_WCS } filename_type;
 	union {
 		char	 m[1];/* MBS filename. */
@@ -86,6 +97,7 @@ static ssize_t	file_read(struct archive *, void *, const void **buff);
 static int64_t	file_seek(struct archive *, void *, int64_t request, int);
 static int64_t	file_skip(struct archive *, void *, int64_t request);
 static int64_t	file_skip_lseek(struct archive *, void *, int64_t request);
+static int	file_map(struct read_file_data *, const struct stat *);
 
 int
 archive_read_open_file(struct archive *a, const char *filename,
@@ -286,22 +298,42 @@ file_open_filename(struct archive *a, enum fnt_e filename_type,
 	else
 		mine = (struct read_file_data *)calloc(1,
 		    sizeof(*mine) + strlen(filename));
-	/* Disk-like devices prefer power-of-two block sizes.  */
-	/* Use provided block_size as a guide so users have some control. */
-	if (is_disk_like) {
-		size_t new_block_size = 64 * 1024;
-		while (new_block_size < block_size
-		    && new_block_size < 64 * 1024 * 1024)
-			new_block_size *= 2;
-		block_size = new_block_size;
-	}
-	buffer = malloc(block_size);
-	if (mine == NULL || buffer == NULL) {
+	if (mine == NULL) {
 		archive_set_error(a, ENOMEM, "No memory");
-		free(mine);
-		free(buffer);
 		return (ARCHIVE_FATAL);
 	}
+	mine->fd = fd;
+	/*
+	 * If requested, map regular files into memory.  Then the
+	 * whole file is handed to libarchive as a single block and
+	 * nothing ever needs to be copied.  If that isn't possible,
+	 * quietly fall back to ordinary reads.
+	 */
+	if (((struct archive_read *)a)->client_options.mmap
+	    && S_ISREG(st.st_mode) && file_map(mine, &st) == 0) {
+		buffer = NULL;
+		block_size = 0;
+	} else {
+		/* Disk-like devices prefer power-of-two block sizes.  */
+		/* Use provided block_size as a guide so users have some
+		 * control. */
+		if (is_disk_like) {
+			size_t new_block_size = 64 * 1024;
+			while (new_block_size < block_size
+			    && new_block_size < 64 * 1024 * 1024)
+				new_block_size *= 2;
+			block_size = new_block_size;
+		}
+		buffer = malloc(block_size);
+		if (buffer == NULL) {
+			archive_set_error(a, ENOMEM, "No memory");
+			free(mine);
+			return (ARCHIVE_FATAL);
+		}
+		/* If this fails, we just read synchronously. */
+		mine->prefetch = __archive_read_prefetch_new(fd, block_size,
+		    ((struct archive_read *)a)->client_options.prefetch);
+	}
 	if (filename_type == FNT_WCS)
 		wcscpy(mine->filename.w, wfilename);
 	else
@@ -309,7 +341,6 @@ file_open_filename(struct archive *a, enum fnt_e filename_type,
 	mine->filename_type = filename_type;
 	mine->block_size = block_size;
 	mine->buffer = buffer;
-	mine->fd = fd;
 	/* Remember mode so close can decide whether to flush. */
 	mine->st_mode = st.st_mode;
 
@@ -326,20 +357,59 @@ file_open_filename(struct archive *a, enum fnt_e filename_type,
 	return (archive_read_open1(a));
 }
 
+/*
+ * Map the entire file read-only.  Returns zero on success.  Files
+ * that are empty or too large to fit in the address space are left
+ * to ordinary reads.
+ */
+static int
+file_map(struct read_file_data *mine, const struct stat *st)
+{
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+	void *p;
+	int64_t offset;
+
+	if (st->st_size <= 0 || (uint64_t)st->st_size > (SIZE_MAX >> 1))
+		return (-1);
+	/* stdin may already have been partially consumed. */
+	offset = lseek(mine->fd, 0, SEEK_CUR);
+	if (offset < 0 || offset > st->st_size)
+		return (-1);
+	p = mmap(NULL, (size_t)st->st_size, PROT_READ, MAP_SHARED,
+	    mine->fd, 0);
+	if (p == MAP_FAILED)
+		return (-1);
+	mine->map = (const char *)p;
+	mine->map_size = (size_t)st->st_size;
+	mine->map_offset = offset;
+	return (0);
+#else
+	(void)mine; /* UNUSED */
+	(void)st; /* UNUSED */
+	return (-1);
+#endif
+}
+
 static ssize_t
 file_read(struct archive *a, void *client_data, const void **buff)
 {
 	struct read_file_data *mine = (struct read_file_data *)client_data;
 	ssize_t bytes_read;
 
+	/* A mapped file is returned as a single block. */
+	if (mine->map != NULL) {
+		if (mine->map_offset >= (int64_t)mine->map_size)
+			return (0);
+		*buff = mine->map + mine->map_offset;
+		bytes_read = (ssize_t)(mine->map_size - mine->map_offset);
+		mine->map_offset = mine->map_size;
+		return (bytes_read);
+	}
+
 	/* TODO: If a recent lseek() operation has left us
 	 * mis-aligned, read and return a short block to try to get
 	 * us back in alignment. */
 
-	/* TODO: Someday, try mmap() here; if that succeeds, give
-	 * the entire file to libarchive as a single block.  That
-	 * could be a lot faster than block-by-block manual I/O. */
-
 	/* TODO: We might be able to improve performance on pipes and
 	 * sockets by setting non-blocking I/O and just accepting
 	 * whatever we get here instead of waiting for a full block
@@ -347,7 +417,12 @@ file_read(struct archive *a, void *client_data, const void **buff)
 
 	*buff = mine->buffer;
 	for (;;) {
-		bytes_read = read(mine->fd, mine->buffer, mine->block_size);
+		if (mine->prefetch != NULL)
+			bytes_read = __archive_read_prefetch_read(
+			    mine->prefetch, buff);
+		else
+			bytes_read = read(mine->fd, mine->buffer,
+			    mine->block_size);
 		if (bytes_read < 0) {
 			if (errno == EINTR)
 				continue;
@@ -405,7 +480,9 @@ file_skip_lseek(struct archive *a, void *client_data, int64_t request)
 	 * on Windows, though, so it might suffice to just use
 	 * _lseeki64() on Windows.
 	 */
-	if ((old_offset = lseek(mine->fd, 0, SEEK_CUR)) >= 0 &&
+	if ((mine->prefetch == NULL
+	    || __archive_read_prefetch_reset(mine->prefetch) == 0) &&
+	    (old_offset = lseek(mine->fd, 0, SEEK_CUR)) >= 0 &&
 	    (new_offset = lseek(mine->fd, request, SEEK_CUR)) >= 0)
 		return (new_offset - old_offset);
 
@@ -439,6 +516,15 @@ file_skip(struct archive *a, void *client_data, int64_t request)
 {
 	struct read_file_data *mine = (struct read_file_data *)client_data;
 
+	/* Skipping in a mapped file is just pointer arithmetic. */
+	if (mine->map != NULL) {
+		int64_t remaining = (int64_t)mine->map_size - mine->map_offset;
+		if (request > remaining)
+			request = remaining < 0 ? 0 : remaining;
+		mine->map_offset += request;
+		return (request);
+	}
+
 	/* Delegate skip requests. */
 	if (mine->use_lseek)
 		return (file_skip_lseek(a, client_data, request));
@@ -456,9 +542,26 @@ file_seek(struct archive *a, void *client_data, int64_t request, int whence)
 	struct read_file_data *mine = (struct read_file_data *)client_data;
 	off_t r;
 
-	/* We use off_t here because lseek() is declared that way. */
-	/* See above for notes about when off_t is less than 64 bits. */
-	r = lseek(mine->fd, request, whence);
+	/* Mapped files just move the read position. */
+	if (mine->map != NULL) {
+		switch (whence) {
+		case SEEK_SET: r = 0; break;
+		case SEEK_CUR: r = mine->map_offset; break;
+		case SEEK_END: r = mine->map_size; break;
+		default: r = -1; break;
+		}
+		if (r >= 0 && r + request >= 0) {
+			mine->map_offset = r + request;
+			return (mine->map_offset);
+		}
+		errno = EINVAL;
+		r = -1;
+	} else if (mine->prefetch != NULL &&
+	    __archive_read_prefetch_reset(mine->prefetch) != 0)
+		r = -1;
+	else
+		/* We use off_t here because lseek() is declared that way. */
+		r = lseek(mine->fd, request, whence);
 	if (r >= 0)
 		return r;
 
@@ -481,6 +584,9 @@ file_close(struct archive *a, void *client_data)
 
 	(void)a; /* UNUSED */
 
+	/* Stop reading ahead before we flush or close the file. */
+	__archive_read_prefetch_free(mine->prefetch);
+
 	/* Only flush and close if open succeeded. */
 	if (mine->fd >= 0) {
 		/*
@@ -507,6 +613,10 @@ file_close(struct archive *a, void *client_data)
 		if (mine->filename_type != FNT_STDIN)
 			close(mine->fd);
 	}
+#if defined(HAVE_MMAP) && defined(HAVE_SYS_MMAN_H)
+	if (mine->map != NULL)
+		munmap((void *)(uintptr_t)mine->map, mine->map_size);
+#endif
 	free(mine->buffer);
 	free(mine);
 	return (ARCHIVE_OK);
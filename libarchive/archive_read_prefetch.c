@@ -0,0 +1,406 @@
+/*-
+ * Copyright (c) 2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Background read-ahead.
+ *
+ * A helper thread keeps up to 'depth' blocks in flight ahead of the
+ * consumer, so that producing the data (waiting for the disk or a
+ * pipe, or decompressing) overlaps with whatever the consumer is
+ * doing with the previous block.  Blocks are handed out without
+ * further copying: the block returned by __archive_read_prefetch_read()
+ * stays valid until the next call, exactly like the buffer of an
+ * ordinary read callback.
+ *
+ * The file descriptor based read clients use this with read(2) as
+ * the producer; archive_read.c uses it to run filter stages in
+ * parallel.
+ *
+ * Without pthreads, the constructors return NULL and callers just
+ * keep doing their work synchronously.
+ */
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include "archive_read_private.h"
+
+#ifdef HAVE_PTHREAD_H
+
+struct prefetch_block {
+	char		*buff;
+	ssize_t		 length;	/* Bytes read, 0 at EOF, -1 on error. */
+	int		 error;		/* errno if length < 0. */
+};
+
+struct archive_read_prefetch {
+	/* Producer; returns like read(2). */
+	ssize_t		(*fill)(void *cookie, void *buff, size_t size);
+	void		*cookie;
+	int		 fd;		/* -1 unless reading a file. */
+	size_t		 block_size;
+	int		 nblocks;
+
+	/*
+	 * The blocks form a ring.  'next' is the oldest filled block,
+	 * 'filled' blocks starting there are ready for the consumer,
+	 * and if 'held' is set the block just before 'next' is still
+	 * in use by the consumer.  The worker reads into the first
+	 * free block after the filled ones.
+	 */
+	struct prefetch_block *blocks;
+	int		 next;
+	int		 filled;
+	char		 held;
+
+	char		 running;	/* Worker thread exists. */
+	char		 stop;		/* Worker should exit. */
+	char		 reading;	/* Worker is busy filling a block. */
+	char		 done;		/* Worker saw EOF or an error. */
+	ssize_t		 final;		/* Result repeated after EOF/error. */
+	int		 final_error;
+
+	pthread_t	 thread;
+	pthread_mutex_t	 lock;
+	pthread_cond_t	 cond;
+};
+
+static ssize_t	 prefetch_fill_fd(void *, void *, size_t);
+static void	*prefetch_worker(void *);
+
+struct archive_read_prefetch *
+__archive_read_prefetch_new(int fd, size_t block_size, int depth)
+{
+	struct archive_read_prefetch *p;
+
+	p = __archive_read_prefetch_new2(block_size, depth,
+	    prefetch_fill_fd, NULL);
+	if (p != NULL) {
+		p->cookie = p;
+		p->fd = fd;
+	}
+	return (p);
+}
+
+struct archive_read_prefetch *
+__archive_read_prefetch_new2(size_t block_size, int depth,
+    ssize_t (*fill)(void *, void *, size_t), void *cookie)
+{
+	struct archive_read_prefetch *p;
+	int i;
+
+	if (depth <= 0 || block_size == 0)
+		return (NULL);
+	p = calloc(1, sizeof(*p));
+	if (p == NULL)
+		return (NULL);
+	p->fill = fill;
+	p->cookie = cookie;
+	p->fd = -1;
+	p->block_size = block_size;
+	/* One extra block for the one the consumer is holding. */
+	p->nblocks = depth + 1;
+	p->blocks = calloc(p->nblocks, sizeof(p->blocks[0]));
+	if (p->blocks == NULL) {
+		free(p);
+		return (NULL);
+	}
+	for (i = 0; i < p->nblocks; i++) {
+		p->blocks[i].buff = malloc(block_size);
+		if (p->blocks[i].buff == NULL) {
+			while (--i >= 0)
+				free(p->blocks[i].buff);
+			free(p->blocks);
+			free(p);
+			return (NULL);
+		}
+	}
+	if (pthread_mutex_init(&p->lock, NULL) != 0) {
+		for (i = 0; i < p->nblocks; i++)
+			free(p->blocks[i].buff);
+		free(p->blocks);
+		free(p);
+		return (NULL);
+	}
+	if (pthread_cond_init(&p->cond, NULL) != 0) {
+		pthread_mutex_destroy(&p->lock);
+		for (i = 0; i < p->nblocks; i++)
+			free(p->blocks[i].buff);
+		free(p->blocks);
+		free(p);
+		return (NULL);
+	}
+	return (p);
+}
+
+static ssize_t
+prefetch_fill_fd(void *cookie, void *buff, size_t size)
+{
+	struct archive_read_prefetch *p = cookie;
+	ssize_t bytes_read;
+
+	do {
+		bytes_read = read(p->fd, buff, size);
+	} while (bytes_read < 0 && errno == EINTR);
+	return (bytes_read);
+}
+
+static void *
+prefetch_worker(void *arg)
+{
+	struct archive_read_prefetch *p = arg;
+	struct prefetch_block *b;
+	ssize_t bytes_read;
+	int error, oldstate;
+
+	/* We can only be cancelled while we're inside read(2). */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+	pthread_mutex_lock(&p->lock);
+	for (;;) {
+		while (!p->stop && !p->done
+		    && p->filled + p->held >= p->nblocks)
+			pthread_cond_wait(&p->cond, &p->lock);
+		if (p->stop || p->done)
+			break;
+		b = &p->blocks[(p->next + p->filled) % p->nblocks];
+		/* Nobody else touches a free block; fill it unlocked. */
+		p->reading = 1;
+		pthread_mutex_unlock(&p->lock);
+		if (p->fd >= 0)
+			pthread_setcancelstate(PTHREAD_CANCEL_ENABLE,
+			    &oldstate);
+		bytes_read = (p->fill)(p->cookie, b->buff, p->block_size);
+		error = errno;
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &oldstate);
+		pthread_mutex_lock(&p->lock);
+		p->reading = 0;
+		b->length = bytes_read;
+		b->error = error;
+		p->filled++;
+		if (bytes_read <= 0)
+			p->done = 1;
+		pthread_cond_broadcast(&p->cond);
+	}
+	pthread_mutex_unlock(&p->lock);
+	return (NULL);
+}
+
+/*
+ * Return the next block, 0 at end-of-file or -1 with errno set.
+ */
+ssize_t
+__archive_read_prefetch_read(struct archive_read_prefetch *p,
+    const void **buff)
+{
+	struct prefetch_block *b;
+	ssize_t bytes_read;
+
+	pthread_mutex_lock(&p->lock);
+	/* The consumer is done with the block we handed out last. */
+	p->held = 0;
+	if (p->filled == 0 && p->done) {
+		/* Keep reporting EOF (or the error) once we've hit it. */
+		bytes_read = p->final;
+		errno = p->final_error;
+		pthread_mutex_unlock(&p->lock);
+		return (bytes_read);
+	}
+	if (!p->running) {
+		if (pthread_create(&p->thread, NULL, prefetch_worker, p)
+		    != 0) {
+			/* No thread; fill the next block ourselves. */
+			b = &p->blocks[p->next];
+			pthread_mutex_unlock(&p->lock);
+			bytes_read = (p->fill)(p->cookie, b->buff,
+			    p->block_size);
+			*buff = b->buff;
+			return (bytes_read);
+		}
+		p->running = 1;
+	}
+	pthread_cond_broadcast(&p->cond);
+	while (p->filled == 0)
+		pthread_cond_wait(&p->cond, &p->lock);
+	b = &p->blocks[p->next];
+	p->next = (p->next + 1) % p->nblocks;
+	p->filled--;
+	bytes_read = b->length;
+	if (bytes_read > 0) {
+		p->held = 1;
+		*buff = b->buff;
+	} else {
+		p->final = bytes_read;
+		p->final_error = b->error;
+		errno = b->error;
+	}
+	/* Let the worker reuse the block released above. */
+	pthread_cond_broadcast(&p->cond);
+	pthread_mutex_unlock(&p->lock);
+	return (bytes_read);
+}
+
+/*
+ * Let the worker finish the block it is working on, then stop it and
+ * discard everything that was read ahead.  Returns the number of
+ * bytes discarded.  The worker is restarted by the next read.
+ */
+int64_t
+__archive_read_prefetch_stop(struct archive_read_prefetch *p)
+{
+	int64_t unconsumed = 0;
+	int i;
+
+	if (p->running) {
+		pthread_mutex_lock(&p->lock);
+		p->stop = 1;
+		pthread_cond_broadcast(&p->cond);
+		pthread_mutex_unlock(&p->lock);
+		pthread_join(p->thread, NULL);
+		p->running = 0;
+		p->stop = 0;
+	}
+	for (i = 0; i < p->filled; i++) {
+		struct prefetch_block *b =
+		    &p->blocks[(p->next + i) % p->nblocks];
+		if (b->length > 0)
+			unconsumed += b->length;
+	}
+	p->next = 0;
+	p->filled = 0;
+	p->held = 0;
+	p->done = 0;
+	p->final = 0;
+	p->final_error = 0;
+	return (unconsumed);
+}
+
+/*
+ * Stop reading ahead and move the file pointer back to the first
+ * byte the consumer hasn't seen.  Used before the client skips or
+ * seeks.  Returns 0 on success or -1 with errno set if the file
+ * pointer couldn't be restored.
+ */
+int
+__archive_read_prefetch_reset(struct archive_read_prefetch *p)
+{
+	int64_t unconsumed;
+
+	unconsumed = __archive_read_prefetch_stop(p);
+	if (unconsumed > 0 && lseek(p->fd, -unconsumed, SEEK_CUR) < 0)
+		return (-1);
+	return (0);
+}
+
+void
+__archive_read_prefetch_free(struct archive_read_prefetch *p)
+{
+	int i;
+
+	if (p == NULL)
+		return;
+	if (p->running) {
+		pthread_mutex_lock(&p->lock);
+		p->stop = 1;
+		pthread_cond_broadcast(&p->cond);
+		/* Don't wait for a pipe or socket that may never deliver. */
+		if (p->reading && p->fd >= 0)
+			pthread_cancel(p->thread);
+		pthread_mutex_unlock(&p->lock);
+		pthread_join(p->thread, NULL);
+	}
+	pthread_cond_destroy(&p->cond);
+	pthread_mutex_destroy(&p->lock);
+	for (i = 0; i < p->nblocks; i++)
+		free(p->blocks[i].buff);
+	free(p->blocks);
+	free(p);
+}
+
+#else /* !HAVE_PTHREAD_H */
+
+struct archive_read_prefetch *
+__archive_read_prefetch_new(int fd, size_t block_size, int depth)
+{
+	(void)fd; /* UNUSED */
+	(void)block_size; /* UNUSED */
+	(void)depth; /* UNUSED */
+	return (NULL);
+}
+
+struct archive_read_prefetch *
+__archive_read_prefetch_new2(size_t block_size, int depth,
+    ssize_t (*fill)(void *, void *, size_t), void *cookie)
+{
+	(void)block_size; /* UNUSED */
+	(void)depth; /* UNUSED */
+	(void)fill; /* UNUSED */
+	(void)cookie; /* UNUSED */
+	return (NULL);
+}
+
+ssize_t
+__archive_read_prefetch_read(struct archive_read_prefetch *p,
+    const void **buff)
+{
+	(void)p; /* UNUSED */
+	(void)buff; /* UNUSED */
+	errno = ENOSYS;
+	return (-1);
+}
+
+int64_t
+__archive_read_prefetch_stop(struct archive_read_prefetch *p)
+{
+	(void)p; /* UNUSED */
+	return (0);
+}
+
+int
+__archive_read_prefetch_reset(struct archive_read_prefetch *p)
+{
+	(void)p; /* UNUSED */
+	return (0);
+}
+
+void
+__archive_read_prefetch_free(struct archive_read_prefetch *p)
+{
+	(void)p; /* UNUSED */
+}
+
+#endif /* HAVE_PTHREAD_H */
@@ -58,6 +58,8 @@ struct archive_read_filter;
 struct archive_read_filter_bidder {
 	/* Configuration data for the bidder. */
 	void *data;
+	/* Name used to route options set before the archive is opened. */
+	const char *name;
 	/* Taste the upstream filter to see if we handle this. */
 	int (*bid)(struct archive_read_filter_bidder *,
 	    struct archive_read_filter *);
@@ -108,6 +110,10 @@ struct archive_read_filter {
 	char		 end_of_file;
 	char		 closed;
 	char		 fatal;
+	/* Runs on a pipeline thread and is hidden behind a proxy. */
+	char		 piped;
+	/* For archive_read_get_stats(). */
+	struct archive_read_stats stats;
 };
 
 /*
@@ -149,8 +155,21 @@ struct archive_read {
 	/* Callbacks to open/read/write/close client archive stream. */
 	struct archive_read_client client;
 
+	/*
+	 * I/O strategy requested through archive_read_set_options()
+	 * for the built-in clients (archive_read_open_filename() and
+	 * friends) and the filter chain.  These must be set before the
+	 * archive is opened.
+	 */
+	struct {
+		char	 mmap;	/* Map regular files into memory. */
+		int	 prefetch; /* Blocks to read ahead on a helper thread. */
+		int	 pipeline; /* Blocks queued between filter threads. */
+		char	 timing; /* Time read callbacks for the stats. */
+	} client_options;
+
 	/* Registered filter bidders. */
-	struct archive_read_filter_bidder bidders[9];
+	struct archive_read_filter_bidder bidders[11];
 
 	/* Last filter in chain */
 	struct archive_read_filter *filter;
@@ -158,6 +177,14 @@ struct archive_read {
 	/* File offset of beginning of most recently-read header. */
 	int64_t		  header_position;
 
+	/*
+	 * Sidecar index from archive_read_set_index_file().  If the
+	 * file didn't exist yet, index_filename is set and the index
+	 * is built up as headers are read, then saved on close.
+	 */
+	struct archive_index *index;
+	char		 *index_filename;
+
 	/*
 	 * Format detection is mostly the same as compression
 	 * detection, with one significant difference: The bidders
@@ -175,6 +202,14 @@ struct archive_read {
 		int	(*read_header)(struct archive_read *, struct archive_entry *);
 		int	(*read_data)(struct archive_read *, const void **, size_t *, int64_t *);
 		int	(*read_data_skip)(struct archive_read *);
+		/*
+		 * Optional: read the header of the entry with the given
+		 * pathname or, if that is NULL, index.  Sets
+		 * header_position.  Returns ARCHIVE_FAILED if there is
+		 * no such entry, without disturbing the current one.
+		 */
+		int	(*seek_entry)(struct archive_read *,
+		    struct archive_entry *, const char *, int64_t);
 		int	(*cleanup)(struct archive_read *);
 	}	formats[16];
 	struct archive_format_descriptor	*format; /* Active format. */
@@ -194,6 +229,8 @@ int	__archive_read_register_format(struct archive_read *a,
 	    int (*read_header)(struct archive_read *, struct archive_entry *),
 	    int (*read_data)(struct archive_read *, const void **, size_t *, int64_t *),
 	    int (*read_data_skip)(struct archive_read *),
+	    int (*seek_entry)(struct archive_read *, struct archive_entry *,
+		const char *, int64_t),
 	    int (*cleanup)(struct archive_read *));
 
 int __archive_read_get_bidder(struct archive_read *a,
@@ -207,4 +244,20 @@ int64_t	__archive_read_filter_seek(struct archive_read_filter *, int64_t, int);
 int64_t	__archive_read_consume(struct archive_read *, int64_t);
 int64_t	__archive_read_filter_consume(struct archive_read_filter *, int64_t);
 int __archive_read_program(struct archive_read_filter *, const char *);
+int __archive_read_index_seek(struct archive_read *, const char *, int64_t,
+    const char **);
+int __archive_read_index_verify(struct archive_read *, struct archive_entry *,
+    const char *, int);
+
+/* Background read-ahead; see archive_read_prefetch.c. */
+struct archive_read_prefetch;
+struct archive_read_prefetch *__archive_read_prefetch_new(int fd,
+    size_t block_size, int depth);
+struct archive_read_prefetch *__archive_read_prefetch_new2(size_t block_size,
+    int depth, ssize_t (*fill)(void *, void *, size_t), void *cookie);
+ssize_t	__archive_read_prefetch_read(struct archive_read_prefetch *,
+    const void **);
+int64_t	__archive_read_prefetch_stop(struct archive_read_prefetch *);
+int	__archive_read_prefetch_reset(struct archive_read_prefetch *);
+void	__archive_read_prefetch_free(struct archive_read_prefetch *);
 #endif
@@ -35,6 +35,8 @@ static int	archive_set_filter_option(struct archive *a,
 		    const char *m, const char *o, const char *v);
 static int	archive_set_option(struct archive *a,
 		    const char *m, const char *o, const char *v);
+static int	archive_set_client_option(struct archive *a,
+		    const char *m, const char *o, const char *v);
 
 int
 archive_read_set_format_option(struct archive *a, const char *m, const char *o,
@@ -112,8 +114,32 @@ archive_set_filter_option(struct archive *_a, const char *m, const char *o,
 	struct archive_read *a = (struct archive_read *)_a;
 	struct archive_read_filter *filter;
 	struct archive_read_filter_bidder *bidder;
+	size_t i;
 	int r, rv = ARCHIVE_FAILED;
 
+	/*
+	 * Before the archive is opened there are no filters yet, so
+	 * hand the option to the bidder, which keeps it for the
+	 * filters it creates.
+	 */
+	if (a->archive.state == ARCHIVE_STATE_NEW) {
+		for (i = 0; i < sizeof(a->bidders)/sizeof(a->bidders[0]); i++) {
+			bidder = &a->bidders[i];
+			if (bidder->options == NULL || bidder->name == NULL)
+				continue;
+			if (m != NULL && strcmp(bidder->name, m) != 0)
+				continue;
+			r = bidder->options(bidder, o, v);
+			if (r == ARCHIVE_FATAL)
+				return (ARCHIVE_FATAL);
+			if (m != NULL)
+				return (r);
+			if (r == ARCHIVE_OK)
+				rv = ARCHIVE_OK;
+		}
+		return (rv);
+	}
+
 	for (filter = a->filter; filter != NULL; filter = filter->upstream) {
 		bidder = filter->bidder;
 		if (bidder == NULL)
@@ -138,10 +164,68 @@ archive_set_filter_option(struct archive *_a, const char *m, const char *o,
 	return (rv);
 }
 
+/*
+ * Parse the number of blocks to keep in flight; "!option" means 0.
+ */
+static int
+parse_depth(const char *v, int *depth)
+{
+	int d = 0;
+
+	if (v != NULL) {
+		if (*v == '\0')
+			return (ARCHIVE_WARN);
+		for (; *v != '\0'; v++) {
+			if (*v < '0' || *v > '9')
+				return (ARCHIVE_WARN);
+			d = d * 10 + (*v - '0');
+			if (d > 1024)
+				return (ARCHIVE_WARN);
+		}
+	}
+	*depth = d;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Options that are not tied to a format or filter tune the I/O
+ * strategy of the built-in read clients.  They are only recognized
+ * when no module name is given.
+ */
+static int
+archive_set_client_option(struct archive *_a, const char *m, const char *o,
+    const char *v)
+{
+	struct archive_read *a = (struct archive_read *)_a;
+
+	if (m != NULL)
+		return (ARCHIVE_FAILED);
+	if (strcmp(o, "mmap") == 0) {
+		a->client_options.mmap = (v != NULL);
+		return (ARCHIVE_OK);
+	}
+	if (strcmp(o, "prefetch") == 0)
+		return (parse_depth(v, &a->client_options.prefetch));
+	if (strcmp(o, "pipeline") == 0)
+		return (parse_depth(v, &a->client_options.pipeline));
+	if (strcmp(o, "timing") == 0) {
+		a->client_options.timing = (v != NULL);
+		return (ARCHIVE_OK);
+	}
+	return (ARCHIVE_FAILED);
+}
+
 static int
 archive_set_option(struct archive *a, const char *m, const char *o,
     const char *v)
 {
+	int r;
+
+	if (o != NULL) {
+		r = archive_set_client_option(a, m, o, v);
+		if (r != ARCHIVE_FAILED)
+			return (r);
+	}
 	return _archive_set_either_option(a, m, o, v,
 	    archive_set_format_option,
 	    archive_set_filter_option);
@@ -50,6 +50,8 @@ archive_read_support_filter_all(struct archive *a)
 	archive_read_support_filter_compress(a);
 	/* Gzip decompress falls back to "gunzip" command-line. */
 	archive_read_support_filter_gzip(a);
+	/* The lz4 decoder doesn't use an outside library. */
+	archive_read_support_filter_lz4(a);
 	/* Lzip falls back to "unlzip" command-line program. */
 	archive_read_support_filter_lzip(a);
 	/* The LZMA file format has a very weak signature, so it
@@ -59,6 +61,8 @@ archive_read_support_filter_all(struct archive *a)
 	archive_read_support_filter_lzma(a);
 	/* Xz falls back to "unxz" command-line program. */
 	archive_read_support_filter_xz(a);
+	/* Zstd falls back to "zstd -d" command-line program. */
+	archive_read_support_filter_zstd(a);
 	/* The decode code doesn't use an outside library. */
 	archive_read_support_filter_uu(a);
 	/* The decode code doesn't use an outside library. */
@@ -45,21 +45,77 @@ __FBSDID("$FreeBSD$");
 #endif
 
 #include "archive.h"
+#include "archive_parallel_private.h"
 #include "archive_private.h"
 #include "archive_read_private.h"
 
 #if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+struct bzip2_options {
+	int		 threads;
+};
+
+/*
+ * One bzip2 block, decompressed on a worker thread.  The block is
+ * the bits from 'start' up to 'end' (counted from the start of the
+ * filter's input), copied into 'in' from the byte holding 'start'.
+ * A job can also stand for the end-of-stream marker, in which case
+ * 'crc' is the stream CRC it carries and there is no work to do.
+ */
+struct bzip2_job {
+	int64_t		 start;
+	int64_t		 end;
+	int		 level;
+	int		 skip;		/* Magic numbers passed over. */
+	char		 end_of_stream;
+	char		 ok;
+	uint32_t	 crc;
+	char		*in;
+	char		*out;
+	size_t		 out_len;
+	size_t		 out_size;
+};
+
+/* How far apart two block magic numbers can be. */
+#define	PARALLEL_SCAN_LIMIT	(8 * 1024 * 1024)
+/* How many suspect magic numbers to pass over before giving up. */
+#define	PARALLEL_MAX_SKIP	4
+
 struct private_data {
 	bz_stream	 stream;
 	char		*out_block;
 	size_t		 out_block_size;
 	char		 valid; /* True = decompressor is initialized */
 	char		 eof; /* True = found end of compressed data. */
+
+	/* Decompressing blocks on worker threads. */
+	struct archive_parallel *parallel;
+	int		 threads;
+	/* Compressed data read from upstream but not yet decompressed. */
+	char		*pending;
+	size_t		 pending_start;
+	size_t		 pending_len;
+	size_t		 pending_size;
+	int64_t		 pending_pos;	/* Input offset of pending data. */
+	char		 upstream_eof;
+	/* Where the next job starts, in bits. */
+	int64_t		 scan_bit;
+	char		 at_header;	/* scan_bit is at "BZh". */
+	int		 level;
+	int		 skip;
+	char		 scan_done;	/* Nothing more to hand out. */
+	const char	*scan_error;	/* Why, if it's an error. */
+	uint32_t	 combined_crc;
+	struct bzip2_job *current;	/* Output being returned. */
 };
 
 /* Bzip2 filter */
 static ssize_t	bzip2_filter_read(struct archive_read_filter *, const void **);
+static ssize_t	bzip2_parallel_read(struct archive_read_filter *,
+		    const void **);
+static void	bzip2_job_free(struct bzip2_job *);
 static int	bzip2_filter_close(struct archive_read_filter *);
+static int	bzip2_reader_options(struct archive_read_filter_bidder *,
+		    const char *, const char *);
 #endif
 
 /*
@@ -93,10 +149,20 @@ archive_read_support_filter_bzip2(struct archive *_a)
 	if (__archive_read_get_bidder(a, &reader) != ARCHIVE_OK)
 		return (ARCHIVE_FATAL);
 
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+	reader->data = calloc(1, sizeof(struct bzip2_options));
+	if (reader->data == NULL) {
+		archive_set_error(_a, ENOMEM, "Can't allocate bzip2 options");
+		return (ARCHIVE_FATAL);
+	}
+	reader->options = bzip2_reader_options;
+#else
 	reader->data = NULL;
+	reader->options = NULL;
+#endif
+	reader->name = "bzip2";
 	reader->bid = bzip2_reader_bid;
 	reader->init = bzip2_reader_init;
-	reader->options = NULL;
 	reader->free = bzip2_reader_free;
 #if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
 	return (ARCHIVE_OK);
@@ -109,7 +175,8 @@ archive_read_support_filter_bzip2(struct archive *_a)
 
 static int
 bzip2_reader_free(struct archive_read_filter_bidder *self){
-	(void)self; /* UNUSED */
+	free(self->data);
+	self->data = NULL;
 	return (ARCHIVE_OK);
 }
 
@@ -182,6 +249,37 @@ bzip2_reader_init(struct archive_read_filter *self)
 
 #else
 
+/*
+ * Options:
+ *   threads=N          Decompress up to N blocks at once.
+ */
+static int
+bzip2_reader_options(struct archive_read_filter_bidder *self,
+    const char *key, const char *value)
+{
+	struct bzip2_options *opts = (struct bzip2_options *)self->data;
+	int n = 0;
+
+	if (strcmp(key, "threads") == 0) {
+		if (value == NULL || *value == '\0')
+			return (ARCHIVE_WARN);
+		for (; *value != '\0'; value++) {
+			if (*value < '0' || *value > '9')
+				return (ARCHIVE_WARN);
+			n = n * 10 + (*value - '0');
+			if (n > 1024)
+				return (ARCHIVE_WARN);
+		}
+		opts->threads = n;
+		return (ARCHIVE_OK);
+	}
+
+	/* Note: The "warn" return is just to inform the options
+	 * supervisor that we didn't handle it.  It will generate
+	 * a suitable error if no one used this option. */
+	return (ARCHIVE_WARN);
+}
+
 /*
  * Setup the callbacks.
  */
@@ -191,6 +289,7 @@ bzip2_reader_init(struct archive_read_filter *self)
 	static const size_t out_block_size = 64 * 1024;
 	void *out_block;
 	struct private_data *state;
+	struct bzip2_options *opts;
 
 	self->code = ARCHIVE_COMPRESSION_BZIP2;
 	self->name = "bzip2";
@@ -212,6 +311,16 @@ bzip2_reader_init(struct archive_read_filter *self)
 	self->skip = NULL; /* not supported */
 	self->close = bzip2_filter_close;
 
+	opts = (struct bzip2_options *)self->bidder->data;
+	if (opts->threads > 0) {
+		state->parallel = __archive_parallel_new(opts->threads);
+		if (state->parallel != NULL) {
+			state->threads = opts->threads;
+			state->at_header = 1;
+			self->read = bzip2_parallel_read;
+		}
+	}
+
 	return (ARCHIVE_OK);
 }
 
@@ -338,6 +447,464 @@ bzip2_filter_read(struct archive_read_filter *self, const void **p)
 	}
 }
 
+/*
+ * With threads=N, blocks are decompressed on worker threads.  bzlib
+ * can only start at the beginning of a stream, but a bzip2 block
+ * doesn't depend on anything before it: every block starts with the
+ * 48-bit magic number 0x314159265359 and the stream ends with
+ * 0x177245385090, neither of them on a byte boundary.  So we look
+ * ahead for those, and hand each worker a block wrapped in a header
+ * and an end-of-stream marker of its own, the way bzip2recover does.
+ * bzlib checks the block CRC; we check the stream CRC.
+ *
+ * A magic number can also turn up inside compressed data by chance.
+ * Then the block before it fails to decompress, and we go back and
+ * try again, this time passing over that magic number.
+ */
+
+#define	BLOCK_MAGIC	0x314159265359ULL
+#define	EOS_MAGIC	0x177245385090ULL
+
+static void
+bzip2_job_free(struct bzip2_job *job)
+{
+	if (job == NULL)
+		return;
+	free(job->in);
+	free(job->out);
+	free(job);
+}
+
+static void
+set_bits(char *p, size_t bit, uint64_t v, int n)
+{
+	unsigned char *u = (unsigned char *)p;
+	int b;
+
+	for (; n > 0; n--, bit++) {
+		b = 0x80 >> (bit & 7);
+		if ((v >> (n - 1)) & 1)
+			u[bit >> 3] |= b;
+		else
+			u[bit >> 3] &= ~b;
+	}
+}
+
+/*
+ * Worker: decompress one block.
+ */
+static void
+bzip2_job_run(void *arg)
+{
+	struct bzip2_job *job = (struct bzip2_job *)arg;
+	const unsigned char *in = (const unsigned char *)job->in;
+	unsigned char *s;
+	bz_stream stream;
+	size_t nbits, nbytes, i, n;
+	int off, ret;
+	char *out;
+
+	job->ok = 0;
+	job->out_len = 0;
+	if (job->end_of_stream) {
+		job->ok = 1;
+		return;
+	}
+
+	/* "BZh9", the block moved to a byte boundary, and the end. */
+	nbits = (size_t)(job->end - job->start);
+	off = (int)(job->start & 7);
+	nbytes = 4 + (nbits + 80 + 7) / 8;
+	s = malloc(nbytes);
+	if (s == NULL)
+		return;
+	memcpy(s, "BZh", 3);
+	s[3] = '0' + job->level;
+	n = (nbits + 7) / 8;
+	for (i = 0; i < n; i++) {
+		s[4 + i] = in[i] << off;
+		if (off > 0 && i * 8 + 8 - off < nbits)
+			s[4 + i] |= in[i + 1] >> (8 - off);
+	}
+	/* With one block, the stream CRC is the block CRC. */
+	set_bits((char *)s, 32 + nbits, EOS_MAGIC, 48);
+	set_bits((char *)s, 32 + nbits + 48, job->crc, 32);
+	set_bits((char *)s, 32 + nbits + 80, 0,
+	    (int)(nbytes * 8 - 32 - nbits - 80));
+
+	memset(&stream, 0, sizeof(stream));
+	if (BZ2_bzDecompressInit(&stream, 0, 0) != BZ_OK) {
+		free(s);
+		return;
+	}
+	stream.next_in = (char *)s;
+	stream.avail_in = (unsigned int)nbytes;
+	do {
+		if (job->out_len == job->out_size) {
+			n = job->out_size * 2;
+			if (n < (size_t)job->level * 100000)
+				n = (size_t)job->level * 100000;
+			out = realloc(job->out, n);
+			if (out == NULL)
+				goto done;
+			job->out = out;
+			job->out_size = n;
+		}
+		stream.next_out = job->out + job->out_len;
+		stream.avail_out = (unsigned int)(job->out_size - job->out_len);
+		ret = BZ2_bzDecompress(&stream);
+		job->out_len = stream.next_out - job->out;
+	} while (ret == BZ_OK && (stream.avail_in > 0
+	    || stream.avail_out == 0));
+	if (ret == BZ_STREAM_END)
+		job->ok = 1;
+done:
+	BZ2_bzDecompressEnd(&stream);
+	free(s);
+}
+
+/*
+ * Copy data from upstream until at least 'want' bytes are pending
+ * or upstream runs dry.
+ */
+static int
+fill_pending(struct archive_read_filter *self, size_t want)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	const void *p;
+	char *buff;
+	ssize_t avail;
+	size_t n, size;
+
+	while (state->pending_len < want && !state->upstream_eof) {
+		p = __archive_read_filter_ahead(self->upstream, 1, &avail);
+		if (p == NULL) {
+			if (avail < 0)
+				return (ARCHIVE_FATAL);
+			state->upstream_eof = 1;
+			break;
+		}
+		n = want - state->pending_len;
+		if (n < 64 * 1024)
+			n = 64 * 1024;
+		if (n > (size_t)avail)
+			n = avail;
+		/* Several blocks are pending at once; only move them
+		 * down when that frees up half the buffer. */
+		if (state->pending_start + state->pending_len + n
+		    > state->pending_size
+		    && state->pending_start >= state->pending_size / 2) {
+			memmove(state->pending,
+			    state->pending + state->pending_start,
+			    state->pending_len);
+			state->pending_start = 0;
+		}
+		if (state->pending_start + state->pending_len + n
+		    > state->pending_size) {
+			size = state->pending_size * 2;
+			if (size < state->pending_start + state->pending_len
+			    + n)
+				size = state->pending_start
+				    + state->pending_len + n;
+			buff = realloc(state->pending, size);
+			if (buff == NULL) {
+				archive_set_error(&self->archive->archive,
+				    ENOMEM, "Can't allocate data for bzip2 "
+				    "decompression");
+				return (ARCHIVE_FATAL);
+			}
+			state->pending = buff;
+			state->pending_size = size;
+		}
+		memcpy(state->pending + state->pending_start
+		    + state->pending_len, p, n);
+		state->pending_len += n;
+		__archive_read_filter_consume(self->upstream, n);
+	}
+	return (ARCHIVE_OK);
+}
+
+/* Make sure the pending data reaches input bit 'bit'. */
+static int
+fill_pending_to(struct archive_read_filter *self, int64_t bit)
+{
+	struct private_data *state = (struct private_data *)self->data;
+
+	return (fill_pending(self,
+	    (size_t)((bit + 7) / 8 - state->pending_pos)));
+}
+
+static int
+have_pending_to(struct private_data *state, int64_t bit)
+{
+	return ((bit + 7) / 8 <= state->pending_pos
+	    + (int64_t)state->pending_len);
+}
+
+/* Read 'n' bits, most significant first, from input bit 'bit'. */
+static uint64_t
+get_bits(struct private_data *state, int64_t bit, int n)
+{
+	const unsigned char *p = (const unsigned char *)state->pending
+	    + state->pending_start;
+	uint64_t v = 0;
+
+	bit -= state->pending_pos * 8;
+	for (; n > 0; n--, bit++)
+		v = (v << 1) | ((p[bit >> 3] >> (7 - (bit & 7))) & 1);
+	return (v);
+}
+
+/*
+ * Find the first magic number that starts at or after input bit
+ * 'from' within the pending data.  Returns -1 if there is none, and
+ * sets '*resume' to where a later search should start.
+ */
+static int64_t
+find_magic(struct private_data *state, int64_t from, int64_t *resume)
+{
+	const unsigned char *p = (const unsigned char *)state->pending
+	    + state->pending_start;
+	int64_t i, end, start;
+	uint64_t v = 0, m;
+	int sh;
+
+	end = state->pending_pos + state->pending_len;
+	for (i = from / 8; i < end; i++) {
+		v = (v << 8) | p[i - state->pending_pos];
+		for (sh = 7; sh >= 0; sh--) {
+			start = i * 8 - 40 - sh;
+			if (start < from)
+				continue;
+			m = (v >> sh) & 0xffffffffffffULL;
+			if (m == BLOCK_MAGIC || m == EOS_MAGIC)
+				return (start);
+		}
+	}
+	*resume = end * 8 - 47;
+	if (*resume < from)
+		*resume = from;
+	return (-1);
+}
+
+static void
+drop_pending_to(struct private_data *state, int64_t bit)
+{
+	size_t n = (size_t)(bit / 8 - state->pending_pos);
+
+	state->pending_start += n;
+	state->pending_len -= n;
+	state->pending_pos += n;
+	if (state->pending_len == 0)
+		state->pending_start = 0;
+}
+
+/*
+ * Cut the next block from the pending data and hand it to a worker.
+ */
+static int
+bzip2_parallel_submit(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct bzip2_job *job;
+	const char *p;
+	int64_t start, end, search, resume;
+	uint64_t magic;
+	int found;
+
+	if (state->at_header) {
+		/* "BZh", the block size, and a magic number. */
+		if (fill_pending_to(self, state->scan_bit + 80) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		if (!have_pending_to(state, state->scan_bit + 80)) {
+			/* End of input, or garbage after the last stream. */
+			state->scan_done = 1;
+			return (ARCHIVE_OK);
+		}
+		p = state->pending + state->pending_start
+		    + (state->scan_bit / 8 - state->pending_pos);
+		magic = get_bits(state, state->scan_bit + 32, 48);
+		if (memcmp(p, "BZh", 3) != 0 || p[3] < '1' || p[3] > '9'
+		    || (magic != BLOCK_MAGIC && magic != EOS_MAGIC)) {
+			state->scan_done = 1;
+			return (ARCHIVE_OK);
+		}
+		state->level = p[3] - '0';
+		state->scan_bit += 32;
+		state->at_header = 0;
+	}
+
+	start = state->scan_bit;
+	if (fill_pending_to(self, start + 80) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	if (!have_pending_to(state, start + 80)) {
+		state->scan_error = "truncated bzip2 input";
+		state->scan_done = 1;
+		return (ARCHIVE_OK);
+	}
+	job = calloc(1, sizeof(*job));
+	if (job == NULL)
+		goto nomem;
+	job->start = start;
+	job->level = state->level;
+	job->skip = state->skip;
+	job->crc = (uint32_t)get_bits(state, start + 48, 32);
+	magic = get_bits(state, start, 48);
+	if (magic == EOS_MAGIC) {
+		/* The stream is padded to a byte boundary. */
+		job->end_of_stream = 1;
+		job->end = (start + 80 + 7) / 8 * 8;
+		state->at_header = 1;
+	} else if (magic == BLOCK_MAGIC) {
+		/* The block ends where the next magic number starts. */
+		search = start + 48;
+		found = 0;
+		for (;;) {
+			end = find_magic(state, search, &resume);
+			if (end >= 0) {
+				if (found++ == state->skip)
+					break;
+				search = end + 1;
+				continue;
+			}
+			if (resume - start > (int64_t)PARALLEL_SCAN_LIMIT * 8) {
+				state->scan_error = "bzip2 data is corrupted";
+				break;
+			}
+			if (state->upstream_eof) {
+				/* Unless we already passed over something
+				 * that looked like the end. */
+				state->scan_error = state->skip > 0
+				    ? "bzip2 data is corrupted"
+				    : "truncated bzip2 input";
+				break;
+			}
+			if (fill_pending(self, state->pending_len + 64 * 1024)
+			    != ARCHIVE_OK) {
+				bzip2_job_free(job);
+				return (ARCHIVE_FATAL);
+			}
+			search = resume;
+		}
+		if (state->scan_error != NULL) {
+			bzip2_job_free(job);
+			state->scan_done = 1;
+			return (ARCHIVE_OK);
+		}
+		job->end = end;
+		job->in = malloc((size_t)((end + 7) / 8 - start / 8));
+		if (job->in == NULL)
+			goto nomem;
+		memcpy(job->in, state->pending + state->pending_start
+		    + (start / 8 - state->pending_pos),
+		    (size_t)((end + 7) / 8 - start / 8));
+	} else {
+		bzip2_job_free(job);
+		state->scan_error = "bzip2 data is corrupted";
+		state->scan_done = 1;
+		return (ARCHIVE_OK);
+	}
+	if (__archive_parallel_submit(state->parallel, bzip2_job_run, job)
+	    != ARCHIVE_OK)
+		goto nomem;
+	state->scan_bit = job->end;
+	state->skip = 0;
+	return (ARCHIVE_OK);
+nomem:
+	bzip2_job_free(job);
+	archive_set_error(&self->archive->archive, ENOMEM,
+	    "Can't allocate data for bzip2 decompression");
+	return (ARCHIVE_FATAL);
+}
+
+/*
+ * A block failed to decompress.  If the magic number that ended it
+ * was a fluke, the block really goes on to the next one; throw away
+ * everything after it and start over from there.
+ */
+static int
+bzip2_parallel_retry(struct archive_read_filter *self, struct bzip2_job *job)
+{
+	struct private_data *state = (struct private_data *)self->data;
+
+	while (__archive_parallel_pending(state->parallel) > 0)
+		bzip2_job_free(__archive_parallel_next(state->parallel));
+	if (job->skip >= PARALLEL_MAX_SKIP) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC, "bzip2 data is corrupted");
+		return (ARCHIVE_FATAL);
+	}
+	state->scan_bit = job->start;
+	state->level = job->level;
+	state->skip = job->skip + 1;
+	state->at_header = 0;
+	state->scan_done = 0;
+	state->scan_error = NULL;
+	return (ARCHIVE_OK);
+}
+
+static ssize_t
+bzip2_parallel_read(struct archive_read_filter *self, const void **p)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct bzip2_job *job;
+
+	*p = NULL;
+	bzip2_job_free(state->current);
+	state->current = NULL;
+	while (!state->eof) {
+		/* Keep every worker busy, with one block in reserve. */
+		while (!state->scan_done
+		    && __archive_parallel_pending(state->parallel)
+		    < state->threads * 2) {
+			if (bzip2_parallel_submit(self) != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+		}
+		job = __archive_parallel_next(state->parallel);
+		if (job == NULL) {
+			if (state->scan_error != NULL) {
+				archive_set_error(&self->archive->archive,
+				    ARCHIVE_ERRNO_MISC, "%s",
+				    state->scan_error);
+				return (ARCHIVE_FATAL);
+			}
+			state->eof = 1;
+			continue;
+		}
+		if (!job->ok) {
+			if (bzip2_parallel_retry(self, job) != ARCHIVE_OK) {
+				bzip2_job_free(job);
+				return (ARCHIVE_FATAL);
+			}
+			bzip2_job_free(job);
+			continue;
+		}
+		drop_pending_to(state, job->end);
+		if (job->end_of_stream) {
+			if (job->crc != state->combined_crc) {
+				bzip2_job_free(job);
+				archive_set_error(&self->archive->archive,
+				    ARCHIVE_ERRNO_MISC,
+				    "bzip2 data is corrupted");
+				return (ARCHIVE_FATAL);
+			}
+			state->combined_crc = 0;
+			bzip2_job_free(job);
+			continue;
+		}
+		state->combined_crc = ((state->combined_crc << 1)
+		    | (state->combined_crc >> 31)) ^ job->crc;
+		if (job->out_len == 0) {
+			bzip2_job_free(job);
+			continue;
+		}
+		state->current = job;
+		*p = job->out;
+		return (job->out_len);
+	}
+	return (0);
+}
+
 /*
  * Clean up the decompressor.
  */
@@ -349,6 +916,14 @@ bzip2_filter_close(struct archive_read_filter *self)
 
 	state = (struct private_data *)self->data;
 
+	if (state->parallel != NULL) {
+		while (__archive_parallel_pending(state->parallel) > 0)
+			bzip2_job_free(__archive_parallel_next(state->parallel));
+		__archive_parallel_free(state->parallel);
+	}
+	bzip2_job_free(state->current);
+	free(state->pending);
+
 	if (state->valid) {
 		switch (BZ2_bzDecompressEnd(&state->stream)) {
 		case BZ_OK:
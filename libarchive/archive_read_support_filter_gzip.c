@@ -31,6 +31,9 @@ __FBSDID("$FreeBSD$");
 #ifdef HAVE_ERRNO_H
 #include <errno.h>
 #endif
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
 #ifdef HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
@@ -45,10 +48,79 @@ __FBSDID("$FreeBSD$");
 #endif
 
 #include "archive.h"
+#include "archive_crc32.h"
+#include "archive_endian.h"
+#include "archive_parallel_private.h"
 #include "archive_private.h"
 #include "archive_read_private.h"
 
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
 #ifdef HAVE_ZLIB_H
+/*
+ * Random access needs inflateGetDictionary() to save the window at
+ * each checkpoint.
+ */
+#if ZLIB_VERNUM >= 0x1271
+#define	GZIP_SEEKABLE	1
+#endif
+
+/*
+ * A place where decompression can be restarted: the state of the
+ * decompressor after 'out' bytes of output, which is the 32k window
+ * of preceding output plus the position in the compressed stream,
+ * down to the bit.  The first checkpoint is the start of the first
+ * gzip member and has no window.
+ */
+struct checkpoint {
+	int64_t		 out;
+	int64_t		 in;
+	int		 bits;
+	unsigned	 window_len;
+	unsigned char	*window;
+	/* Compressed data at 'in', to catch a stale checkpoint file. */
+	unsigned	 check_len;
+	unsigned char	 check[16];
+};
+
+/* Options for the filters created by one bidder. */
+struct gzip_options {
+	int64_t		 checkpoint_interval;
+	char		*checkpoint_file;
+	int		 threads;
+};
+
+/*
+ * A run of complete gzip members, decompressed on a worker thread.
+ * 'ok' is set only if the input decompressed cleanly and ended
+ * exactly at the end of a member; otherwise the first 'good_in'
+ * bytes still decompressed to the first 'good_out' bytes of output.
+ */
+struct gzip_job {
+	unsigned char	*in;
+	size_t		 in_len;
+	size_t		 good_in;
+	unsigned char	*out;
+	size_t		 out_len;
+	size_t		 out_size;
+	size_t		 good_out;
+	int		 ok;
+};
+
+/* Compressed bytes handed to each worker. */
+#define	PARALLEL_JOB_SIZE	(1024 * 1024)
+/* How far to look for the start of the next member. */
+#define	PARALLEL_SCAN_LIMIT	(8 * 1024 * 1024)
+/*
+ * Most output a worker may produce: 32 times its input, but at least
+ * one job's worth and at most 64 MiB.  Members that inflate to more
+ * than that are left to the caller's thread, which streams them.
+ */
+#define	PARALLEL_OUT_RATIO	32
+#define	PARALLEL_OUT_MAX	(64 * 1024 * 1024)
+
 struct private_data {
 	z_stream	 stream;
 	char		 in_stream;
@@ -56,12 +128,46 @@ struct private_data {
 	size_t		 out_block_size;
 	int64_t		 total_out;
 	unsigned long	 crc;
+	int64_t		 member_out;
 	char		 eof; /* True = found end of compressed data. */
+
+	/* Checkpoints for seeking, in order of 'out'. */
+	struct checkpoint *checkpoints;
+	size_t		 checkpoint_count;
+	size_t		 checkpoint_allocated;
+	int64_t		 checkpoint_interval;
+	char		*checkpoint_file;
+	char		 checkpoints_dirty;
+	/* Start of the compressed stream, to recognize it again. */
+	unsigned char	 signature[32];
+	size_t		 signature_len;
+
+	/* Decompressing members on worker threads. */
+	struct archive_parallel *parallel;
+	int		 threads;
+	/* Compressed data read from upstream but not yet in a job. */
+	unsigned char	*pending;
+	size_t		 pending_start;
+	size_t		 pending_len;
+	size_t		 pending_size;
+	char		 upstream_eof;
+	char		 scan_done;	/* Nothing more to hand out. */
+	char		 scan_blocked;	/* No member boundary in sight. */
+	char		 serial;	/* Inflating 'pending' ourselves. */
+	struct gzip_job	*current;	/* Output being returned. */
 };
 
 /* Gzip Filter. */
 static ssize_t	gzip_filter_read(struct archive_read_filter *, const void **);
+static ssize_t	gzip_parallel_read(struct archive_read_filter *,
+		    const void **);
 static int	gzip_filter_close(struct archive_read_filter *);
+static int	gzip_bidder_options(struct archive_read_filter_bidder *,
+		    const char *, const char *);
+static int	gzip_bidder_free(struct archive_read_filter_bidder *);
+#ifdef GZIP_SEEKABLE
+static int64_t	gzip_filter_seek(struct archive_read_filter *, int64_t, int);
+#endif
 #endif
 
 /*
@@ -99,11 +205,22 @@ archive_read_support_filter_gzip(struct archive *_a)
 	if (__archive_read_get_bidder(a, &bidder) != ARCHIVE_OK)
 		return (ARCHIVE_FATAL);
 
+#ifdef HAVE_ZLIB_H
+	bidder->data = calloc(1, sizeof(struct gzip_options));
+	if (bidder->data == NULL) {
+		archive_set_error(_a, ENOMEM, "Can't allocate gzip options");
+		return (ARCHIVE_FATAL);
+	}
+	bidder->options = gzip_bidder_options;
+	bidder->free = gzip_bidder_free;
+#else
 	bidder->data = NULL;
-	bidder->bid = gzip_bidder_bid;
-	bidder->init = gzip_bidder_init;
 	bidder->options = NULL;
 	bidder->free = NULL; /* No data, so no cleanup necessary. */
+#endif
+	bidder->name = "gzip";
+	bidder->bid = gzip_bidder_bid;
+	bidder->init = gzip_bidder_init;
 	/* Signal the extent of gzip support with the return value here. */
 #if HAVE_ZLIB_H
 	return (ARCHIVE_OK);
@@ -242,6 +359,87 @@ gzip_bidder_init(struct archive_read_filter *self)
 
 #else
 
+/*
+ * Parse a small decimal number; a NULL value means zero.
+ */
+static int
+get_number(const char *value, int64_t max, int64_t *n)
+{
+	*n = 0;
+	if (value == NULL)
+		return (ARCHIVE_OK);
+	if (*value == '\0')
+		return (ARCHIVE_WARN);
+	for (; *value != '\0'; value++) {
+		if (*value < '0' || *value > '9')
+			return (ARCHIVE_WARN);
+		*n = *n * 10 + (*value - '0');
+		if (*n > max)
+			return (ARCHIVE_WARN);
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Options:
+ *   checkpoint=N       Remember how to restart decompression about
+ *                      every N megabytes of output, so that the
+ *                      filter can seek.
+ *   checkpoint-file=F  Load checkpoints from F if it exists and
+ *                      save them there when done.
+ *   threads=N          Decompress up to N gzip members at once.
+ */
+static int
+gzip_bidder_options(struct archive_read_filter_bidder *self,
+    const char *key, const char *value)
+{
+	struct gzip_options *opts = (struct gzip_options *)self->data;
+	int64_t n;
+
+	if (strcmp(key, "checkpoint") == 0) {
+		if (get_number(value, 4096, &n) != ARCHIVE_OK)
+			return (ARCHIVE_WARN);
+		opts->checkpoint_interval = n * 1024 * 1024;
+		return (ARCHIVE_OK);
+	}
+	if (strcmp(key, "threads") == 0) {
+		if (get_number(value, 1024, &n) != ARCHIVE_OK)
+			return (ARCHIVE_WARN);
+		opts->threads = (int)n;
+		return (ARCHIVE_OK);
+	}
+	if (strcmp(key, "checkpoint-file") == 0) {
+		free(opts->checkpoint_file);
+		opts->checkpoint_file = NULL;
+		if (value != NULL) {
+			opts->checkpoint_file = strdup(value);
+			if (opts->checkpoint_file == NULL)
+				return (ARCHIVE_FATAL);
+		}
+		return (ARCHIVE_OK);
+	}
+
+	/* Note: The "warn" return is just to inform the options
+	 * supervisor that we didn't handle it.  It will generate
+	 * a suitable error if no one used this option. */
+	return (ARCHIVE_WARN);
+}
+
+static int
+gzip_bidder_free(struct archive_read_filter_bidder *self)
+{
+	struct gzip_options *opts = (struct gzip_options *)self->data;
+
+	free(opts->checkpoint_file);
+	free(opts);
+	self->data = NULL;
+	return (ARCHIVE_OK);
+}
+
+#ifdef GZIP_SEEKABLE
+static int	load_checkpoints(struct archive_read_filter *);
+#endif
+
 /*
  * Initialize the filter object.
  */
@@ -249,6 +447,7 @@ static int
 gzip_bidder_init(struct archive_read_filter *self)
 {
 	struct private_data *state;
+	struct gzip_options *opts;
 	static const size_t out_block_size = 64 * 1024;
 	void *out_block;
 
@@ -274,6 +473,60 @@ gzip_bidder_init(struct archive_read_filter *self)
 
 	state->in_stream = 0; /* We're not actually within a stream yet. */
 
+#ifdef GZIP_SEEKABLE
+	opts = (struct gzip_options *)self->bidder->data;
+	state->checkpoint_interval = opts->checkpoint_interval;
+	if (opts->checkpoint_file != NULL) {
+		state->checkpoint_file = strdup(opts->checkpoint_file);
+		if (state->checkpoint_file == NULL) {
+			archive_set_error(&self->archive->archive, ENOMEM,
+			    "Can't allocate data for gzip decompression");
+			return (ARCHIVE_FATAL);
+		}
+		if (state->checkpoint_interval == 0)
+			state->checkpoint_interval = 1024 * 1024;
+	}
+	if (state->checkpoint_interval > 0) {
+		const void *p;
+		ssize_t avail;
+
+		/* Decompression can always restart from the top. */
+		state->checkpoints = calloc(16, sizeof(struct checkpoint));
+		if (state->checkpoints == NULL) {
+			archive_set_error(&self->archive->archive, ENOMEM,
+			    "Can't allocate data for gzip decompression");
+			return (ARCHIVE_FATAL);
+		}
+		state->checkpoint_allocated = 16;
+		state->checkpoint_count = 1;
+		state->checkpoints[0].in = self->upstream->position;
+
+		p = __archive_read_filter_ahead(self->upstream, 1, &avail);
+		if (p != NULL) {
+			state->signature_len = avail < 32 ? avail : 32;
+			memcpy(state->signature, p, state->signature_len);
+		}
+		if (state->checkpoint_file != NULL
+		    && load_checkpoints(self) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		self->seek = gzip_filter_seek;
+	}
+#else
+	opts = (struct gzip_options *)self->bidder->data;
+#endif
+
+	/*
+	 * Checkpoints need every byte to go through one decompressor,
+	 * so they rule out working on several members at once.
+	 */
+	if (opts->threads > 0 && state->checkpoint_interval == 0) {
+		state->parallel = __archive_parallel_new(opts->threads);
+		if (state->parallel != NULL) {
+			state->threads = opts->threads;
+			self->read = gzip_parallel_read;
+		}
+	}
+
 	return (ARCHIVE_OK);
 }
 
@@ -294,7 +547,7 @@ consume_header(struct archive_read_filter *self)
 	__archive_read_filter_consume(self->upstream, len);
 
 	/* Initialize CRC accumulator. */
-	state->crc = crc32(0L, NULL, 0);
+	state->crc = __archive_crc32(0L, NULL, 0);
 
 	/* Initialize compression library. */
 	state->stream.next_in = (unsigned char *)(uintptr_t)
@@ -368,19 +621,82 @@ consume_trailer(struct archive_read_filter *self)
 	return (ARCHIVE_OK);
 }
 
+#ifdef GZIP_SEEKABLE
+/*
+ * Called at the end of each deflate block; if we are far enough past
+ * the last checkpoint, record a new one.
+ */
+static int
+add_checkpoint(struct archive_read_filter *self, int64_t out)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct checkpoint *cp;
+	const void *p;
+	ssize_t avail;
+	uInt len = 32768;
+
+	cp = &state->checkpoints[state->checkpoint_count - 1];
+	if (out < cp->out + state->checkpoint_interval)
+		return (ARCHIVE_OK);
+	if (state->checkpoint_count >= state->checkpoint_allocated) {
+		size_t n = state->checkpoint_allocated * 2;
+
+		cp = realloc(state->checkpoints, n * sizeof(*cp));
+		if (cp == NULL)
+			goto nomem;
+		state->checkpoints = cp;
+		state->checkpoint_allocated = n;
+	}
+	cp = &state->checkpoints[state->checkpoint_count];
+	cp->window = malloc(len);
+	if (cp->window == NULL)
+		goto nomem;
+	if (inflateGetDictionary(&state->stream, cp->window, &len) != Z_OK) {
+		free(cp->window);
+		archive_set_error(&self->archive->archive, ARCHIVE_ERRNO_MISC,
+		    "Can't save gzip decompression state");
+		return (ARCHIVE_FATAL);
+	}
+	cp->window_len = len;
+	cp->out = out;
+	cp->in = self->upstream->position;
+	cp->bits = state->stream.data_type & 7;
+	/* Whatever is already buffered; don't force a read. */
+	cp->check_len = 0;
+	p = __archive_read_filter_ahead(self->upstream, 1, &avail);
+	if (p != NULL) {
+		cp->check_len = avail < 16 ? (unsigned)avail : 16;
+		memcpy(cp->check, p, cp->check_len);
+	}
+	state->checkpoint_count++;
+	state->checkpoints_dirty = 1;
+	return (ARCHIVE_OK);
+nomem:
+	archive_set_error(&self->archive->archive, ENOMEM,
+	    "Can't allocate gzip checkpoint");
+	return (ARCHIVE_FATAL);
+}
+#endif
+
+/*
+ * Decompress up to 'size' bytes into the output block.
+ */
 static ssize_t
-gzip_filter_read(struct archive_read_filter *self, const void **p)
+gzip_inflate(struct archive_read_filter *self, size_t size)
 {
 	struct private_data *state;
 	size_t decompressed;
 	ssize_t avail_in;
-	int ret;
+	int flush, ret;
 
 	state = (struct private_data *)self->data;
 
 	/* Empty our output buffer. */
 	state->stream.next_out = state->out_block;
-	state->stream.avail_out = state->out_block_size;
+	state->stream.avail_out = size;
+
+	/* Stop at each deflate block if we're looking for checkpoints. */
+	flush = state->checkpoint_interval > 0 ? Z_BLOCK : Z_NO_FLUSH;
 
 	/* Try to fill the output buffer. */
 	while (state->stream.avail_out > 0 && !state->eof) {
@@ -410,11 +726,21 @@ gzip_filter_read(struct archive_read_filter *self, const void **p)
 		state->stream.avail_in = avail_in;
 
 		/* Decompress and consume some of that data. */
-		ret = inflate(&(state->stream), 0);
+		ret = inflate(&(state->stream), flush);
 		switch (ret) {
 		case Z_OK: /* Decompressor made some progress. */
 			__archive_read_filter_consume(self->upstream,
 			    avail_in - state->stream.avail_in);
+#ifdef GZIP_SEEKABLE
+			/* At the end of a block other than the last? */
+			if (flush == Z_BLOCK
+			    && (state->stream.data_type & 192) == 128
+			    && state->stream.total_out > 0
+			    && add_checkpoint(self, state->total_out
+				+ (state->stream.next_out - state->out_block))
+			    != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+#endif
 			break;
 		case Z_STREAM_END: /* Found end of stream. */
 			__archive_read_filter_consume(self->upstream,
@@ -437,13 +763,863 @@ gzip_filter_read(struct archive_read_filter *self, const void **p)
 	/* We've read as much as we can. */
 	decompressed = state->stream.next_out - state->out_block;
 	state->total_out += decompressed;
-	if (decompressed == 0)
+	return (decompressed);
+}
+
+static ssize_t
+gzip_filter_read(struct archive_read_filter *self, const void **p)
+{
+	struct private_data *state;
+	ssize_t decompressed;
+
+	state = (struct private_data *)self->data;
+	decompressed = gzip_inflate(self, state->out_block_size);
+	if (decompressed <= 0)
 		*p = NULL;
 	else
 		*p = state->out_block;
 	return (decompressed);
 }
 
+/*
+ * Parallel decompression.
+ *
+ * Most big gzip files consist of a single member, but BGZF files and
+ * the output of parallel compressors are runs of many independent
+ * members, and those can be decompressed side by side.  We copy the
+ * compressed data into jobs of about PARALLEL_JOB_SIZE bytes, cut at
+ * member boundaries, decompress the jobs on worker threads and return
+ * their output in order.
+ *
+ * BGZF headers give the size of the member, so the boundary is
+ * certain.  Otherwise we guess: the next member starts at the next
+ * byte sequence that looks like a gzip header.  A worker that doesn't
+ * end up exactly at the end of a member when its input runs out
+ * proves the guess wrong; we then put its input (and that of every
+ * job after it) back and decompress that member ourselves, then
+ * carry on as before.  We do the same if a member is too big to find
+ * its end within PARALLEL_SCAN_LIMIT bytes, or if a job would inflate
+ * to more than its share of memory.
+ */
+
+/*
+ * Parse a gzip member header in memory.  Returns its length, 0 if
+ * more data is needed, or -1 if this isn't a gzip header.  If the
+ * header has a BGZF "BC" subfield, *member_size gets the size of
+ * the whole member, otherwise 0.
+ */
+static ssize_t
+parse_header(const unsigned char *p, size_t avail, size_t *member_size)
+{
+	const unsigned char *z;
+	size_t len = 10, sub, sublen;
+	int flags;
+
+	*member_size = 0;
+	if (avail < 10)
+		return (0);
+	if (memcmp(p, "\x1F\x8B\x08", 3) != 0 || (p[3] & 0xE0) != 0)
+		return (-1);
+	flags = p[3];
+	if (flags & 4) {
+		if (avail < 12)
+			return (0);
+		len = 12 + archive_le16dec(p + 10);
+		if (avail < len)
+			return (0);
+		for (sub = 12; sub + 4 <= len; sub += 4 + sublen) {
+			sublen = archive_le16dec(p + sub + 2);
+			if (p[sub] == 'B' && p[sub + 1] == 'C' && sublen == 2
+			    && sub + 6 <= len)
+				*member_size = archive_le16dec(p + sub + 4) + 1;
+		}
+	}
+	if (flags & 8) {
+		z = memchr(p + len, 0, avail - len);
+		if (z == NULL)
+			return (0);
+		len = z - p + 1;
+	}
+	if (flags & 16) {
+		z = memchr(p + len, 0, avail - len);
+		if (z == NULL)
+			return (0);
+		len = z - p + 1;
+	}
+	if (flags & 2) {
+		len += 2;
+		if (avail < len)
+			return (0);
+	}
+	return (len);
+}
+
+/*
+ * Could a gzip member start here?  Besides the magic number, require
+ * sane values for the flags, the deflate flags and the OS byte so
+ * that compressed data rarely passes.
+ */
+static int
+looks_like_header(const unsigned char *p)
+{
+	return (p[0] == 0x1F && p[1] == 0x8B && p[2] == 0x08
+	    && (p[3] & 0xE0) == 0
+	    && (p[8] == 0 || p[8] == 2 || p[8] == 4)
+	    && (p[9] <= 13 || p[9] == 255));
+}
+
+/*
+ * Worker: decompress every member in the job.
+ */
+static void
+gzip_job_run(void *arg)
+{
+	struct gzip_job *job = (struct gzip_job *)arg;
+	z_stream stream;
+	const unsigned char *trailer;
+	unsigned char *out;
+	size_t pos = 0, member_size, start, limit;
+	ssize_t hlen;
+	int ret;
+
+	job->ok = 0;
+	job->out_len = job->good_out = job->good_in = 0;
+	limit = PARALLEL_OUT_MAX;
+	if (job->in_len < PARALLEL_OUT_MAX / PARALLEL_OUT_RATIO)
+		limit = job->in_len * PARALLEL_OUT_RATIO;
+	if (limit < PARALLEL_JOB_SIZE)
+		limit = PARALLEL_JOB_SIZE;
+	memset(&stream, 0, sizeof(stream));
+	if (inflateInit2(&stream, -15) != Z_OK)
+		return;
+	while (pos < job->in_len) {
+		hlen = parse_header(job->in + pos, job->in_len - pos,
+		    &member_size);
+		if (hlen <= 0 || inflateReset(&stream) != Z_OK)
+			goto done;
+		stream.next_in = job->in + pos + hlen;
+		stream.avail_in = (uInt)(job->in_len - pos - hlen);
+		start = job->out_len;
+		do {
+			if (job->out_len == job->out_size) {
+				size_t n = job->out_size * 2;
+
+				/* Too much; give up on the rest. */
+				if (job->out_size >= limit)
+					goto done;
+				if (n < 64 * 1024)
+					n = 64 * 1024;
+				if (n > limit)
+					n = limit;
+				out = realloc(job->out, n);
+				if (out == NULL)
+					goto done;
+				job->out = out;
+				job->out_size = n;
+			}
+			stream.next_out = job->out + job->out_len;
+			stream.avail_out = (uInt)(job->out_size - job->out_len);
+			ret = inflate(&stream, Z_NO_FLUSH);
+			job->out_len = stream.next_out - job->out;
+		} while (ret == Z_OK);
+		if (ret != Z_STREAM_END || stream.avail_in < 8)
+			goto done;
+		trailer = stream.next_in;
+		if (archive_le32dec(trailer) != (uint32_t)__archive_crc32(0,
+		    job->out + start, job->out_len - start)
+		    || archive_le32dec(trailer + 4)
+		    != (uint32_t)(job->out_len - start))
+			goto done;
+		pos = trailer + 8 - job->in;
+		job->good_in = pos;
+		job->good_out = job->out_len;
+	}
+	job->ok = 1;
+done:
+	inflateEnd(&stream);
+}
+
+static void
+gzip_job_free(struct gzip_job *job)
+{
+	if (job == NULL)
+		return;
+	free(job->in);
+	free(job->out);
+	free(job);
+}
+
+/*
+ * Copy data from upstream until at least 'want' bytes are pending
+ * or upstream runs dry.
+ */
+static int
+fill_pending(struct archive_read_filter *self, size_t want)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	const void *p;
+	unsigned char *buff;
+	ssize_t avail;
+	size_t n, size;
+
+	while (state->pending_len < want && !state->upstream_eof) {
+		p = __archive_read_filter_ahead(self->upstream, 1, &avail);
+		if (p == NULL) {
+			if (avail < 0)
+				return (ARCHIVE_FATAL);
+			state->upstream_eof = 1;
+			break;
+		}
+		n = want - state->pending_len;
+		if (n < 64 * 1024)
+			n = 64 * 1024;
+		if (n > (size_t)avail)
+			n = avail;
+		if (state->pending_start + state->pending_len + n
+		    > state->pending_size) {
+			memmove(state->pending,
+			    state->pending + state->pending_start,
+			    state->pending_len);
+			state->pending_start = 0;
+		}
+		if (state->pending_len + n > state->pending_size) {
+			size = state->pending_size * 2;
+			if (size < state->pending_len + n)
+				size = state->pending_len + n;
+			buff = realloc(state->pending, size);
+			if (buff == NULL) {
+				archive_set_error(&self->archive->archive,
+				    ENOMEM, "Can't allocate data for gzip "
+				    "decompression");
+				return (ARCHIVE_FATAL);
+			}
+			state->pending = buff;
+			state->pending_size = size;
+		}
+		memcpy(state->pending + state->pending_start
+		    + state->pending_len, p, n);
+		state->pending_len += n;
+		__archive_read_filter_consume(self->upstream, n);
+	}
+	return (ARCHIVE_OK);
+}
+
+static void
+drop_pending(struct private_data *state, size_t n)
+{
+	state->pending_start += n;
+	state->pending_len -= n;
+	if (state->pending_len == 0)
+		state->pending_start = 0;
+}
+
+/*
+ * Cut the next job from the pending data and hand it to a worker.
+ */
+static int
+gzip_parallel_submit(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct gzip_job *job;
+	const unsigned char *p, *q;
+	size_t pos = 0, scan, member_size;
+	ssize_t hlen;
+
+	for (;;) {
+		/* 'pos' is where we think a member starts. */
+		if (fill_pending(self, pos + 1024) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		if (pos >= state->pending_len) {
+			/* End of the data. */
+			pos = state->pending_len;
+			if (pos == 0) {
+				state->scan_done = 1;
+				return (ARCHIVE_OK);
+			}
+			break;
+		}
+		p = state->pending + state->pending_start;
+		hlen = parse_header(p + pos, state->pending_len - pos,
+		    &member_size);
+		while (hlen == 0 && !state->upstream_eof
+		    && state->pending_len < PARALLEL_SCAN_LIMIT) {
+			/* A long file name or comment. */
+			if (fill_pending(self, state->pending_len + 1024)
+			    != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+			p = state->pending + state->pending_start;
+			hlen = parse_header(p + pos, state->pending_len - pos,
+			    &member_size);
+		}
+		if (hlen <= 0) {
+			/* End of data, or trailing garbage, which we
+			 * ignore the same way gzip_filter_read() does. */
+			if (pos == 0) {
+				state->scan_done = 1;
+				return (ARCHIVE_OK);
+			}
+			break;
+		}
+		if (pos >= PARALLEL_JOB_SIZE)
+			break;
+		if (member_size > 0) {
+			pos += member_size;
+			continue;
+		}
+
+		/* Find the next thing that looks like a header. */
+		scan = pos + hlen;
+		for (;;) {
+			p = state->pending + state->pending_start;
+			q = NULL;
+			while (scan + 10 <= state->pending_len) {
+				q = memchr(p + scan, 0x1F,
+				    state->pending_len - 9 - scan);
+				if (q == NULL) {
+					scan = state->pending_len - 9;
+					break;
+				}
+				scan = q - p;
+				if (looks_like_header(q))
+					break;
+				scan++;
+				q = NULL;
+			}
+			if (q != NULL || state->upstream_eof
+			    || state->pending_len >= PARALLEL_SCAN_LIMIT)
+				break;
+			if (fill_pending(self, state->pending_len + 256 * 1024)
+			    != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+		}
+		if (q != NULL)
+			pos = scan;
+		else if (state->upstream_eof)
+			pos = state->pending_len;
+		else if (pos > 0)
+			break;
+		else {
+			/* This member is too big to find its end. */
+			state->scan_blocked = 1;
+			return (ARCHIVE_OK);
+		}
+	}
+
+	if (pos > state->pending_len)
+		pos = state->pending_len;
+	job = calloc(1, sizeof(*job));
+	if (job != NULL)
+		job->in = malloc(pos);
+	if (job == NULL || job->in == NULL) {
+		free(job);
+		archive_set_error(&self->archive->archive, ENOMEM,
+		    "Can't allocate data for gzip decompression");
+		return (ARCHIVE_FATAL);
+	}
+	memcpy(job->in, state->pending + state->pending_start, pos);
+	job->in_len = pos;
+	drop_pending(state, pos);
+	if (__archive_parallel_submit(state->parallel, gzip_job_run, job)
+	    != ARCHIVE_OK) {
+		gzip_job_free(job);
+		archive_set_error(&self->archive->archive, ENOMEM,
+		    "Can't allocate data for gzip decompression");
+		return (ARCHIVE_FATAL);
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * A job failed.  Put its input after the members it did manage to
+ * decompress and the input of all later jobs back in front of the
+ * pending data, in order.
+ */
+static int
+gzip_parallel_unwind(struct archive_read_filter *self, struct gzip_job *job)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct gzip_job *j, **jobs;
+	unsigned char *buff;
+	size_t len;
+	int pending, i;
+
+	pending = __archive_parallel_pending(state->parallel);
+	len = job->in_len - job->good_in + state->pending_len;
+	jobs = calloc(pending + 1, sizeof(*jobs));
+	if (jobs == NULL)
+		goto nomem;
+	jobs[0] = job;
+	for (i = 1; i <= pending; i++) {
+		j = __archive_parallel_next(state->parallel);
+		jobs[i] = j;
+		len += j->in_len;
+	}
+	buff = malloc(len > 0 ? len : 1);
+	if (buff == NULL) {
+		for (i = 1; i <= pending; i++)
+			gzip_job_free(jobs[i]);
+		free(jobs);
+		goto nomem;
+	}
+	memcpy(buff, job->in + job->good_in, job->in_len - job->good_in);
+	len = job->in_len - job->good_in;
+	for (i = 1; i <= pending; i++) {
+		memcpy(buff + len, jobs[i]->in, jobs[i]->in_len);
+		len += jobs[i]->in_len;
+		gzip_job_free(jobs[i]);
+	}
+	free(jobs);
+	memcpy(buff + len, state->pending + state->pending_start,
+	    state->pending_len);
+	len += state->pending_len;
+	free(state->pending);
+	state->pending = buff;
+	state->pending_start = 0;
+	state->pending_len = state->pending_size = len;
+	state->scan_done = 0;
+	state->scan_blocked = 0;
+	return (ARCHIVE_OK);
+nomem:
+	archive_set_error(&self->archive->archive, ENOMEM,
+	    "Can't allocate data for gzip decompression");
+	return (ARCHIVE_FATAL);
+}
+
+/*
+ * Decompress the member at the start of the pending data on this
+ * thread.  Clears state->serial once the member is done.
+ */
+static ssize_t
+gzip_parallel_inflate(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	unsigned char *p;
+	size_t member_size, consumed, produced;
+	ssize_t hlen;
+	int ret;
+
+	state->stream.next_out = state->out_block;
+	state->stream.avail_out = (uInt)state->out_block_size;
+	while (state->stream.avail_out > 0 && state->serial) {
+		if (!state->in_stream) {
+			p = state->pending + state->pending_start;
+			hlen = parse_header(p, state->pending_len,
+			    &member_size);
+			if (hlen <= 0) {
+				/* We only get here at a real header. */
+				state->serial = 0;
+				break;
+			}
+			drop_pending(state, hlen);
+			state->stream.next_in = NULL;
+			state->stream.avail_in = 0;
+			if (inflateInit2(&state->stream, -15) != Z_OK) {
+				archive_set_error(&self->archive->archive,
+				    ARCHIVE_ERRNO_MISC,
+				    "Internal error initializing "
+				    "compression library");
+				return (ARCHIVE_FATAL);
+			}
+			state->in_stream = 1;
+			state->crc = __archive_crc32(0L, NULL, 0);
+			state->member_out = 0;
+		}
+		if (state->pending_len == 0) {
+			if (fill_pending(self, 1) != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+			if (state->pending_len == 0)
+				goto truncated;
+		}
+		p = state->pending + state->pending_start;
+		state->stream.next_in = p;
+		state->stream.avail_in = state->pending_len > 0x40000000
+		    ? 0x40000000 : (uInt)state->pending_len;
+		produced = state->stream.avail_out;
+		ret = inflate(&state->stream, Z_NO_FLUSH);
+		produced -= state->stream.avail_out;
+		state->crc = __archive_crc32(state->crc,
+		    state->stream.next_out - produced, produced);
+		state->member_out += produced;
+		consumed = state->stream.next_in - p;
+		drop_pending(state, consumed);
+		if (ret == Z_OK)
+			continue;
+		if (ret != Z_STREAM_END) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC, "gzip decompression failed");
+			return (ARCHIVE_FATAL);
+		}
+		inflateEnd(&state->stream);
+		state->in_stream = 0;
+		if (fill_pending(self, 8) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		if (state->pending_len < 8)
+			goto truncated;
+		p = state->pending + state->pending_start;
+		if (archive_le32dec(p) != (uint32_t)state->crc
+		    || archive_le32dec(p + 4) != (uint32_t)state->member_out) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC, "gzip data is corrupted");
+			return (ARCHIVE_FATAL);
+		}
+		drop_pending(state, 8);
+		state->serial = 0;
+	}
+	return (state->stream.next_out - state->out_block);
+truncated:
+	archive_set_error(&self->archive->archive, ARCHIVE_ERRNO_MISC,
+	    "truncated gzip input");
+	return (ARCHIVE_FATAL);
+}
+
+static ssize_t
+gzip_parallel_read(struct archive_read_filter *self, const void **p)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct gzip_job *job;
+	ssize_t bytes;
+
+	*p = NULL;
+	gzip_job_free(state->current);
+	state->current = NULL;
+	while (!state->eof) {
+		if (state->serial) {
+			bytes = gzip_parallel_inflate(self);
+			if (bytes < 0)
+				return (bytes);
+			if (bytes == 0)
+				continue;
+			state->total_out += bytes;
+			*p = state->out_block;
+			return (bytes);
+		}
+
+		/* Keep every worker busy, with one job in reserve. */
+		while (!state->scan_done && !state->scan_blocked
+		    && __archive_parallel_pending(state->parallel)
+		    < state->threads * 2) {
+			if (gzip_parallel_submit(self) != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+		}
+		job = __archive_parallel_next(state->parallel);
+		if (job == NULL) {
+			if (state->scan_blocked) {
+				state->scan_blocked = 0;
+				state->serial = 1;
+			} else
+				state->eof = 1;
+			continue;
+		}
+		if (!job->ok) {
+			if (gzip_parallel_unwind(self, job) != ARCHIVE_OK) {
+				gzip_job_free(job);
+				return (ARCHIVE_FATAL);
+			}
+			state->serial = 1;
+			job->out_len = job->good_out;
+		}
+		if (job->out_len == 0) {
+			gzip_job_free(job);
+			continue;
+		}
+		state->current = job;
+		state->total_out += job->out_len;
+		*p = job->out;
+		return (job->out_len);
+	}
+	return (0);
+}
+
+#ifdef GZIP_SEEKABLE
+/*
+ * Put the decompressor back in the state recorded at a checkpoint.
+ */
+static int
+restore_checkpoint(struct archive_read_filter *self, struct checkpoint *cp)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	const unsigned char *p;
+	int64_t r;
+	int ret;
+
+	r = __archive_read_filter_seek(self->upstream,
+	    cp->in - (cp->bits ? 1 : 0), SEEK_SET);
+	if (r < 0)
+		return ((int)r);
+
+	if (cp->window == NULL) {
+		/* Start of a gzip member. */
+		if (state->in_stream)
+			inflateEnd(&state->stream);
+		state->in_stream = 0;
+	} else {
+		if (state->in_stream)
+			ret = inflateReset(&state->stream);
+		else {
+			state->stream.next_in = NULL;
+			state->stream.avail_in = 0;
+			ret = inflateInit2(&state->stream, -15);
+		}
+		if (ret != Z_OK)
+			goto fail;
+		state->in_stream = 1;
+		if (cp->bits) {
+			p = __archive_read_filter_ahead(self->upstream, 1, NULL);
+			if (p == NULL) {
+				archive_set_error(&self->archive->archive,
+				    ARCHIVE_ERRNO_MISC, "truncated gzip input");
+				return (ARCHIVE_FATAL);
+			}
+			ret = inflatePrime(&state->stream, cp->bits,
+			    p[0] >> (8 - cp->bits));
+			__archive_read_filter_consume(self->upstream, 1);
+			if (ret != Z_OK)
+				goto fail;
+		}
+		ret = inflateSetDictionary(&state->stream, cp->window,
+		    cp->window_len);
+		if (ret != Z_OK)
+			goto fail;
+		p = NULL;
+		if (cp->check_len > 0)
+			p = __archive_read_filter_ahead(self->upstream,
+			    cp->check_len, NULL);
+		if (cp->check_len > 0 && (p == NULL
+		    || memcmp(p, cp->check, cp->check_len) != 0)) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC,
+			    "gzip checkpoint does not match the data");
+			return (ARCHIVE_FATAL);
+		}
+	}
+	state->total_out = cp->out;
+	state->eof = 0;
+	return (ARCHIVE_OK);
+fail:
+	archive_set_error(&self->archive->archive, ARCHIVE_ERRNO_MISC,
+	    "Can't restore gzip decompression state");
+	return (ARCHIVE_FATAL);
+}
+
+/*
+ * Seek to an offset in the decompressed data: restart from the
+ * nearest checkpoint before it, unless just decompressing forward
+ * from where we are gets there at least as quickly.
+ */
+static int64_t
+gzip_filter_seek(struct archive_read_filter *self, int64_t offset, int whence)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct checkpoint *cp;
+	size_t lo, hi, mid;
+	int64_t target;
+	ssize_t bytes;
+	int r;
+
+	switch (whence) {
+	case SEEK_SET:
+		target = offset;
+		break;
+	case SEEK_CUR:
+		target = self->position + offset;
+		break;
+	case SEEK_END:
+		/* Finding the end would take decompressing everything. */
+		if (!state->eof)
+			return (ARCHIVE_FAILED);
+		target = state->total_out + offset;
+		break;
+	default:
+		return (ARCHIVE_FATAL);
+	}
+	if (target < 0) {
+		archive_set_error(&self->archive->archive, EINVAL,
+		    "Seek before start of gzip data");
+		return (ARCHIVE_FAILED);
+	}
+
+	/* Find the last checkpoint at or before the target. */
+	lo = 0;
+	hi = state->checkpoint_count;
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (state->checkpoints[mid].out <= target)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	cp = &state->checkpoints[lo];
+	if (target < state->total_out || cp->out > state->total_out) {
+		r = restore_checkpoint(self, cp);
+		if (r != ARCHIVE_OK)
+			return (r);
+	}
+
+	while (state->total_out < target) {
+		bytes = gzip_inflate(self,
+		    target - state->total_out < (int64_t)state->out_block_size
+		    ? (size_t)(target - state->total_out)
+		    : state->out_block_size);
+		if (bytes < 0)
+			return (bytes);
+		if (bytes == 0)
+			break;
+	}
+	return (state->total_out);
+}
+
+/*
+ * Checkpoint files are little-endian:
+ *    8 bytes   magic "LAGZCKP1"
+ *    4 bytes   length of the signature
+ *   32 bytes   signature: the start of the compressed stream
+ *    8 bytes   number of checkpoints
+ *   per checkpoint: uncompressed offset (8 bytes), compressed offset
+ *   (8 bytes), bit offset (4 bytes), length of the check bytes
+ *   (4 bytes), check bytes (16 bytes), window length (4 bytes) and
+ *   the window, which is absent for the first one.
+ *
+ * A file that doesn't belong to this stream is ignored.
+ */
+#define	CKP_MAGIC	"LAGZCKP1"
+#define	CKP_HEADER_SIZE	52
+#define	CKP_RECORD_SIZE	44
+
+static int
+load_checkpoints(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct checkpoint *cp;
+	unsigned char *buff = NULL, *p, *end;
+	uint64_t count, i;
+	size_t size = 0, alloc = 0;
+	ssize_t bytes;
+	int fd;
+
+	fd = open(state->checkpoint_file, O_RDONLY | O_BINARY);
+	if (fd < 0)
+		return (ARCHIVE_OK);
+	for (;;) {
+		if (size == alloc) {
+			alloc = alloc ? alloc * 2 : 256 * 1024;
+			p = realloc(buff, alloc);
+			if (p == NULL) {
+				free(buff);
+				close(fd);
+				archive_set_error(&self->archive->archive,
+				    ENOMEM, "Can't read gzip checkpoints");
+				return (ARCHIVE_FATAL);
+			}
+			buff = p;
+		}
+		bytes = read(fd, buff + size, alloc - size);
+		if (bytes <= 0)
+			break;
+		size += bytes;
+	}
+	close(fd);
+	if (bytes < 0 || size < CKP_HEADER_SIZE
+	    || memcmp(buff, CKP_MAGIC, 8) != 0
+	    || archive_le32dec(buff + 8) != state->signature_len
+	    || memcmp(buff + 12, state->signature, state->signature_len) != 0)
+		goto ignore;
+	count = archive_le64dec(buff + 44);
+	if (count < 1 || count > size / CKP_RECORD_SIZE)
+		goto ignore;
+	cp = calloc((size_t)count, sizeof(*cp));
+	if (cp == NULL) {
+		free(buff);
+		archive_set_error(&self->archive->archive, ENOMEM,
+		    "Can't read gzip checkpoints");
+		return (ARCHIVE_FATAL);
+	}
+	p = buff + CKP_HEADER_SIZE;
+	end = buff + size;
+	for (i = 0; i < count; i++) {
+		if (end - p < CKP_RECORD_SIZE)
+			break;
+		cp[i].out = (int64_t)archive_le64dec(p);
+		cp[i].in = (int64_t)archive_le64dec(p + 8);
+		cp[i].bits = (int)archive_le32dec(p + 16);
+		cp[i].check_len = archive_le32dec(p + 20);
+		memcpy(cp[i].check, p + 24, 16);
+		cp[i].window_len = archive_le32dec(p + 40);
+		p += CKP_RECORD_SIZE;
+		if (cp[i].in < 0 || cp[i].bits < 0 || cp[i].bits > 7
+		    || cp[i].check_len > 16 || cp[i].window_len > 32768
+		    || (size_t)(end - p) < cp[i].window_len
+		    || (i == 0 ? cp[i].out != 0 || cp[i].window_len != 0
+			: cp[i].out <= cp[i - 1].out || cp[i].window_len == 0))
+			break;
+		if (i > 0) {
+			cp[i].window = malloc(cp[i].window_len);
+			if (cp[i].window == NULL)
+				break;
+			memcpy(cp[i].window, p, cp[i].window_len);
+			p += cp[i].window_len;
+		}
+	}
+	if (i < count) {
+		while (i > 0)
+			free(cp[--i].window);
+		free(cp);
+		goto ignore;
+	}
+	free(buff);
+	free(state->checkpoints);
+	state->checkpoints = cp;
+	state->checkpoint_count = state->checkpoint_allocated = (size_t)count;
+	return (ARCHIVE_OK);
+ignore:
+	free(buff);
+	return (ARCHIVE_OK);
+}
+
+static int
+save_checkpoints(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct checkpoint *cp;
+	unsigned char header[CKP_HEADER_SIZE], rec[CKP_RECORD_SIZE];
+	size_t i;
+	int fd, ok;
+
+	fd = open(state->checkpoint_file, O_WRONLY | O_CREAT | O_TRUNC
+	    | O_BINARY, 0666);
+	if (fd < 0) {
+		archive_set_error(&self->archive->archive, errno,
+		    "Can't create '%s'", state->checkpoint_file);
+		return (ARCHIVE_WARN);
+	}
+	memset(header, 0, sizeof(header));
+	memcpy(header, CKP_MAGIC, 8);
+	archive_le32enc(header + 8, (uint32_t)state->signature_len);
+	memcpy(header + 12, state->signature, state->signature_len);
+	archive_le64enc(header + 44, state->checkpoint_count);
+	ok = write(fd, header, sizeof(header)) == sizeof(header);
+	for (i = 0; ok && i < state->checkpoint_count; i++) {
+		cp = &state->checkpoints[i];
+		archive_le64enc(rec, cp->out);
+		archive_le64enc(rec + 8, cp->in);
+		archive_le32enc(rec + 16, cp->bits);
+		archive_le32enc(rec + 20, cp->check_len);
+		memcpy(rec + 24, cp->check, 16);
+		archive_le32enc(rec + 40, cp->window_len);
+		ok = write(fd, rec, sizeof(rec)) == sizeof(rec)
+		    && (cp->window_len == 0 || write(fd, cp->window,
+			cp->window_len) == (ssize_t)cp->window_len);
+	}
+	if (close(fd) != 0)
+		ok = 0;
+	if (!ok) {
+		archive_set_error(&self->archive->archive, errno,
+		    "Can't write '%s'", state->checkpoint_file);
+		return (ARCHIVE_WARN);
+	}
+	return (ARCHIVE_OK);
+}
+#endif
+
 /*
  * Clean up the decompressor.
  */
@@ -451,6 +1627,7 @@ static int
 gzip_filter_close(struct archive_read_filter *self)
 {
 	struct private_data *state;
+	size_t i;
 	int ret;
 
 	state = (struct private_data *)self->data;
@@ -468,6 +1645,22 @@ gzip_filter_close(struct archive_read_filter *self)
 		}
 	}
 
+#ifdef GZIP_SEEKABLE
+	if (ret == ARCHIVE_OK && state->checkpoint_file != NULL
+	    && state->checkpoints_dirty)
+		ret = save_checkpoints(self);
+#endif
+	if (state->parallel != NULL) {
+		while (__archive_parallel_pending(state->parallel) > 0)
+			gzip_job_free(__archive_parallel_next(state->parallel));
+		__archive_parallel_free(state->parallel);
+	}
+	gzip_job_free(state->current);
+	free(state->pending);
+	for (i = 0; i < state->checkpoint_count; i++)
+		free(state->checkpoints[i].window);
+	free(state->checkpoints);
+	free(state->checkpoint_file);
 	free(state->out_block);
 	free(state);
 	return (ret);
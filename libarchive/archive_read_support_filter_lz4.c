@@ -0,0 +1,595 @@
+/*-
+ * Copyright (c) 2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "archive.h"
+#include "archive_endian.h"
+#include "archive_private.h"
+#include "archive_read_private.h"
+#include "archive_xxhash_private.h"
+
+/*
+ * LZ4 decompression.  The LZ4 block format is simple enough that we
+ * decode it ourselves rather than depend on an outside library.
+ *
+ * Both the frame format (magic 0x184D2204), with its optional block
+ * and content checksums, and the older "legacy" format written by
+ * "lz4 -l" are handled.  Frames may be concatenated and interleaved
+ * with skippable frames.
+ */
+
+#define	LZ4_MAGIC		0x184D2204U
+#define	LZ4_LEGACY_MAGIC	0x184C2102U
+#define	LZ4_SKIPPABLE_MAGIC	0x184D2A50U	/* Low four bits vary. */
+#define	LZ4_SKIPPABLE_MASK	0xFFFFFFF0U
+
+#define	LZ4_LEGACY_BLOCK_SIZE	(8 * 1024 * 1024)
+/* Worst case for a legacy block: LZ4_compressBound(8 MiB). */
+#define	LZ4_LEGACY_MAX_INPUT	(LZ4_LEGACY_BLOCK_SIZE \
+				 + LZ4_LEGACY_BLOCK_SIZE / 255 + 16)
+/* How far back a match can reach. */
+#define	LZ4_WINDOW		(64 * 1024)
+
+struct private_data {
+	enum {
+		SELECT_FRAME,	/* Looking for the next frame. */
+		FRAME,
+		LEGACY
+	}		 stage;
+	/* Flags of the current frame. */
+	char		 block_independence;
+	char		 block_checksum;
+	char		 content_checksum;
+	char		 has_content_size;
+	size_t		 block_max;
+	int64_t		 content_size;
+	int64_t		 frame_out;
+	struct archive_xxh32 xxh;
+
+	/*
+	 * Decompressed blocks go to out_block + history; the history
+	 * before them holds the end of the previous block for frames
+	 * whose blocks refer to each other.
+	 */
+	unsigned char	*out_block;
+	size_t		 out_block_size;
+	size_t		 history;
+	size_t		 last_len;
+	char		 eof;
+	char		 found_frame;
+};
+
+static int	lz4_bidder_bid(struct archive_read_filter_bidder *,
+		    struct archive_read_filter *);
+static int	lz4_bidder_init(struct archive_read_filter *);
+static ssize_t	lz4_filter_read(struct archive_read_filter *, const void **);
+static int	lz4_filter_close(struct archive_read_filter *);
+
+int
+archive_read_support_filter_lz4(struct archive *_a)
+{
+	struct archive_read *a = (struct archive_read *)_a;
+	struct archive_read_filter_bidder *bidder;
+
+	archive_check_magic(_a, ARCHIVE_READ_MAGIC,
+	    ARCHIVE_STATE_NEW, "archive_read_support_filter_lz4");
+
+	if (__archive_read_get_bidder(a, &bidder) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+
+	bidder->data = NULL;
+	bidder->name = "lz4";
+	bidder->bid = lz4_bidder_bid;
+	bidder->init = lz4_bidder_init;
+	bidder->options = NULL;
+	bidder->free = NULL;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Check the frame descriptor: version 01, reserved bits clear, a
+ * known block size and a matching header checksum.  Returns the
+ * descriptor length or 0.
+ */
+static size_t
+lz4_frame_descriptor(const unsigned char *p, size_t avail)
+{
+	size_t len;
+
+	if (avail < 7)
+		return (0);
+	if ((p[4] & 0xC2) != 0x40 || (p[5] & 0x8F) != 0
+	    || (p[5] >> 4) < 4)
+		return (0);
+	len = 3;			/* FLG, BD, HC */
+	if (p[4] & 0x08)
+		len += 8;		/* Content size. */
+	if (p[4] & 0x01)
+		len += 4;		/* Dictionary ID. */
+	if (avail < 4 + len)
+		return (0);
+	if (((__archive_xxh32(p + 4, len - 1, 0) >> 8) & 0xff)
+	    != p[4 + len - 1])
+		return (0);
+	return (len);
+}
+
+static int
+lz4_bidder_bid(struct archive_read_filter_bidder *self,
+    struct archive_read_filter *filter)
+{
+	const unsigned char *p;
+	ssize_t avail;
+	uint32_t magic;
+
+	(void)self; /* UNUSED */
+
+	p = __archive_read_filter_ahead(filter, 4, &avail);
+	if (p == NULL)
+		return (0);
+	magic = archive_le32dec(p);
+	if (magic == LZ4_MAGIC) {
+		p = __archive_read_filter_ahead(filter, 19, &avail);
+		if (p == NULL)
+			p = __archive_read_filter_ahead(filter, 7, &avail);
+		if (p == NULL || lz4_frame_descriptor(p, avail) == 0)
+			return (0);
+		/* 32-bit magic, 8 bits of flags and 8 of checksum. */
+		return (48);
+	}
+	if (magic == LZ4_LEGACY_MAGIC)
+		return (32);
+	return (0);
+}
+
+static int
+lz4_bidder_init(struct archive_read_filter *self)
+{
+	struct private_data *state;
+
+	self->code = ARCHIVE_FILTER_LZ4;
+	self->name = "lz4";
+
+	state = (struct private_data *)calloc(sizeof(*state), 1);
+	if (state == NULL) {
+		archive_set_error(&self->archive->archive, ENOMEM,
+		    "Can't allocate data for lz4 decompression");
+		return (ARCHIVE_FATAL);
+	}
+	self->data = state;
+	self->read = lz4_filter_read;
+	self->skip = NULL; /* not supported */
+	self->close = lz4_filter_close;
+	state->stage = SELECT_FRAME;
+	return (ARCHIVE_OK);
+}
+
+static int
+lz4_allocate_out_block(struct archive_read_filter *self, size_t block_max)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	size_t size = LZ4_WINDOW + block_max;
+	unsigned char *p;
+
+	if (state->out_block_size < size) {
+		p = malloc(size);
+		if (p == NULL) {
+			archive_set_error(&self->archive->archive, ENOMEM,
+			    "Can't allocate data for lz4 decompression");
+			return (ARCHIVE_FATAL);
+		}
+		free(state->out_block);
+		state->out_block = p;
+		state->out_block_size = size;
+	}
+	state->block_max = block_max;
+	state->history = 0;
+	state->last_len = 0;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Decode one LZ4 block into base + start.  Matches may refer back to
+ * 'base' itself, where the history is.  Returns the decoded length,
+ * or -1 if the block is corrupt or doesn't fit in 'limit' bytes.
+ */
+static ssize_t
+lz4_decode_block(const unsigned char *src, size_t src_len,
+    unsigned char *base, size_t start, size_t limit)
+{
+	const unsigned char *ip = src, *iend = src + src_len;
+	unsigned char *op = base + start, *oend = op + limit;
+	const unsigned char *match;
+	size_t len, offset, n;
+	unsigned token;
+
+	for (;;) {
+		if (ip >= iend)
+			return (-1);
+		token = *ip++;
+
+		/* Literals. */
+		len = token >> 4;
+		if (len == 15) {
+			do {
+				if (ip >= iend)
+					return (-1);
+				n = *ip++;
+				len += n;
+			} while (n == 255);
+		}
+		if (len > (size_t)(iend - ip) || len > (size_t)(oend - op))
+			return (-1);
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+		if (ip == iend)
+			break;	/* The last sequence has no match. */
+
+		/* Match. */
+		if (iend - ip < 2)
+			return (-1);
+		offset = archive_le16dec(ip);
+		ip += 2;
+		if (offset == 0 || offset > (size_t)(op - base))
+			return (-1);
+		len = token & 15;
+		if (len == 15) {
+			do {
+				if (ip >= iend)
+					return (-1);
+				n = *ip++;
+				len += n;
+			} while (n == 255);
+		}
+		len += 4;
+		if (len > (size_t)(oend - op))
+			return (-1);
+		match = op - offset;
+		/* An overlapping match repeats the bytes before it;
+		 * each copy doubles the distance we can copy from. */
+		while (len > 0) {
+			n = op - match;
+			if (n > len)
+				n = len;
+			memcpy(op, match, n);
+			op += n;
+			len -= n;
+		}
+	}
+	return (op - (base + start));
+}
+
+/*
+ * Read a frame header, or skip a skippable frame.
+ */
+static int
+lz4_select_frame(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	const unsigned char *p;
+	ssize_t avail;
+	uint32_t magic;
+	size_t len;
+
+	p = __archive_read_filter_ahead(self->upstream, 4, &avail);
+	if (p == NULL) {
+		if (avail < 0)
+			return (ARCHIVE_FATAL);
+		/* Clean end of input. */
+		state->eof = 1;
+		return (ARCHIVE_OK);
+	}
+	magic = archive_le32dec(p);
+	if ((magic & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC) {
+		p = __archive_read_filter_ahead(self->upstream, 8, NULL);
+		if (p == NULL)
+			goto truncated;
+		if (__archive_read_filter_consume(self->upstream,
+		    8 + (int64_t)archive_le32dec(p + 4)) < 0)
+			return (ARCHIVE_FATAL);
+		return (ARCHIVE_OK);
+	}
+	if (magic == LZ4_LEGACY_MAGIC) {
+		__archive_read_filter_consume(self->upstream, 4);
+		if (lz4_allocate_out_block(self, LZ4_LEGACY_BLOCK_SIZE)
+		    != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		state->block_independence = 1;
+		state->stage = LEGACY;
+		state->found_frame = 1;
+		return (ARCHIVE_OK);
+	}
+	if (magic != LZ4_MAGIC) {
+		/* Like gzip, ignore anything after the last frame. */
+		if (state->found_frame) {
+			state->eof = 1;
+			return (ARCHIVE_OK);
+		}
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC, "Invalid lz4 frame");
+		return (ARCHIVE_FATAL);
+	}
+
+	/* The descriptor is 7 to 19 bytes long, counting the magic. */
+	p = __archive_read_filter_ahead(self->upstream, 19, &avail);
+	if (p == NULL)
+		p = __archive_read_filter_ahead(self->upstream, 7, &avail);
+	if (p == NULL)
+		goto truncated;
+	len = lz4_frame_descriptor(p, avail);
+	if (len == 0) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC, "Invalid lz4 frame descriptor");
+		return (ARCHIVE_FATAL);
+	}
+	if (p[4] & 0x01) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC,
+		    "lz4 frames with a preset dictionary are not supported");
+		return (ARCHIVE_FATAL);
+	}
+	state->block_independence = (p[4] >> 5) & 1;
+	state->block_checksum = (p[4] >> 4) & 1;
+	state->has_content_size = (p[4] >> 3) & 1;
+	state->content_checksum = (p[4] >> 2) & 1;
+	if (state->has_content_size)
+		state->content_size = (int64_t)archive_le64dec(p + 6);
+	if (lz4_allocate_out_block(self, (size_t)1 << (2 * (p[5] >> 4) + 8))
+	    != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	__archive_read_filter_consume(self->upstream, 4 + len);
+	__archive_xxh32_init(&state->xxh, 0);
+	state->frame_out = 0;
+	state->stage = FRAME;
+	state->found_frame = 1;
+	return (ARCHIVE_OK);
+truncated:
+	archive_set_error(&self->archive->archive, ARCHIVE_ERRNO_MISC,
+	    "truncated lz4 input");
+	return (ARCHIVE_FATAL);
+}
+
+/*
+ * Finish a frame: the EndMark has been consumed.
+ */
+static int
+lz4_end_frame(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	const unsigned char *p;
+
+	if (state->content_checksum) {
+		p = __archive_read_filter_ahead(self->upstream, 4, NULL);
+		if (p == NULL) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC, "truncated lz4 input");
+			return (ARCHIVE_FATAL);
+		}
+		if (archive_le32dec(p) != __archive_xxh32_digest(&state->xxh)) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC, "lz4 stream checksum error");
+			return (ARCHIVE_FATAL);
+		}
+		__archive_read_filter_consume(self->upstream, 4);
+	}
+	if (state->has_content_size
+	    && state->content_size != state->frame_out) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC, "lz4 content size mismatch");
+		return (ARCHIVE_FATAL);
+	}
+	state->stage = SELECT_FRAME;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Decode the next block of the current frame.  Returns its length,
+ * 0 at the end of the frame, or an error.
+ */
+static ssize_t
+lz4_frame_block(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	const unsigned char *p;
+	unsigned char *out;
+	size_t len, total;
+	ssize_t n;
+	uint32_t v;
+	int compressed;
+
+	p = __archive_read_filter_ahead(self->upstream, 4, NULL);
+	if (p == NULL)
+		goto truncated;
+	v = archive_le32dec(p);
+	if (v == 0) {
+		/* EndMark. */
+		__archive_read_filter_consume(self->upstream, 4);
+		if (lz4_end_frame(self) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		return (0);
+	}
+	compressed = (v & 0x80000000U) == 0;
+	len = v & 0x7FFFFFFFU;
+	if (len > state->block_max) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC, "Invalid lz4 block size");
+		return (ARCHIVE_FATAL);
+	}
+	total = 4 + len + (state->block_checksum ? 4 : 0);
+	p = __archive_read_filter_ahead(self->upstream, total, NULL);
+	if (p == NULL)
+		goto truncated;
+	p += 4;
+	if (state->block_checksum
+	    && __archive_xxh32(p, len, 0) != archive_le32dec(p + len)) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC, "lz4 block checksum error");
+		return (ARCHIVE_FATAL);
+	}
+	out = state->out_block + state->history;
+	if (compressed) {
+		n = lz4_decode_block(p, len,
+		    state->block_independence ? out : state->out_block,
+		    state->block_independence ? 0 : state->history,
+		    state->block_max);
+		if (n < 0) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC, "lz4 data is corrupted");
+			return (ARCHIVE_FATAL);
+		}
+	} else {
+		memcpy(out, p, len);
+		n = len;
+	}
+	__archive_read_filter_consume(self->upstream, total);
+	if (state->content_checksum)
+		__archive_xxh32_update(&state->xxh, out, n);
+	state->frame_out += n;
+	return (n);
+truncated:
+	archive_set_error(&self->archive->archive, ARCHIVE_ERRNO_MISC,
+	    "truncated lz4 input");
+	return (ARCHIVE_FATAL);
+}
+
+/*
+ * Decode the next block of a legacy stream, which ends at the end of
+ * the input or at the next magic number.
+ */
+static ssize_t
+lz4_legacy_block(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	const unsigned char *p;
+	ssize_t avail, n;
+	uint32_t v;
+
+	p = __archive_read_filter_ahead(self->upstream, 4, &avail);
+	if (p == NULL) {
+		if (avail < 0)
+			return (ARCHIVE_FATAL);
+		state->stage = SELECT_FRAME;
+		return (0);
+	}
+	v = archive_le32dec(p);
+	if (v == LZ4_MAGIC || v == LZ4_LEGACY_MAGIC
+	    || (v & LZ4_SKIPPABLE_MASK) == LZ4_SKIPPABLE_MAGIC) {
+		state->stage = SELECT_FRAME;
+		return (0);
+	}
+	if (v > LZ4_LEGACY_MAX_INPUT) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC, "Invalid lz4 block size");
+		return (ARCHIVE_FATAL);
+	}
+	p = __archive_read_filter_ahead(self->upstream, 4 + v, NULL);
+	if (p == NULL) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC, "truncated lz4 input");
+		return (ARCHIVE_FATAL);
+	}
+	n = lz4_decode_block(p + 4, v, state->out_block, 0,
+	    LZ4_LEGACY_BLOCK_SIZE);
+	if (n < 0) {
+		archive_set_error(&self->archive->archive,
+		    ARCHIVE_ERRNO_MISC, "lz4 data is corrupted");
+		return (ARCHIVE_FATAL);
+	}
+	__archive_read_filter_consume(self->upstream, 4 + v);
+	return (n);
+}
+
+/*
+ * Return the next block of decompressed data.
+ */
+static ssize_t
+lz4_filter_read(struct archive_read_filter *self, const void **p)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	size_t keep;
+	ssize_t n = 0;
+
+	/* Keep the last 64 KiB for blocks that refer back to them. */
+	if (state->stage == FRAME && !state->block_independence) {
+		keep = state->history + state->last_len;
+		if (keep > LZ4_WINDOW)
+			keep = LZ4_WINDOW;
+		memmove(state->out_block, state->out_block + state->history
+		    + state->last_len - keep, keep);
+		state->history = keep;
+	}
+	state->last_len = 0;
+
+	while (n == 0 && !state->eof) {
+		switch (state->stage) {
+		case SELECT_FRAME:
+			if (lz4_select_frame(self) != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+			break;
+		case FRAME:
+			n = lz4_frame_block(self);
+			break;
+		case LEGACY:
+			n = lz4_legacy_block(self);
+			break;
+		}
+		if (n < 0)
+			return (n);
+	}
+	if (n == 0) {
+		*p = NULL;
+		return (0);
+	}
+	*p = state->out_block + state->history;
+	state->last_len = n;
+	return (n);
+}
+
+/*
+ * Clean up the decompressor.
+ */
+static int
+lz4_filter_close(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+
+	free(state->out_block);
+	free(state);
+	return (ARCHIVE_OK);
+}
@@ -374,7 +374,7 @@ int
 __archive_read_program(struct archive_read_filter *self, const char *cmd)
 {
 	struct program_filter	*state;
-	static const size_t out_buf_len = 65536;
+	static const size_t out_buf_len = 1024 * 1024;
 	char *out_buf;
 	char *description;
 	const char *prefix = "Program: ";
@@ -49,11 +49,28 @@ __FBSDID("$FreeBSD$");
 
 #include "archive.h"
 #include "archive_endian.h"
+#include "archive_parallel_private.h"
 #include "archive_private.h"
 #include "archive_read_private.h"
 
 #if HAVE_LZMA_H && HAVE_LIBLZMA
 
+struct xz_options {
+	int		 threads;
+};
+
+/* One xz block, decompressed on its own. */
+struct xz_job {
+	unsigned char	*in;
+	size_t		 in_len;	/* Total size of the block. */
+	lzma_vli	 unpadded_size;
+	lzma_check	 check;
+	unsigned char	*out;
+	size_t		 out_len;
+	int64_t		 out_offset;	/* Where 'out' starts in the output. */
+	int		 ret;
+};
+
 struct private_data {
 	lzma_stream	 stream;
 	unsigned char	*out_block;
@@ -67,8 +84,31 @@ struct private_data {
 	uint32_t	 crc32;
 	int64_t		 member_in;
 	int64_t		 member_out;
+
+	/*
+	 * Following variables are used for xz only: with the Index
+	 * from the end of a seekable file, blocks can be located and
+	 * decompressed independently.
+	 */
+	lzma_index	*index;
+	lzma_index_iter	 iter;
+	char		 iter_ready;	/* 'iter' is the next block to read. */
+	char		 iter_end;
+	char		 index_failed;
+	char		 again;		/* Return 'current' once more. */
+	int64_t		 in_start;	/* Upstream position of the stream. */
+	int64_t		 skip_out;
+	struct archive_parallel *parallel;
+	int		 threads;
+	struct xz_job	*current;
 };
 
+/*
+ * Blocks bigger than this are left to the streaming decompressor,
+ * which doesn't need to hold a whole block in memory.
+ */
+#define	XZ_BLOCK_LIMIT	(256 * 1024 * 1024)
+
 #if LZMA_VERSION_MAJOR >= 5
 /* Effectively disable the limiter. */
 #define LZMA_MEMLIMIT	UINT64_MAX
@@ -81,6 +121,11 @@ struct private_data {
 static ssize_t	xz_filter_read(struct archive_read_filter *, const void **);
 static int	xz_filter_close(struct archive_read_filter *);
 static int	xz_lzma_bidder_init(struct archive_read_filter *);
+static int	xz_bidder_options(struct archive_read_filter_bidder *,
+		    const char *, const char *);
+static int	xz_bidder_free(struct archive_read_filter_bidder *);
+static ssize_t	xz_indexed_read(struct archive_read_filter *, const void **);
+static int64_t	xz_filter_seek(struct archive_read_filter *, int64_t, int);
 
 #elif HAVE_LZMADEC_H && HAVE_LIBLZMADEC
 
@@ -135,11 +180,22 @@ archive_read_support_filter_xz(struct archive *_a)
 	if (__archive_read_get_bidder(a, &bidder) != ARCHIVE_OK)
 		return (ARCHIVE_FATAL);
 
+#if HAVE_LZMA_H && HAVE_LIBLZMA
+	bidder->data = calloc(1, sizeof(struct xz_options));
+	if (bidder->data == NULL) {
+		archive_set_error(_a, ENOMEM, "Can't allocate xz options");
+		return (ARCHIVE_FATAL);
+	}
+	bidder->options = xz_bidder_options;
+	bidder->free = xz_bidder_free;
+#else
 	bidder->data = NULL;
-	bidder->bid = xz_bidder_bid;
-	bidder->init = xz_bidder_init;
 	bidder->options = NULL;
 	bidder->free = NULL;
+#endif
+	bidder->name = "xz";
+	bidder->bid = xz_bidder_bid;
+	bidder->init = xz_bidder_init;
 #if HAVE_LZMA_H && HAVE_LIBLZMA
 	return (ARCHIVE_OK);
 #else
@@ -412,12 +468,77 @@ lzip_bidder_bid(struct archive_read_filter_bidder *self,
 /*
  * liblzma 4.999.7 and later support both lzma and xz streams.
  */
+static int	load_index(struct archive_read_filter *);
+
 static int
 xz_bidder_init(struct archive_read_filter *self)
 {
+	struct xz_options *opts = (struct xz_options *)self->bidder->data;
+	struct private_data *state;
+	int r;
+
 	self->code = ARCHIVE_COMPRESSION_XZ;
 	self->name = "xz";
-	return (xz_lzma_bidder_init(self));
+	r = xz_lzma_bidder_init(self);
+	if (r != ARCHIVE_OK)
+		return (r);
+	state = (struct private_data *)self->data;
+	state->in_start = self->upstream->position;
+	self->seek = xz_filter_seek;
+
+	/*
+	 * Blocks can only be handed to several threads when the
+	 * Index says where they are.  A single block gains nothing.
+	 */
+	if (opts->threads > 0 && load_index(self) == ARCHIVE_OK
+	    && lzma_index_block_count(state->index) > 1) {
+		state->parallel = __archive_parallel_new(opts->threads);
+		if (state->parallel != NULL) {
+			state->threads = opts->threads;
+			lzma_index_iter_init(&state->iter, state->index);
+			self->read = xz_indexed_read;
+		}
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Options:
+ *   threads=N          Decompress up to N blocks at once.
+ */
+static int
+xz_bidder_options(struct archive_read_filter_bidder *self,
+    const char *key, const char *value)
+{
+	struct xz_options *opts = (struct xz_options *)self->data;
+	int n = 0;
+
+	if (strcmp(key, "threads") == 0) {
+		if (value == NULL || *value == '\0')
+			return (ARCHIVE_WARN);
+		for (; *value != '\0'; value++) {
+			if (*value < '0' || *value > '9')
+				return (ARCHIVE_WARN);
+			n = n * 10 + (*value - '0');
+			if (n > 1024)
+				return (ARCHIVE_WARN);
+		}
+		opts->threads = n;
+		return (ARCHIVE_OK);
+	}
+
+	/* Note: The "warn" return is just to inform the options
+	 * supervisor that we didn't handle it.  It will generate
+	 * a suitable error if no one used this option. */
+	return (ARCHIVE_WARN);
+}
+
+static int
+xz_bidder_free(struct archive_read_filter_bidder *self)
+{
+	free(self->data);
+	self->data = NULL;
+	return (ARCHIVE_OK);
 }
 
 static int
@@ -743,6 +864,391 @@ xz_filter_read(struct archive_read_filter *self, const void **p)
 	return (decompressed);
 }
 
+/*
+ * Read 'len' bytes at an absolute upstream offset.
+ */
+static const unsigned char *
+read_at(struct archive_read_filter *self, int64_t offset, size_t len)
+{
+	if (__archive_read_filter_seek(self->upstream, offset, SEEK_SET) < 0)
+		return (NULL);
+	return (__archive_read_filter_ahead(self->upstream, len, NULL));
+}
+
+/*
+ * Load the Index of every stream in the file, working back from the
+ * end, into one lzma_index that maps uncompressed offsets to blocks.
+ * Returns ARCHIVE_FAILED, with the upstream where it was, if the
+ * input can't seek or doesn't look like a well-formed .xz file.
+ */
+static int
+load_index(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	lzma_stream_flags header_flags, footer_flags;
+	lzma_index *index = NULL, *this_index = NULL;
+	lzma_index_iter iter;
+	const unsigned char *p;
+	uint64_t memlimit;
+	int64_t saved, pos, padding;
+	size_t in_pos;
+
+	if (state->index != NULL)
+		return (ARCHIVE_OK);
+	if (state->index_failed)
+		return (ARCHIVE_FAILED);
+	state->index_failed = 1;
+
+	saved = self->upstream->position;
+	pos = __archive_read_filter_seek(self->upstream, 0, SEEK_END);
+	if (pos < 0) {
+		/* Not seekable; nothing has moved. */
+		archive_clear_error(&self->archive->archive);
+		return (ARCHIVE_FAILED);
+	}
+	padding = 0;
+	while (pos > state->in_start) {
+		if (pos - state->in_start < 2 * LZMA_STREAM_HEADER_SIZE)
+			goto fail;
+		p = read_at(self, pos - LZMA_STREAM_HEADER_SIZE,
+		    LZMA_STREAM_HEADER_SIZE);
+		if (p == NULL)
+			goto fail;
+		/* A footer ends in "YZ"; zeros are Stream Padding. */
+		if (archive_le32dec(p + LZMA_STREAM_HEADER_SIZE - 4) == 0) {
+			pos -= 4;
+			padding += 4;
+			continue;
+		}
+		if (lzma_stream_footer_decode(&footer_flags, p) != LZMA_OK
+		    || pos - state->in_start < (int64_t)(2
+			* LZMA_STREAM_HEADER_SIZE + footer_flags.backward_size))
+			goto fail;
+		p = read_at(self, pos - LZMA_STREAM_HEADER_SIZE
+		    - footer_flags.backward_size,
+		    (size_t)footer_flags.backward_size);
+		if (p == NULL)
+			goto fail;
+		memlimit = UINT64_MAX;
+		in_pos = 0;
+		if (lzma_index_buffer_decode(&this_index, &memlimit, NULL,
+		    p, &in_pos, (size_t)footer_flags.backward_size) != LZMA_OK)
+			goto fail;
+		pos -= lzma_index_stream_size(this_index);
+		if (in_pos != footer_flags.backward_size
+		    || pos < state->in_start)
+			goto fail;
+		p = read_at(self, pos, LZMA_STREAM_HEADER_SIZE);
+		if (p == NULL
+		    || lzma_stream_header_decode(&header_flags, p) != LZMA_OK
+		    || lzma_stream_flags_compare(&header_flags,
+			&footer_flags) != LZMA_OK
+		    || lzma_index_stream_flags(this_index,
+			&footer_flags) != LZMA_OK
+		    || lzma_index_stream_padding(this_index,
+			padding) != LZMA_OK)
+			goto fail;
+		padding = 0;
+		/* Streams are found last to first. */
+		if (index != NULL
+		    && lzma_index_cat(this_index, index, NULL) != LZMA_OK)
+			goto fail;
+		index = this_index;
+		this_index = NULL;
+	}
+	if (index == NULL)
+		goto fail;
+
+	lzma_index_iter_init(&iter, index);
+	while (!lzma_index_iter_next(&iter, LZMA_INDEX_ITER_NONEMPTY_BLOCK)) {
+		if (iter.block.total_size > XZ_BLOCK_LIMIT
+		    || iter.block.uncompressed_size > XZ_BLOCK_LIMIT)
+			goto fail;
+	}
+	if (__archive_read_filter_seek(self->upstream, saved, SEEK_SET) < 0) {
+		lzma_index_end(index, NULL);
+		return (ARCHIVE_FATAL);
+	}
+	state->index = index;
+	state->index_failed = 0;
+	return (ARCHIVE_OK);
+fail:
+	lzma_index_end(this_index, NULL);
+	lzma_index_end(index, NULL);
+	archive_clear_error(&self->archive->archive);
+	if (__archive_read_filter_seek(self->upstream, saved, SEEK_SET) < 0)
+		return (ARCHIVE_FATAL);
+	return (ARCHIVE_FAILED);
+}
+
+static void
+xz_job_free(struct xz_job *job)
+{
+	if (job == NULL)
+		return;
+	free(job->in);
+	free(job->out);
+	free(job);
+}
+
+/*
+ * Decompress one block, run on a worker thread.
+ */
+static void
+xz_job_run(void *arg)
+{
+	struct xz_job *job = (struct xz_job *)arg;
+	lzma_filter filters[LZMA_FILTERS_MAX + 1];
+	lzma_block block;
+	size_t in_pos = 0, out_pos = 0;
+	int i;
+
+	memset(&block, 0, sizeof(block));
+	block.version = 0;
+	block.check = job->check;
+	block.filters = filters;
+	block.header_size = lzma_block_header_size_decode(job->in[0]);
+	if (block.header_size > job->in_len) {
+		job->ret = LZMA_DATA_ERROR;
+		return;
+	}
+	job->ret = lzma_block_header_decode(&block, NULL, job->in);
+	if (job->ret != LZMA_OK)
+		return;
+	job->ret = lzma_block_compressed_size(&block, job->unpadded_size);
+	if (job->ret == LZMA_OK && block.uncompressed_size != LZMA_VLI_UNKNOWN
+	    && block.uncompressed_size != job->out_len)
+		job->ret = LZMA_DATA_ERROR;
+	if (job->ret == LZMA_OK) {
+		/* The header has been decoded; the data follows it. */
+		in_pos = block.header_size;
+		block.uncompressed_size = job->out_len;
+		job->ret = lzma_block_buffer_decode(&block, NULL, job->in,
+		    &in_pos, job->in_len, job->out, &out_pos, job->out_len);
+	}
+	for (i = 0; filters[i].id != LZMA_VLI_UNKNOWN; i++)
+		free(filters[i].options);
+	if (job->ret == LZMA_OK
+	    && (in_pos != job->in_len || out_pos != job->out_len))
+		job->ret = LZMA_DATA_ERROR;
+}
+
+/*
+ * Advance to the next block with any data in it.
+ */
+static int
+next_block(struct private_data *state)
+{
+	if (state->iter_ready) {
+		state->iter_ready = 0;
+		return (1);
+	}
+	if (state->iter_end)
+		return (0);
+	if (lzma_index_iter_next(&state->iter,
+	    LZMA_INDEX_ITER_NONEMPTY_BLOCK)) {
+		state->iter_end = 1;
+		return (0);
+	}
+	return (1);
+}
+
+/*
+ * Copy the block 'iter' points at out of the upstream.
+ */
+static struct xz_job *
+new_job(struct archive_read_filter *self)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct xz_job *job;
+	const unsigned char *p;
+	int64_t offset;
+	ssize_t avail;
+	size_t copied;
+
+	job = calloc(1, sizeof(*job));
+	if (job == NULL)
+		goto nomem;
+	job->in_len = (size_t)state->iter.block.total_size;
+	job->unpadded_size = state->iter.block.unpadded_size;
+	job->check = state->iter.stream.flags->check;
+	job->out_len = (size_t)state->iter.block.uncompressed_size;
+	job->out_offset = state->iter.block.uncompressed_file_offset;
+	job->in = malloc(job->in_len);
+	job->out = malloc(job->out_len);
+	if (job->in == NULL || job->out == NULL)
+		goto nomem;
+
+	offset = state->in_start + state->iter.block.compressed_file_offset;
+	if (self->upstream->position < offset) {
+		if (__archive_read_filter_consume(self->upstream,
+		    offset - self->upstream->position) < 0)
+			goto fail;
+	} else if (self->upstream->position > offset) {
+		if (__archive_read_filter_seek(self->upstream,
+		    offset, SEEK_SET) < 0)
+			goto fail;
+	}
+	for (copied = 0; copied < job->in_len; copied += avail) {
+		p = __archive_read_filter_ahead(self->upstream, 1, &avail);
+		if (p == NULL) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC, "truncated input");
+			goto fail;
+		}
+		if ((size_t)avail > job->in_len - copied)
+			avail = job->in_len - copied;
+		memcpy(job->in + copied, p, avail);
+		__archive_read_filter_consume(self->upstream, avail);
+	}
+	return (job);
+nomem:
+	archive_set_error(&self->archive->archive, ENOMEM,
+	    "Can't allocate data for xz decompression");
+fail:
+	xz_job_free(job);
+	return (NULL);
+}
+
+/*
+ * Return the next block of decompressed data, using the Index to
+ * keep several blocks in flight.
+ */
+static ssize_t
+xz_indexed_read(struct archive_read_filter *self, const void **p)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct xz_job *job = NULL;
+	ssize_t bytes;
+
+	if (state->again)
+		job = state->current;
+	else
+		xz_job_free(state->current);
+	state->current = NULL;
+	state->again = 0;
+
+	while (job == NULL) {
+		if (state->parallel != NULL) {
+			while (__archive_parallel_pending(state->parallel)
+			    < state->threads * 2 && next_block(state)) {
+				job = new_job(self);
+				if (job == NULL)
+					return (ARCHIVE_FATAL);
+				if (__archive_parallel_submit(state->parallel,
+				    xz_job_run, job) != ARCHIVE_OK) {
+					xz_job_free(job);
+					archive_set_error(
+					    &self->archive->archive, ENOMEM,
+					    "Can't allocate data for xz "
+					    "decompression");
+					return (ARCHIVE_FATAL);
+				}
+			}
+			job = __archive_parallel_next(state->parallel);
+		} else if (next_block(state)) {
+			job = new_job(self);
+			if (job == NULL)
+				return (ARCHIVE_FATAL);
+			xz_job_run(job);
+		}
+		if (job == NULL) {
+			*p = NULL;
+			return (0);
+		}
+		if (job->ret != LZMA_OK) {
+			set_error(self, job->ret);
+			xz_job_free(job);
+			return (ARCHIVE_FATAL);
+		}
+		if (state->skip_out >= (int64_t)job->out_len) {
+			state->skip_out -= job->out_len;
+			xz_job_free(job);
+			job = NULL;
+		}
+	}
+
+	state->current = job;
+	*p = job->out + state->skip_out;
+	bytes = job->out_len - (size_t)state->skip_out;
+	state->skip_out = 0;
+	state->total_out += bytes;
+	return (bytes);
+}
+
+/*
+ * Seek to an offset in the decompressed data by starting over at the
+ * block that holds it.  The first seek loads the Index and switches
+ * over from streaming.
+ */
+static int64_t
+xz_filter_seek(struct archive_read_filter *self, int64_t offset, int whence)
+{
+	struct private_data *state = (struct private_data *)self->data;
+	struct xz_job *job;
+	int64_t target;
+	int r;
+
+	if (self->read != xz_indexed_read) {
+		r = load_index(self);
+		if (r != ARCHIVE_OK)
+			return (r);
+		lzma_index_iter_init(&state->iter, state->index);
+		self->read = xz_indexed_read;
+	}
+
+	switch (whence) {
+	case SEEK_SET:
+		target = offset;
+		break;
+	case SEEK_CUR:
+		target = self->position + offset;
+		break;
+	case SEEK_END:
+		target = (int64_t)lzma_index_uncompressed_size(state->index)
+		    + offset;
+		break;
+	default:
+		return (ARCHIVE_FATAL);
+	}
+	if (target < 0) {
+		archive_set_error(&self->archive->archive, EINVAL,
+		    "Seek before start of xz data");
+		return (ARCHIVE_FAILED);
+	}
+
+	/* Still inside the block we just returned? */
+	job = state->current;
+	if (job != NULL && target >= job->out_offset
+	    && target < job->out_offset + (int64_t)job->out_len) {
+		state->again = 1;
+		state->skip_out = target - job->out_offset;
+		state->total_out = target;
+		return (target);
+	}
+
+	/* Blocks decompressed ahead are of no use now. */
+	if (state->parallel != NULL)
+		while (__archive_parallel_pending(state->parallel) > 0)
+			xz_job_free(__archive_parallel_next(state->parallel));
+	xz_job_free(state->current);
+	state->current = NULL;
+	state->again = 0;
+	if (lzma_index_iter_locate(&state->iter, (lzma_vli)target)) {
+		/* At or past the end. */
+		state->iter_ready = 0;
+		state->iter_end = 1;
+		state->skip_out = 0;
+	} else {
+		state->iter_ready = 1;
+		state->iter_end = 0;
+		state->skip_out =
+		    target - state->iter.block.uncompressed_file_offset;
+	}
+	state->total_out = target;
+	return (target);
+}
+
 /*
  * Clean up the decompressor.
  */
@@ -753,6 +1259,13 @@ xz_filter_close(struct archive_read_filter *self)
 
 	state = (struct private_data *)self->data;
 	lzma_end(&(state->stream));
+	if (state->parallel != NULL) {
+		while (__archive_parallel_pending(state->parallel) > 0)
+			xz_job_free(__archive_parallel_next(state->parallel));
+		__archive_parallel_free(state->parallel);
+	}
+	xz_job_free(state->current);
+	lzma_index_end(state->index, NULL);
 	free(state->out_block);
 	free(state);
 	return (ARCHIVE_OK);
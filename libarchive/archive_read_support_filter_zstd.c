@@ -0,0 +1,360 @@
+/*-
+ * Copyright (c) 2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#include <stdio.h>
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+
+#include "archive.h"
+#include "archive_endian.h"
+#include "archive_private.h"
+#include "archive_read_private.h"
+
+#define	ZSTD_FRAME_MAGIC	0xFD2FB528U
+#define	ZSTD_SKIPPABLE_MAGIC	0x184D2A50U	/* Low four bits vary. */
+#define	ZSTD_SKIPPABLE_MASK	0xFFFFFFF0U
+
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+struct zstd_options {
+	int		 window_log_max;	/* 0 = library default. */
+};
+
+struct private_data {
+	ZSTD_DCtx	*dctx;
+	unsigned char	*out_block;
+	size_t		 out_block_size;
+	char		 in_frame;
+	char		 eof; /* True = found end of compressed data. */
+};
+
+/* Zstd filter */
+static ssize_t	zstd_filter_read(struct archive_read_filter *, const void **);
+static int	zstd_filter_close(struct archive_read_filter *);
+static int	zstd_reader_options(struct archive_read_filter_bidder *,
+		    const char *, const char *);
+#endif
+
+/*
+ * Note that we can detect zstd archives even if we can't decompress
+ * them.  (In fact, we like detecting them because we can give better
+ * error messages.)  So the bid framework here gets compiled even
+ * if libzstd is unavailable.
+ */
+static int	zstd_reader_bid(struct archive_read_filter_bidder *,
+		    struct archive_read_filter *);
+static int	zstd_reader_init(struct archive_read_filter *);
+static int	zstd_reader_free(struct archive_read_filter_bidder *);
+
+int
+archive_read_support_filter_zstd(struct archive *_a)
+{
+	struct archive_read *a = (struct archive_read *)_a;
+	struct archive_read_filter_bidder *reader;
+
+	archive_check_magic(_a, ARCHIVE_READ_MAGIC,
+	    ARCHIVE_STATE_NEW, "archive_read_support_filter_zstd");
+
+	if (__archive_read_get_bidder(a, &reader) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+	reader->data = calloc(1, sizeof(struct zstd_options));
+	if (reader->data == NULL) {
+		archive_set_error(_a, ENOMEM, "Can't allocate zstd options");
+		return (ARCHIVE_FATAL);
+	}
+	reader->options = zstd_reader_options;
+#else
+	reader->data = NULL;
+	reader->options = NULL;
+#endif
+	reader->name = "zstd";
+	reader->bid = zstd_reader_bid;
+	reader->init = zstd_reader_init;
+	reader->free = zstd_reader_free;
+#if defined(HAVE_ZSTD_H) && defined(HAVE_LIBZSTD)
+	return (ARCHIVE_OK);
+#else
+	archive_set_error(_a, ARCHIVE_ERRNO_MISC,
+	    "Using external zstd program");
+	return (ARCHIVE_WARN);
+#endif
+}
+
+static int
+zstd_reader_free(struct archive_read_filter_bidder *self){
+	free(self->data);
+	self->data = NULL;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Test whether we can handle this data.
+ *
+ * A zstd stream starts with a frame: a 32-bit magic number followed
+ * by a frame header descriptor whose reserved bit must be clear.
+ */
+static int
+zstd_reader_bid(struct archive_read_filter_bidder *self,
+    struct archive_read_filter *filter)
+{
+	const unsigned char *buffer;
+	ssize_t avail;
+
+	(void)self; /* UNUSED */
+
+	buffer = __archive_read_filter_ahead(filter, 5, &avail);
+	if (buffer == NULL)
+		return (0);
+	if (archive_le32dec(buffer) != ZSTD_FRAME_MAGIC)
+		return (0);
+	if (buffer[4] & 0x08)
+		return (0);
+	return (33);
+}
+
+#if !defined(HAVE_ZSTD_H) || !defined(HAVE_LIBZSTD)
+
+/*
+ * If we don't have the library on this system, we can't do the
+ * decompression directly.  We can, however, try to run "zstd -d"
+ * in case that's available.
+ */
+static int
+zstd_reader_init(struct archive_read_filter *self)
+{
+	int r;
+
+	r = __archive_read_program(self, "zstd -d -qq");
+	/* Note: We set the format here even if __archive_read_program()
+	 * above fails.  We do, after all, know what the format is
+	 * even if we weren't able to read it. */
+	self->code = ARCHIVE_FILTER_ZSTD;
+	self->name = "zstd";
+	return (r);
+}
+
+#else
+
+/*
+ * Options:
+ *   long[=N]           Accept frames with windows of up to 2^N bytes
+ *                      (default: the largest libzstd allows), as
+ *                      "zstd -d --long" does.
+ */
+static int
+zstd_reader_options(struct archive_read_filter_bidder *self,
+    const char *key, const char *value)
+{
+	struct zstd_options *opts = (struct zstd_options *)self->data;
+	ZSTD_bounds bounds;
+	int n = 0;
+
+	if (strcmp(key, "long") == 0) {
+		bounds = ZSTD_dParam_getBounds(ZSTD_d_windowLogMax);
+		if (value == NULL) {
+			opts->window_log_max = 0;
+			return (ARCHIVE_OK);
+		}
+		if (strcmp(value, "1") == 0) {
+			opts->window_log_max = bounds.upperBound;
+			return (ARCHIVE_OK);
+		}
+		for (; *value != '\0'; value++) {
+			if (*value < '0' || *value > '9' || n > 100)
+				return (ARCHIVE_WARN);
+			n = n * 10 + (*value - '0');
+		}
+		if (n < bounds.lowerBound || n > bounds.upperBound)
+			return (ARCHIVE_WARN);
+		opts->window_log_max = n;
+		return (ARCHIVE_OK);
+	}
+
+	/* Note: The "warn" return is just to inform the options
+	 * supervisor that we didn't handle it.  It will generate
+	 * a suitable error if no one used this option. */
+	return (ARCHIVE_WARN);
+}
+
+/*
+ * Setup the callbacks.
+ */
+static int
+zstd_reader_init(struct archive_read_filter *self)
+{
+	struct private_data *state;
+	struct zstd_options *opts;
+	size_t r;
+
+	self->code = ARCHIVE_FILTER_ZSTD;
+	self->name = "zstd";
+
+	state = (struct private_data *)calloc(sizeof(*state), 1);
+	if (state != NULL) {
+		state->out_block_size = ZSTD_DStreamOutSize();
+		state->out_block = malloc(state->out_block_size);
+		state->dctx = ZSTD_createDCtx();
+	}
+	if (state == NULL || state->out_block == NULL
+	    || state->dctx == NULL) {
+		archive_set_error(&self->archive->archive, ENOMEM,
+		    "Can't allocate data for zstd decompression");
+		if (state != NULL) {
+			free(state->out_block);
+			ZSTD_freeDCtx(state->dctx);
+			free(state);
+		}
+		return (ARCHIVE_FATAL);
+	}
+
+	self->data = state;
+	self->read = zstd_filter_read;
+	self->skip = NULL; /* not supported */
+	self->close = zstd_filter_close;
+
+	opts = (struct zstd_options *)self->bidder->data;
+	if (opts->window_log_max > 0) {
+		r = ZSTD_DCtx_setParameter(state->dctx, ZSTD_d_windowLogMax,
+		    opts->window_log_max);
+		if (ZSTD_isError(r)) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC,
+			    "Internal error initializing decompressor: %s",
+			    ZSTD_getErrorName(r));
+			return (ARCHIVE_FATAL);
+		}
+	}
+
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Return the next block of decompressed data.
+ *
+ * A stream can hold any number of frames, some of them skippable;
+ * libzstd passes over the skippable ones itself.  Anything else after
+ * a complete frame is taken to be the end of the compressed data.
+ */
+static ssize_t
+zstd_filter_read(struct archive_read_filter *self, const void **p)
+{
+	struct private_data *state;
+	ZSTD_outBuffer out;
+	ZSTD_inBuffer in;
+	const unsigned char *read_buf;
+	ssize_t avail;
+	uint32_t magic = 0;
+	size_t r;
+
+	state = (struct private_data *)self->data;
+	*p = state->out_block;
+	out.dst = state->out_block;
+	out.size = state->out_block_size;
+	out.pos = 0;
+
+	while (!state->eof && out.pos < out.size) {
+		if (!state->in_frame) {
+			read_buf = __archive_read_filter_ahead(self->upstream,
+			    4, &avail);
+			if (read_buf == NULL && avail < 0)
+				return (ARCHIVE_FATAL);
+			if (read_buf != NULL)
+				magic = archive_le32dec(read_buf);
+			if (read_buf == NULL || (magic != ZSTD_FRAME_MAGIC
+			    && (magic & ZSTD_SKIPPABLE_MASK)
+			    != ZSTD_SKIPPABLE_MAGIC)) {
+				state->eof = 1;
+				break;
+			}
+			state->in_frame = 1;
+		}
+
+		read_buf = __archive_read_filter_ahead(self->upstream, 1,
+		    &avail);
+		if (read_buf == NULL) {
+			if (avail < 0)
+				return (ARCHIVE_FATAL);
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC, "truncated zstd input");
+			return (ARCHIVE_FATAL);
+		}
+		in.src = read_buf;
+		in.size = avail;
+		in.pos = 0;
+
+		/* Decompress as much as we can in one pass. */
+		r = ZSTD_decompressStream(state->dctx, &out, &in);
+		__archive_read_filter_consume(self->upstream, in.pos);
+		if (ZSTD_isError(r)) {
+			archive_set_error(&self->archive->archive,
+			    ARCHIVE_ERRNO_MISC,
+			    "zstd decompression failed: %s",
+			    ZSTD_getErrorName(r));
+			return (ARCHIVE_FATAL);
+		}
+		/* The frame is finished and all of it has been output. */
+		if (r == 0)
+			state->in_frame = 0;
+	}
+
+	if (out.pos == 0)
+		*p = NULL;
+	return (out.pos);
+}
+
+/*
+ * Clean up the decompressor.
+ */
+static int
+zstd_filter_close(struct archive_read_filter *self)
+{
+	struct private_data *state;
+
+	state = (struct private_data *)self->data;
+	ZSTD_freeDCtx(state->dctx);
+	free(state->out_block);
+	free(state);
+	return (ARCHIVE_OK);
+}
+
+#endif /* HAVE_ZSTD_H && HAVE_LIBZSTD */
@@ -50,9 +50,7 @@ __FBSDID("$FreeBSD$");
 #include "archive_read_private.h"
 #include "archive_endian.h"
 
-#ifndef HAVE_ZLIB_H
 #include "archive_crc32.h"
-#endif
 
 #define _7ZIP_SIGNATURE	"7z\xBC\xAF\x27\x1C"
 #define SFX_MIN_ADDR	0x27000
@@ -329,6 +327,8 @@ static int	archive_read_format_7zip_cleanup(struct archive_read *);
 static int	archive_read_format_7zip_read_data(struct archive_read *,
 		    const void **, size_t *, int64_t *);
 static int	archive_read_format_7zip_read_data_skip(struct archive_read *);
+static int	archive_read_format_7zip_seek_entry(struct archive_read *,
+		    struct archive_entry *, const char *, int64_t);
 static int	archive_read_format_7zip_read_header(struct archive_read *,
 		    struct archive_entry *);
 static int	check_7zip_header_in_sfx(const char *);
@@ -370,6 +370,9 @@ static int	read_SubStreamsInfo(struct archive_read *,
 static int	read_Times(struct archive_read *, struct _7z_header_info *,
 		    int);
 static void	read_consume(struct archive_read *);
+static int	read_entries(struct archive_read *, struct _7zip *);
+static int	read_entry_header(struct archive_read *, struct archive_entry *,
+		    struct _7zip *);
 static ssize_t	read_stream(struct archive_read *, const void **, size_t,
 		    size_t);
 static int	seek_pack(struct archive_read *);
@@ -409,6 +412,7 @@ archive_read_support_format_7zip(struct archive *_a)
 	    archive_read_format_7zip_read_header,
 	    archive_read_format_7zip_read_data,
 	    archive_read_format_7zip_read_data_skip,
+	    archive_read_format_7zip_seek_entry,
 	    archive_read_format_7zip_cleanup);
 
 	if (r != ARCHIVE_OK)
@@ -481,7 +485,7 @@ check_7zip_header_in_sfx(const char *p)
 		 * Magic Code, so we should do this in order not to
 		 * make a mis-detection.
 		 */
-		if (crc32(0, (unsigned char *)p + 12, 20)
+		if (__archive_crc32(0, (unsigned char *)p + 12, 20)
 			!= archive_le32dec(p + 8))
 			return (6); 
 		/* Hit the header! */
@@ -560,40 +564,146 @@ fatal:
 	return (ARCHIVE_FATAL);
 }
 
+static int
+read_entries(struct archive_read *a, struct _7zip *zip)
+{
+	struct _7z_header_info header;
+	int r;
+
+	memset(&header, 0, sizeof(header));
+	r = slurp_central_directory(a, zip, &header);
+	free_Header(&header);
+	if (r != ARCHIVE_OK)
+		return (r);
+	zip->entries_remaining = zip->numFiles;
+	zip->entry = NULL;
+	return (ARCHIVE_OK);
+}
+
 static int
 archive_read_format_7zip_read_header(struct archive_read *a,
 	struct archive_entry *entry)
 {
 	struct _7zip *zip = (struct _7zip *)a->format->data;
-	struct _7zip_entry *zip_entry;
-	int r, ret = ARCHIVE_OK;
+	int r;
 
 	a->archive.archive_format = ARCHIVE_FORMAT_7ZIP;
 	if (a->archive.archive_format_name == NULL)
 		a->archive.archive_format_name = "7-Zip";
 
 	if (zip->entries == NULL) {
-		struct _7z_header_info header;
-
-		memset(&header, 0, sizeof(header));
-		r = slurp_central_directory(a, zip, &header);
-		free_Header(&header);
+		r = read_entries(a, zip);
 		if (r != ARCHIVE_OK)
 			return (r);
-		zip->entries_remaining = zip->numFiles;
+	}
+	if (zip->entry == NULL)
 		zip->entry = zip->entries;
-	} else {
+	else
 		++zip->entry;
-	}
-	zip_entry = zip->entry;
 
 	if (zip->entries_remaining <= 0)
 		return ARCHIVE_EOF;
 	--zip->entries_remaining;
+	return (read_entry_header(a, entry, zip));
+}
+
+/*
+ * Find an entry by pathname or position, and rewind the decoder so
+ * that the next read_stream() starts at its data.
+ */
+static int
+archive_read_format_7zip_seek_entry(struct archive_read *a,
+	struct archive_entry *entry, const char *pathname, int64_t index)
+{
+	struct _7zip *zip = (struct _7zip *)a->format->data;
+	struct _7zip_entry *found = NULL, *e;
+	struct archive_string name;
+	uint64_t skipped = 0;
+	size_t i;
+	int r;
+
+	a->archive.archive_format = ARCHIVE_FORMAT_7ZIP;
+	if (zip->entries == NULL) {
+		r = read_entries(a, zip);
+		if (r != ARCHIVE_OK)
+			return (r);
+	}
+
+	if (pathname == NULL) {
+		if (index < (int64_t)zip->numFiles)
+			found = &zip->entries[index];
+	} else {
+		if (zip->sconv == NULL) {
+			zip->sconv = archive_string_conversion_from_charset(
+			    &a->archive, "UTF-16LE", 1);
+			if (zip->sconv == NULL)
+				return (ARCHIVE_FATAL);
+		}
+		/* The last of several same-named entries wins, as it
+		 * would when extracting. */
+		archive_string_init(&name);
+		for (i = 0; i < zip->numFiles; i++) {
+			e = &zip->entries[i];
+			if (archive_strncpy_in_locale(&name, e->utf16name,
+			    e->name_len, zip->sconv) == 0 &&
+			    strcmp(name.s, pathname) == 0)
+				found = e;
+		}
+		archive_string_free(&name);
+	}
+	if (found == NULL) {
+		if (pathname != NULL)
+			archive_set_error(&a->archive, ENOENT,
+			    "%s: Not found in archive", pathname);
+		else
+			archive_set_error(&a->archive, ENOENT,
+			    "No entry %jd in archive", (intmax_t)index);
+		return (ARCHIVE_FAILED);
+	}
+
+	/*
+	 * Drop the folder being decoded.  read_stream() then starts
+	 * decoding the entry's folder from its beginning and discards
+	 * the data of the entries in front of it, as it does for
+	 * entries skipped in list mode.
+	 */
+	read_consume(a);
+	zip->uncompressed_buffer_bytes_remaining = 0;
+	zip->pack_stream_inbytes_remaining = 0;
+	zip->pack_stream_remaining = 0;
+	zip->folder_outbytes_remaining = 0;
+	zip->folder_index = 0;
+	for (i = 0; i < zip->si.ci.numFolders; i++)
+		zip->si.ci.folders[i].skipped_bytes = 0;
+	if (found->flg & HAS_STREAM) {
+		for (e = zip->entries; e < found; e++) {
+			if (e->folderIndex == found->folderIndex &&
+			    (e->flg & HAS_STREAM))
+				skipped += zip->si.ss.unpackSizes[e->ssIndex];
+		}
+		zip->si.ci.folders[found->folderIndex].skipped_bytes =
+		    skipped;
+	}
+
+	zip->entry = found;
+	zip->entries_remaining = zip->numFiles - (found - zip->entries) - 1;
+	a->header_position = a->filter->position;
+	return (read_entry_header(a, entry, zip));
+}
+
+/*
+ * Fill in the entry from zip->entry.
+ */
+static int
+read_entry_header(struct archive_read *a, struct archive_entry *entry,
+	struct _7zip *zip)
+{
+	struct _7zip_entry *zip_entry = zip->entry;
+	int ret = ARCHIVE_OK;
 
 	zip->entry_offset = 0;
 	zip->end_of_entry = 0;
-	zip->entry_crc32 = crc32(0, NULL, 0);
+	zip->entry_crc32 = __archive_crc32(0, NULL, 0);
 
 	/* Setup a string conversion for a filename. */
 	if (zip->sconv == NULL) {
@@ -731,7 +841,8 @@ archive_read_format_7zip_read_data(struct archive_read *a,
 
 	/* Update checksum */
 	if ((zip->entry->flg & CRC32_IS_SET) && bytes)
-		zip->entry_crc32 = crc32(zip->entry_crc32, *buff, bytes);
+		zip->entry_crc32 =
+		    __archive_crc32(zip->entry_crc32, *buff, bytes);
 
 	/* If we hit the end, swallow any end-of-data marker. */
 	if (zip->end_of_entry) {
@@ -2676,7 +2787,7 @@ header_bytes(struct archive_read *a, size_t rbytes)
 	}
 
 	/* Update checksum */
-	zip->header_crc32 = crc32(zip->header_crc32, p, rbytes);
+	zip->header_crc32 = __archive_crc32(zip->header_crc32, p, rbytes);
 	return (p);
 }
 
@@ -2710,7 +2821,8 @@ slurp_central_directory(struct archive_read *a, struct _7zip *zip,
 	}
 
 	/* CRC check. */
-	if (crc32(0, (unsigned char *)p + 12, 20) != archive_le32dec(p + 8)) {
+	if (__archive_crc32(0, (unsigned char *)p + 12, 20)
+	    != archive_le32dec(p + 8)) {
 		archive_set_error(&a->archive, -1, "Header CRC error");
 		return (ARCHIVE_FATAL);
 	}
@@ -42,6 +42,7 @@
 #endif
 
 #include "archive.h"
+#include "archive_checksum_private.h"
 #include "archive_entry.h"
 #include "archive_entry_locale.h"
 #include "archive_private.h"
@@ -324,7 +325,6 @@ static time_t	cab_dos_time(const unsigned char *);
 static int	cab_read_data(struct archive_read *, const void **,
 		    size_t *, int64_t *);
 static int	cab_read_header(struct archive_read *);
-static uint32_t cab_checksum_cfdata_4(const void *, size_t bytes, uint32_t);
 static uint32_t cab_checksum_cfdata(const void *, size_t bytes, uint32_t);
 static void	cab_checksum_update(struct archive_read *, size_t);
 static int	cab_checksum_finish(struct archive_read *);
@@ -380,6 +380,7 @@ archive_read_support_format_cab(struct archive *_a)
 	    archive_read_format_cab_read_header,
 	    archive_read_format_cab_read_data,
 	    archive_read_format_cab_read_data_skip,
+	    NULL,
 	    archive_read_format_cab_cleanup);
 
 	if (r != ARCHIVE_OK)
@@ -1045,23 +1046,6 @@ archive_read_format_cab_read_data(struct archive_read *a,
 	return (cab_read_data(a, buff, size, offset));
 }
 
-static uint32_t
-cab_checksum_cfdata_4(const void *p, size_t bytes, uint32_t seed)
-{
-	const unsigned char *b;
-	int u32num;
-	uint32_t sum;
-
-	u32num = bytes / 4;
-	sum = seed;
-	b = p;
-	while (--u32num >= 0) {
-		sum ^= archive_le32dec(b);
-		b += 4;
-	}
-	return (sum);
-}
-
 static uint32_t
 cab_checksum_cfdata(const void *p, size_t bytes, uint32_t seed)
 {
@@ -1069,7 +1053,7 @@ cab_checksum_cfdata(const void *p, size_t bytes, uint32_t seed)
 	uint32_t sum;
 	uint32_t t;
 
-	sum = cab_checksum_cfdata_4(p, bytes, seed);
+	sum = __archive_xor32le(seed, p, bytes);
 	b = p;
 	b += bytes & ~3;
 	t = 0;
@@ -1114,16 +1098,16 @@ cab_checksum_update(struct archive_read *a, size_t bytes)
 			sumbytes--;
 		}
 		if (cfdata->sum_extra_avail == 4) {
-			cfdata->sum_calculated = cab_checksum_cfdata_4(
-			    cfdata->sum_extra, 4, cfdata->sum_calculated);
+			cfdata->sum_calculated = __archive_xor32le(
+			    cfdata->sum_calculated, cfdata->sum_extra, 4);
 			cfdata->sum_extra_avail = 0;
 		}
 	}
 	if (sumbytes) {
 		int odd = sumbytes & 3;
 		if (sumbytes - odd > 0)
-			cfdata->sum_calculated = cab_checksum_cfdata_4(
-			    p, sumbytes - odd, cfdata->sum_calculated);
+			cfdata->sum_calculated = __archive_xor32le(
+			    cfdata->sum_calculated, p, sumbytes - odd);
 		if (odd)
 			memcpy(cfdata->sum_extra, p + sumbytes - odd, odd);
 		cfdata->sum_extra_avail = odd;
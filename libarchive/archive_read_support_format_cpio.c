@@ -198,6 +198,8 @@ static int	archive_read_format_cpio_read_data(struct archive_read *,
 static int	archive_read_format_cpio_read_header(struct archive_read *,
 		    struct archive_entry *);
 static int	archive_read_format_cpio_skip(struct archive_read *);
+static int	archive_read_format_cpio_seek_entry(struct archive_read *,
+		    struct archive_entry *, const char *, int64_t);
 static int	be4(const unsigned char *);
 static int	find_odc_header(struct archive_read *);
 static int	find_newc_header(struct archive_read *);
@@ -242,6 +244,7 @@ archive_read_support_format_cpio(struct archive *_a)
 	    archive_read_format_cpio_read_header,
 	    archive_read_format_cpio_read_data,
 	    archive_read_format_cpio_skip,
+	    archive_read_format_cpio_seek_entry,
 	    archive_read_format_cpio_cleanup);
 
 	if (r != ARCHIVE_OK)
@@ -492,6 +495,27 @@ archive_read_format_cpio_skip(struct archive_read *a)
 	return (ARCHIVE_OK);
 }
 
+/*
+ * Like tar, cpio needs a sidecar index to find entries.
+ */
+static int
+archive_read_format_cpio_seek_entry(struct archive_read *a,
+    struct archive_entry *entry, const char *pathname, int64_t index)
+{
+	struct cpio *cpio = (struct cpio *)(a->format->data);
+	const char *name;
+	int r;
+
+	r = __archive_read_index_seek(a, pathname, index, &name);
+	if (r != ARCHIVE_OK)
+		return (r);
+	cpio->entry_bytes_remaining = 0;
+	cpio->entry_padding = 0;
+	cpio->entry_bytes_unconsumed = 0;
+	r = archive_read_format_cpio_read_header(a, entry);
+	return (__archive_read_index_verify(a, entry, name, r));
+}
+
 /*
  * Skip forward to the next cpio newc header by searching for the
  * 07070[12] string.  This should be generalized and merged with
@@ -39,6 +39,7 @@
 #endif
 
 #include "archive.h"
+#include "archive_checksum_private.h"
 #include "archive_entry.h"
 #include "archive_entry_locale.h"
 #include "archive_private.h"
@@ -214,41 +215,6 @@ struct lha {
 #define H_LEVEL_OFFSET	20	/* Header Level.  */
 #define H_SIZE		22	/* Minimum header size. */
 
-static const uint16_t crc16tbl[256] = {
-	0x0000,0xC0C1,0xC181,0x0140,0xC301,0x03C0,0x0280,0xC241,
-	0xC601,0x06C0,0x0780,0xC741,0x0500,0xC5C1,0xC481,0x0440,
-	0xCC01,0x0CC0,0x0D80,0xCD41,0x0F00,0xCFC1,0xCE81,0x0E40,
-	0x0A00,0xCAC1,0xCB81,0x0B40,0xC901,0x09C0,0x0880,0xC841,
-	0xD801,0x18C0,0x1980,0xD941,0x1B00,0xDBC1,0xDA81,0x1A40,
-	0x1E00,0xDEC1,0xDF81,0x1F40,0xDD01,0x1DC0,0x1C80,0xDC41,
-	0x1400,0xD4C1,0xD581,0x1540,0xD701,0x17C0,0x1680,0xD641,
-	0xD201,0x12C0,0x1380,0xD341,0x1100,0xD1C1,0xD081,0x1040,
-	0xF001,0x30C0,0x3180,0xF141,0x3300,0xF3C1,0xF281,0x3240,
-	0x3600,0xF6C1,0xF781,0x3740,0xF501,0x35C0,0x3480,0xF441,
-	0x3C00,0xFCC1,0xFD81,0x3D40,0xFF01,0x3FC0,0x3E80,0xFE41,
-	0xFA01,0x3AC0,0x3B80,0xFB41,0x3900,0xF9C1,0xF881,0x3840,
-	0x2800,0xE8C1,0xE981,0x2940,0xEB01,0x2BC0,0x2A80,0xEA41,
-	0xEE01,0x2EC0,0x2F80,0xEF41,0x2D00,0xEDC1,0xEC81,0x2C40,
-	0xE401,0x24C0,0x2580,0xE541,0x2700,0xE7C1,0xE681,0x2640,
-	0x2200,0xE2C1,0xE381,0x2340,0xE101,0x21C0,0x2080,0xE041,
-	0xA001,0x60C0,0x6180,0xA141,0x6300,0xA3C1,0xA281,0x6240,
-	0x6600,0xA6C1,0xA781,0x6740,0xA501,0x65C0,0x6480,0xA441,
-	0x6C00,0xACC1,0xAD81,0x6D40,0xAF01,0x6FC0,0x6E80,0xAE41,
-	0xAA01,0x6AC0,0x6B80,0xAB41,0x6900,0xA9C1,0xA881,0x6840,
-	0x7800,0xB8C1,0xB981,0x7940,0xBB01,0x7BC0,0x7A80,0xBA41,
-	0xBE01,0x7EC0,0x7F80,0xBF41,0x7D00,0xBDC1,0xBC81,0x7C40,
-	0xB401,0x74C0,0x7580,0xB541,0x7700,0xB7C1,0xB681,0x7640,
-	0x7200,0xB2C1,0xB381,0x7340,0xB101,0x71C0,0x7080,0xB041,
-	0x5000,0x90C1,0x9181,0x5140,0x9301,0x53C0,0x5280,0x9241,
-	0x9601,0x56C0,0x5780,0x9741,0x5500,0x95C1,0x9481,0x5440,
-	0x9C01,0x5CC0,0x5D80,0x9D41,0x5F00,0x9FC1,0x9E81,0x5E40,
-	0x5A00,0x9AC1,0x9B81,0x5B40,0x9901,0x59C0,0x5880,0x9841,
-	0x8801,0x48C0,0x4980,0x8941,0x4B00,0x8BC1,0x8A81,0x4A40,
-	0x4E00,0x8EC1,0x8F81,0x4F40,0x8D01,0x4DC0,0x4C80,0x8C41,
-	0x4400,0x84C1,0x8581,0x4540,0x8701,0x47C0,0x4680,0x8641,
-	0x8201,0x42C0,0x4380,0x8341,0x4100,0x81C1,0x8081,0x4040
-};
-
 static int      archive_read_format_lha_bid(struct archive_read *, int);
 static int      archive_read_format_lha_options(struct archive_read *,
 		    const char *, const char *);
@@ -279,7 +245,6 @@ static int	lha_read_data_none(struct archive_read *, const void **,
 		    size_t *, int64_t *);
 static int	lha_read_data_lzh(struct archive_read *, const void **,
 		    size_t *, int64_t *);
-static uint16_t lha_crc16(uint16_t, const void *, size_t);
 static int	lzh_decode_init(struct lzh_stream *, const char *);
 static void	lzh_decode_free(struct lzh_stream *);
 static int	lzh_decode(struct lzh_stream *, int);
@@ -319,6 +284,7 @@ archive_read_support_format_lha(struct archive *_a)
 	    archive_read_format_lha_read_header,
 	    archive_read_format_lha_read_data,
 	    archive_read_format_lha_read_data_skip,
+	    NULL,
 	    archive_read_format_lha_cleanup);
 
 	if (r != ARCHIVE_OK)
@@ -1021,7 +987,7 @@ lha_read_file_header_2(struct archive_read *a, struct lha *lha)
 		return (ARCHIVE_FATAL);
 	}
 
-	header_crc = lha_crc16(0, p, H2_FIXED_SIZE);
+	header_crc = __archive_crc16(0, p, H2_FIXED_SIZE);
 	__archive_read_consume(a, H2_FIXED_SIZE);
 
 	/* Read extended headers */
@@ -1035,7 +1001,7 @@ lha_read_file_header_2(struct archive_read *a, struct lha *lha)
 	if (padding > 0) {
 		if ((p = __archive_read_ahead(a, padding, NULL)) == NULL)
 			return (truncated_error(a));
-		header_crc = lha_crc16(header_crc, p, padding);
+		header_crc = __archive_crc16(header_crc, p, padding);
 		__archive_read_consume(a, padding);
 	}
 
@@ -1098,7 +1064,7 @@ lha_read_file_header_3(struct archive_read *a, struct lha *lha)
 
 	if (lha->header_size < H3_FIXED_SIZE + 4)
 		goto invalid;
-	header_crc = lha_crc16(0, p, H3_FIXED_SIZE);
+	header_crc = __archive_crc16(0, p, H3_FIXED_SIZE);
 	__archive_read_consume(a, H3_FIXED_SIZE);
 
 	/* Read extended headers */
@@ -1178,7 +1144,8 @@ lha_read_file_extended_header(struct archive_read *a, struct lha *lha,
 		if (extdsize == 0) {
 			/* End of extended header */
 			if (crc != NULL)
-				*crc = lha_crc16(*crc, h, sizefield_length);
+				*crc = __archive_crc16(*crc, h,
+				    sizefield_length);
 			__archive_read_consume(a, sizefield_length);
 			return (ARCHIVE_OK);
 		}
@@ -1203,7 +1170,7 @@ lha_read_file_extended_header(struct archive_read *a, struct lha *lha,
 		extdheader += sizefield_length + 1;
 
 		if (crc != NULL && extdtype != EXT_HEADER_CRC)
-			*crc = lha_crc16(*crc, h, extdsize);
+			*crc = __archive_crc16(*crc, h, extdsize);
 		switch (extdtype) {
 		case EXT_HEADER_CRC:
 			/* We only use a header CRC. Following data will not
@@ -1212,11 +1179,11 @@ lha_read_file_extended_header(struct archive_read *a, struct lha *lha,
 				lha->header_crc = archive_le16dec(extdheader);
 				if (crc != NULL) {
 					static const char zeros[2] = {0, 0};
-					*crc = lha_crc16(*crc, h,
+					*crc = __archive_crc16(*crc, h,
 					    extdsize - datasize);
 					/* CRC value itself as zero */
-					*crc = lha_crc16(*crc, zeros, 2);
-					*crc = lha_crc16(*crc,
+					*crc = __archive_crc16(*crc, zeros, 2);
+					*crc = __archive_crc16(*crc,
 					    extdheader+2, datasize - 2);
 				}
 			}
@@ -1446,7 +1413,7 @@ lha_read_data_none(struct archive_read *a, const void **buff,
 	if (bytes_avail > lha->entry_bytes_remaining)
 		bytes_avail = lha->entry_bytes_remaining;
 	lha->entry_crc_calculated =
-	    lha_crc16(lha->entry_crc_calculated, *buff, bytes_avail);
+	    __archive_crc16(lha->entry_crc_calculated, *buff, bytes_avail);
 	*size = bytes_avail;
 	*offset = lha->entry_offset;
 	lha->entry_offset += bytes_avail;
@@ -1556,7 +1523,7 @@ lha_read_data_lzh(struct archive_read *a, const void **buff,
 		*size = lha->strm.next_out - lha->uncompressed_buffer;
 		*buff = lha->uncompressed_buffer;
 		lha->entry_crc_calculated =
-		    lha_crc16(lha->entry_crc_calculated, *buff, *size);
+		    __archive_crc16(lha->entry_crc_calculated, *buff, *size);
 		lha->entry_offset += *size;
 	} else {
 		*offset = lha->entry_offset;
@@ -1697,50 +1664,6 @@ lha_calcsum(unsigned char sum, const void *pp, int offset, int size)
 	return (sum);
 }
 
-#define CRC16(crc, v)	do {	\
-	(crc) = crc16tbl[((crc) ^ v) & 0xFF] ^ ((crc) >> 8);	\
-} while (0)
-
-static uint16_t
-lha_crc16(uint16_t crc, const void *pp, size_t len)
-{
-	const unsigned char *buff = (const unsigned char *)pp;
-
-	while (len >= 8) {
-		CRC16(crc, *buff++); CRC16(crc, *buff++);
-		CRC16(crc, *buff++); CRC16(crc, *buff++);
-		CRC16(crc, *buff++); CRC16(crc, *buff++);
-		CRC16(crc, *buff++); CRC16(crc, *buff++);
-		len -= 8;
-	}
-	switch (len) {
-	case 7:
-		CRC16(crc, *buff++);
-		/* FALL THROUGH */
-	case 6:
-		CRC16(crc, *buff++);
-		/* FALL THROUGH */
-	case 5:
-		CRC16(crc, *buff++);
-		/* FALL THROUGH */
-	case 4:
-		CRC16(crc, *buff++);
-		/* FALL THROUGH */
-	case 3:
-		CRC16(crc, *buff++);
-		/* FALL THROUGH */
-	case 2:
-		CRC16(crc, *buff++);
-		/* FALL THROUGH */
-	case 1:
-		CRC16(crc, *buff);
-		/* FALL THROUGH */
-	case 0:
-		break;
-	}
-	return (crc);
-}
-
 
 /*
  * Initialize LZHUF decoder.
@@ -196,6 +196,8 @@ static int	archive_read_format_tar_cleanup(struct archive_read *);
 static int	archive_read_format_tar_read_data(struct archive_read *a,
 		    const void **buff, size_t *size, int64_t *offset);
 static int	archive_read_format_tar_skip(struct archive_read *a);
+static int	archive_read_format_tar_seek_entry(struct archive_read *,
+		    struct archive_entry *, const char *, int64_t);
 static int	archive_read_format_tar_read_header(struct archive_read *,
 		    struct archive_entry *);
 static int	checksum(struct archive_read *, const void *);
@@ -253,6 +255,7 @@ archive_read_support_format_tar(struct archive *_a)
 	    archive_read_format_tar_read_header,
 	    archive_read_format_tar_read_data,
 	    archive_read_format_tar_skip,
+	    archive_read_format_tar_seek_entry,
 	    archive_read_format_tar_cleanup);
 
 	if (r != ARCHIVE_OK)
@@ -601,6 +604,31 @@ archive_read_format_tar_skip(struct archive_read *a)
 	return (ARCHIVE_OK);
 }
 
+/*
+ * Tar has no directory of entries, so this only works with a sidecar
+ * index; see archive_read_set_index_file().
+ */
+static int
+archive_read_format_tar_seek_entry(struct archive_read *a,
+    struct archive_entry *entry, const char *pathname, int64_t index)
+{
+	struct tar *tar;
+	const char *name;
+	int r;
+
+	tar = (struct tar *)(a->format->data);
+	r = __archive_read_index_seek(a, pathname, index, &name);
+	if (r != ARCHIVE_OK)
+		return (r);
+	/* Forget whatever was left of the current entry. */
+	tar->entry_bytes_remaining = 0;
+	tar->entry_bytes_unconsumed = 0;
+	tar->entry_padding = 0;
+	tar->header_recursion_depth = 0;
+	r = archive_read_format_tar_read_header(a, entry);
+	return (__archive_read_index_verify(a, entry, name, r));
+}
+
 /*
  * This function recursively interprets all of the headers associated
  * with a single entry.
@@ -33,6 +33,12 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read_support_format_zip.c 201102
 #ifdef HAVE_STDLIB_H
 #include <stdlib.h>
 #endif
+#ifdef HAVE_BZLIB_H
+#include <bzlib.h>
+#endif
+#ifdef HAVE_LZMA_H
+#include <lzma.h>
+#endif
 #ifdef HAVE_ZLIB_H
 #include <zlib.h>
 #endif
@@ -41,17 +47,19 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_read_support_format_zip.c 201102
 #include "archive_endian.h"
 #include "archive_entry.h"
 #include "archive_entry_locale.h"
+#include "archive_parallel_private.h"
 #include "archive_private.h"
 #include "archive_rb.h"
 #include "archive_read_private.h"
 
-#ifndef HAVE_ZLIB_H
 #include "archive_crc32.h"
-#endif
 
 struct zip_entry {
 	struct archive_rb_node	node;
 	int64_t			local_header_offset;
+	/* Filename from the central directory (seekable Zip only) */
+	size_t			name_offset;
+	size_t			name_length;
 	int64_t			compressed_size;
 	int64_t			uncompressed_size;
 	int64_t			gid;
@@ -65,6 +73,9 @@ struct zip_entry {
 	uint16_t		flags;
 	char			compression;
 	char			system;
+	/* Local header has a Zip64 extra field, so the data
+	   descriptor has 64-bit sizes. */
+	char			zip64;
 };
 
 struct zip {
@@ -80,6 +91,17 @@ struct zip {
 	struct zip_entry	*zip_entries;
 	struct zip_entry	*entry;
 	struct archive_rb_tree	tree;
+	struct archive_string	names;
+
+	/* Decompressing entries on worker threads (seekable Zip only). */
+	int			threads;
+	struct archive_parallel	*parallel;
+	/* Next entry to hand to the workers, in local header order. */
+	struct zip_entry	*parallel_next;
+	/* Memory held by submitted jobs. */
+	size_t			parallel_bytes;
+	/* Decompressed body of the current entry, if a worker did it. */
+	struct zip_job		*job;
 
 	size_t			unconsumed;
 
@@ -106,6 +128,14 @@ struct zip {
 	z_stream		stream;
 	char			stream_valid;
 #endif
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+	bz_stream		bzstream;
+	char			bzstream_valid;
+#endif
+#ifdef HAVE_LZMA_H
+	lzma_stream		lzstream;
+	char			lzstream_valid;
+#endif
 
 	struct archive_string	extra;
 	struct archive_string_conv *sconv;
@@ -115,9 +145,40 @@ struct zip {
 	char	format_name[64];
 };
 
+/*
+ * An entry decompressed by a worker thread: a copy of its local file
+ * header and compressed data, and then its decompressed data.
+ */
+struct zip_job {
+	struct zip_entry	*zip_entry;
+	unsigned char		*head;
+	unsigned char		*in;
+	size_t			 in_size;
+	unsigned char		*out;
+	size_t			 out_size;
+	/* Memory used, for limiting how far we read ahead. */
+	size_t			 bytes;
+	/* Compressed bytes the decompressor used. */
+	size_t			 in_used;
+	unsigned long		 crc32;
+	int			 compression;
+	int			 status;
+	int			 zlib_status;
+};
+
+#define	ZIP_JOB_OK		0
+#define	ZIP_JOB_NOMEM		1
+#define	ZIP_JOB_TRUNCATED	2	/* Input ended early. */
+#define	ZIP_JOB_TOO_LONG	3	/* Output longer than expected. */
+#define	ZIP_JOB_FAILED		4	/* zlib_status says why. */
+
+/* Larger entries are decompressed on the calling thread. */
+#define	ZIP_JOB_MAX		(16 * 1024 * 1024)
+
 #define ZIP_LENGTH_AT_END	8
 #define ZIP_ENCRYPTED		(1<<0)	
 #define ZIP_STRONG_ENCRYPTED	(1<<6)	
+#define ZIP_LZMA_EOPM		(1<<1)	/* LZMA data has an end marker. */
 #define ZIP_UTF8_NAME		(1<<11)	
 
 static int	archive_read_format_zip_streamable_bid(struct archive_read *, int);
@@ -132,14 +193,33 @@ static int	archive_read_format_zip_seekable_read_header(struct archive_read *,
 		    struct archive_entry *);
 static int	archive_read_format_zip_streamable_read_header(struct archive_read *,
 		    struct archive_entry *);
+static int	archive_read_format_zip_seekable_seek_entry(struct archive_read *,
+		    struct archive_entry *, const char *, int64_t);
 #ifdef HAVE_ZLIB_H
 static int	zip_read_data_deflate(struct archive_read *a, const void **buff,
 		    size_t *size, int64_t *offset);
 #endif
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+static int	zip_read_data_bzip2(struct archive_read *a, const void **buff,
+		    size_t *size, int64_t *offset);
+#endif
+#ifdef HAVE_LZMA_H
+static int	zip_read_data_lzma(struct archive_read *a, const void **buff,
+		    size_t *size, int64_t *offset);
+#endif
+static int	zip_read_data_job(struct archive_read *a, const void **buff,
+    size_t *size, int64_t *offset);
 static int	zip_read_data_none(struct archive_read *a, const void **buff,
 		    size_t *size, int64_t *offset);
+static int	zip_parse_local_file_header(struct archive_read *a,
+    struct archive_entry *entry, struct zip *, const char *);
 static int	zip_read_local_file_header(struct archive_read *a,
     struct archive_entry *entry, struct zip *);
+static int	zip_read_seekable_entry(struct archive_read *a,
+    struct archive_entry *entry, struct zip *);
+static void	zip_parallel_fill(struct archive_read *, struct zip *);
+static void	zip_parallel_drain(struct zip *);
+static void	zip_job_free(struct zip_job *);
 static time_t	zip_time(const char *);
 static const char *compression_name(int compression);
 static void process_extra(const char *, size_t, struct zip_entry *);
@@ -170,6 +250,7 @@ archive_read_support_format_zip_streamable(struct archive *_a)
 	    archive_read_format_zip_streamable_read_header,
 	    archive_read_format_zip_read_data,
 	    archive_read_format_zip_read_data_skip,
+	    NULL,
 	    archive_read_format_zip_cleanup);
 
 	if (r != ARCHIVE_OK)
@@ -203,6 +284,7 @@ archive_read_support_format_zip_seekable(struct archive *_a)
 	    archive_read_format_zip_seekable_read_header,
 	    archive_read_format_zip_read_data,
 	    archive_read_format_zip_read_data_skip,
+	    archive_read_format_zip_seekable_seek_entry,
 	    archive_read_format_zip_cleanup);
 
 	if (r != ARCHIVE_OK)
@@ -265,6 +347,41 @@ archive_read_format_zip_seekable_bid(struct archive_read *a, int best_bid)
 	/* Just one volume, so central dir must all be on this volume. */
 	if (zip->central_directory_entries != archive_le16dec(p + 8))
 		return 0;
+
+	/* A Zip64 end of central directory locator just before this
+	   record points to a Zip64 end of central directory record
+	   with the full count, size and offset. */
+	if (filesize >= 20 + 56
+	    && __archive_read_seek(a, filesize - 20, SEEK_SET) >= 0
+	    && (p = __archive_read_ahead(a, 20, NULL)) != NULL
+	    && memcmp(p, "PK\006\007\000\000\000\000", 8) == 0) {
+		int64_t offset64 = archive_le64dec(p + 8);
+		uint64_t entries, size;
+
+		/* Again, just one volume. */
+		if (archive_le32dec(p + 16) != 1
+		    || offset64 < 0 || offset64 > filesize - 20 - 56)
+			return 0;
+		if (__archive_read_seek(a, offset64, SEEK_SET) < 0
+		    || (p = __archive_read_ahead(a, 56, NULL)) == NULL
+		    || memcmp(p, "PK\006\006", 4) != 0
+		    || archive_le32dec(p + 16) != 0
+		    || archive_le32dec(p + 20) != 0)
+			return 0;
+		entries = archive_le64dec(p + 32);
+		size = archive_le64dec(p + 40);
+		if (entries != archive_le64dec(p + 24)
+		    || size > (uint64_t)filesize
+		    || (uint64_t)(size_t)size != size
+		    || entries > size / 46)
+			return 0;
+		zip->central_directory_entries = (size_t)entries;
+		zip->central_directory_size = (size_t)size;
+		zip->central_directory_offset = archive_le64dec(p + 48);
+		if (zip->central_directory_offset < 0)
+			return 0;
+	}
+
 	/* Central directory can't extend beyond end of this file. */
 	if (zip->central_directory_offset + zip->central_directory_size > filesize)
 		return 0;
@@ -281,7 +398,11 @@ cmp_node(const struct archive_rb_node *n1, const struct archive_rb_node *n2)
 	const struct zip_entry *e1 = (const struct zip_entry *)n1;
 	const struct zip_entry *e2 = (const struct zip_entry *)n2;
 
-	return ((int)(e2->local_header_offset - e1->local_header_offset));
+	if (e1->local_header_offset > e2->local_header_offset)
+		return -1;
+	if (e1->local_header_offset < e2->local_header_offset)
+		return 1;
+	return 0;
 }
 
 static int
@@ -304,6 +425,7 @@ slurp_central_directory(struct archive_read *a, struct zip *zip)
 	__archive_read_seek(a, zip->central_directory_offset, SEEK_SET);
 	zip->offset = zip->central_directory_offset;
 	__archive_rb_tree_init(&zip->tree, &rb_ops);
+	zip->entries_remaining = zip->central_directory_entries;
 
 	zip->zip_entries = calloc(zip->central_directory_entries,
 				sizeof(struct zip_entry));
@@ -315,6 +437,11 @@ slurp_central_directory(struct archive_read *a, struct zip *zip)
 
 		if ((p = __archive_read_ahead(a, 46, NULL)) == NULL)
 			return ARCHIVE_FATAL;
+		filename_length = archive_le16dec(p + 28);
+		extra_length = archive_le16dec(p + 30);
+		if ((p = __archive_read_ahead(a,
+		    46 + filename_length + extra_length, NULL)) == NULL)
+			return ARCHIVE_FATAL;
 		if (memcmp(p, "PK\001\002", 4) != 0) {
 			archive_set_error(&a->archive,
 			    -1, "Invalid central directory signature");
@@ -330,13 +457,16 @@ slurp_central_directory(struct archive_read *a, struct zip *zip)
 		zip_entry->crc32 = archive_le32dec(p + 16);
 		zip_entry->compressed_size = archive_le32dec(p + 20);
 		zip_entry->uncompressed_size = archive_le32dec(p + 24);
-		filename_length = archive_le16dec(p + 28);
-		extra_length = archive_le16dec(p + 30);
 		comment_length = archive_le16dec(p + 32);
 		/* disk_start = archive_le16dec(p + 34); */ /* Better be zero. */
 		/* internal_attributes = archive_le16dec(p + 36); */ /* text bit */
 		external_attributes = archive_le32dec(p + 38);
 		zip_entry->local_header_offset = archive_le32dec(p + 42);
+		/* Sizes and offset that don't fit in 32 bits are in
+		   a Zip64 extra field; the rest of the extra block is
+		   duplicated at the local file header. */
+		process_extra(p + 46 + filename_length, extra_length,
+		    zip_entry);
 
 		/* If we can't guess the mode, leave it zero here;
 		   when we read the local file header we might get
@@ -348,18 +478,22 @@ slurp_central_directory(struct archive_read *a, struct zip *zip)
 		/* Register an entry to RB tree to sort it by file offset. */
 		__archive_rb_tree_insert_node(&zip->tree, &zip_entry->node);
 
-		/* We don't read the filename until we get to the
-		   local file header.  Reading it here would speed up
-		   table-of-contents operations (removing the need to
-		   find and read local file header to get the
-		   filename) at the cost of requiring a lot of extra
-		   space. */
-		/* We don't read the extra block here.  We assume it
-		   will be duplicated at the local file header. */
+		/* Keep the raw filename so that archive_read_seek_entry()
+		   can find an entry without visiting every local file
+		   header.  The pathname we report is still the one from
+		   the local file header. */
+		zip_entry->name_offset = archive_strlen(&zip->names);
+		zip_entry->name_length = filename_length;
+		archive_strncat(&zip->names, p + 46, filename_length);
 		__archive_read_consume(a,
 		    46 + filename_length + extra_length + comment_length);
 	}
 
+	if (zip->threads > 0 && zip->central_directory_entries > 1) {
+		zip->parallel = __archive_parallel_new(zip->threads);
+		zip->parallel_next =
+		    (struct zip_entry *)ARCHIVE_RB_TREE_MIN(&zip->tree);
+	}
 	return ARCHIVE_OK;
 }
 
@@ -380,7 +514,7 @@ archive_read_format_zip_seekable_read_header(struct archive_read *a,
 	struct archive_entry *entry)
 {
 	struct zip *zip = (struct zip *)a->format->data;
-	int r, ret = ARCHIVE_OK;
+	int r;
 
 	a->archive.archive_format = ARCHIVE_FORMAT_ZIP;
 	if (a->archive.archive_format_name == NULL)
@@ -388,9 +522,11 @@ archive_read_format_zip_seekable_read_header(struct archive_read *a,
 
 	if (zip->zip_entries == NULL) {
 		r = slurp_central_directory(a, zip);
-		zip->entries_remaining = zip->central_directory_entries;
 		if (r != ARCHIVE_OK)
 			return r;
+	}
+	if (zip->entry == NULL &&
+	    zip->entries_remaining == zip->central_directory_entries) {
 		/* Get first entry whose local header offset is lower than
 		 * other entries in the archive file. */
 		zip->entry =
@@ -405,13 +541,122 @@ archive_read_format_zip_seekable_read_header(struct archive_read *a,
 		return ARCHIVE_EOF;
 	--zip->entries_remaining;
 
-	if (zip->offset != zip->entry->local_header_offset) {
-		__archive_read_seek(a, zip->entry->local_header_offset,
-			SEEK_SET);
-		zip->offset = zip->entry->local_header_offset;
+	zip_job_free(zip->job);
+	zip->job = NULL;
+	if (zip->parallel != NULL) {
+		zip_parallel_fill(a, zip);
+		if (__archive_parallel_pending(zip->parallel) > 0) {
+			/* Jobs come back in the order we read entries. */
+			zip->job = __archive_parallel_next(zip->parallel);
+			zip->parallel_bytes -= zip->job->bytes;
+			if (zip->job->zip_entry != zip->entry) {
+				archive_set_error(&a->archive,
+				    ARCHIVE_ERRNO_MISC,
+				    "Internal error: ZIP entries out of order");
+				return (ARCHIVE_FATAL);
+			}
+		} else if (zip->parallel_next == zip->entry) {
+			/* This one wasn't suitable; read it here. */
+			zip->parallel_next =
+			    (struct zip_entry *)__archive_rb_tree_iterate(
+				&zip->tree, &zip->entry->node,
+				ARCHIVE_RB_DIR_RIGHT);
+		}
+		/* We've likely read past this entry already. */
+		a->header_position = zip->entry->local_header_offset;
+	}
+	return (zip_read_seekable_entry(a, entry, zip));
+}
+
+/*
+ * Find an entry by its central directory filename or by its position
+ * in the archive, and read its local file header.
+ */
+static int
+archive_read_format_zip_seekable_seek_entry(struct archive_read *a,
+	struct archive_entry *entry, const char *pathname, int64_t index)
+{
+	struct zip *zip = (struct zip *)a->format->data;
+	struct zip_entry *zip_entry, *found = NULL;
+	size_t len = 0, remaining = 0, i = 0;
+	int r;
+
+	if (zip->zip_entries == NULL) {
+		r = slurp_central_directory(a, zip);
+		if (r != ARCHIVE_OK)
+			return r;
+	}
+	if (pathname != NULL)
+		len = strlen(pathname);
+
+	/* Walk in archive order; the last of several same-named
+	 * entries wins, as it would when extracting. */
+	for (zip_entry = (struct zip_entry *)ARCHIVE_RB_TREE_MIN(&zip->tree);
+	    zip_entry != NULL;
+	    zip_entry = (struct zip_entry *)__archive_rb_tree_iterate(
+		&zip->tree, &zip_entry->node, ARCHIVE_RB_DIR_RIGHT), i++) {
+		if (pathname == NULL) {
+			if ((int64_t)i == index) {
+				found = zip_entry;
+				remaining = zip->central_directory_entries - i;
+				break;
+			}
+		} else if (zip_entry->name_length == len &&
+		    memcmp(zip->names.s + zip_entry->name_offset,
+			pathname, len) == 0) {
+			found = zip_entry;
+			remaining = zip->central_directory_entries - i;
+		}
+	}
+	if (found == NULL) {
+		if (pathname != NULL)
+			archive_set_error(&a->archive, ENOENT,
+			    "%s: Not found in archive", pathname);
+		else
+			archive_set_error(&a->archive, ENOENT,
+			    "No entry %jd in archive", (intmax_t)index);
+		return (ARCHIVE_FAILED);
+	}
+
+	zip->entry = found;
+	zip->entries_remaining = remaining - 1;
+	zip_job_free(zip->job);
+	zip->job = NULL;
+	if (zip->parallel != NULL) {
+		/* Start reading ahead again after this entry. */
+		zip_parallel_drain(zip);
+		zip->parallel_next =
+		    (struct zip_entry *)__archive_rb_tree_iterate(
+			&zip->tree, &found->node, ARCHIVE_RB_DIR_RIGHT);
 	}
+	/* Whatever we were reading is abandoned; always seek. */
+	zip->offset = -1;
+	a->header_position = found->local_header_offset;
+	return (zip_read_seekable_entry(a, entry, zip));
+}
+
+/*
+ * Read the local file header of zip->entry, or take it from the
+ * worker's copy if there is one.
+ */
+static int
+zip_read_seekable_entry(struct archive_read *a, struct archive_entry *entry,
+	struct zip *zip)
+{
+	int r, ret = ARCHIVE_OK;
+
 	zip->unconsumed = 0;
-	r = zip_read_local_file_header(a, entry, zip);
+	if (zip->job != NULL)
+		r = zip_parse_local_file_header(a, entry, zip,
+		    (const char *)zip->job->head);
+	else {
+		if (zip->offset != zip->entry->local_header_offset) {
+			__archive_read_seek(a,
+			    zip->entry->local_header_offset, SEEK_SET);
+			zip->offset = zip->entry->local_header_offset;
+		}
+		r = zip_read_local_file_header(a, entry, zip);
+	}
 	if (r != ARCHIVE_OK)
 		return r;
 	if ((zip->entry->mode & AE_IFMT) == AE_IFLNK) {
@@ -420,7 +665,13 @@ archive_read_format_zip_seekable_read_header(struct archive_read *a,
 		size_t linkname_length = archive_entry_size(entry);
 
 		archive_entry_set_size(entry, 0);
-		p = __archive_read_ahead(a, linkname_length, NULL);
+		if (zip->job == NULL)
+			p = __archive_read_ahead(a, linkname_length, NULL);
+		else if (zip->job->status == ZIP_JOB_OK &&
+		    zip->job->out_size >= linkname_length)
+			p = zip->job->out;
+		else
+			p = NULL;
 		if (p == NULL) {
 			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
 			    "Truncated Zip file");
@@ -521,6 +772,26 @@ archive_read_format_zip_options(struct archive_read *a,
 			} else
 				ret = ARCHIVE_FATAL;
 		}
+	} else if (strcmp(key, "threads") == 0) {
+		int n = 0;
+
+		if (val == NULL || *val == '\0') {
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "zip: threads option needs a number");
+			return (ARCHIVE_FAILED);
+		}
+		for (; *val != '\0'; val++) {
+			if (*val >= '0' && *val <= '9')
+				n = n * 10 + (*val - '0');
+			if (*val < '0' || *val > '9' || n > 1024) {
+				archive_set_error(&a->archive,
+				    ARCHIVE_ERRNO_MISC,
+				    "zip: invalid threads option");
+				return (ARCHIVE_FAILED);
+			}
+		}
+		zip->threads = n;
+		ret = ARCHIVE_OK;
 	} else
 		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
 		    "zip: unknown keyword ``%s''", key);
@@ -595,7 +866,38 @@ zip_read_local_file_header(struct archive_read *a, struct archive_entry *entry,
     struct zip *zip)
 {
 	const char *p;
-	const void *h;
+	size_t header_length;
+	int r;
+
+	if ((p = __archive_read_ahead(a, 30, NULL)) == NULL) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
+		    "Truncated ZIP file header");
+		return (ARCHIVE_FATAL);
+	}
+	if (memcmp(p, "PK\003\004", 4) != 0) {
+		archive_set_error(&a->archive, -1, "Damaged Zip archive");
+		return ARCHIVE_FATAL;
+	}
+	header_length = 30 + archive_le16dec(p + 26) + archive_le16dec(p + 28);
+	if ((p = __archive_read_ahead(a, header_length, NULL)) == NULL) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
+		    "Truncated ZIP file header");
+		return (ARCHIVE_FATAL);
+	}
+	r = zip_parse_local_file_header(a, entry, zip, p);
+	zip_read_consume(a, header_length);
+	return (r);
+}
+
+/*
+ * Parse a complete local file header, which the caller has checked
+ * starts with the right signature.
+ */
+static int
+zip_parse_local_file_header(struct archive_read *a,
+    struct archive_entry *entry, struct zip *zip, const char *p)
+{
+	const char *h;
 	const wchar_t *wp;
 	const char *cp;
 	size_t len, filename_length, extra_length;
@@ -610,7 +912,7 @@ zip_read_local_file_header(struct archive_read *a, struct archive_entry *entry,
 	zip->end_of_entry = 0;
 	zip->entry_uncompressed_bytes_read = 0;
 	zip->entry_compressed_bytes_read = 0;
-	zip->entry_crc32 = crc32(0, NULL, 0);
+	zip->entry_crc32 = __archive_crc32(0, NULL, 0);
 
 	/* Setup default conversion. */
 	if (zip->sconv == NULL && !zip->init_default_conversion) {
@@ -619,16 +921,6 @@ zip_read_local_file_header(struct archive_read *a, struct archive_entry *entry,
 		zip->init_default_conversion = 1;
 	}
 
-	if ((p = __archive_read_ahead(a, 30, NULL)) == NULL) {
-		archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
-		    "Truncated ZIP file header");
-		return (ARCHIVE_FATAL);
-	}
-
-	if (memcmp(p, "PK\003\004", 4) != 0) {
-		archive_set_error(&a->archive, -1, "Damaged Zip archive");
-		return ARCHIVE_FATAL;
-	}
 	version = p[4];
 	zip_entry->system = p[5];
 	zip_entry->flags = archive_le16dec(p + 6);
@@ -640,8 +932,6 @@ zip_read_local_file_header(struct archive_read *a, struct archive_entry *entry,
 	filename_length = archive_le16dec(p + 26);
 	extra_length = archive_le16dec(p + 28);
 
-	zip_read_consume(a, 30);
-
 	if (zip->have_central_directory) {
 		/* If we read the central dir entry, we must have size information
 		   as well, so ignore the length-at-end flag. */
@@ -656,13 +946,13 @@ zip_read_local_file_header(struct archive_read *a, struct archive_entry *entry,
 			    "Inconsistent CRC32 values");
 			ret = ARCHIVE_WARN;
 		}
-		if (compressed_size != 0
+		if (compressed_size != 0 && compressed_size != 0xffffffff
 		    && compressed_size != zip_entry->compressed_size) {
 			archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
 			    "Inconsistent compressed size");
 			ret = ARCHIVE_WARN;
 		}
-		if (uncompressed_size != 0
+		if (uncompressed_size != 0 && uncompressed_size != 0xffffffff
 		    && uncompressed_size != zip_entry->uncompressed_size) {
 			archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
 			    "Inconsistent uncompressed size");
@@ -676,11 +966,7 @@ zip_read_local_file_header(struct archive_read *a, struct archive_entry *entry,
 	}
 
 	/* Read the filename. */
-	if ((h = __archive_read_ahead(a, filename_length, NULL)) == NULL) {
-		archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
-		    "Truncated ZIP file header");
-		return (ARCHIVE_FATAL);
-	}
+	h = p + 30;
 	if (zip_entry->flags & ZIP_UTF8_NAME) {
 		/* The filename is stored to be UTF-8. */
 		if (zip->sconv_utf8 == NULL) {
@@ -710,7 +996,6 @@ zip_read_local_file_header(struct archive_read *a, struct archive_entry *entry,
 		    archive_string_conversion_charset_name(sconv));
 		ret = ARCHIVE_WARN;
 	}
-	zip_read_consume(a, filename_length);
 
 	if (zip_entry->mode == 0) {
 		/* Especially in streaming mode, we can end up
@@ -733,14 +1018,17 @@ zip_read_local_file_header(struct archive_read *a, struct archive_entry *entry,
 		}
 	}
 
-	/* Read the extra data. */
-	if ((h = __archive_read_ahead(a, extra_length, NULL)) == NULL) {
-		archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
-		    "Truncated ZIP file header");
-		return (ARCHIVE_FATAL);
+	/* Read the extra data.  The central directory already gave
+	   us the real sizes; don't let the local Zip64 field (whose
+	   compressed size may be zero) replace them. */
+	compressed_size = zip_entry->compressed_size;
+	uncompressed_size = zip_entry->uncompressed_size;
+	zip_entry->zip64 = 0;
+	process_extra(h + filename_length, extra_length, zip_entry);
+	if (zip->have_central_directory) {
+		zip_entry->compressed_size = compressed_size;
+		zip_entry->uncompressed_size = uncompressed_size;
 	}
-	process_extra(h, extra_length, zip_entry);
-	zip_read_consume(a, extra_length);
 
 	/* Populate some additional entry fields: */
 	archive_entry_set_mode(entry, zip_entry->mode);
@@ -781,7 +1069,13 @@ compression_name(int compression)
 		"reduced-4",
 		"imploded",
 		"reserved",
-		"deflation"
+		"deflation",
+		"deflation-64-bit",
+		"ibm-terse",
+		"reserved",
+		"bzip2",
+		"reserved",
+		"lzma"
 	};
 
 	if (compression <
@@ -840,7 +1134,9 @@ archive_read_format_zip_read_data(struct archive_read *a,
 	zip_read_consume(a, zip->unconsumed);
 	zip->unconsumed = 0;
 
-	switch(zip->entry->compression) {
+	if (zip->job != NULL)
+		r = zip_read_data_job(a, buff, size, offset);
+	else switch(zip->entry->compression) {
 	case 0:  /* No compression. */
 		r =  zip_read_data_none(a, buff, size, offset);
 		break;
@@ -848,6 +1144,16 @@ archive_read_format_zip_read_data(struct archive_read *a,
 	case 8: /* Deflate compression. */
 		r =  zip_read_data_deflate(a, buff, size, offset);
 		break;
+#endif
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+	case 12: /* bzip2 compression. */
+		r =  zip_read_data_bzip2(a, buff, size, offset);
+		break;
+#endif
+#ifdef HAVE_LZMA_H
+	case 14: /* LZMA compression. */
+		r =  zip_read_data_lzma(a, buff, size, offset);
+		break;
 #endif
 	default: /* Unsupported compression. */
 		/* Return a warning. */
@@ -862,8 +1168,9 @@ archive_read_format_zip_read_data(struct archive_read *a,
 	if (r != ARCHIVE_OK)
 		return (r);
 	/* Update checksum */
-	if (*size)
-		zip->entry_crc32 = crc32(zip->entry_crc32, *buff, *size);
+	if (*size && zip->job == NULL)
+		zip->entry_crc32 =
+		    __archive_crc32(zip->entry_crc32, *buff, *size);
 	/* If we hit the end, swallow any end-of-data marker. */
 	if (zip->end_of_entry) {
 		/* Check file size, CRC against these values. */
@@ -908,7 +1215,8 @@ archive_read_format_zip_read_data(struct archive_read *a,
  * we have no size information.  In this case, we can do pretty
  * well by watching for the data descriptor record.  The data
  * descriptor is 16 bytes and includes a computed CRC that should
- * provide a strong check.
+ * provide a strong check.  (After a Zip64 local header it is
+ * 24 bytes, with 64-bit sizes.)
  *
  * TODO: Technically, the PK\007\010 signature is optional.
  * In the original spec, the data descriptor contained CRC
@@ -932,10 +1240,12 @@ zip_read_data_none(struct archive_read *a, const void **_buff,
 
 	if (zip->entry->flags & ZIP_LENGTH_AT_END) {
 		const char *p;
+		ssize_t dd = zip->entry->zip64 ? 24 : 16;
+		int64_t csize, usize;
 
-		/* Grab at least 16 bytes. */
-		buff = __archive_read_ahead(a, 16, &bytes_avail);
-		if (bytes_avail < 16) {
+		/* Grab at least a data descriptor's worth. */
+		buff = __archive_read_ahead(a, dd, &bytes_avail);
+		if (bytes_avail < dd) {
 			/* Zip archives have end-of-archive markers
 			   that are longer than this, so a failure to get at
 			   least 16 bytes really does indicate a truncated
@@ -946,16 +1256,23 @@ zip_read_data_none(struct archive_read *a, const void **_buff,
 		}
 		/* Check for a complete PK\007\010 signature. */
 		p = buff;
+		if (zip->entry->zip64) {
+			csize = archive_le64dec(p + 8);
+			usize = archive_le64dec(p + 16);
+		} else {
+			csize = archive_le32dec(p + 8);
+			usize = archive_le32dec(p + 12);
+		}
 		if (p[0] == 'P' && p[1] == 'K' 
 		    && p[2] == '\007' && p[3] == '\010'
 		    && archive_le32dec(p + 4) == zip->entry_crc32
-		    && archive_le32dec(p + 8) == zip->entry_compressed_bytes_read
-		    && archive_le32dec(p + 12) == zip->entry_uncompressed_bytes_read) {
+		    && csize == zip->entry_compressed_bytes_read
+		    && usize == zip->entry_uncompressed_bytes_read) {
 			zip->entry->crc32 = archive_le32dec(p + 4);
-			zip->entry->compressed_size = archive_le32dec(p + 8);
-			zip->entry->uncompressed_size = archive_le32dec(p + 12);
+			zip->entry->compressed_size = csize;
+			zip->entry->uncompressed_size = usize;
 			zip->end_of_entry = 1;
-			zip->unconsumed = 16;
+			zip->unconsumed = dd;
 			return (ARCHIVE_OK);
 		}
 		/* If not at EOF, ensure we consume at least one byte. */
@@ -998,17 +1315,15 @@ zip_read_data_none(struct archive_read *a, const void **_buff,
 	return (ARCHIVE_OK);
 }
 
-#ifdef HAVE_ZLIB_H
+#if defined(HAVE_ZLIB_H) || defined(HAVE_LZMA_H) || \
+    (defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR))
+/*
+ * Helpers shared by the decompressors.
+ */
 static int
-zip_read_data_deflate(struct archive_read *a, const void **buff,
-    size_t *size, int64_t *offset)
+zip_alloc_uncompressed_buffer(struct archive_read *a)
 {
-	struct zip *zip;
-	ssize_t bytes_avail;
-	const void *compressed_buff;
-	int r;
-
-	zip = (struct zip *)(a->format->data);
+	struct zip *zip = (struct zip *)(a->format->data);
 
 	/* If the buffer hasn't been allocated, allocate it now. */
 	if (zip->uncompressed_buffer == NULL) {
@@ -1021,6 +1336,59 @@ zip_read_data_deflate(struct archive_read *a, const void **buff,
 			return (ARCHIVE_FATAL);
 		}
 	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * A decompressor found the end of the entry's data; if the sizes and
+ * CRC follow it, pick them up.
+ */
+static int
+zip_read_end_of_data(struct archive_read *a)
+{
+	struct zip *zip = (struct zip *)(a->format->data);
+
+	const char *p;
+
+	if (0 == (zip->entry->flags & ZIP_LENGTH_AT_END))
+		return (ARCHIVE_OK);
+	if (NULL == (p = __archive_read_ahead(a,
+	    zip->entry->zip64 ? 24 : 16, NULL))) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
+		    "Truncated ZIP end-of-file record");
+		return (ARCHIVE_FATAL);
+	}
+	/* Consume the optional PK\007\010 marker. */
+	if (p[0] == 'P' && p[1] == 'K' && p[2] == '\007' && p[3] == '\010') {
+		zip->entry->crc32 = archive_le32dec(p + 4);
+		if (zip->entry->zip64) {
+			zip->entry->compressed_size = archive_le64dec(p + 8);
+			zip->entry->uncompressed_size = archive_le64dec(p + 16);
+			zip->unconsumed = 24;
+		} else {
+			zip->entry->compressed_size = archive_le32dec(p + 8);
+			zip->entry->uncompressed_size = archive_le32dec(p + 12);
+			zip->unconsumed = 16;
+		}
+	}
+	return (ARCHIVE_OK);
+}
+#endif
+
+#ifdef HAVE_ZLIB_H
+static int
+zip_read_data_deflate(struct archive_read *a, const void **buff,
+    size_t *size, int64_t *offset)
+{
+	struct zip *zip;
+	ssize_t bytes_avail;
+	const void *compressed_buff;
+	int r;
+
+	zip = (struct zip *)(a->format->data);
+
+	if (zip_alloc_uncompressed_buffer(a) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
 
 	/* If we haven't yet read any data, initialize the decompressor. */
 	if (!zip->decompress_init) {
@@ -1097,28 +1465,507 @@ zip_read_data_deflate(struct archive_read *a, const void **buff,
 	zip->entry_uncompressed_bytes_read += zip->stream.total_out;
 	*buff = zip->uncompressed_buffer;
 
-	if (zip->end_of_entry && (zip->entry->flags & ZIP_LENGTH_AT_END)) {
-		const char *p;
+	if (zip->end_of_entry)
+		return (zip_read_end_of_data(a));
+	return (ARCHIVE_OK);
+}
+#endif
 
-		if (NULL == (p = __archive_read_ahead(a, 16, NULL))) {
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+static int
+zip_read_data_bzip2(struct archive_read *a, const void **buff,
+    size_t *size, int64_t *offset)
+{
+	struct zip *zip;
+	ssize_t bytes_avail;
+	const void *compressed_buff;
+	int r;
+
+	zip = (struct zip *)(a->format->data);
+
+	if (zip_alloc_uncompressed_buffer(a) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+
+	/* If we haven't yet read any data, initialize the decompressor. */
+	if (!zip->decompress_init) {
+		if (zip->bzstream_valid) {
+			BZ2_bzDecompressEnd(&zip->bzstream);
+			zip->bzstream_valid = 0;
+		}
+		memset(&zip->bzstream, 0, sizeof(zip->bzstream));
+		r = BZ2_bzDecompressInit(&zip->bzstream, 0, 0);
+		if (r != BZ_OK) {
+			archive_set_error(&a->archive,
+			    r == BZ_MEM_ERROR ? ENOMEM : ARCHIVE_ERRNO_MISC,
+			    "Can't initialize ZIP bzip2 decompression.");
+			return (ARCHIVE_FATAL);
+		}
+		zip->bzstream_valid = 1;
+		zip->decompress_init = 1;
+	}
+
+	/*
+	 * Once a known-length body is used up, keep calling the
+	 * decompressor with no input so it can return what it holds.
+	 */
+	if (0 == (zip->entry->flags & ZIP_LENGTH_AT_END)
+	    && zip->entry_bytes_remaining <= 0) {
+		compressed_buff = NULL;
+		bytes_avail = 0;
+	} else {
+		compressed_buff = __archive_read_ahead(a, 1, &bytes_avail);
+		if (0 == (zip->entry->flags & ZIP_LENGTH_AT_END)
+		    && bytes_avail > zip->entry_bytes_remaining)
+			bytes_avail = zip->entry_bytes_remaining;
+		if (bytes_avail <= 0) {
 			archive_set_error(&a->archive,
 			    ARCHIVE_ERRNO_FILE_FORMAT,
-			    "Truncated ZIP end-of-file record");
+			    "Truncated ZIP file body");
 			return (ARCHIVE_FATAL);
 		}
-		/* Consume the optional PK\007\010 marker. */
-		if (p[0] == 'P' && p[1] == 'K' && p[2] == '\007' && p[3] == '\010') {
-			zip->entry->crc32 = archive_le32dec(p + 4);
-			zip->entry->compressed_size = archive_le32dec(p + 8);
-			zip->entry->uncompressed_size = archive_le32dec(p + 12);
-			zip->unconsumed = 16;
+	}
+
+	zip->bzstream.next_in = (char *)(uintptr_t)compressed_buff;
+	zip->bzstream.avail_in = (unsigned int)bytes_avail;
+	zip->bzstream.next_out = (char *)zip->uncompressed_buffer;
+	zip->bzstream.avail_out = (unsigned int)zip->uncompressed_buffer_size;
+
+	r = BZ2_bzDecompress(&zip->bzstream);
+	switch (r) {
+	case BZ_OK:
+		break;
+	case BZ_STREAM_END:
+		zip->end_of_entry = 1;
+		BZ2_bzDecompressEnd(&zip->bzstream);
+		zip->bzstream_valid = 0;
+		break;
+	case BZ_MEM_ERROR:
+		archive_set_error(&a->archive, ENOMEM,
+		    "Out of memory for ZIP decompression");
+		return (ARCHIVE_FATAL);
+	default:
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "ZIP bzip2 decompression failed (%d)", r);
+		return (ARCHIVE_FATAL);
+	}
+
+	/* Consume as much as the compressor actually used. */
+	bytes_avail -= zip->bzstream.avail_in;
+	zip_read_consume(a, bytes_avail);
+	zip->entry_bytes_remaining -= bytes_avail;
+	zip->entry_compressed_bytes_read += bytes_avail;
+
+	*size = zip->uncompressed_buffer_size - zip->bzstream.avail_out;
+	zip->entry_uncompressed_bytes_read += *size;
+	*buff = zip->uncompressed_buffer;
+
+	if (zip->end_of_entry)
+		return (zip_read_end_of_data(a));
+	if (compressed_buff == NULL && *size == 0) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
+		    "Truncated ZIP file body");
+		return (ARCHIVE_FATAL);
+	}
+	return (ARCHIVE_OK);
+}
+#endif
+
+#ifdef HAVE_LZMA_H
+/*
+ * LZMA data in a Zip entry starts with the version of the LZMA SDK
+ * that wrote it (2 bytes), the size of the LZMA properties (2 bytes,
+ * always 5) and the properties.  We turn that into the 13-byte header
+ * of an .lzma file, which liblzma knows how to decode.  Without
+ * ZIP_LZMA_EOPM, the data ends after exactly uncompressed_size bytes.
+ */
+static int
+zip_init_lzma(struct archive_read *a)
+{
+	struct zip *zip = (struct zip *)(a->format->data);
+	const unsigned char *p;
+	unsigned char header[13];
+	uint64_t uncompressed_size;
+	int r;
+
+	p = __archive_read_ahead(a, 9, NULL);
+	if (p == NULL || (0 == (zip->entry->flags & ZIP_LENGTH_AT_END)
+	    && zip->entry_bytes_remaining < 9)) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
+		    "Truncated ZIP file body");
+		return (ARCHIVE_FATAL);
+	}
+	if (archive_le16dec(p + 2) != 5) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
+		    "Invalid ZIP LZMA properties size (%d)",
+		    archive_le16dec(p + 2));
+		return (ARCHIVE_FATAL);
+	}
+	if ((zip->entry->flags & ZIP_LZMA_EOPM) ||
+	    ((zip->entry->flags & ZIP_LENGTH_AT_END) &&
+	     !zip->have_central_directory))
+		uncompressed_size = UINT64_MAX;
+	else
+		uncompressed_size = zip->entry->uncompressed_size;
+	memcpy(header, p + 4, 5);
+	archive_le64enc(header + 5, uncompressed_size);
+	zip_read_consume(a, 9);
+	zip->entry_bytes_remaining -= 9;
+	zip->entry_compressed_bytes_read += 9;
+
+	r = lzma_alone_decoder(&zip->lzstream, UINT64_MAX);
+	if (r == LZMA_OK) {
+		zip->lzstream_valid = 1;
+		zip->lzstream.next_in = header;
+		zip->lzstream.avail_in = sizeof(header);
+		zip->lzstream.next_out = zip->uncompressed_buffer;
+		zip->lzstream.avail_out = zip->uncompressed_buffer_size;
+		r = lzma_code(&zip->lzstream, LZMA_RUN);
+		if (r == LZMA_STREAM_END)
+			zip->end_of_entry = 1;
+		else if (r == LZMA_OK && zip->lzstream.avail_in != 0)
+			r = LZMA_DATA_ERROR;
+	}
+	switch (r) {
+	case LZMA_OK:
+	case LZMA_STREAM_END:
+		return (ARCHIVE_OK);
+	case LZMA_MEM_ERROR:
+		archive_set_error(&a->archive, ENOMEM,
+		    "Out of memory for ZIP decompression");
+		return (ARCHIVE_FATAL);
+	default:
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Can't initialize ZIP LZMA decompression (%d)", r);
+		return (ARCHIVE_FATAL);
+	}
+}
+
+static int
+zip_read_data_lzma(struct archive_read *a, const void **buff,
+    size_t *size, int64_t *offset)
+{
+	struct zip *zip;
+	ssize_t bytes_avail;
+	const void *compressed_buff;
+	int r;
+
+	zip = (struct zip *)(a->format->data);
+
+	if (zip_alloc_uncompressed_buffer(a) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+
+	/* If we haven't yet read any data, initialize the decompressor. */
+	if (!zip->decompress_init) {
+		if (zip_init_lzma(a) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		zip->decompress_init = 1;
+		if (zip->end_of_entry) {
+			*size = 0;
+			*buff = zip->uncompressed_buffer;
+			return (zip_read_end_of_data(a));
+		}
+	}
+
+	/* As for bzip2, drain the decompressor once the body is used up. */
+	if (0 == (zip->entry->flags & ZIP_LENGTH_AT_END)
+	    && zip->entry_bytes_remaining <= 0) {
+		compressed_buff = NULL;
+		bytes_avail = 0;
+	} else {
+		compressed_buff = __archive_read_ahead(a, 1, &bytes_avail);
+		if (0 == (zip->entry->flags & ZIP_LENGTH_AT_END)
+		    && bytes_avail > zip->entry_bytes_remaining)
+			bytes_avail = zip->entry_bytes_remaining;
+		if (bytes_avail <= 0) {
+			archive_set_error(&a->archive,
+			    ARCHIVE_ERRNO_FILE_FORMAT,
+			    "Truncated ZIP file body");
+			return (ARCHIVE_FATAL);
 		}
 	}
 
+	zip->lzstream.next_in = compressed_buff;
+	zip->lzstream.avail_in = bytes_avail;
+	zip->lzstream.next_out = zip->uncompressed_buffer;
+	zip->lzstream.avail_out = zip->uncompressed_buffer_size;
+
+	r = lzma_code(&zip->lzstream, LZMA_RUN);
+	switch (r) {
+	case LZMA_OK:
+		break;
+	case LZMA_STREAM_END:
+		zip->end_of_entry = 1;
+		break;
+	case LZMA_MEM_ERROR:
+		archive_set_error(&a->archive, ENOMEM,
+		    "Out of memory for ZIP decompression");
+		return (ARCHIVE_FATAL);
+	default:
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "ZIP LZMA decompression failed (%d)", r);
+		return (ARCHIVE_FATAL);
+	}
+
+	/* Consume as much as the compressor actually used. */
+	bytes_avail -= zip->lzstream.avail_in;
+	zip_read_consume(a, bytes_avail);
+	zip->entry_bytes_remaining -= bytes_avail;
+	zip->entry_compressed_bytes_read += bytes_avail;
+
+	*size = zip->uncompressed_buffer_size - zip->lzstream.avail_out;
+	zip->entry_uncompressed_bytes_read += *size;
+	*buff = zip->uncompressed_buffer;
+
+	if (zip->end_of_entry)
+		return (zip_read_end_of_data(a));
+	if (compressed_buff == NULL && *size == 0) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
+		    "Truncated ZIP file body");
+		return (ARCHIVE_FATAL);
+	}
 	return (ARCHIVE_OK);
 }
 #endif
 
+/*
+ * Decompressing entries on worker threads.
+ *
+ * With the threads option, the seekable reader copies the local file
+ * header and compressed data of the next several entries out of the
+ * archive, in the order it will return them, and has the workers
+ * decompress each one and compute its CRC.  read_header() then takes
+ * the oldest job, parses the header from its copy and read_data()
+ * hands back the whole body at once.  Everything that touches the
+ * archive or the client stays on the calling thread.
+ *
+ * Encrypted entries, methods other than stored and deflate, entries
+ * over ZIP_JOB_MAX and anything that can't be read ahead cleanly stop
+ * the read-ahead; such an entry is read as usual when its turn comes.
+ */
+static void
+zip_job_free(struct zip_job *job)
+{
+	if (job == NULL)
+		return;
+	if (job->out != job->in)
+		free(job->out);
+	free(job->in);
+	free(job->head);
+	free(job);
+}
+
+static void
+zip_job_run(void *_job)
+{
+	struct zip_job *job = (struct zip_job *)_job;
+#ifdef HAVE_ZLIB_H
+	z_stream stream;
+	int r;
+#endif
+
+	if (job->compression == 0) {
+		job->out = job->in;
+		job->out_size = job->in_size;
+		job->in_used = job->in_size;
+	}
+#ifdef HAVE_ZLIB_H
+	else {
+		/* The output buffer has one byte more than the
+		 * central directory promised, so we can tell when
+		 * the data doesn't end there. */
+		memset(&stream, 0, sizeof(stream));
+		if (inflateInit2(&stream, -15) != Z_OK) {
+			job->status = ZIP_JOB_NOMEM;
+			return;
+		}
+		stream.next_in = job->in;
+		stream.avail_in = (uInt)job->in_size;
+		stream.next_out = job->out;
+		stream.avail_out = (uInt)job->out_size;
+		r = inflate(&stream, Z_FINISH);
+		job->in_used = stream.total_in;
+		job->out_size = stream.total_out;
+		inflateEnd(&stream);
+		switch (r) {
+		case Z_STREAM_END:
+			break;
+		case Z_MEM_ERROR:
+			job->status = ZIP_JOB_NOMEM;
+			return;
+		case Z_BUF_ERROR:
+			job->status = stream.avail_out == 0 ?
+			    ZIP_JOB_TOO_LONG : ZIP_JOB_TRUNCATED;
+			return;
+		default:
+			job->status = ZIP_JOB_FAILED;
+			job->zlib_status = r;
+			return;
+		}
+	}
+#endif
+	job->crc32 = __archive_crc32(0, job->out, job->out_size);
+}
+
+/*
+ * Copy the entry at the current read position and hand it to the
+ * workers.  Returns ARCHIVE_FAILED if the entry has to be read on
+ * the calling thread instead.
+ */
+static int
+zip_parallel_submit(struct archive_read *a, struct zip *zip,
+    struct zip_entry *zip_entry)
+{
+	struct zip_job *job;
+	const char *p;
+	size_t header_length, n;
+	ssize_t bytes_avail;
+	int compression;
+
+	if (zip_entry->compressed_size > ZIP_JOB_MAX ||
+	    zip_entry->uncompressed_size > ZIP_JOB_MAX)
+		return (ARCHIVE_FAILED);
+	if (zip->offset != zip_entry->local_header_offset) {
+		if (__archive_read_seek(a, zip_entry->local_header_offset,
+		    SEEK_SET) < 0)
+			return (ARCHIVE_FAILED);
+		zip->offset = zip_entry->local_header_offset;
+	}
+	/* Go by the local file header, as read_data() will. */
+	if ((p = __archive_read_ahead(a, 30, NULL)) == NULL ||
+	    memcmp(p, "PK\003\004", 4) != 0)
+		return (ARCHIVE_FAILED);
+	if (archive_le16dec(p + 6) & (ZIP_ENCRYPTED | ZIP_STRONG_ENCRYPTED))
+		return (ARCHIVE_FAILED);
+	compression = archive_le16dec(p + 8);
+	switch (compression) {
+	case 0:
+#ifdef HAVE_ZLIB_H
+	case 8:
+#endif
+		break;
+	default:
+		return (ARCHIVE_FAILED);
+	}
+	header_length = 30 + archive_le16dec(p + 26) + archive_le16dec(p + 28);
+	if ((p = __archive_read_ahead(a, header_length, NULL)) == NULL)
+		return (ARCHIVE_FAILED);
+
+	job = calloc(1, sizeof(*job));
+	if (job == NULL)
+		return (ARCHIVE_FAILED);
+	job->zip_entry = zip_entry;
+	job->compression = compression;
+	job->in_size = (size_t)zip_entry->compressed_size;
+	job->head = malloc(header_length);
+	job->in = malloc(job->in_size + 1);
+	if (compression != 0) {
+		job->out_size = (size_t)zip_entry->uncompressed_size + 1;
+		job->out = malloc(job->out_size);
+	}
+	if (job->head == NULL || job->in == NULL ||
+	    (compression != 0 && job->out == NULL)) {
+		zip_job_free(job);
+		return (ARCHIVE_FAILED);
+	}
+	job->bytes = header_length + job->in_size + job->out_size;
+	memcpy(job->head, p, header_length);
+	zip_read_consume(a, header_length);
+
+	for (n = 0; n < job->in_size; n += bytes_avail) {
+		p = __archive_read_ahead(a, 1, &bytes_avail);
+		if (p == NULL || bytes_avail <= 0) {
+			zip_job_free(job);
+			return (ARCHIVE_FAILED);
+		}
+		if ((size_t)bytes_avail > job->in_size - n)
+			bytes_avail = job->in_size - n;
+		memcpy(job->in + n, p, bytes_avail);
+		zip_read_consume(a, bytes_avail);
+	}
+
+	if (__archive_parallel_submit(zip->parallel, zip_job_run, job)
+	    != ARCHIVE_OK) {
+		zip_job_free(job);
+		return (ARCHIVE_FAILED);
+	}
+	zip->parallel_bytes += job->bytes;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Keep a few jobs per thread queued, within a memory budget.
+ */
+static void
+zip_parallel_fill(struct archive_read *a, struct zip *zip)
+{
+	int pending;
+
+	while (zip->parallel_next != NULL) {
+		pending = __archive_parallel_pending(zip->parallel);
+		if (pending >= zip->threads * 4 || (pending > 0 &&
+		    zip->parallel_bytes >= (size_t)zip->threads * ZIP_JOB_MAX))
+			break;
+		if (zip_parallel_submit(a, zip, zip->parallel_next)
+		    != ARCHIVE_OK)
+			break;
+		zip->parallel_next =
+		    (struct zip_entry *)__archive_rb_tree_iterate(
+			&zip->tree, &zip->parallel_next->node,
+			ARCHIVE_RB_DIR_RIGHT);
+	}
+}
+
+static void
+zip_parallel_drain(struct zip *zip)
+{
+	while (__archive_parallel_pending(zip->parallel) > 0)
+		zip_job_free(__archive_parallel_next(zip->parallel));
+	zip->parallel_bytes = 0;
+}
+
+/*
+ * Return the body a worker decompressed, all at once.
+ */
+static int
+zip_read_data_job(struct archive_read *a, const void **buff,
+    size_t *size, int64_t *offset)
+{
+	struct zip *zip = (struct zip *)(a->format->data);
+	struct zip_job *job = zip->job;
+
+	switch (job->status) {
+	case ZIP_JOB_OK:
+		break;
+	case ZIP_JOB_NOMEM:
+		archive_set_error(&a->archive, ENOMEM,
+		    "Out of memory for ZIP decompression");
+		return (ARCHIVE_FATAL);
+	case ZIP_JOB_TRUNCATED:
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
+		    "Truncated ZIP file body");
+		return (ARCHIVE_FATAL);
+	case ZIP_JOB_TOO_LONG:
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "ZIP uncompressed data is wrong size (expected %jd)",
+		    (intmax_t)zip->entry->uncompressed_size);
+		return (ARCHIVE_FATAL);
+	default:
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "ZIP decompression failed (%d)", job->zlib_status);
+		return (ARCHIVE_FATAL);
+	}
+
+	*buff = job->out;
+	*size = job->out_size;
+	*offset = 0;
+	zip->entry_bytes_remaining -= job->in_used;
+	zip->entry_compressed_bytes_read = job->in_used;
+	zip->entry_uncompressed_bytes_read = job->out_size;
+	zip->entry_crc32 = job->crc32;
+	zip->end_of_entry = 1;
+	return (ARCHIVE_OK);
+}
+
 static int
 archive_read_format_zip_read_data_skip(struct archive_read *a)
 {
@@ -1130,6 +1977,10 @@ archive_read_format_zip_read_data_skip(struct archive_read *a)
 	if (zip->end_of_entry)
 		return (ARCHIVE_OK);
 
+	/* A worker has it all in memory; nothing to skip. */
+	if (zip->job != NULL)
+		return (ARCHIVE_OK);
+
 	/* So we know we're streaming... */
 	if (0 == (zip->entry->flags & ZIP_LENGTH_AT_END)) {
 		/* We know the compressed length, so we can just skip. */
@@ -1157,6 +2008,32 @@ archive_read_format_zip_read_data_skip(struct archive_read *a)
 				return (r);
 		}
 		break;
+#endif
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+	case 12: /* bzip2 compression. */
+		while (!zip->end_of_entry) {
+			int64_t offset = 0;
+			const void *buff = NULL;
+			size_t size = 0;
+			int r;
+			r =  zip_read_data_bzip2(a, &buff, &size, &offset);
+			if (r != ARCHIVE_OK)
+				return (r);
+		}
+		break;
+#endif
+#ifdef HAVE_LZMA_H
+	case 14: /* LZMA compression. */
+		while (!zip->end_of_entry) {
+			int64_t offset = 0;
+			const void *buff = NULL;
+			size_t size = 0;
+			int r;
+			r =  zip_read_data_lzma(a, &buff, &size, &offset);
+			if (r != ARCHIVE_OK)
+				return (r);
+		}
+		break;
 #endif
 	default: /* Uncompressed or unknown. */
 		/* Scan for a PK\007\010 signature. */
@@ -1165,20 +2042,21 @@ archive_read_format_zip_read_data_skip(struct archive_read *a)
 		for (;;) {
 			const char *p, *buff;
 			ssize_t bytes_avail;
-			buff = __archive_read_ahead(a, 16, &bytes_avail);
-			if (bytes_avail < 16) {
+			ssize_t dd = zip->entry->zip64 ? 24 : 16;
+			buff = __archive_read_ahead(a, dd, &bytes_avail);
+			if (bytes_avail < dd) {
 				archive_set_error(&a->archive, ARCHIVE_ERRNO_FILE_FORMAT,
 				    "Truncated ZIP file data");
 				return (ARCHIVE_FATAL);
 			}
 			p = buff;
-			while (p <= buff + bytes_avail - 16) {
+			while (p <= buff + bytes_avail - dd) {
 				if (p[3] == 'P') { p += 3; }
 				else if (p[3] == 'K') { p += 2; }
 				else if (p[3] == '\007') { p += 1; }
 				else if (p[3] == '\010' && p[2] == '\007'
 				    && p[1] == 'K' && p[0] == 'P') {
-					zip_read_consume(a, p - buff + 16);
+					zip_read_consume(a, p - buff + dd);
 					return ARCHIVE_OK;
 				} else { p += 4; }
 			}
@@ -1198,7 +2076,21 @@ archive_read_format_zip_cleanup(struct archive_read *a)
 	if (zip->stream_valid)
 		inflateEnd(&zip->stream);
 #endif
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+	if (zip->bzstream_valid)
+		BZ2_bzDecompressEnd(&zip->bzstream);
+#endif
+#ifdef HAVE_LZMA_H
+	if (zip->lzstream_valid)
+		lzma_end(&zip->lzstream);
+#endif
+	zip_job_free(zip->job);
+	if (zip->parallel != NULL) {
+		zip_parallel_drain(zip);
+		__archive_parallel_free(zip->parallel);
+	}
 	free(zip->zip_entries);
+	archive_string_free(&(zip->names));
 	free(zip->uncompressed_buffer);
 	archive_string_free(&(zip->extra));
 	free(zip);
@@ -1216,7 +2108,7 @@ process_extra(const char *p, size_t extra_length, struct zip_entry* zip_entry)
 {
 	unsigned offset = 0;
 
-	while (offset < extra_length - 4)
+	while (offset + 4 <= extra_length)
 	{
 		unsigned short headerid = archive_le16dec(p + offset);
 		unsigned short datasize = archive_le16dec(p + offset + 2);
@@ -1229,14 +2121,33 @@ process_extra(const char *p, size_t extra_length, struct zip_entry* zip_entry)
 #endif
 		switch (headerid) {
 		case 0x0001:
-			/* Zip64 extended information extra field. */
-			if (datasize >= 8)
+		{
+			/* Zip64 extended information extra field.  It
+			   holds only the values whose usual field is
+			   0xffffffff, in this order. */
+			unsigned o = offset, end = offset + datasize;
+
+			zip_entry->zip64 = 1;
+			if (zip_entry->uncompressed_size == 0xffffffff
+			    && o + 8 <= end) {
 				zip_entry->uncompressed_size =
-				    archive_le64dec(p + offset);
-			if (datasize >= 16)
+				    archive_le64dec(p + o);
+				o += 8;
+			}
+			if (zip_entry->compressed_size == 0xffffffff
+			    && o + 8 <= end) {
 				zip_entry->compressed_size =
-				    archive_le64dec(p + offset + 8);
+				    archive_le64dec(p + o);
+				o += 8;
+			}
+			if (zip_entry->local_header_offset == 0xffffffff
+			    && o + 8 <= end) {
+				zip_entry->local_header_offset =
+				    archive_le64dec(p + o);
+				o += 8;
+			}
 			break;
+		}
 		case 0x5455:
 		{
 			/* Extended time field "UT". */
@@ -57,6 +57,7 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write.c 201099 2009-12-28 03:03:
 
 #include "archive.h"
 #include "archive_entry.h"
+#include "archive_index_private.h"
 #include "archive_private.h"
 #include "archive_write_private.h"
 
@@ -203,6 +204,49 @@ archive_write_set_skip_file(struct archive *_a, int64_t d, int64_t i)
 	return (ARCHIVE_OK);
 }
 
+/*
+ * Only tar and cpio write each header in place, just ahead of its
+ * data.  The other writers buffer or reorder what they write, so the
+ * number of bytes written so far says nothing about where a header
+ * ends up; archive_write_open() refuses to index those.
+ */
+static int
+index_supported(struct archive_write *a)
+{
+	switch (a->archive.archive_format & ARCHIVE_FORMAT_BASE_MASK) {
+	case ARCHIVE_FORMAT_TAR:
+	case ARCHIVE_FORMAT_CPIO:
+		return (1);
+	default:
+		return (0);
+	}
+}
+
+/*
+ * Record where each entry starts, so that readers can later find
+ * entries without scanning the archive; see
+ * archive_read_set_index_file().
+ */
+
+int
+archive_write_set_index_file(struct archive *_a, const char *filename)
+{
+	struct archive_write *a = (struct archive_write *)_a;
+
+	archive_check_magic(&a->archive, ARCHIVE_WRITE_MAGIC,
+	    ARCHIVE_STATE_NEW, "archive_write_set_index_file");
+	free(a->index_filename);
+	if (a->index == NULL)
+		a->index = __archive_index_new();
+	a->index_filename = strdup(filename);
+	if (a->index == NULL || a->index_filename == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate index");
+		return (ARCHIVE_FATAL);
+	}
+	return (ARCHIVE_OK);
+}
+
 /*
  * Allocate and return the next filter structure.
  */
@@ -457,6 +501,15 @@ archive_write_open(struct archive *_a, void *client_data,
 	    ARCHIVE_STATE_NEW, "archive_write_open");
 	archive_clear_error(&a->archive);
 
+	if (a->index_filename != NULL && !index_supported(a)) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Indexes can only be written for tar and cpio archives");
+		/* Let the client free whatever it set up. */
+		if (closer != NULL)
+			(closer)(&a->archive, client_data);
+		return (ARCHIVE_FATAL);
+	}
+
 	a->client_writer = writer;
 	a->client_opener = opener;
 	a->client_closer = closer;
@@ -514,6 +567,14 @@ _archive_write_close(struct archive *_a)
 	if (r1 < r)
 		r = r1;
 
+	if (a->index_filename != NULL && r > ARCHIVE_FATAL
+	    && a->archive.state != ARCHIVE_STATE_FATAL) {
+		r1 = __archive_index_save(&a->archive, a->index,
+		    a->index_filename);
+		if (r1 < r)
+			r = r1;
+	}
+
 	if (a->archive.state != ARCHIVE_STATE_FATAL)
 		a->archive.state = ARCHIVE_STATE_CLOSED;
 	return (r);
@@ -581,6 +642,8 @@ _archive_write_free(struct archive *_a)
 	}
 
 	__archive_write_filters_free(_a);
+	__archive_index_free(a->index);
+	free(a->index_filename);
 
 	/* Release various dynamic buffers. */
 	free((void *)(uintptr_t)(const void *)a->nulls);
@@ -598,6 +661,7 @@ static int
 _archive_write_header(struct archive *_a, struct archive_entry *entry)
 {
 	struct archive_write *a = (struct archive_write *)_a;
+	int64_t offset;
 	int ret, r2;
 
 	archive_check_magic(&a->archive, ARCHIVE_WRITE_MAGIC,
@@ -631,6 +695,7 @@ _archive_write_header(struct archive *_a, struct archive_entry *entry)
 	}
 
 	/* Format and write header. */
+	offset = a->filter_first->bytes_written;
 	r2 = ((a->format_write_header)(a, entry));
 	if (r2 == ARCHIVE_FATAL) {
 		a->archive.state = ARCHIVE_STATE_FATAL;
@@ -638,6 +703,15 @@ _archive_write_header(struct archive *_a, struct archive_entry *entry)
 	}
 	if (r2 < ret)
 		ret = r2;
+	if (a->index_filename != NULL && r2 >= ARCHIVE_WARN
+	    && archive_entry_pathname(entry) != NULL
+	    && __archive_index_add(a->index, archive_entry_pathname(entry),
+		offset, a->filter_first->bytes_written) != ARCHIVE_OK) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate index entry");
+		a->archive.state = ARCHIVE_STATE_FATAL;
+		return (ARCHIVE_FATAL);
+	}
 
 	a->archive.state = ARCHIVE_STATE_DATA;
 	return (ret);
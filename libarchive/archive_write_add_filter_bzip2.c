@@ -42,6 +42,7 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_compression_bzip2.c 20
 #endif
 
 #include "archive.h"
+#include "archive_parallel_private.h"
 #include "archive_private.h"
 #include "archive_write_private.h"
 
@@ -65,12 +66,43 @@ archive_write_add_filter_bzip2(struct archive *a)
 #else
 /* Don't compile this if we don't have bzlib. */
 
+/*
+ * With threads=N, the input is cut into chunks that are compressed as
+ * separate bzip2 streams on worker threads, pbzip2-style.  A chunk is
+ * small enough that it always fits in one bzip2 block, even after the
+ * initial run-length encoding grows it by 5/4, so every worker's
+ * output is a header, one block and an end-of-stream marker.  The
+ * blocks are bit-aligned; we splice them together behind a single
+ * header and finish with our own end-of-stream marker carrying the
+ * combined CRC, so the result is one ordinary .bz2 stream.
+ */
+#define	CHUNK_SIZE(level)	((size_t)(level) * 80000 - 100)
+
+struct bzip2_job {
+	int		 compression_level;
+	char		*in;
+	size_t		 in_len;
+	char		*out;
+	size_t		 out_len;
+	/* The block is the bits from 32 (after "BZh9") to end_bit. */
+	size_t		 end_bit;
+	uint32_t	 crc;
+	int		 ret;
+};
+
 struct private_data {
 	int		 compression_level;
 	bz_stream	 stream;
 	int64_t		 total_in;
 	char		*compressed;
 	size_t		 compressed_buffer_size;
+
+	int		 threads;
+	struct archive_parallel *parallel;
+	struct bzip2_job *job;		/* Being filled. */
+	uint32_t	 combined_crc;
+	unsigned	 bitbuf;
+	int		 bitcount;
 };
 
 /*
@@ -89,6 +121,14 @@ static int archive_compressor_bzip2_write(struct archive_write_filter *,
 		    const void *, size_t);
 static int drive_compressor(struct archive_write_filter *,
 		    struct private_data *, int finishing);
+static int parallel_write(struct archive_write_filter *,
+		    struct private_data *, const void *, size_t);
+static int parallel_finish(struct archive_write_filter *,
+		    struct private_data *);
+static int put_output(struct archive_write_filter *,
+		    struct private_data *, const char *, size_t);
+static struct bzip2_job *new_job(struct private_data *);
+static void bzip2_job_free(struct bzip2_job *);
 
 /*
  * Add a bzip2 compression filter to this write handle.
@@ -159,6 +199,28 @@ archive_compressor_bzip2_open(struct archive_write_filter *f)
 	data->stream.avail_out = data->compressed_buffer_size;
 	f->write = archive_compressor_bzip2_write;
 
+	if (data->threads > 0 && data->parallel == NULL) {
+		data->parallel = __archive_parallel_new(data->threads);
+		if (data->parallel != NULL) {
+			data->job = new_job(data);
+			if (data->job == NULL) {
+				archive_set_error(f->archive, ENOMEM,
+				    "Can't allocate data for compression");
+				return (ARCHIVE_FATAL);
+			}
+		}
+	}
+	if (data->parallel != NULL) {
+		char header[4];
+
+		memcpy(header, "BZh", 3);
+		header[3] = '0' + data->compression_level;
+		data->combined_crc = 0;
+		data->bitbuf = 0;
+		data->bitcount = 0;
+		return (put_output(f, data, header, 4));
+	}
+
 	/* Initialize compression library */
 	ret = BZ2_bzCompressInit(&(data->stream),
 	    data->compression_level, 0, 30);
@@ -215,6 +277,21 @@ archive_compressor_bzip2_options(struct archive_write_filter *f,
 			data->compression_level = 1;
 		return (ARCHIVE_OK);
 	}
+	if (strcmp(key, "threads") == 0) {
+		int n = 0;
+
+		if (value == NULL || *value == '\0')
+			return (ARCHIVE_WARN);
+		for (; *value != '\0'; value++) {
+			if (*value < '0' || *value > '9')
+				return (ARCHIVE_WARN);
+			n = n * 10 + (*value - '0');
+			if (n > 1024)
+				return (ARCHIVE_WARN);
+		}
+		data->threads = n;
+		return (ARCHIVE_OK);
+	}
 
 	return (ARCHIVE_WARN);
 }
@@ -233,6 +310,9 @@ archive_compressor_bzip2_write(struct archive_write_filter *f,
 	/* Update statistics */
 	data->total_in += length;
 
+	if (data->parallel != NULL)
+		return (parallel_write(f, data, buff, length));
+
 	/* Compress input data to output buffer */
 	SET_NEXT_IN(data, buff);
 	data->stream.avail_in = length;
@@ -252,7 +332,10 @@ archive_compressor_bzip2_close(struct archive_write_filter *f)
 	int ret, r1;
 
 	/* Finish compression cycle. */
-	ret = drive_compressor(f, data, 1);
+	if (data->parallel != NULL)
+		ret = parallel_finish(f, data);
+	else
+		ret = drive_compressor(f, data, 1);
 	if (ret == ARCHIVE_OK) {
 		/* Write the last block */
 		ret = __archive_write_filter(f->next_filter,
@@ -260,13 +343,15 @@ archive_compressor_bzip2_close(struct archive_write_filter *f)
 		    data->compressed_buffer_size - data->stream.avail_out);
 	}
 
-	switch (BZ2_bzCompressEnd(&(data->stream))) {
-	case BZ_OK:
-		break;
-	default:
-		archive_set_error(f->archive, ARCHIVE_ERRNO_PROGRAMMER,
-		    "Failed to clean up compressor");
-		ret = ARCHIVE_FATAL;
+	if (data->parallel == NULL) {
+		switch (BZ2_bzCompressEnd(&(data->stream))) {
+		case BZ_OK:
+			break;
+		default:
+			archive_set_error(f->archive, ARCHIVE_ERRNO_PROGRAMMER,
+			    "Failed to clean up compressor");
+			ret = ARCHIVE_FATAL;
+		}
 	}
 
 	r1 = __archive_write_close_filter(f->next_filter);
@@ -277,6 +362,14 @@ static int
 archive_compressor_bzip2_free(struct archive_write_filter *f)
 {
 	struct private_data *data = (struct private_data *)f->data;
+
+	if (data->parallel != NULL) {
+		while (__archive_parallel_pending(data->parallel) > 0)
+			bzip2_job_free(
+			    __archive_parallel_next(data->parallel));
+		__archive_parallel_free(data->parallel);
+	}
+	bzip2_job_free(data->job);
 	free(data->compressed);
 	free(data);
 	f->data = NULL;
@@ -340,4 +433,290 @@ drive_compressor(struct archive_write_filter *f,
 	}
 }
 
+static struct bzip2_job *
+new_job(struct private_data *data)
+{
+	struct bzip2_job *job;
+
+	job = calloc(1, sizeof(*job));
+	if (job == NULL)
+		return (NULL);
+	job->in = malloc(CHUNK_SIZE(data->compression_level));
+	if (job->in == NULL) {
+		free(job);
+		return (NULL);
+	}
+	job->compression_level = data->compression_level;
+	return (job);
+}
+
+static void
+bzip2_job_free(struct bzip2_job *job)
+{
+	if (job == NULL)
+		return;
+	free(job->in);
+	free(job->out);
+	free(job);
+}
+
+/* Read 'n' <= 32 bits, most significant first, starting at bit 'bit'. */
+static uint32_t
+get_bits(const char *p, size_t bit, int n)
+{
+	uint32_t v = 0;
+
+	for (; n > 0; n--, bit++)
+		v = (v << 1) | ((((const unsigned char *)p)[bit >> 3]
+		    >> (7 - (bit & 7))) & 1);
+	return (v);
+}
+
+/*
+ * Worker: compress one chunk as a complete bzip2 stream and find
+ * where its block ends.
+ */
+static void
+bzip2_job_run(void *arg)
+{
+	struct bzip2_job *job = (struct bzip2_job *)arg;
+	bz_stream stream;
+	size_t size, bits;
+	int pad, ret;
+
+	job->ret = ARCHIVE_FATAL;
+	memset(&stream, 0, sizeof(stream));
+	if (BZ2_bzCompressInit(&stream, job->compression_level, 0, 30)
+	    != BZ_OK)
+		return;
+	/* bzlib documents 1% + 600 bytes as the worst case. */
+	size = job->in_len + job->in_len / 100 + 600;
+	job->out = malloc(size);
+	if (job->out == NULL)
+		goto done;
+	stream.next_in = job->in;
+	stream.avail_in = (unsigned int)job->in_len;
+	stream.next_out = job->out;
+	stream.avail_out = (unsigned int)size;
+	ret = BZ2_bzCompress(&stream, BZ_FINISH);
+	if (ret != BZ_STREAM_END)
+		goto done;
+	job->out_len = size - stream.avail_out;
+
+	/*
+	 * The stream ends with the 48-bit end-of-stream magic, the
+	 * stream CRC and up to 7 bits of padding.  With a single block
+	 * the stream CRC is the block CRC, which follows the block
+	 * magic right after the header.
+	 */
+	bits = job->out_len * 8;
+	if (bits < 32 + 80 + 80)
+		goto done;
+	job->crc = get_bits(job->out, 32 + 48, 32);
+	for (pad = 0; pad < 8; pad++) {
+		job->end_bit = bits - pad - 80;
+		if (get_bits(job->out, job->end_bit, 24) == 0x177245
+		    && get_bits(job->out, job->end_bit + 24, 24) == 0x385090
+		    && get_bits(job->out, job->end_bit + 48, 32) == job->crc) {
+			job->ret = ARCHIVE_OK;
+			break;
+		}
+	}
+done:
+	BZ2_bzCompressEnd(&stream);
+}
+
+/*
+ * Append compressed data to the output buffer, writing out full
+ * blocks as necessary.
+ */
+static int
+put_output(struct archive_write_filter *f, struct private_data *data,
+    const char *p, size_t len)
+{
+	size_t n;
+	int ret;
+
+	while (len > 0) {
+		if (data->stream.avail_out == 0) {
+			ret = __archive_write_filter(f->next_filter,
+			    data->compressed,
+			    data->compressed_buffer_size);
+			if (ret != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+			data->stream.next_out = data->compressed;
+			data->stream.avail_out = data->compressed_buffer_size;
+		}
+		n = len < data->stream.avail_out ? len : data->stream.avail_out;
+		memcpy(data->stream.next_out, p, n);
+		data->stream.next_out += n;
+		data->stream.avail_out -= n;
+		p += n;
+		len -= n;
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Append 'nbits' bits of 'p', starting at bit 'bit', to the output.
+ * Whatever doesn't make up a whole byte waits in data->bitbuf.
+ */
+static int
+put_bits(struct archive_write_filter *f, struct private_data *data,
+    const char *p, size_t bit, size_t nbits)
+{
+	const unsigned char *u = (const unsigned char *)p;
+	char buff[4096];
+	size_t n = 0;
+	unsigned v;
+	int k, ret;
+
+	while (nbits > 0) {
+		k = nbits < 8 ? (int)nbits : 8;
+		v = u[bit >> 3] << 8;
+		if ((bit & 7) + k > 8)
+			v |= u[(bit >> 3) + 1];
+		v = (v >> (16 - (bit & 7) - k)) & ((1U << k) - 1);
+		data->bitbuf = (data->bitbuf << k) | v;
+		data->bitcount += k;
+		if (data->bitcount >= 8) {
+			data->bitcount -= 8;
+			buff[n++] = (char)(data->bitbuf >> data->bitcount);
+			data->bitbuf &= (1U << data->bitcount) - 1;
+			if (n == sizeof(buff)) {
+				if ((ret = put_output(f, data, buff, n))
+				    != ARCHIVE_OK)
+					return (ret);
+				n = 0;
+			}
+		}
+		bit += k;
+		nbits -= k;
+	}
+	return (put_output(f, data, buff, n));
+}
+
+/*
+ * Wait for the oldest chunk and add its block to the output.
+ */
+static int
+collect_job(struct archive_write_filter *f, struct private_data *data)
+{
+	struct bzip2_job *job;
+	int ret = ARCHIVE_OK;
+
+	job = __archive_parallel_next(data->parallel);
+	if (job->ret != ARCHIVE_OK) {
+		bzip2_job_free(job);
+		archive_set_error(f->archive, ARCHIVE_ERRNO_PROGRAMMER,
+		    "Bzip2 compression failed");
+		return (ARCHIVE_FATAL);
+	}
+	if (job->in_len > 0) {
+		data->combined_crc = ((data->combined_crc << 1)
+		    | (data->combined_crc >> 31)) ^ job->crc;
+		ret = put_bits(f, data, job->out, 32, job->end_bit - 32);
+	}
+	bzip2_job_free(job);
+	return (ret);
+}
+
+/*
+ * Hand the chunk being filled to a worker.
+ */
+static int
+submit_job(struct archive_write_filter *f, struct private_data *data,
+    int last)
+{
+	struct bzip2_job *job = data->job, *next = NULL;
+	int ret;
+
+	/* Keep every worker busy, with one chunk in reserve. */
+	while (__archive_parallel_pending(data->parallel) >= data->threads * 2)
+		if ((ret = collect_job(f, data)) != ARCHIVE_OK)
+			return (ret);
+	if (!last) {
+		next = new_job(data);
+		if (next == NULL)
+			goto nomem;
+	}
+	if (job->in_len == 0) {
+		/* Nothing left to compress. */
+		bzip2_job_free(job);
+	} else if (__archive_parallel_submit(data->parallel, bzip2_job_run,
+	    job) != ARCHIVE_OK) {
+		bzip2_job_free(next);
+		goto nomem;
+	}
+	data->job = next;
+	return (ARCHIVE_OK);
+nomem:
+	archive_set_error(f->archive, ENOMEM,
+	    "Can't allocate data for compression");
+	return (ARCHIVE_FATAL);
+}
+
+static int
+parallel_write(struct archive_write_filter *f, struct private_data *data,
+    const void *buff, size_t length)
+{
+	const char *p = (const char *)buff;
+	size_t chunk = CHUNK_SIZE(data->compression_level);
+	struct bzip2_job *job;
+	size_t n;
+	int ret;
+
+	while (length > 0) {
+		job = data->job;
+		n = chunk - job->in_len;
+		if (n > length)
+			n = length;
+		memcpy(job->in + job->in_len, p, n);
+		job->in_len += n;
+		p += n;
+		length -= n;
+		if (job->in_len == chunk
+		    && (ret = submit_job(f, data, 0)) != ARCHIVE_OK)
+			return (ret);
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Compress the last chunk, wait for all the blocks and end the
+ * stream.
+ */
+static int
+parallel_finish(struct archive_write_filter *f, struct private_data *data)
+{
+	char trailer[10];
+	int ret;
+
+	if (data->job == NULL) {
+		archive_set_error(f->archive, ARCHIVE_ERRNO_PROGRAMMER,
+		    "Bzip2 compression failed");
+		return (ARCHIVE_FATAL);
+	}
+	ret = submit_job(f, data, 1);
+	while (ret == ARCHIVE_OK
+	    && __archive_parallel_pending(data->parallel) > 0)
+		ret = collect_job(f, data);
+	if (ret != ARCHIVE_OK)
+		return (ret);
+
+	/* End-of-stream magic, the combined CRC, and padding. */
+	memcpy(trailer, "\x17\x72\x45\x38\x50\x90", 6);
+	trailer[6] = (char)(data->combined_crc >> 24);
+	trailer[7] = (char)(data->combined_crc >> 16);
+	trailer[8] = (char)(data->combined_crc >> 8);
+	trailer[9] = (char)data->combined_crc;
+	ret = put_bits(f, data, trailer, 0, 80);
+	if (ret == ARCHIVE_OK && data->bitcount > 0) {
+		trailer[0] = (char)(data->bitbuf << (8 - data->bitcount));
+		data->bitcount = 0;
+		ret = put_output(f, data, trailer, 1);
+	}
+	return (ret);
+}
+
 #endif /* HAVE_BZLIB_H && BZ_CONFIG_ERROR */
@@ -42,6 +42,8 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_compression_gzip.c 201
 #endif
 
 #include "archive.h"
+#include "archive_crc32.h"
+#include "archive_parallel_private.h"
 #include "archive_private.h"
 #include "archive_write_private.h"
 
@@ -65,6 +67,31 @@ archive_write_add_filter_gzip(struct archive *a)
 #else
 /* Don't compile this if we don't have zlib. */
 
+/*
+ * With threads=N, the input is cut into chunks that are compressed
+ * independently on worker threads, pigz-style.  Each chunk is primed
+ * with the 32k of input before it, so the compression ratio barely
+ * suffers, and all but the last end with a sync flush, which leaves
+ * the compressed data on a byte boundary.  Concatenating the output
+ * in order gives a single deflate stream; the CRCs of the chunks are
+ * combined into the CRC for the trailer.
+ */
+#define	CHUNK_SIZE	(128 * 1024)
+#define	WINDOW_SIZE	32768
+
+struct deflate_job {
+	int		 compression_level;
+	int		 last;
+	/* The window, then the data to compress. */
+	unsigned char	*in;
+	size_t		 window_len;
+	size_t		 in_len;
+	unsigned char	*out;
+	size_t		 out_len;
+	unsigned long	 crc;
+	int		 ret;
+};
+
 struct private_data {
 	int		 compression_level;
 	z_stream	 stream;
@@ -72,6 +99,10 @@ struct private_data {
 	unsigned char	*compressed;
 	size_t		 compressed_buffer_size;
 	unsigned long	 crc;
+
+	int		 threads;
+	struct archive_parallel *parallel;
+	struct deflate_job *job;	/* Being filled. */
 };
 
 /*
@@ -90,6 +121,13 @@ static int archive_compressor_gzip_close(struct archive_write_filter *);
 static int archive_compressor_gzip_free(struct archive_write_filter *);
 static int drive_compressor(struct archive_write_filter *,
 		    struct private_data *, int finishing);
+static int parallel_write(struct archive_write_filter *,
+		    struct private_data *, const void *, size_t);
+static int parallel_finish(struct archive_write_filter *,
+		    struct private_data *);
+static struct deflate_job *new_job(struct private_data *,
+		    struct deflate_job *);
+static void deflate_job_free(struct deflate_job *);
 
 
 /*
@@ -155,7 +193,7 @@ archive_compressor_gzip_open(struct archive_write_filter *f)
 		}
 	}
 
-	data->crc = crc32(0L, NULL, 0);
+	data->crc = __archive_crc32(0L, NULL, 0);
 	data->stream.next_out = data->compressed;
 	data->stream.avail_out = data->compressed_buffer_size;
 
@@ -176,6 +214,20 @@ archive_compressor_gzip_open(struct archive_write_filter *f)
 
 	f->write = archive_compressor_gzip_write;
 
+	if (data->threads > 0 && data->parallel == NULL) {
+		data->parallel = __archive_parallel_new(data->threads);
+		if (data->parallel != NULL) {
+			data->job = new_job(data, NULL);
+			if (data->job == NULL) {
+				archive_set_error(f->archive, ENOMEM,
+				    "Can't allocate data for compression");
+				return (ARCHIVE_FATAL);
+			}
+		}
+	}
+	if (data->parallel != NULL)
+		return (ARCHIVE_OK);
+
 	/* Initialize compression library. */
 	ret = deflateInit2(&(data->stream),
 	    data->compression_level,
@@ -230,6 +282,21 @@ archive_compressor_gzip_options(struct archive_write_filter *f, const char *key,
 		data->compression_level = value[0] - '0';
 		return (ARCHIVE_OK);
 	}
+	if (strcmp(key, "threads") == 0) {
+		int n = 0;
+
+		if (value == NULL || *value == '\0')
+			return (ARCHIVE_WARN);
+		for (; *value != '\0'; value++) {
+			if (*value < '0' || *value > '9')
+				return (ARCHIVE_WARN);
+			n = n * 10 + (*value - '0');
+			if (n > 1024)
+				return (ARCHIVE_WARN);
+		}
+		data->threads = n;
+		return (ARCHIVE_OK);
+	}
 	return (ARCHIVE_WARN);
 }
 
@@ -243,8 +310,13 @@ archive_compressor_gzip_write(struct archive_write_filter *f, const void *buff,
 	struct private_data *data = (struct private_data *)f->data;
 	int ret;
 
+	if (data->parallel != NULL) {
+		data->total_in += length;
+		return (parallel_write(f, data, buff, length));
+	}
+
 	/* Update statistics */
-	data->crc = crc32(data->crc, (const Bytef *)buff, length);
+	data->crc = __archive_crc32(data->crc, buff, length);
 	data->total_in += length;
 
 	/* Compress input data to output buffer */
@@ -267,7 +339,10 @@ archive_compressor_gzip_close(struct archive_write_filter *f)
 	int ret, r1;
 
 	/* Finish compression cycle */
-	ret = drive_compressor(f, data, 1);
+	if (data->parallel != NULL)
+		ret = parallel_finish(f, data);
+	else
+		ret = drive_compressor(f, data, 1);
 	if (ret == ARCHIVE_OK) {
 		/* Write the last compressed data. */
 		ret = __archive_write_filter(f->next_filter,
@@ -287,13 +362,15 @@ archive_compressor_gzip_close(struct archive_write_filter *f)
 		ret = __archive_write_filter(f->next_filter, trailer, 8);
 	}
 
-	switch (deflateEnd(&(data->stream))) {
-	case Z_OK:
-		break;
-	default:
-		archive_set_error(f->archive, ARCHIVE_ERRNO_MISC,
-		    "Failed to clean up compressor");
-		ret = ARCHIVE_FATAL;
+	if (data->parallel == NULL) {
+		switch (deflateEnd(&(data->stream))) {
+		case Z_OK:
+			break;
+		default:
+			archive_set_error(f->archive, ARCHIVE_ERRNO_MISC,
+			    "Failed to clean up compressor");
+			ret = ARCHIVE_FATAL;
+		}
 	}
 	r1 = __archive_write_close_filter(f->next_filter);
 	return (r1 < ret ? r1 : ret);
@@ -303,6 +380,14 @@ static int
 archive_compressor_gzip_free(struct archive_write_filter *f)
 {
 	struct private_data *data = (struct private_data *)f->data;
+
+	if (data->parallel != NULL) {
+		while (__archive_parallel_pending(data->parallel) > 0)
+			deflate_job_free(
+			    __archive_parallel_next(data->parallel));
+		__archive_parallel_free(data->parallel);
+	}
+	deflate_job_free(data->job);
 	free(data->compressed);
 	free(data);
 	f->data = NULL;
@@ -363,4 +448,213 @@ drive_compressor(struct archive_write_filter *f,
 	}
 }
 
+static struct deflate_job *
+new_job(struct private_data *data, struct deflate_job *prev)
+{
+	struct deflate_job *job;
+	size_t n;
+
+	job = calloc(1, sizeof(*job));
+	if (job == NULL)
+		return (NULL);
+	job->in = malloc(WINDOW_SIZE + CHUNK_SIZE);
+	if (job->in == NULL) {
+		free(job);
+		return (NULL);
+	}
+	job->compression_level = data->compression_level;
+	if (prev != NULL) {
+		/* The last 32k of input are the window for the next. */
+		n = prev->window_len + prev->in_len;
+		if (n > WINDOW_SIZE)
+			n = WINDOW_SIZE;
+		memcpy(job->in,
+		    prev->in + prev->window_len + prev->in_len - n, n);
+		job->window_len = n;
+	}
+	return (job);
+}
+
+static void
+deflate_job_free(struct deflate_job *job)
+{
+	if (job == NULL)
+		return;
+	free(job->in);
+	free(job->out);
+	free(job);
+}
+
+/*
+ * Worker: compress one chunk.
+ */
+static void
+deflate_job_run(void *arg)
+{
+	struct deflate_job *job = (struct deflate_job *)arg;
+	z_stream stream;
+	size_t size;
+	int ret;
+
+	job->ret = ARCHIVE_FATAL;
+	job->crc = __archive_crc32(0, job->in + job->window_len, job->in_len);
+	memset(&stream, 0, sizeof(stream));
+	if (deflateInit2(&stream, job->compression_level, Z_DEFLATED,
+	    -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		return;
+	if (job->window_len > 0 && deflateSetDictionary(&stream, job->in,
+	    (uInt)job->window_len) != Z_OK)
+		goto done;
+	/* Room for the data plus the sync marker or the final block. */
+	size = deflateBound(&stream, (uLong)job->in_len) + 16;
+	job->out = malloc(size);
+	if (job->out == NULL)
+		goto done;
+	stream.next_in = job->in + job->window_len;
+	stream.avail_in = (uInt)job->in_len;
+	stream.next_out = job->out;
+	stream.avail_out = (uInt)size;
+	ret = deflate(&stream, job->last ? Z_FINISH : Z_SYNC_FLUSH);
+	if (job->last ? ret != Z_STREAM_END
+	    : ret != Z_OK || stream.avail_out == 0)
+		goto done;
+	job->out_len = size - stream.avail_out;
+	job->ret = ARCHIVE_OK;
+done:
+	deflateEnd(&stream);
+}
+
+/*
+ * Append compressed data to the output buffer, writing out full
+ * blocks as necessary.
+ */
+static int
+put_output(struct archive_write_filter *f, struct private_data *data,
+    const unsigned char *p, size_t len)
+{
+	size_t n;
+	int ret;
+
+	while (len > 0) {
+		if (data->stream.avail_out == 0) {
+			ret = __archive_write_filter(f->next_filter,
+			    data->compressed,
+			    data->compressed_buffer_size);
+			if (ret != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+			data->stream.next_out = data->compressed;
+			data->stream.avail_out = data->compressed_buffer_size;
+		}
+		n = len < data->stream.avail_out ? len : data->stream.avail_out;
+		memcpy(data->stream.next_out, p, n);
+		data->stream.next_out += n;
+		data->stream.avail_out -= n;
+		p += n;
+		len -= n;
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Wait for the oldest chunk and add it to the output.
+ */
+static int
+collect_job(struct archive_write_filter *f, struct private_data *data)
+{
+	struct deflate_job *job;
+	int ret;
+
+	job = __archive_parallel_next(data->parallel);
+	if (job->ret != ARCHIVE_OK) {
+		deflate_job_free(job);
+		archive_set_error(f->archive, ARCHIVE_ERRNO_MISC,
+		    "GZip compression failed");
+		return (ARCHIVE_FATAL);
+	}
+	data->crc = __archive_crc32_combine(data->crc, job->crc,
+	    (int64_t)job->in_len);
+	ret = put_output(f, data, job->out, job->out_len);
+	deflate_job_free(job);
+	return (ret);
+}
+
+/*
+ * Hand the chunk being filled to a worker.
+ */
+static int
+submit_job(struct archive_write_filter *f, struct private_data *data,
+    int last)
+{
+	struct deflate_job *job = data->job, *next = NULL;
+	int ret;
+
+	/* Keep every worker busy, with one chunk in reserve. */
+	while (__archive_parallel_pending(data->parallel) >= data->threads * 2)
+		if ((ret = collect_job(f, data)) != ARCHIVE_OK)
+			return (ret);
+	job->last = last;
+	if (!last) {
+		next = new_job(data, job);
+		if (next == NULL)
+			goto nomem;
+	}
+	if (__archive_parallel_submit(data->parallel, deflate_job_run, job)
+	    != ARCHIVE_OK) {
+		deflate_job_free(next);
+		goto nomem;
+	}
+	data->job = next;
+	return (ARCHIVE_OK);
+nomem:
+	archive_set_error(f->archive, ENOMEM,
+	    "Can't allocate data for compression");
+	return (ARCHIVE_FATAL);
+}
+
+static int
+parallel_write(struct archive_write_filter *f, struct private_data *data,
+    const void *buff, size_t length)
+{
+	const unsigned char *p = (const unsigned char *)buff;
+	struct deflate_job *job;
+	size_t n;
+	int ret;
+
+	while (length > 0) {
+		job = data->job;
+		n = CHUNK_SIZE - job->in_len;
+		if (n > length)
+			n = length;
+		memcpy(job->in + job->window_len + job->in_len, p, n);
+		job->in_len += n;
+		p += n;
+		length -= n;
+		if (job->in_len == CHUNK_SIZE
+		    && (ret = submit_job(f, data, 0)) != ARCHIVE_OK)
+			return (ret);
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Compress the last chunk, which ends the deflate stream, and wait
+ * for all the output.
+ */
+static int
+parallel_finish(struct archive_write_filter *f, struct private_data *data)
+{
+	int ret;
+
+	if (data->job == NULL) {
+		archive_set_error(f->archive, ARCHIVE_ERRNO_MISC,
+		    "GZip compression failed");
+		return (ARCHIVE_FATAL);
+	}
+	ret = submit_job(f, data, 1);
+	while (ret == ARCHIVE_OK
+	    && __archive_parallel_pending(data->parallel) > 0)
+		ret = collect_job(f, data);
+	return (ret);
+}
+
 #endif /* HAVE_ZLIB_H */
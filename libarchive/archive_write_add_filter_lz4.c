@@ -0,0 +1,470 @@
+/*-
+ * Copyright (c) 2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "archive.h"
+#include "archive_endian.h"
+#include "archive_private.h"
+#include "archive_write_private.h"
+#include "archive_xxhash_private.h"
+
+/*
+ * LZ4 compression into the LZ4 frame format, with our own block
+ * compressor: a greedy matcher with one hash probe per position at
+ * level 1, and hash chains searched more deeply at higher levels.
+ */
+
+#define	LZ4_MAGIC	0x184D2204U
+#define	LZ4_WINDOW	(64 * 1024)
+#define	HASH_BITS	16
+#define	MIN_MATCH	4
+/* The last match must start this far from the end of a block, */
+#define	MF_LIMIT	12
+/* and the last literals must be at least this long. */
+#define	LAST_LITERALS	5
+
+struct private_data {
+	int		 compression_level;
+	int		 block_size_id;		/* 4 to 7: 64 KiB to 4 MiB. */
+	char		 block_dependence;
+	char		 block_checksum;
+	char		 stream_checksum;
+	size_t		 block_max;
+
+	/*
+	 * Input goes to in + history; for dependent blocks the history
+	 * before it is the last 64 KiB of the previous block.
+	 */
+	unsigned char	*in;
+	size_t		 history;
+	size_t		 in_len;
+	uint32_t	 in_position;	/* Stream position of in[0]. */
+	unsigned char	*out;
+	uint32_t	*hash;		/* Stream positions. */
+	uint16_t	*chain;		/* Distance to the previous one. */
+	struct archive_xxh32 xxh;
+};
+
+static int archive_compressor_lz4_open(struct archive_write_filter *);
+static int archive_compressor_lz4_options(struct archive_write_filter *,
+		    const char *, const char *);
+static int archive_compressor_lz4_write(struct archive_write_filter *,
+		    const void *, size_t);
+static int archive_compressor_lz4_close(struct archive_write_filter *);
+static int archive_compressor_lz4_free(struct archive_write_filter *);
+
+/*
+ * Add an lz4 compression filter to this write handle.
+ */
+int
+archive_write_add_filter_lz4(struct archive *_a)
+{
+	struct archive_write *a = (struct archive_write *)_a;
+	struct archive_write_filter *f;
+	struct private_data *data;
+
+	archive_check_magic(&a->archive, ARCHIVE_WRITE_MAGIC,
+	    ARCHIVE_STATE_NEW, "archive_write_add_filter_lz4");
+	data = calloc(1, sizeof(*data));
+	if (data == NULL) {
+		archive_set_error(&a->archive, ENOMEM, "Out of memory");
+		return (ARCHIVE_FATAL);
+	}
+	data->compression_level = 1;
+	data->block_size_id = 7;
+	data->stream_checksum = 1;
+
+	f = __archive_write_allocate_filter(_a);
+	f->data = data;
+	f->open = &archive_compressor_lz4_open;
+	f->options = &archive_compressor_lz4_options;
+	f->free = &archive_compressor_lz4_free;
+	f->code = ARCHIVE_FILTER_LZ4;
+	f->name = "lz4";
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Set write options.
+ */
+static int
+archive_compressor_lz4_options(struct archive_write_filter *f,
+    const char *key, const char *value)
+{
+	struct private_data *data = (struct private_data *)f->data;
+
+	if (strcmp(key, "compression-level") == 0) {
+		if (value == NULL || !(value[0] >= '1' && value[0] <= '9') ||
+		    value[1] != '\0')
+			return (ARCHIVE_WARN);
+		data->compression_level = value[0] - '0';
+		return (ARCHIVE_OK);
+	}
+	if (strcmp(key, "block-size") == 0) {
+		if (value == NULL || !(value[0] >= '4' && value[0] <= '7') ||
+		    value[1] != '\0')
+			return (ARCHIVE_WARN);
+		data->block_size_id = value[0] - '0';
+		return (ARCHIVE_OK);
+	}
+	if (strcmp(key, "block-dependence") == 0) {
+		data->block_dependence = value != NULL;
+		return (ARCHIVE_OK);
+	}
+	if (strcmp(key, "block-checksum") == 0) {
+		data->block_checksum = value != NULL;
+		return (ARCHIVE_OK);
+	}
+	if (strcmp(key, "stream-checksum") == 0) {
+		data->stream_checksum = value != NULL;
+		return (ARCHIVE_OK);
+	}
+
+	/* Note: The "warn" return is just to inform the options
+	 * supervisor that we didn't handle it.  It will generate
+	 * a suitable error if no one used this option. */
+	return (ARCHIVE_WARN);
+}
+
+/*
+ * Setup callback.
+ */
+static int
+archive_compressor_lz4_open(struct archive_write_filter *f)
+{
+	struct private_data *data = (struct private_data *)f->data;
+	unsigned char header[7];
+	int ret;
+
+	ret = __archive_write_open_filter(f->next_filter);
+	if (ret != ARCHIVE_OK)
+		return (ret);
+
+	data->block_max = (size_t)1 << (2 * data->block_size_id + 8);
+	data->in = malloc(LZ4_WINDOW + data->block_max);
+	/* Block size, block, block checksum. */
+	data->out = malloc(data->block_max + 8);
+	data->hash = calloc((size_t)1 << HASH_BITS, sizeof(data->hash[0]));
+	if (data->compression_level > 1)
+		data->chain = calloc(LZ4_WINDOW, sizeof(data->chain[0]));
+	if (data->in == NULL || data->out == NULL || data->hash == NULL
+	    || (data->compression_level > 1 && data->chain == NULL)) {
+		archive_set_error(f->archive, ENOMEM,
+		    "Can't allocate data for compression buffer");
+		return (ARCHIVE_FATAL);
+	}
+	data->history = 0;
+	data->in_len = 0;
+	/* Far enough from 0 that the empty table matches nothing. */
+	data->in_position = LZ4_WINDOW;
+	__archive_xxh32_init(&data->xxh, 0);
+
+	f->write = archive_compressor_lz4_write;
+	f->close = archive_compressor_lz4_close;
+
+	archive_le32enc(header, LZ4_MAGIC);
+	header[4] = 0x40		/* Version 01. */
+	    | (data->block_dependence ? 0 : 0x20)
+	    | (data->block_checksum ? 0x10 : 0)
+	    | (data->stream_checksum ? 0x04 : 0);
+	header[5] = data->block_size_id << 4;
+	header[6] = (__archive_xxh32(header + 4, 2, 0) >> 8) & 0xff;
+	return (__archive_write_filter(f->next_filter, header, sizeof(header)));
+}
+
+static inline uint32_t
+hash4(const unsigned char *p)
+{
+	return ((archive_le32dec(p) * 2654435761U) >> (32 - HASH_BITS));
+}
+
+/* Remember that the four bytes at in[i] were seen. */
+static inline uint32_t
+insert(struct private_data *data, size_t i)
+{
+	uint32_t pos = data->in_position + (uint32_t)i;
+	uint32_t h = hash4(data->in + i);
+	uint32_t prev = data->hash[h];
+
+	data->hash[h] = pos;
+	if (data->chain != NULL)
+		data->chain[pos & (LZ4_WINDOW - 1)] =
+		    pos - prev < 0xffff ? (uint16_t)(pos - prev) : 0xffff;
+	return (pos - prev);
+}
+
+static size_t
+match_length(const unsigned char *p, const unsigned char *m,
+    const unsigned char *limit)
+{
+	const unsigned char *start = p;
+
+	while (p + 8 <= limit && memcmp(p, m, 8) == 0) {
+		p += 8;
+		m += 8;
+	}
+	while (p < limit && *p == *m) {
+		p++;
+		m++;
+	}
+	return (p - start);
+}
+
+static unsigned char *
+put_length(unsigned char *op, size_t len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (unsigned char)len;
+	return (op);
+}
+
+/*
+ * Emit one sequence: literals in[anchor..ip), then a match unless
+ * 'len' is zero.  Returns NULL if it won't fit before 'oend'.
+ */
+static unsigned char *
+put_sequence(unsigned char *op, unsigned char *oend,
+    const unsigned char *literals, size_t lit, size_t dist, size_t len)
+{
+	unsigned char *token;
+
+	if ((size_t)(oend - op) < 1 + lit + lit / 255 + 1 + 2 + len / 255 + 1)
+		return (NULL);
+	token = op++;
+	if (lit >= 15) {
+		*token = 15 << 4;
+		op = put_length(op, lit - 15);
+	} else
+		*token = (unsigned char)(lit << 4);
+	memcpy(op, literals, lit);
+	op += lit;
+	if (len == 0)
+		return (op);
+	archive_le16enc(op, (uint16_t)dist);
+	op += 2;
+	len -= MIN_MATCH;
+	if (len >= 15) {
+		*token |= 15;
+		op = put_length(op, len - 15);
+	} else
+		*token |= (unsigned char)len;
+	return (op);
+}
+
+/*
+ * Compress in[history..history+in_len) into 'dst'.  Returns the
+ * compressed size, or 0 if it wouldn't be smaller than the input.
+ */
+static size_t
+compress_block(struct private_data *data, unsigned char *dst)
+{
+	const unsigned char *in = data->in;
+	unsigned char *op = dst, *oend = dst + data->in_len - 1;
+	size_t start = data->history, end = data->history + data->in_len;
+	size_t ip = start, anchor = start, m, len, best_len, best_dist;
+	uint32_t dist;
+	unsigned misses = 0;
+	int tries;
+
+	if (data->in_len < MF_LIMIT + 1)
+		goto last_literals;
+	while (ip + MF_LIMIT <= end) {
+		dist = insert(data, ip);
+		best_len = best_dist = 0;
+		tries = 1 << (data->compression_level - 1);
+		while (dist >= 1 && dist < LZ4_WINDOW && dist <= ip) {
+			m = ip - dist;
+			if (in[m + best_len] == in[ip + best_len]
+			    && memcmp(in + m, in + ip, MIN_MATCH) == 0) {
+				len = MIN_MATCH + match_length(
+				    in + ip + MIN_MATCH, in + m + MIN_MATCH,
+				    in + end - LAST_LITERALS);
+				if (len > best_len) {
+					best_len = len;
+					best_dist = dist;
+				}
+			}
+			if (data->chain == NULL || --tries == 0)
+				break;
+			dist += data->chain[(data->in_position + m)
+			    & (LZ4_WINDOW - 1)];
+		}
+		if (best_len < MIN_MATCH) {
+			/* Move faster through data that doesn't match. */
+			ip += (data->chain == NULL) ? 1 + (misses++ >> 6) : 1;
+			continue;
+		}
+		/* Extend the match backwards into the literals. */
+		m = ip - best_dist;
+		while (ip > anchor && m > 0 && in[ip - 1] == in[m - 1]) {
+			ip--;
+			m--;
+			best_len++;
+		}
+		op = put_sequence(op, oend, in + anchor, ip - anchor,
+		    best_dist, best_len);
+		if (op == NULL)
+			return (0);
+		if (data->chain != NULL) {
+			for (m = ip + 1; m < ip + best_len; m++)
+				insert(data, m);
+		} else
+			insert(data, ip + best_len - 2);
+		ip += best_len;
+		anchor = ip;
+		misses = 0;
+	}
+last_literals:
+	op = put_sequence(op, oend, in + anchor, end - anchor, 0, 0);
+	if (op == NULL)
+		return (0);
+	return (op - dst);
+}
+
+/*
+ * Compress and write out the buffered block.
+ */
+static int
+flush_block(struct archive_write_filter *f)
+{
+	struct private_data *data = (struct private_data *)f->data;
+	size_t len, keep;
+	int ret;
+
+	len = compress_block(data, data->out + 4);
+	if (len == 0) {
+		/* Store incompressible data as it is. */
+		len = data->in_len;
+		memcpy(data->out + 4, data->in + data->history, len);
+		archive_le32enc(data->out, 0x80000000U | (uint32_t)len);
+	} else
+		archive_le32enc(data->out, (uint32_t)len);
+	if (data->block_checksum) {
+		archive_le32enc(data->out + 4 + len,
+		    __archive_xxh32(data->out + 4, len, 0));
+		len += 4;
+	}
+	ret = __archive_write_filter(f->next_filter, data->out, len + 4);
+
+	if (data->block_dependence) {
+		keep = data->history + data->in_len;
+		if (keep > LZ4_WINDOW)
+			keep = LZ4_WINDOW;
+		memmove(data->in, data->in + data->history + data->in_len
+		    - keep, keep);
+		data->in_position += (uint32_t)(data->history + data->in_len
+		    - keep);
+		data->history = keep;
+	} else
+		/* Positions before the block no longer match. */
+		data->in_position += (uint32_t)data->in_len;
+	data->in_len = 0;
+	return (ret);
+}
+
+/*
+ * Write data to the compressed stream.
+ */
+static int
+archive_compressor_lz4_write(struct archive_write_filter *f,
+    const void *buff, size_t length)
+{
+	struct private_data *data = (struct private_data *)f->data;
+	const char *p = buff;
+	size_t n;
+	int ret;
+
+	if (data->stream_checksum)
+		__archive_xxh32_update(&data->xxh, buff, length);
+	while (length > 0) {
+		n = data->block_max - data->in_len;
+		if (n > length)
+			n = length;
+		memcpy(data->in + data->history + data->in_len, p, n);
+		data->in_len += n;
+		p += n;
+		length -= n;
+		if (data->in_len == data->block_max) {
+			ret = flush_block(f);
+			if (ret != ARCHIVE_OK)
+				return (ret);
+		}
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Finish the compression.
+ */
+static int
+archive_compressor_lz4_close(struct archive_write_filter *f)
+{
+	struct private_data *data = (struct private_data *)f->data;
+	unsigned char trailer[8];
+	int ret = ARCHIVE_OK, r1;
+
+	if (data->in_len > 0)
+		ret = flush_block(f);
+	if (ret == ARCHIVE_OK) {
+		/* EndMark, then the checksum of everything. */
+		archive_le32enc(trailer, 0);
+		archive_le32enc(trailer + 4,
+		    __archive_xxh32_digest(&data->xxh));
+		ret = __archive_write_filter(f->next_filter, trailer,
+		    data->stream_checksum ? 8 : 4);
+	}
+	r1 = __archive_write_close_filter(f->next_filter);
+	return (r1 < ret ? r1 : ret);
+}
+
+static int
+archive_compressor_lz4_free(struct archive_write_filter *f)
+{
+	struct private_data *data = (struct private_data *)f->data;
+
+	free(data->in);
+	free(data->out);
+	free(data->hash);
+	free(data->chain);
+	free(data);
+	f->data = NULL;
+	return (ARCHIVE_OK);
+}
@@ -35,6 +35,9 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_compression_program.c
 #ifdef HAVE_FCNTL_H
 #  include <fcntl.h>
 #endif
+#ifdef HAVE_PTHREAD_H
+#  include <pthread.h>
+#endif
 #ifdef HAVE_STDLIB_H
 #  include <stdlib.h>
 #endif
@@ -75,6 +78,15 @@ archive_write_add_filter_program(struct archive *_a, const char *cmd)
 
 #include "filter_fork.h"
 
+#ifdef HAVE_PTHREAD_H
+/* Output the reader thread has collected from the child. */
+struct child_block {
+	struct child_block	*next;
+	size_t			 len;
+	char			 buf[65536];
+};
+#endif
+
 struct private_data {
 	char		*cmd;
 	char		*description;
@@ -83,6 +95,22 @@ struct private_data {
 
 	char		*child_buf;
 	size_t		 child_buf_len, child_buf_avail;
+
+#ifdef HAVE_PTHREAD_H
+	/*
+	 * A thread that does nothing but drain the child's stdout lets
+	 * us block writing its stdin without any risk of deadlock, and
+	 * lets the child's output be collected while we're busy
+	 * elsewhere.  It only touches the file descriptor and the block
+	 * list; everything that involves the archive stays on the
+	 * caller's thread.
+	 */
+	pthread_t	 reader;
+	char		 reader_running;
+	pthread_mutex_t	 lock;
+	struct child_block *first, *last;
+	int		 reader_errno;
+#endif
 };
 
 static int archive_compressor_program_open(struct archive_write_filter *);
@@ -90,6 +118,11 @@ static int archive_compressor_program_write(struct archive_write_filter *,
 		    const void *, size_t);
 static int archive_compressor_program_close(struct archive_write_filter *);
 static int archive_compressor_program_free(struct archive_write_filter *);
+#ifdef HAVE_PTHREAD_H
+static void *child_reader(void *);
+static int child_forward(struct archive_write_filter *);
+static void child_reader_stop(struct private_data *);
+#endif
 
 /*
  * Add a filter to this write handle that passes all data through an
@@ -109,6 +142,13 @@ archive_write_add_filter_program(struct archive *_a, const char *cmd)
 		archive_set_error(&a->archive, ENOMEM, "Out of memory");
 		return (ARCHIVE_FATAL);
 	}
+#ifdef HAVE_PTHREAD_H
+	if (pthread_mutex_init(&data->lock, NULL) != 0) {
+		free(data);
+		archive_set_error(&a->archive, ENOMEM, "Out of memory");
+		return (ARCHIVE_FATAL);
+	}
+#endif
 	data->cmd = strdup(cmd);
 	data->description = (char *)malloc(strlen(prefix) + strlen(cmd) + 1);
 	strcpy(data->description, prefix);
@@ -153,6 +193,20 @@ archive_compressor_program_open(struct archive_write_filter *f)
 		return (ARCHIVE_FATAL);
 	}
 
+#ifdef HAVE_PTHREAD_H
+	/* With a reader thread, both descriptors can simply block. */
+	data->first = data->last = NULL;
+	data->reader_errno = 0;
+	fcntl(data->child_stdout, F_SETFL, 0);
+	if (pthread_create(&data->reader, NULL, child_reader, data) == 0) {
+		data->reader_running = 1;
+		fcntl(data->child_stdin, F_SETFL, 0);
+	} else {
+		/* Multiplex the two pipes as below. */
+		fcntl(data->child_stdout, F_SETFL, O_NONBLOCK);
+	}
+#endif
+
 	f->write = archive_compressor_program_write;
 	f->close = archive_compressor_program_close;
 	f->free = archive_compressor_program_free;
@@ -238,6 +292,31 @@ archive_compressor_program_write(struct archive_write_filter *f,
 	const char *buf;
 
 	buf = buff;
+#ifdef HAVE_PTHREAD_H
+	if (((struct private_data *)f->data)->reader_running) {
+		struct private_data *data = f->data;
+
+		while (length > 0) {
+			/* Hand over what the child has produced so far
+			 * every so often, so the queue stays short. */
+			do {
+				ret = write(data->child_stdin, buf,
+				    length < data->child_buf_len ?
+				    length : data->child_buf_len);
+			} while (ret == -1 && errno == EINTR);
+			if (ret <= 0) {
+				archive_set_error(f->archive, EIO,
+				    "Can't write to filter");
+				return (ARCHIVE_FATAL);
+			}
+			length -= ret;
+			buf += ret;
+			if (child_forward(f) != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+		}
+		return (ARCHIVE_OK);
+	}
+#endif
 	while (length > 0) {
 		ret = child_write(f, buf, length);
 		if (ret == -1 || ret == 0) {
@@ -267,6 +346,15 @@ archive_compressor_program_close(struct archive_write_filter *f)
 	data->child_stdin = -1;
 	fcntl(data->child_stdout, F_SETFL, 0);
 
+#ifdef HAVE_PTHREAD_H
+	if (data->reader_running) {
+		/* The child sees EOF, finishes, and closes its output. */
+		child_reader_stop(data);
+		if (child_forward(f) != ARCHIVE_OK)
+			ret = ARCHIVE_FATAL;
+		goto cleanup;
+	}
+#endif
 	for (;;) {
 		do {
 			bytes_read = read(data->child_stdout,
@@ -316,6 +404,25 @@ static int
 archive_compressor_program_free(struct archive_write_filter *f)
 {
 	struct private_data *data = (struct private_data *)f->data;
+#ifdef HAVE_PTHREAD_H
+	struct child_block *b;
+
+	/* If we never got to close, stop the child now. */
+	if (data->reader_running) {
+		close(data->child_stdin);
+		data->child_stdin = -1;
+		child_reader_stop(data);
+		close(data->child_stdout);
+		data->child_stdout = -1;
+		while (waitpid(data->child, NULL, 0) == -1 && errno == EINTR)
+			continue;
+	}
+	while ((b = data->first) != NULL) {
+		data->first = b->next;
+		free(b);
+	}
+	pthread_mutex_destroy(&data->lock);
+#endif
 	free(data->cmd);
 	free(data->description);
 	free(data->child_buf);
@@ -324,4 +431,89 @@ archive_compressor_program_free(struct archive_write_filter *f)
 	return (ARCHIVE_OK);
 }
 
+#ifdef HAVE_PTHREAD_H
+/*
+ * Reader thread: collect everything the child writes until it closes
+ * its output.
+ */
+static void *
+child_reader(void *arg)
+{
+	struct private_data *data = arg;
+	struct child_block *b = NULL;
+	ssize_t bytes;
+
+	for (;;) {
+		if (b == NULL && (b = malloc(sizeof(*b))) == NULL) {
+			bytes = -1;
+			errno = ENOMEM;
+		} else {
+			do {
+				bytes = read(data->child_stdout, b->buf,
+				    sizeof(b->buf));
+			} while (bytes == -1 && errno == EINTR);
+		}
+		if (bytes == 0 || (bytes == -1 && errno == EPIPE))
+			break;
+		if (bytes == -1) {
+			pthread_mutex_lock(&data->lock);
+			data->reader_errno = errno;
+			pthread_mutex_unlock(&data->lock);
+			break;
+		}
+		b->len = bytes;
+		b->next = NULL;
+		pthread_mutex_lock(&data->lock);
+		if (data->last != NULL)
+			data->last->next = b;
+		else
+			data->first = b;
+		data->last = b;
+		pthread_mutex_unlock(&data->lock);
+		b = NULL;
+	}
+	free(b);
+	return (NULL);
+}
+
+static void
+child_reader_stop(struct private_data *data)
+{
+	pthread_join(data->reader, NULL);
+	data->reader_running = 0;
+}
+
+/*
+ * Pass whatever the reader thread has collected on to the next filter.
+ */
+static int
+child_forward(struct archive_write_filter *f)
+{
+	struct private_data *data = f->data;
+	struct child_block *b, *list;
+	int err, ret = ARCHIVE_OK;
+
+	pthread_mutex_lock(&data->lock);
+	list = data->first;
+	data->first = data->last = NULL;
+	err = data->reader_errno;
+	pthread_mutex_unlock(&data->lock);
+
+	while ((b = list) != NULL) {
+		list = b->next;
+		if (ret == ARCHIVE_OK &&
+		    __archive_write_filter(f->next_filter, b->buf, b->len)
+		    != ARCHIVE_OK)
+			ret = ARCHIVE_FATAL;
+		free(b);
+	}
+	if (ret == ARCHIVE_OK && err != 0) {
+		archive_set_error(f->archive, err,
+		    "Read from filter failed unexpectedly.");
+		ret = ARCHIVE_FATAL;
+	}
+	return (ret);
+}
+#endif
+
 #endif /* !defined(HAVE_PIPE) || !defined(HAVE_VFORK) || !defined(HAVE_FCNTL) */
@@ -44,6 +44,7 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_compression_xz.c 20110
 
 #include "archive.h"
 #include "archive_endian.h"
+#include "archive_parallel_private.h"
 #include "archive_private.h"
 #include "archive_write_private.h"
 
@@ -98,6 +99,25 @@ archive_write_add_filter_lzip(struct archive *a)
 #else
 /* Don't compile this if we don't have liblzma. */
 
+/*
+ * With threads=N, xz output is written as a series of independent
+ * blocks, each compressed on a worker thread with
+ * lzma_block_buffer_encode().  We write the stream header, the blocks
+ * in order, and then the index of block sizes and the stream footer
+ * ourselves, so the result is an ordinary .xz file that readers can
+ * also decode a block at a time.
+ */
+struct xz_job {
+	lzma_filter	*filters;
+	uint8_t		*in;
+	size_t		 in_len;
+	uint8_t		*out;
+	size_t		 out_len;
+	lzma_vli	 unpadded_size;
+	lzma_vli	 uncompressed_size;
+	lzma_ret	 ret;
+};
+
 struct private_data {
 	int		 compression_level;
 	lzma_stream	 stream;
@@ -109,6 +129,12 @@ struct private_data {
 	int64_t		 total_out;
 	/* the CRC32 value of uncompressed data for lzip */
 	uint32_t	 crc32;
+
+	int		 threads;
+	size_t		 block_size;
+	struct archive_parallel *parallel;
+	struct xz_job	*job;		/* Being filled. */
+	lzma_index	*index;
 };
 
 static int	archive_compressor_xz_options(struct archive_write_filter *,
@@ -120,6 +146,13 @@ static int	archive_compressor_xz_close(struct archive_write_filter *);
 static int	archive_compressor_xz_free(struct archive_write_filter *);
 static int	drive_compressor(struct archive_write_filter *,
 		    struct private_data *, int finishing);
+static int	parallel_open(struct archive_write_filter *,
+		    struct private_data *);
+static int	parallel_write(struct archive_write_filter *,
+		    struct private_data *, const void *, size_t);
+static int	parallel_finish(struct archive_write_filter *,
+		    struct private_data *);
+static void	xz_job_free(struct xz_job *);
 
 struct option_value {
 	uint32_t dict_size;
@@ -348,6 +381,12 @@ archive_compressor_xz_open(struct archive_write_filter *f)
 		data->lzmafilters[0].options = &data->lzma_opt;
 		data->lzmafilters[1].id = LZMA_VLI_UNKNOWN;/* Terminate */
 	}
+	if (f->code == ARCHIVE_COMPRESSION_XZ && data->threads > 0
+	    && data->parallel == NULL) {
+		data->parallel = __archive_parallel_new(data->threads);
+		if (data->parallel != NULL)
+			return (parallel_open(f, data));
+	}
 	ret = archive_compressor_xz_init_stream(f, data);
 	if (ret == LZMA_OK) {
 		f->data = data;
@@ -374,6 +413,31 @@ archive_compressor_xz_options(struct archive_write_filter *f,
 			data->compression_level = 6;
 		return (ARCHIVE_OK);
 	}
+	/* Only xz has blocks; lzma and lzip stay single-threaded. */
+	if (f->code == ARCHIVE_COMPRESSION_XZ
+	    && (strcmp(key, "threads") == 0
+	    || strcmp(key, "block-size") == 0)) {
+		int64_t n = 0;
+
+		if (value == NULL || *value == '\0')
+			return (ARCHIVE_WARN);
+		for (; *value != '\0'; value++) {
+			if (*value < '0' || *value > '9'
+			    || n > 1024 * 1024 * 1024)
+				return (ARCHIVE_WARN);
+			n = n * 10 + (*value - '0');
+		}
+		if (strcmp(key, "threads") == 0) {
+			if (n > 1024)
+				return (ARCHIVE_WARN);
+			data->threads = (int)n;
+		} else {
+			if (n > 1024 * 1024 * 1024)
+				return (ARCHIVE_WARN);
+			data->block_size = (size_t)n;
+		}
+		return (ARCHIVE_OK);
+	}
 
 	return (ARCHIVE_WARN);
 }
@@ -390,6 +454,8 @@ archive_compressor_xz_write(struct archive_write_filter *f,
 
 	/* Update statistics */
 	data->total_in += length;
+	if (data->parallel != NULL)
+		return (parallel_write(f, data, buff, length));
 	if (f->code == ARCHIVE_COMPRESSION_LZIP)
 		data->crc32 = lzma_crc32(buff, length, data->crc32);
 
@@ -412,7 +478,10 @@ archive_compressor_xz_close(struct archive_write_filter *f)
 	struct private_data *data = (struct private_data *)f->data;
 	int ret, r1;
 
-	ret = drive_compressor(f, data, 1);
+	if (data->parallel != NULL)
+		ret = parallel_finish(f, data);
+	else
+		ret = drive_compressor(f, data, 1);
 	if (ret == ARCHIVE_OK) {
 		data->total_out +=
 		    data->compressed_buffer_size - data->stream.avail_out;
@@ -427,7 +496,8 @@ archive_compressor_xz_close(struct archive_write_filter *f)
 			    data->compressed, 20);
 		}
 	}
-	lzma_end(&(data->stream));
+	if (data->parallel == NULL)
+		lzma_end(&(data->stream));
 	r1 = __archive_write_close_filter(f->next_filter);
 	return (r1 < ret ? r1 : ret);
 }
@@ -436,6 +506,15 @@ static int
 archive_compressor_xz_free(struct archive_write_filter *f)
 {
 	struct private_data *data = (struct private_data *)f->data;
+
+	if (data->parallel != NULL) {
+		while (__archive_parallel_pending(data->parallel) > 0)
+			xz_job_free(__archive_parallel_next(data->parallel));
+		__archive_parallel_free(data->parallel);
+	}
+	xz_job_free(data->job);
+	if (data->index != NULL)
+		lzma_index_end(data->index, NULL);
 	free(data->compressed);
 	free(data);
 	f->data = NULL;
@@ -509,4 +588,272 @@ drive_compressor(struct archive_write_filter *f,
 	}
 }
 
+static struct xz_job *
+new_job(struct private_data *data)
+{
+	struct xz_job *job;
+
+	job = calloc(1, sizeof(*job));
+	if (job == NULL)
+		return (NULL);
+	job->in = malloc(data->block_size);
+	if (job->in == NULL) {
+		free(job);
+		return (NULL);
+	}
+	job->filters = data->lzmafilters;
+	return (job);
+}
+
+static void
+xz_job_free(struct xz_job *job)
+{
+	if (job == NULL)
+		return;
+	free(job->in);
+	free(job->out);
+	free(job);
+}
+
+/*
+ * Worker: compress one block, header and all.
+ */
+static void
+xz_job_run(void *arg)
+{
+	struct xz_job *job = (struct xz_job *)arg;
+	lzma_block block;
+	size_t size;
+
+	memset(&block, 0, sizeof(block));
+	block.version = 0;
+	block.check = LZMA_CHECK_CRC64;
+	block.filters = job->filters;
+	size = lzma_block_buffer_bound(job->in_len);
+	job->out = malloc(size);
+	if (job->out == NULL) {
+		job->ret = LZMA_MEM_ERROR;
+		return;
+	}
+	job->out_len = 0;
+	job->ret = lzma_block_buffer_encode(&block, NULL, job->in,
+	    job->in_len, job->out, &job->out_len, size);
+	if (job->ret == LZMA_OK) {
+		job->unpadded_size = lzma_block_unpadded_size(&block);
+		job->uncompressed_size = block.uncompressed_size;
+	}
+}
+
+/*
+ * Append compressed data to the output buffer, writing out full
+ * blocks as necessary.
+ */
+static int
+put_output(struct archive_write_filter *f, struct private_data *data,
+    const uint8_t *p, size_t len)
+{
+	size_t n;
+	int ret;
+
+	while (len > 0) {
+		if (data->stream.avail_out == 0) {
+			data->total_out += data->compressed_buffer_size;
+			ret = __archive_write_filter(f->next_filter,
+			    data->compressed,
+			    data->compressed_buffer_size);
+			if (ret != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+			data->stream.next_out = data->compressed;
+			data->stream.avail_out = data->compressed_buffer_size;
+		}
+		n = len < data->stream.avail_out ? len : data->stream.avail_out;
+		memcpy(data->stream.next_out, p, n);
+		data->stream.next_out += n;
+		data->stream.avail_out -= n;
+		p += n;
+		len -= n;
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Start an xz stream whose blocks are compressed by workers.
+ */
+static int
+parallel_open(struct archive_write_filter *f, struct private_data *data)
+{
+	uint8_t header[LZMA_STREAM_HEADER_SIZE];
+	lzma_stream_flags flags;
+
+	/* Like xz(1), default to blocks of three times the dictionary. */
+	if (data->block_size == 0) {
+		data->block_size = (size_t)data->lzma_opt.dict_size * 3;
+		if (data->block_size < 1024 * 1024)
+			data->block_size = 1024 * 1024;
+	}
+	data->job = new_job(data);
+	data->index = lzma_index_init(NULL);
+	if (data->job == NULL || data->index == NULL) {
+		archive_set_error(f->archive, ENOMEM,
+		    "Can't allocate data for compression");
+		return (ARCHIVE_FATAL);
+	}
+	data->stream.next_out = data->compressed;
+	data->stream.avail_out = data->compressed_buffer_size;
+
+	memset(&flags, 0, sizeof(flags));
+	flags.version = 0;
+	flags.check = LZMA_CHECK_CRC64;
+	if (lzma_stream_header_encode(&flags, header) != LZMA_OK) {
+		archive_set_error(f->archive, ARCHIVE_ERRNO_MISC,
+		    "Internal error initializing compression library");
+		return (ARCHIVE_FATAL);
+	}
+	return (put_output(f, data, header, sizeof(header)));
+}
+
+/*
+ * Wait for the oldest block, add it to the output and the index.
+ */
+static int
+collect_job(struct archive_write_filter *f, struct private_data *data)
+{
+	struct xz_job *job;
+	lzma_ret r;
+	int ret;
+
+	job = __archive_parallel_next(data->parallel);
+	r = job->ret;
+	if (r == LZMA_OK)
+		r = lzma_index_append(data->index, NULL, job->unpadded_size,
+		    job->uncompressed_size);
+	if (r != LZMA_OK) {
+		xz_job_free(job);
+		if (r == LZMA_MEM_ERROR)
+			archive_set_error(f->archive, ENOMEM,
+			    "lzma compression error: Cannot allocate memory");
+		else
+			archive_set_error(f->archive, ARCHIVE_ERRNO_MISC,
+			    "lzma compression failed:"
+			    " lzma_block_buffer_encode() call returned"
+			    " status %d", r);
+		return (ARCHIVE_FATAL);
+	}
+	ret = put_output(f, data, job->out, job->out_len);
+	xz_job_free(job);
+	return (ret);
+}
+
+/*
+ * Hand the block being filled to a worker.
+ */
+static int
+submit_job(struct archive_write_filter *f, struct private_data *data,
+    int last)
+{
+	struct xz_job *job = data->job, *next = NULL;
+	int ret;
+
+	/* A block and its encoder can take a lot of memory, so keep
+	 * no more blocks in flight than there are workers. */
+	while (__archive_parallel_pending(data->parallel) >= data->threads)
+		if ((ret = collect_job(f, data)) != ARCHIVE_OK)
+			return (ret);
+	if (!last) {
+		next = new_job(data);
+		if (next == NULL)
+			goto nomem;
+	}
+	if (job->in_len == 0) {
+		/* Nothing left to compress. */
+		xz_job_free(job);
+	} else if (__archive_parallel_submit(data->parallel, xz_job_run, job)
+	    != ARCHIVE_OK) {
+		xz_job_free(next);
+		goto nomem;
+	}
+	data->job = next;
+	return (ARCHIVE_OK);
+nomem:
+	archive_set_error(f->archive, ENOMEM,
+	    "Can't allocate data for compression");
+	return (ARCHIVE_FATAL);
+}
+
+static int
+parallel_write(struct archive_write_filter *f, struct private_data *data,
+    const void *buff, size_t length)
+{
+	const uint8_t *p = (const uint8_t *)buff;
+	struct xz_job *job;
+	size_t n;
+	int ret;
+
+	while (length > 0) {
+		job = data->job;
+		n = data->block_size - job->in_len;
+		if (n > length)
+			n = length;
+		memcpy(job->in + job->in_len, p, n);
+		job->in_len += n;
+		p += n;
+		length -= n;
+		if (job->in_len == data->block_size
+		    && (ret = submit_job(f, data, 0)) != ARCHIVE_OK)
+			return (ret);
+	}
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Compress the last block, wait for all of them, and end the stream
+ * with the index and the stream footer.
+ */
+static int
+parallel_finish(struct archive_write_filter *f, struct private_data *data)
+{
+	uint8_t footer[LZMA_STREAM_HEADER_SIZE];
+	lzma_stream_flags flags;
+	uint8_t *index;
+	size_t size, pos = 0;
+	int ret;
+
+	if (data->job == NULL) {
+		archive_set_error(f->archive, ARCHIVE_ERRNO_MISC,
+		    "lzma compression failed");
+		return (ARCHIVE_FATAL);
+	}
+	ret = submit_job(f, data, 1);
+	while (ret == ARCHIVE_OK
+	    && __archive_parallel_pending(data->parallel) > 0)
+		ret = collect_job(f, data);
+	if (ret != ARCHIVE_OK)
+		return (ret);
+
+	size = (size_t)lzma_index_size(data->index);
+	index = malloc(size);
+	if (index == NULL) {
+		archive_set_error(f->archive, ENOMEM,
+		    "Can't allocate data for compression");
+		return (ARCHIVE_FATAL);
+	}
+	memset(&flags, 0, sizeof(flags));
+	flags.version = 0;
+	flags.check = LZMA_CHECK_CRC64;
+	flags.backward_size = lzma_index_size(data->index);
+	if (lzma_index_buffer_encode(data->index, index, &pos, size)
+	    != LZMA_OK
+	    || lzma_stream_footer_encode(&flags, footer) != LZMA_OK) {
+		free(index);
+		archive_set_error(f->archive, ARCHIVE_ERRNO_MISC,
+		    "lzma compression failed: can't write the index");
+		return (ARCHIVE_FATAL);
+	}
+	ret = put_output(f, data, index, pos);
+	free(index);
+	if (ret == ARCHIVE_OK)
+		ret = put_output(f, data, footer, sizeof(footer));
+	return (ret);
+}
+
 #endif /* HAVE_LZMA_H */
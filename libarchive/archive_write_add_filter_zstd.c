@@ -0,0 +1,364 @@
+/*-
+ * Copyright (c) 2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+
+__FBSDID("$FreeBSD$");
+
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+#ifdef HAVE_ZSTD_H
+#include <zstd.h>
+#endif
+
+#include "archive.h"
+#include "archive_private.h"
+#include "archive_write_private.h"
+
+#if !defined(HAVE_ZSTD_H) || !defined(HAVE_LIBZSTD)
+int
+archive_write_add_filter_zstd(struct archive *a)
+{
+	archive_set_error(a, ARCHIVE_ERRNO_MISC,
+	    "zstd compression not supported on this platform");
+	return (ARCHIVE_FATAL);
+}
+#else
+/* Don't compile this if we don't have libzstd. */
+
+/*
+ * With threads=N, libzstd itself hands pieces of the input to N
+ * worker threads; the output is still a single frame.
+ */
+#define	DEFAULT_COMPRESSION_LEVEL	3
+#define	DEFAULT_LONG_WINDOW_LOG		27
+
+struct private_data {
+	int		 compression_level;
+	int		 long_window_log;	/* 0 = no long-distance mode. */
+	int		 threads;
+	ZSTD_CCtx	*cctx;
+	ZSTD_outBuffer	 out;
+	int64_t		 total_in;
+	char		*compressed;
+	size_t		 compressed_buffer_size;
+};
+
+static int archive_compressor_zstd_close(struct archive_write_filter *);
+static int archive_compressor_zstd_free(struct archive_write_filter *);
+static int archive_compressor_zstd_open(struct archive_write_filter *);
+static int archive_compressor_zstd_options(struct archive_write_filter *,
+		    const char *, const char *);
+static int archive_compressor_zstd_write(struct archive_write_filter *,
+		    const void *, size_t);
+static int drive_compressor(struct archive_write_filter *,
+		    struct private_data *, ZSTD_inBuffer *, int finishing);
+
+/*
+ * Add a zstd compression filter to this write handle.
+ */
+int
+archive_write_add_filter_zstd(struct archive *_a)
+{
+	struct archive_write *a = (struct archive_write *)_a;
+	struct archive_write_filter *f = __archive_write_allocate_filter(_a);
+	struct private_data *data;
+
+	archive_check_magic(&a->archive, ARCHIVE_WRITE_MAGIC,
+	    ARCHIVE_STATE_NEW, "archive_write_add_filter_zstd");
+
+	data = calloc(1, sizeof(*data));
+	if (data == NULL) {
+		archive_set_error(&a->archive, ENOMEM, "Out of memory");
+		return (ARCHIVE_FATAL);
+	}
+	data->compression_level = DEFAULT_COMPRESSION_LEVEL;
+
+	f->data = data;
+	f->options = &archive_compressor_zstd_options;
+	f->close = &archive_compressor_zstd_close;
+	f->free = &archive_compressor_zstd_free;
+	f->open = &archive_compressor_zstd_open;
+	f->code = ARCHIVE_FILTER_ZSTD;
+	f->name = "zstd";
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Parse a decimal integer, with an optional minus sign, between
+ * 'min' and 'max'.  Returns 0 on success.
+ */
+static int
+parse_int(const char *value, int min, int max, int *result)
+{
+	int n = 0, neg = 0;
+
+	if (value == NULL)
+		return (-1);
+	if (*value == '-') {
+		neg = 1;
+		value++;
+	}
+	if (*value == '\0')
+		return (-1);
+	for (; *value != '\0'; value++) {
+		if (*value < '0' || *value > '9' || n > 100000)
+			return (-1);
+		n = n * 10 + (*value - '0');
+	}
+	if (neg)
+		n = -n;
+	if (n < min || n > max)
+		return (-1);
+	*result = n;
+	return (0);
+}
+
+/*
+ * Set write options.
+ */
+static int
+archive_compressor_zstd_options(struct archive_write_filter *f,
+    const char *key, const char *value)
+{
+	struct private_data *data = (struct private_data *)f->data;
+
+	if (strcmp(key, "compression-level") == 0) {
+		if (parse_int(value, ZSTD_minCLevel(), ZSTD_maxCLevel(),
+		    &data->compression_level) != 0)
+			return (ARCHIVE_WARN);
+		return (ARCHIVE_OK);
+	}
+	if (strcmp(key, "long") == 0) {
+		/* "long" alone picks the default window, as zstd --long. */
+		if (value == NULL)
+			data->long_window_log = 0;
+		else if (strcmp(value, "1") == 0)
+			data->long_window_log = DEFAULT_LONG_WINDOW_LOG;
+		else {
+			ZSTD_bounds b = ZSTD_cParam_getBounds(ZSTD_c_windowLog);
+
+			if (parse_int(value, b.lowerBound, b.upperBound,
+			    &data->long_window_log) != 0)
+				return (ARCHIVE_WARN);
+		}
+		return (ARCHIVE_OK);
+	}
+	if (strcmp(key, "threads") == 0) {
+		if (parse_int(value, 0, 1024, &data->threads) != 0)
+			return (ARCHIVE_WARN);
+		return (ARCHIVE_OK);
+	}
+
+	/* Note: The "warn" return is just to inform the options
+	 * supervisor that we didn't handle it.  It will generate
+	 * a suitable error if no one used this option. */
+	return (ARCHIVE_WARN);
+}
+
+/*
+ * Setup callback.
+ */
+static int
+archive_compressor_zstd_open(struct archive_write_filter *f)
+{
+	struct private_data *data = (struct private_data *)f->data;
+	size_t r;
+	int ret;
+
+	ret = __archive_write_open_filter(f->next_filter);
+	if (ret != 0)
+		return (ret);
+
+	if (data->compressed == NULL) {
+		size_t bs = ZSTD_CStreamOutSize(), bpb;
+		if (f->archive->magic == ARCHIVE_WRITE_MAGIC) {
+			/* Buffer size should be a multiple number of
+			 * the of bytes per block for performance. */
+			bpb = archive_write_get_bytes_per_block(f->archive);
+			if (bpb > bs)
+				bs = bpb;
+			else if (bpb != 0)
+				bs -= bs % bpb;
+		}
+		data->compressed_buffer_size = bs;
+		data->compressed
+		    = (char *)malloc(data->compressed_buffer_size);
+		if (data->compressed == NULL) {
+			archive_set_error(f->archive, ENOMEM,
+			    "Can't allocate data for compression buffer");
+			return (ARCHIVE_FATAL);
+		}
+	}
+
+	if (data->cctx == NULL) {
+		data->cctx = ZSTD_createCCtx();
+		if (data->cctx == NULL) {
+			archive_set_error(f->archive, ENOMEM,
+			    "Can't allocate data for compression");
+			return (ARCHIVE_FATAL);
+		}
+	} else
+		ZSTD_CCtx_reset(data->cctx, ZSTD_reset_session_and_parameters);
+
+	r = ZSTD_CCtx_setParameter(data->cctx, ZSTD_c_compressionLevel,
+	    data->compression_level);
+	if (!ZSTD_isError(r))
+		r = ZSTD_CCtx_setParameter(data->cctx, ZSTD_c_checksumFlag, 1);
+	if (!ZSTD_isError(r) && data->long_window_log > 0) {
+		r = ZSTD_CCtx_setParameter(data->cctx,
+		    ZSTD_c_enableLongDistanceMatching, 1);
+		if (!ZSTD_isError(r))
+			r = ZSTD_CCtx_setParameter(data->cctx,
+			    ZSTD_c_windowLog, data->long_window_log);
+	}
+	if (ZSTD_isError(r)) {
+		archive_set_error(f->archive, ARCHIVE_ERRNO_MISC,
+		    "Internal error initializing compression library: %s",
+		    ZSTD_getErrorName(r));
+		return (ARCHIVE_FATAL);
+	}
+	/* A libzstd built without thread support refuses this;
+	 * compress on the calling thread instead. */
+	if (data->threads > 0)
+		ZSTD_CCtx_setParameter(data->cctx, ZSTD_c_nbWorkers,
+		    data->threads);
+
+	data->out.dst = data->compressed;
+	data->out.size = data->compressed_buffer_size;
+	data->out.pos = 0;
+	f->write = archive_compressor_zstd_write;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Write data to the compressed stream.
+ *
+ * Returns ARCHIVE_OK if all data written, error otherwise.
+ */
+static int
+archive_compressor_zstd_write(struct archive_write_filter *f,
+    const void *buff, size_t length)
+{
+	struct private_data *data = (struct private_data *)f->data;
+	ZSTD_inBuffer in;
+
+	/* Update statistics */
+	data->total_in += length;
+
+	/* Compress input data to output buffer */
+	in.src = buff;
+	in.size = length;
+	in.pos = 0;
+	return (drive_compressor(f, data, &in, 0));
+}
+
+/*
+ * Finish the compression.
+ */
+static int
+archive_compressor_zstd_close(struct archive_write_filter *f)
+{
+	struct private_data *data = (struct private_data *)f->data;
+	ZSTD_inBuffer in;
+	int ret, r1;
+
+	/* Finish compression cycle. */
+	in.src = NULL;
+	in.size = 0;
+	in.pos = 0;
+	ret = drive_compressor(f, data, &in, 1);
+	if (ret == ARCHIVE_OK) {
+		/* Write the last block */
+		ret = __archive_write_filter(f->next_filter,
+		    data->compressed, data->out.pos);
+	}
+
+	r1 = __archive_write_close_filter(f->next_filter);
+	return (r1 < ret ? r1 : ret);
+}
+
+static int
+archive_compressor_zstd_free(struct archive_write_filter *f)
+{
+	struct private_data *data = (struct private_data *)f->data;
+
+	ZSTD_freeCCtx(data->cctx);
+	free(data->compressed);
+	free(data);
+	f->data = NULL;
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Utility function to push input data through compressor, writing
+ * full output blocks as necessary.
+ *
+ * Note that this handles both the regular write case (finishing ==
+ * false) and the end-of-archive case (finishing == true).
+ */
+static int
+drive_compressor(struct archive_write_filter *f,
+    struct private_data *data, ZSTD_inBuffer *in, int finishing)
+{
+	size_t remaining;
+	int ret;
+
+	for (;;) {
+		if (data->out.pos == data->out.size) {
+			ret = __archive_write_filter(f->next_filter,
+			    data->compressed,
+			    data->compressed_buffer_size);
+			if (ret != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+			data->out.pos = 0;
+		}
+
+		/* If there's nothing to do, we're done. */
+		if (!finishing && in->pos == in->size)
+			return (ARCHIVE_OK);
+
+		remaining = ZSTD_compressStream2(data->cctx, &data->out, in,
+		    finishing ? ZSTD_e_end : ZSTD_e_continue);
+		if (ZSTD_isError(remaining)) {
+			archive_set_error(f->archive, ARCHIVE_ERRNO_MISC,
+			    "zstd compression failed: %s",
+			    ZSTD_getErrorName(remaining));
+			return (ARCHIVE_FATAL);
+		}
+		/* Finishing: all done once nothing is left to flush. */
+		if (finishing && remaining == 0)
+			return (ARCHIVE_OK);
+	}
+}
+
+#endif /* HAVE_ZSTD_H && HAVE_LIBZSTD */
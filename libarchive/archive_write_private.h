@@ -100,6 +100,10 @@ struct archive_write {
 	struct archive_write_filter *filter_first;
 	struct archive_write_filter *filter_last;
 
+	/* Sidecar index; see archive_write_set_index_file(). */
+	struct archive_index *index;
+	char		 *index_filename;
+
 	/*
 	 * Pointers to format-specific functions for writing.  They're
 	 * initialized by archive_write_set_format_XXX() calls.
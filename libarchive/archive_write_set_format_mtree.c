@@ -37,6 +37,7 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_format_mtree.c 201171
 #include "archive.h"
 #include "archive_crypto_private.h"
 #include "archive_entry.h"
+#include "archive_parallel_private.h"
 #include "archive_private.h"
 #include "archive_write_private.h"
 
@@ -88,6 +89,23 @@ struct mtree_entry {
 #endif
 };
 
+/*
+ * With threads=N the sums are computed on worker threads.  The data is
+ * copied into one of two staging buffers; while the workers digest one,
+ * the caller fills the other.  The selected sums are split into lanes
+ * of about equal cost, one job per lane, so that no context is ever
+ * used by two threads at once.
+ */
+#define	SUM_BUFF_SIZE	(256 * 1024)
+#define	SUM_MAX_LANES	7
+
+struct sum_job {
+	struct mtree_writer	*mtree;
+	int			 keys;	/* The sums this lane computes. */
+	const unsigned char	*buff;
+	size_t			 size;
+};
+
 struct attr_counter {
 	struct attr_counter *prev;
 	struct attr_counter *next;
@@ -142,6 +160,15 @@ struct mtree_writer {
 #ifdef ARCHIVE_HAS_SHA512
 	archive_sha512_ctx sha512ctx;
 #endif
+	/* threads=N */
+	int threads;
+	struct archive_parallel *parallel;
+	struct sum_job sum_jobs[SUM_MAX_LANES];
+	int sum_lanes;		/* 0 when summing on the calling thread. */
+	int sum_in_flight;	/* Jobs submitted and not yet collected. */
+	unsigned char *sum_buff[2];
+	int sum_cur;		/* The staging buffer being filled. */
+	size_t sum_used;
 	/* Keyword options */
 	int keys;
 #define	F_CKSUM		0x00000001		/* check sum */
@@ -191,7 +218,12 @@ static int inc_attr_count(struct attr_counter **, struct attr_counter *,
 static int collect_set_values(struct mtree_writer *, struct mtree_entry *);
 static int get_keys(struct mtree_writer *, struct mtree_entry *);
 static void sum_init(struct mtree_writer *);
+static void sum_lanes(struct mtree_writer *);
 static void sum_update(struct mtree_writer *, const void *, size_t);
+static void sum_update_keys(struct mtree_writer *, int, const void *,
+	size_t);
+static void sum_flush(struct mtree_writer *);
+static void sum_wait(struct mtree_writer *);
 static void sum_final(struct mtree_writer *, struct mtree_entry *);
 static void sum_write(struct archive_string *, struct mtree_entry *);
 
@@ -1101,6 +1133,13 @@ archive_write_mtree_free(struct archive_write *a)
 	if (mtree == NULL)
 		return (ARCHIVE_OK);
 
+	/* Workers may still be reading a buffer if we were abandoned
+	 * in the middle of an entry. */
+	sum_wait(mtree);
+	__archive_parallel_free(mtree->parallel);
+	free(mtree->sum_buff[0]);
+	free(mtree->sum_buff[1]);
+
 	/* Make sure we dot not leave any entries. */
 	me = mtree->set.me_first;
 	while (me != NULL) {
@@ -1198,6 +1237,21 @@ archive_write_mtree_options(struct archive_write *a, const char *key,
 			keybit = F_SIZE;
 		break;
 	case 't':
+		if (strcmp(key, "threads") == 0) {
+			int n = 0;
+
+			if (value == NULL || *value == '\0')
+				return (ARCHIVE_WARN);
+			for (; *value != '\0'; value++) {
+				if (*value < '0' || *value > '9')
+					return (ARCHIVE_WARN);
+				n = n * 10 + (*value - '0');
+				if (n > 1024)
+					return (ARCHIVE_WARN);
+			}
+			mtree->threads = n;
+			return (ARCHIVE_OK);
+		}
 		if (strcmp(key, "time") == 0)
 			keybit = F_TIME;
 		else if (strcmp(key, "type") == 0)
@@ -1324,12 +1378,135 @@ sum_init(struct mtree_writer *mtree)
 			mtree->keys &= ~F_SHA512;/* Not supported. */
 	}
 #endif
+	sum_lanes(mtree);
+}
+
+/*
+ * Spread the selected sums over up to "threads" lanes, most expensive
+ * first, each to the lane with the least work so far.  The weights are
+ * rough per-byte costs of the portable code.
+ */
+static void
+sum_lanes(struct mtree_writer *mtree)
+{
+	static const struct { int key, cost; } sums[] = {
+		{ F_RMD160, 7 }, { F_SHA256, 5 }, { F_SHA1, 4 },
+		{ F_SHA384, 4 }, { F_SHA512, 4 }, { F_CKSUM, 2 },
+		{ F_MD5, 2 },
+	};
+	int cost[SUM_MAX_LANES];
+	int i, l, lanes, best, nsums = 0;
+
+	mtree->sum_lanes = 0;
+	for (i = 0; i < (int)(sizeof(sums) / sizeof(sums[0])); i++)
+		if (mtree->compute_sum & sums[i].key)
+			nsums++;
+	lanes = mtree->threads < nsums ? mtree->threads : nsums;
+	/* Small files are done before the workers would even wake. */
+	if (lanes < 2 || mtree->entry_bytes_remaining < SUM_BUFF_SIZE / 4)
+		return;
+	if (mtree->parallel == NULL) {
+		mtree->parallel = __archive_parallel_new(mtree->threads);
+		if (mtree->parallel == NULL)
+			return;
+	}
+	if (mtree->sum_buff[0] == NULL) {
+		mtree->sum_buff[0] = malloc(SUM_BUFF_SIZE);
+		mtree->sum_buff[1] = malloc(SUM_BUFF_SIZE);
+		if (mtree->sum_buff[0] == NULL || mtree->sum_buff[1] == NULL) {
+			free(mtree->sum_buff[0]);
+			free(mtree->sum_buff[1]);
+			mtree->sum_buff[0] = mtree->sum_buff[1] = NULL;
+			return;		/* Sum on the calling thread. */
+		}
+	}
+	for (l = 0; l < lanes; l++) {
+		mtree->sum_jobs[l].mtree = mtree;
+		mtree->sum_jobs[l].keys = 0;
+		cost[l] = 0;
+	}
+	for (i = 0; i < (int)(sizeof(sums) / sizeof(sums[0])); i++) {
+		if ((mtree->compute_sum & sums[i].key) == 0)
+			continue;
+		best = 0;
+		for (l = 1; l < lanes; l++)
+			if (cost[l] < cost[best])
+				best = l;
+		mtree->sum_jobs[best].keys |= sums[i].key;
+		cost[best] += sums[i].cost;
+	}
+	mtree->sum_lanes = lanes;
+	mtree->sum_cur = 0;
+	mtree->sum_used = 0;
+}
+
+static void
+sum_run(void *_job)
+{
+	struct sum_job *job = (struct sum_job *)_job;
+
+	sum_update_keys(job->mtree, job->keys, job->buff, job->size);
+}
+
+/* Collect the jobs for the buffer the workers are digesting. */
+static void
+sum_wait(struct mtree_writer *mtree)
+{
+	for (; mtree->sum_in_flight > 0; mtree->sum_in_flight--)
+		__archive_parallel_next(mtree->parallel);
+}
+
+/* Hand the staging buffer to the workers and start filling the other. */
+static void
+sum_flush(struct mtree_writer *mtree)
+{
+	int l;
+
+	sum_wait(mtree);
+	if (mtree->sum_used == 0)
+		return;
+	for (l = 0; l < mtree->sum_lanes; l++) {
+		mtree->sum_jobs[l].buff = mtree->sum_buff[mtree->sum_cur];
+		mtree->sum_jobs[l].size = mtree->sum_used;
+		if (__archive_parallel_submit(mtree->parallel, sum_run,
+		    &mtree->sum_jobs[l]) == ARCHIVE_OK)
+			mtree->sum_in_flight++;
+		else
+			sum_run(&mtree->sum_jobs[l]);
+	}
+	mtree->sum_cur ^= 1;
+	mtree->sum_used = 0;
 }
 
 static void
 sum_update(struct mtree_writer *mtree, const void *buff, size_t n)
 {
-	if (mtree->compute_sum & F_CKSUM) {
+	const unsigned char *p = buff;
+	size_t nn;
+
+	if (mtree->sum_lanes == 0) {
+		sum_update_keys(mtree, mtree->compute_sum, buff, n);
+		return;
+	}
+	while (n > 0) {
+		nn = SUM_BUFF_SIZE - mtree->sum_used;
+		if (nn > n)
+			nn = n;
+		memcpy(mtree->sum_buff[mtree->sum_cur] + mtree->sum_used,
+		    p, nn);
+		mtree->sum_used += nn;
+		p += nn;
+		n -= nn;
+		if (mtree->sum_used == SUM_BUFF_SIZE)
+			sum_flush(mtree);
+	}
+}
+
+static void
+sum_update_keys(struct mtree_writer *mtree, int keys, const void *buff,
+    size_t n)
+{
+	if (keys & F_CKSUM) {
 		/*
 		 * Compute a POSIX 1003.2 checksum
 		 */
@@ -1341,27 +1518,27 @@ sum_update(struct mtree_writer *mtree, const void *buff, size_t n)
 		mtree->crc_len += n;
 	}
 #ifdef ARCHIVE_HAS_MD5
-	if (mtree->compute_sum & F_MD5)
+	if (keys & F_MD5)
 		archive_md5_update(&mtree->md5ctx, buff, n);
 #endif
 #ifdef ARCHIVE_HAS_RMD160
-	if (mtree->compute_sum & F_RMD160)
+	if (keys & F_RMD160)
 		archive_rmd160_update(&mtree->rmd160ctx, buff, n);
 #endif
 #ifdef ARCHIVE_HAS_SHA1
-	if (mtree->compute_sum & F_SHA1)
+	if (keys & F_SHA1)
 		archive_sha1_update(&mtree->sha1ctx, buff, n);
 #endif
 #ifdef ARCHIVE_HAS_SHA256
-	if (mtree->compute_sum & F_SHA256)
+	if (keys & F_SHA256)
 		archive_sha256_update(&mtree->sha256ctx, buff, n);
 #endif
 #ifdef ARCHIVE_HAS_SHA384
-	if (mtree->compute_sum & F_SHA384)
+	if (keys & F_SHA384)
 		archive_sha384_update(&mtree->sha384ctx, buff, n);
 #endif
 #ifdef ARCHIVE_HAS_SHA512
-	if (mtree->compute_sum & F_SHA512)
+	if (keys & F_SHA512)
 		archive_sha512_update(&mtree->sha512ctx, buff, n);
 #endif
 }
@@ -1369,6 +1546,10 @@ sum_update(struct mtree_writer *mtree, const void *buff, size_t n)
 static void
 sum_final(struct mtree_writer *mtree, struct mtree_entry *me)
 {
+	if (mtree->sum_lanes > 0) {
+		sum_flush(mtree);
+		sum_wait(mtree);
+	}
 
 	if (mtree->compute_sum & F_CKSUM) {
 		uint64_t len;
@@ -33,17 +33,15 @@
  * The current implementation is very limited:
  *
  *   - No encryption support.
- *   - No ZIP64 support.
  *   - No support for splitting and spanning.
  *   - Only supports regular file and folder entries.
  *
  * Note that generally data in ZIP files is little-endian encoded,
  * with some exceptions.
  *
- * TODO: Since Libarchive is generally 64bit oriented, but this implementation
- * does not yet support sizes exceeding 32bit, it is highly fragile for
- * big archives. This should change when ZIP64 is finally implemented, otherwise
- * some serious checking has to be done.
+ * Zip64 extensions are used only where a size, offset or count
+ * doesn't fit in the original fields, unless the zip64 option asks
+ * for them everywhere (or nowhere).
  *
  */
 
@@ -62,6 +60,12 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_format_zip.c 201168 20
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
+#ifdef HAVE_BZLIB_H
+#include <bzlib.h>
+#endif
+#ifdef HAVE_LZMA_H
+#include <lzma.h>
+#endif
 #ifdef HAVE_ZLIB_H
 #include <zlib.h>
 #endif
@@ -70,23 +74,42 @@ __FBSDID("$FreeBSD: head/lib/libarchive/archive_write_set_format_zip.c 201168 20
 #include "archive_endian.h"
 #include "archive_entry.h"
 #include "archive_entry_locale.h"
+#include "archive_parallel_private.h"
 #include "archive_private.h"
 #include "archive_write_private.h"
 
-#ifndef HAVE_ZLIB_H
 #include "archive_crc32.h"
-#endif
 
 #define ZIP_SIGNATURE_LOCAL_FILE_HEADER 0x04034b50
 #define ZIP_SIGNATURE_DATA_DESCRIPTOR 0x08074b50
 #define ZIP_SIGNATURE_FILE_HEADER 0x02014b50
 #define ZIP_SIGNATURE_CENTRAL_DIRECTORY_END 0x06054b50
+#define ZIP_SIGNATURE_ZIP64_END 0x06064b50
+#define ZIP_SIGNATURE_ZIP64_LOCATOR 0x07064b50
+#define ZIP_SIGNATURE_EXTRA_ZIP64 0x0001
 #define ZIP_SIGNATURE_EXTRA_TIMESTAMP 0x5455
 #define ZIP_SIGNATURE_EXTRA_NEW_UNIX 0x7875
 #define ZIP_VERSION_EXTRACT 0x0014 /* ZIP version 2.0 is needed. */
+#define ZIP_VERSION_ZIP64 0x002d /* ZIP version 4.5 is needed. */
+#define ZIP_VERSION_BZIP2 0x002e /* ZIP version 4.6 is needed. */
+#define ZIP_VERSION_LZMA 0x003f /* ZIP version 6.3 is needed. */
 #define ZIP_VERSION_BY 0x0314 /* Made by UNIX, using ZIP version 2.0. */
 #define ZIP_FLAGS 0x08 /* Flagging bit 3 (count from 0) for using data descriptor. */
 #define ZIP_FLAGS_UTF8_NAME	(1 << 11)
+#define ZIP_FLAGS_LZMA_EOPM	(1 << 1) /* LZMA data has an end marker. */
+
+/* Largest value of the original 32-bit fields; it also marks a
+ * value that is in the Zip64 extra field instead. */
+#define ZIP_4GB_MAX 0xffffffffLL
+/* Deflated data can be a little larger than its input; entries above
+ * this size get Zip64 sizes in case they need them. */
+#define ZIP_4GB_DEFLATE_MAX 0xff000000LL
+
+enum zip64 {
+	ZIP64_AUTO = 0,	/* Where needed. */
+	ZIP64_ALWAYS,
+	ZIP64_NEVER
+};
 
 enum compression {
 	COMPRESSION_STORE = 0
@@ -94,8 +117,19 @@ enum compression {
 	,
 	COMPRESSION_DEFLATE = 8
 #endif
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+	,
+	COMPRESSION_BZIP2 = 12
+#endif
+#ifdef HAVE_LZMA_H
+	,
+	COMPRESSION_LZMA = 14
+#endif
 };
 
+struct zip_file_header_link;
+struct zip_job;
+
 static ssize_t archive_write_zip_data(struct archive_write *,
 		   const void *buff, size_t s);
 static int archive_write_zip_close(struct archive_write *);
@@ -108,6 +142,26 @@ static int archive_write_zip_options(struct archive_write *,
 static unsigned int dos_time(const time_t);
 static size_t path_length(struct archive_entry *);
 static int write_path(struct archive_entry *, struct archive_write *);
+static void copy_path(struct archive_entry *, unsigned char *);
+static int zip_write_data_descriptor(struct archive_write *,
+		struct zip_file_header_link *);
+static void zip_job_free(struct zip_job *);
+static void zip_job_run(void *);
+static int zip_job_write(struct archive_write *, struct zip_job *);
+static int zip_parallel_write(struct archive_write *, int);
+static int zip_deflate_init(struct archive_write *);
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+static int zip_bzip2_init(struct archive_write *);
+#endif
+#ifdef HAVE_LZMA_H
+static int zip_lzma_init(struct archive_write *);
+#endif
+static int zip_version_extract(enum compression, int);
+static int zip_compressible(const unsigned char *, size_t,
+		unsigned char *);
+static void zip_head_store(struct zip_file_header_link *,
+		unsigned char *);
+static int zip_sample_write(struct archive_write *);
 
 #define LOCAL_FILE_HEADER_SIGNATURE		0
 #define LOCAL_FILE_HEADER_VERSION		4
@@ -145,6 +199,9 @@ static int write_path(struct archive_entry *, struct archive_write *);
 #define DATA_DESCRIPTOR_COMPRESSED_SIZE		8
 #define DATA_DESCRIPTOR_UNCOMPRESSED_SIZE	12
 #define SIZE_DATA_DESCRIPTOR			16
+	/* Zip64 entries have 64-bit sizes. */
+#define DATA_DESCRIPTOR_ZIP64_UNCOMPRESSED_SIZE	16
+#define SIZE_DATA_DESCRIPTOR_ZIP64		24
 
 #define EXTRA_DATA_LOCAL_TIME_ID		0
 #define EXTRA_DATA_LOCAL_TIME_SIZE		2
@@ -179,6 +236,30 @@ static int write_path(struct archive_entry *, struct archive_write *);
 #define CENTRAL_DIRECTORY_END_COMMENT_LENGTH	20
 #define SIZE_CENTRAL_DIRECTORY_END		22
 
+#define ZIP64_END_SIGNATURE			0
+#define ZIP64_END_SIZE				4
+#define ZIP64_END_VERSION_BY			12
+#define ZIP64_END_VERSION_EXTRACT		14
+#define ZIP64_END_DISK				16
+#define ZIP64_END_START_DISK			20
+#define ZIP64_END_ENTRIES_DISK			24
+#define ZIP64_END_ENTRIES			32
+#define ZIP64_END_CD_SIZE			40
+#define ZIP64_END_CD_OFFSET			48
+#define SIZE_ZIP64_END				56
+
+#define ZIP64_LOCATOR_SIGNATURE			0
+#define ZIP64_LOCATOR_DISK			4
+#define ZIP64_LOCATOR_OFFSET			8
+#define ZIP64_LOCATOR_DISKS			16
+#define SIZE_ZIP64_LOCATOR			20
+
+/* Zip64 extended information: up to three 64-bit values. */
+#define EXTRA_DATA_ZIP64_ID			0
+#define EXTRA_DATA_ZIP64_SIZE			2
+#define EXTRA_DATA_ZIP64_DATA			4
+#define SIZE_EXTRA_DATA_ZIP64			28
+
 struct zip_file_header_link {
 	struct zip_file_header_link *next;
 	struct archive_entry *entry;
@@ -187,28 +268,89 @@ struct zip_file_header_link {
 	int64_t compressed_size;
 	enum compression compression;
 	int flags;
+	/* Local header and data descriptor have Zip64 sizes. */
+	int zip64;
 };
 
 struct zip {
-	uint8_t data_descriptor[SIZE_DATA_DESCRIPTOR];
+	uint8_t data_descriptor[SIZE_DATA_DESCRIPTOR_ZIP64];
 	struct zip_file_header_link *central_directory;
 	struct zip_file_header_link *central_directory_end;
 	int64_t offset;
 	int64_t written_bytes;
 	int64_t remaining_data_bytes;
 	enum compression compression;
+	enum zip64 zip64;
+	/* The last central directory entry still needs finishing;
+	 * a header that fails doesn't add one. */
+	int entry_open;
 	int flags;
 	struct archive_string_conv *opt_sconv;
 	struct archive_string_conv *sconv_default;
 	int	init_default_conversion;
+	/* Local file header being assembled. */
+	struct archive_string head;
+	/* auto-store: the first data of a file, until we know whether
+	 * to deflate it.  The header waits as well. */
+	int auto_store;
+	int sampling;
+	unsigned char *sample;
+	size_t sample_used;
+
+	/* Deflating entries on worker threads. */
+	int threads;
+	struct archive_parallel *parallel;
+	/* Input held by jobs that haven't been written out. */
+	size_t parallel_bytes;
+	/* The current entry, if its data goes to a worker. */
+	struct zip_job *job;
 
 #ifdef HAVE_ZLIB_H
 	z_stream stream;
+#endif
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+	bz_stream bzstream;
+	int bzstream_valid;
+#endif
+#ifdef HAVE_LZMA_H
+	/* Kept from one entry to the next; the encoder is big. */
+	lzma_stream lzstream;
+	int lzstream_valid;
+#endif
 	size_t len_buf;
 	unsigned char *buf;
-#endif
 };
 
+/*
+ * An entry deflated by a worker thread: its local file header, ready
+ * to write, and its data before and after compression.
+ */
+struct zip_job {
+	struct zip_file_header_link *l;
+	unsigned char *head;
+	size_t head_size;
+	unsigned char *in;
+	size_t in_size;
+	size_t in_used;
+	unsigned char *out;
+	size_t out_size;
+	unsigned long crc32;
+	int status;
+	int auto_store;
+	/* auto-store decided against deflate; the data is in "in". */
+	int stored;
+};
+
+#define	ZIP_JOB_OK		0
+#define	ZIP_JOB_NOMEM		1
+#define	ZIP_JOB_FAILED		2
+
+/* Larger entries are deflated on the calling thread. */
+#define	ZIP_JOB_MAX		(16 * 1024 * 1024)
+
+/* auto-store looks at this much of each file. */
+#define	ZIP_SAMPLE_SIZE		65536
+
 static int
 archive_write_zip_options(struct archive_write *a, const char *key,
     const char *val)
@@ -228,6 +370,22 @@ archive_write_zip_options(struct archive_write *a, const char *key,
 #else
 			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
 			    "deflate compression not supported");
+#endif
+		} else if (strcmp(val, "bzip2") == 0) {
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+			zip->compression = COMPRESSION_BZIP2;
+			ret = ARCHIVE_OK;
+#else
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "bzip2 compression not supported");
+#endif
+		} else if (strcmp(val, "lzma") == 0) {
+#ifdef HAVE_LZMA_H
+			zip->compression = COMPRESSION_LZMA;
+			ret = ARCHIVE_OK;
+#else
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "lzma compression not supported");
 #endif
 		} else if (strcmp(val, "store") == 0) {
 			zip->compression = COMPRESSION_STORE;
@@ -246,6 +404,47 @@ archive_write_zip_options(struct archive_write *a, const char *key,
 			else
 				ret = ARCHIVE_FATAL;
 		}
+	} else if (strcmp(key, "zip64") == 0) {
+		/* "zip64" forces Zip64 extensions, "!zip64" disables
+		 * them; by default they are used where needed. */
+		zip->zip64 = (val != NULL && val[0] != 0) ?
+		    ZIP64_ALWAYS : ZIP64_NEVER;
+		ret = ARCHIVE_OK;
+	} else if (strcmp(key, "auto-store") == 0) {
+		/* Store files that deflate wouldn't shrink. */
+		zip->auto_store = val != NULL && val[0] != 0;
+		ret = ARCHIVE_OK;
+	} else if (strcmp(key, "threads") == 0) {
+		int n = 0;
+
+		if (val == NULL || val[0] == 0) {
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "%s: threads option needs a number",
+			    a->format_name);
+			return (ARCHIVE_FAILED);
+		}
+		for (; *val != '\0'; val++) {
+			if (*val >= '0' && *val <= '9')
+				n = n * 10 + (*val - '0');
+			if (*val < '0' || *val > '9' || n > 1024) {
+				archive_set_error(&a->archive,
+				    ARCHIVE_ERRNO_MISC,
+				    "%s: invalid threads option",
+				    a->format_name);
+				return (ARCHIVE_FAILED);
+			}
+		}
+		zip->threads = n;
+		if (zip->parallel != NULL) {
+			__archive_parallel_free(zip->parallel);
+			zip->parallel = NULL;
+		}
+#ifdef HAVE_ZLIB_H
+		/* Only deflate has anything for the workers to do. */
+		if (n > 0)
+			zip->parallel = __archive_parallel_new(n);
+#endif
+		ret = ARCHIVE_OK;
 	} else
 		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
 		    "%s: unknown keyword ``%s''", a->format_name, key);
@@ -279,16 +478,17 @@ archive_write_set_format_zip(struct archive *_a)
 
 #ifdef HAVE_ZLIB_H
 	zip->compression = COMPRESSION_DEFLATE;
+#else
+	zip->compression = COMPRESSION_STORE;
+#endif
 	zip->len_buf = 65536;
 	zip->buf = malloc(zip->len_buf);
 	if (zip->buf == NULL) {
 		archive_set_error(&a->archive, ENOMEM,
 		    "Can't allocate compression buffer");
+		free(zip);
 		return (ARCHIVE_FATAL);
 	}
-#else
-	zip->compression = COMPRESSION_STORE;
-#endif
 
 	a->format_data = zip;
 	a->format_name = "zip";
@@ -325,9 +525,12 @@ archive_write_zip_header(struct archive_write *a, struct archive_entry *entry)
 	struct zip *zip;
 	uint8_t h[SIZE_LOCAL_FILE_HEADER];
 	uint8_t e[SIZE_EXTRA_DATA_LOCAL];
-	uint8_t *d;
+	uint8_t z[SIZE_EXTRA_DATA_ZIP64];
 	struct zip_file_header_link *l;
+	struct zip_job *job = NULL;
 	struct archive_string_conv *sconv;
+	unsigned char *head, *p;
+	size_t head_size;
 	int ret, ret2 = ARCHIVE_OK;
 	int64_t size;
 	mode_t type;
@@ -365,10 +568,42 @@ archive_write_zip_header(struct archive_write *a, struct archive_entry *entry)
 #endif
 		}
 	}
-	d = zip->data_descriptor;
 	size = archive_entry_size(entry);
 	zip->remaining_data_bytes = size;
 
+	/* Stored sizes of 0xffffffff would mean "see the Zip64 field". */
+	if (zip->zip64 == ZIP64_NEVER && type == AE_IFREG &&
+	    size > (zip->compression == COMPRESSION_STORE ?
+	    ZIP_4GB_MAX - 1 : ZIP_4GB_DEFLATE_MAX)) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Files larger than 4GiB require Zip64 extensions");
+		return (ARCHIVE_FAILED);
+	}
+
+	/* With threads, a regular file's data is collected and deflated
+	 * on a worker.  Anything else is written on the spot, after the
+	 * entries the workers have. */
+	if (zip->parallel != NULL) {
+#ifdef HAVE_ZLIB_H
+		if (type == AE_IFREG && size <= ZIP_JOB_MAX &&
+		    zip->compression == COMPRESSION_DEFLATE) {
+			job = (struct zip_job *)calloc(1, sizeof(*job));
+			if (job == NULL || (job->in =
+			    malloc(size > 0 ? (size_t)size : 1)) == NULL) {
+				free(job);
+				archive_set_error(&a->archive, ENOMEM,
+				    "Can't allocate zip data");
+				return (ARCHIVE_FATAL);
+			}
+			job->in_size = (size_t)size;
+			job->auto_store = zip->auto_store;
+			zip->job = job;
+		} else
+#endif
+		if (zip_parallel_write(a, 0) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+	}
+
 	/* Append archive entry to the central directory data. */
 	l = (struct zip_file_header_link *) malloc(sizeof(*l));
 	if (l == NULL) {
@@ -429,8 +664,8 @@ archive_write_zip_header(struct archive_write *a, struct archive_entry *entry)
 	    is_all_ascii(archive_entry_pathname(l->entry)))
 		l->flags &= ~ZIP_FLAGS_UTF8_NAME;
 
-	/* Initialize the CRC variable and potentially the local crc32(). */
-	l->crc32 = crc32(0, NULL, 0);
+	/* Initialize the CRC variable. */
+	l->crc32 = __archive_crc32(0, NULL, 0);
 	if (type == AE_IFLNK) {
 		const char *p = archive_entry_symlink(l->entry);
 		if (p != NULL)
@@ -445,6 +680,14 @@ archive_write_zip_header(struct archive_write *a, struct archive_entry *entry)
 		l->compression = zip->compression;
 		l->compressed_size = 0;
 	}
+	if (zip->zip64 == ZIP64_ALWAYS)
+		l->zip64 = 1;
+	else if (zip->zip64 == ZIP64_NEVER)
+		l->zip64 = 0;
+	else if (l->compression == COMPRESSION_STORE)
+		l->zip64 = size >= ZIP_4GB_MAX;
+	else
+		l->zip64 = size > ZIP_4GB_DEFLATE_MAX;
 	l->next = NULL;
 	if (zip->central_directory == NULL) {
 		zip->central_directory = l;
@@ -452,15 +695,25 @@ archive_write_zip_header(struct archive_write *a, struct archive_entry *entry)
 		zip->central_directory_end->next = l;
 	}
 	zip->central_directory_end = l;
+	zip->entry_open = 1;
+	if (job != NULL)
+		job->l = l;
 
 	/* Store the offset of this header for later use in central
 	 * directory. */
 	l->offset = zip->written_bytes;
+#ifdef HAVE_LZMA_H
+	/* We don't know the size ahead of time, as a streamed entry
+	 * goes, so the LZMA data ends with a marker. */
+	if (l->compression == COMPRESSION_LZMA)
+		l->flags |= ZIP_FLAGS_LZMA_EOPM;
+#endif
 
 	memset(h, 0, sizeof(h));
 	archive_le32enc(&h[LOCAL_FILE_HEADER_SIGNATURE],
 		ZIP_SIGNATURE_LOCAL_FILE_HEADER);
-	archive_le16enc(&h[LOCAL_FILE_HEADER_VERSION], ZIP_VERSION_EXTRACT);
+	archive_le16enc(&h[LOCAL_FILE_HEADER_VERSION],
+		zip_version_extract(l->compression, l->zip64));
 	archive_le16enc(&h[LOCAL_FILE_HEADER_FLAGS], l->flags);
 	archive_le16enc(&h[LOCAL_FILE_HEADER_COMPRESSION], l->compression);
 	archive_le32enc(&h[LOCAL_FILE_HEADER_TIMEDATE],
@@ -474,30 +727,64 @@ archive_write_zip_header(struct archive_write *a, struct archive_entry *entry)
 		 * specification says to set to zero when using data
 		 * descriptors. Otherwise the end of the data for an
 		 * entry is rather difficult to find. */
-		archive_le32enc(&h[LOCAL_FILE_HEADER_COMPRESSED_SIZE], size);
-		archive_le32enc(&h[LOCAL_FILE_HEADER_UNCOMPRESSED_SIZE], size);
+		archive_le32enc(&h[LOCAL_FILE_HEADER_COMPRESSED_SIZE],
+			l->zip64 ? ZIP_4GB_MAX : size);
+		archive_le32enc(&h[LOCAL_FILE_HEADER_UNCOMPRESSED_SIZE],
+			l->zip64 ? ZIP_4GB_MAX : size);
 		break;
 #ifdef HAVE_ZLIB_H
 	case COMPRESSION_DEFLATE:
-		archive_le32enc(&h[LOCAL_FILE_HEADER_UNCOMPRESSED_SIZE], size);
-
-		zip->stream.zalloc = Z_NULL;
-		zip->stream.zfree = Z_NULL;
-		zip->stream.opaque = Z_NULL;
-		zip->stream.next_out = zip->buf;
-		zip->stream.avail_out = zip->len_buf;
-		if (deflateInit2(&zip->stream, Z_DEFAULT_COMPRESSION,
-		    Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
-			archive_set_error(&a->archive, ENOMEM,
-			    "Can't init deflate compressor");
-			return (ARCHIVE_FATAL);
+		archive_le32enc(&h[LOCAL_FILE_HEADER_UNCOMPRESSED_SIZE],
+			l->zip64 ? ZIP_4GB_MAX : size);
+		if (l->zip64)
+			archive_le32enc(&h[LOCAL_FILE_HEADER_COMPRESSED_SIZE],
+				ZIP_4GB_MAX);
+		if (job != NULL)
+			break;
+		/* With auto-store, the header and the choice of method
+		 * wait for the first ZIP_SAMPLE_SIZE bytes. */
+		if (zip->auto_store && type == AE_IFREG && size > 0) {
+			if (zip->sample == NULL &&
+			    (zip->sample = malloc(ZIP_SAMPLE_SIZE)) == NULL) {
+				archive_set_error(&a->archive, ENOMEM,
+				    "Can't allocate zip data");
+				return (ARCHIVE_FATAL);
+			}
+			zip->sampling = 1;
+			zip->sample_used = 0;
+			break;
 		}
+		if (zip_deflate_init(a) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		break;
+#endif
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+	case COMPRESSION_BZIP2:
+		archive_le32enc(&h[LOCAL_FILE_HEADER_UNCOMPRESSED_SIZE],
+			l->zip64 ? ZIP_4GB_MAX : size);
+		if (l->zip64)
+			archive_le32enc(&h[LOCAL_FILE_HEADER_COMPRESSED_SIZE],
+				ZIP_4GB_MAX);
+		if (zip_bzip2_init(a) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		break;
+#endif
+#ifdef HAVE_LZMA_H
+	case COMPRESSION_LZMA:
+		archive_le32enc(&h[LOCAL_FILE_HEADER_UNCOMPRESSED_SIZE],
+			l->zip64 ? ZIP_4GB_MAX : size);
+		if (l->zip64)
+			archive_le32enc(&h[LOCAL_FILE_HEADER_COMPRESSED_SIZE],
+				ZIP_4GB_MAX);
+		if (zip_lzma_init(a) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
 		break;
 #endif
 	}
 
 	/* Formatting extra data. */
-	archive_le16enc(&h[LOCAL_FILE_HEADER_EXTRA_LENGTH], sizeof(e));
+	archive_le16enc(&h[LOCAL_FILE_HEADER_EXTRA_LENGTH],
+		sizeof(e) + (l->zip64 ? 4 + 16 : 0));
 	archive_le16enc(&e[EXTRA_DATA_LOCAL_TIME_ID],
 		ZIP_SIGNATURE_EXTRA_TIMESTAMP);
 	archive_le16enc(&e[EXTRA_DATA_LOCAL_TIME_SIZE], 1 + 4 * 3);
@@ -517,32 +804,54 @@ archive_write_zip_header(struct archive_write *a, struct archive_entry *entry)
 	archive_le32enc(&e[EXTRA_DATA_LOCAL_UNIX_GID],
 		archive_entry_gid(entry));
 
-	archive_le32enc(&d[DATA_DESCRIPTOR_UNCOMPRESSED_SIZE], size);
-
-	ret = __archive_write_output(a, h, sizeof(h));
-	if (ret != ARCHIVE_OK)
-		return (ARCHIVE_FATAL);
-	zip->written_bytes += sizeof(h);
-
-	ret = write_path(l->entry, a);
-	if (ret <= ARCHIVE_OK)
-		return (ARCHIVE_FATAL);
-	zip->written_bytes += ret;
-
-	ret = __archive_write_output(a, e, sizeof(e));
-	if (ret != ARCHIVE_OK)
+	/* In a local header, the Zip64 field has both sizes; the
+	 * compressed size is only known up front if it's stored. */
+	archive_le16enc(&z[EXTRA_DATA_ZIP64_ID], ZIP_SIGNATURE_EXTRA_ZIP64);
+	archive_le16enc(&z[EXTRA_DATA_ZIP64_SIZE], 16);
+	archive_le64enc(&z[EXTRA_DATA_ZIP64_DATA], size);
+	archive_le64enc(&z[EXTRA_DATA_ZIP64_DATA + 8],
+		l->compression == COMPRESSION_STORE ? size : 0);
+
+	/* Assemble the whole header (and a symlink's target), so that
+	 * a job can hold on to it until its turn comes. */
+	head_size = sizeof(h) + path_length(l->entry) + sizeof(e) +
+	    (l->zip64 ? 4 + 16 : 0) + (type == AE_IFLNK ? (size_t)size : 0);
+	if (job != NULL)
+		head = job->head = malloc(head_size);
+	else if (archive_string_ensure(&zip->head, head_size) != NULL)
+		head = (unsigned char *)zip->head.s;
+	else
+		head = NULL;
+	if (head == NULL) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate zip header data");
 		return (ARCHIVE_FATAL);
-	zip->written_bytes += sizeof(e);
-
-	if (type == AE_IFLNK) {
-		const unsigned char *p;
+	}
+	p = head;
+	memcpy(p, h, sizeof(h));
+	p += sizeof(h);
+	copy_path(l->entry, p);
+	p += path_length(l->entry);
+	memcpy(p, e, sizeof(e));
+	p += sizeof(e);
+	if (l->zip64) {
+		memcpy(p, z, 4 + 16);
+		p += 4 + 16;
+	}
+	if (type == AE_IFLNK && size > 0) {
+		memcpy(p, archive_entry_symlink(l->entry), (size_t)size);
+		l->crc32 = __archive_crc32(l->crc32, p, (size_t)size);
+	}
 
-		p = (const unsigned char *)archive_entry_symlink(l->entry);
-		ret = __archive_write_output(a, p, size);
+	if (job != NULL)
+		job->head_size = head_size;
+	else if (zip->sampling)
+		zip->head.length = head_size;
+	else {
+		ret = __archive_write_output(a, head, head_size);
 		if (ret != ARCHIVE_OK)
 			return (ARCHIVE_FATAL);
-		zip->written_bytes += size;
-		l->crc32 = crc32(l->crc32, p, size);
+		zip->written_bytes += head_size;
 	}
 
 	if (ret2 != ARCHIVE_OK)
@@ -562,6 +871,36 @@ archive_write_zip_data(struct archive_write *a, const void *buff, size_t s)
 
 	if (s == 0) return 0;
 
+	if (zip->job != NULL) {
+		memcpy(zip->job->in + zip->job->in_used, buff, s);
+		zip->job->in_used += s;
+		zip->remaining_data_bytes -= s;
+		return (s);
+	}
+
+	if (zip->sampling) {
+		/* remaining_data_bytes still counts the sample. */
+		size_t n = ZIP_SAMPLE_SIZE - zip->sample_used;
+		ssize_t r;
+
+		if (n > s)
+			n = s;
+		memcpy(zip->sample + zip->sample_used, buff, n);
+		zip->sample_used += n;
+		if (zip->sample_used < ZIP_SAMPLE_SIZE &&
+		    (int64_t)zip->sample_used < zip->remaining_data_bytes)
+			return (n);
+		ret = zip_sample_write(a);
+		if (ret != ARCHIVE_OK)
+			return (ret);
+		if (n == s)
+			return (s);
+		r = archive_write_zip_data(a, (const char *)buff + n, s - n);
+		if (r < 0)
+			return (r);
+		return (n + r);
+	}
+
 	switch (l->compression) {
 	case COMPRESSION_STORE:
 		ret = __archive_write_output(a, buff, s);
@@ -569,7 +908,7 @@ archive_write_zip_data(struct archive_write *a, const void *buff, size_t s)
 		zip->written_bytes += s;
 		zip->remaining_data_bytes -= s;
 		l->compressed_size += s;
-		l->crc32 = crc32(l->crc32, buff, s);
+		l->crc32 = __archive_crc32(l->crc32, buff, s);
 		return (s);
 #if HAVE_ZLIB_H
 	case COMPRESSION_DEFLATE:
@@ -591,8 +930,54 @@ archive_write_zip_data(struct archive_write *a, const void *buff, size_t s)
 			}
 		} while (zip->stream.avail_in != 0);
 		zip->remaining_data_bytes -= s;
-		/* If we have it, use zlib's fast crc32() */
-		l->crc32 = crc32(l->crc32, buff, s);
+		l->crc32 = __archive_crc32(l->crc32, buff, s);
+		return (s);
+#endif
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+	case COMPRESSION_BZIP2:
+		zip->bzstream.next_in = (char *)(uintptr_t)buff;
+		zip->bzstream.avail_in = (unsigned int)s;
+		do {
+			ret = BZ2_bzCompress(&zip->bzstream, BZ_RUN);
+			if (ret != BZ_RUN_OK)
+				return (ARCHIVE_FATAL);
+			if (zip->bzstream.avail_out == 0) {
+				ret = __archive_write_output(a, zip->buf,
+					zip->len_buf);
+				if (ret != ARCHIVE_OK)
+					return (ret);
+				l->compressed_size += zip->len_buf;
+				zip->written_bytes += zip->len_buf;
+				zip->bzstream.next_out = (char *)zip->buf;
+				zip->bzstream.avail_out =
+				    (unsigned int)zip->len_buf;
+			}
+		} while (zip->bzstream.avail_in != 0);
+		zip->remaining_data_bytes -= s;
+		l->crc32 = __archive_crc32(l->crc32, buff, s);
+		return (s);
+#endif
+#ifdef HAVE_LZMA_H
+	case COMPRESSION_LZMA:
+		zip->lzstream.next_in = buff;
+		zip->lzstream.avail_in = s;
+		do {
+			ret = lzma_code(&zip->lzstream, LZMA_RUN);
+			if (ret != LZMA_OK)
+				return (ARCHIVE_FATAL);
+			if (zip->lzstream.avail_out == 0) {
+				ret = __archive_write_output(a, zip->buf,
+					zip->len_buf);
+				if (ret != ARCHIVE_OK)
+					return (ret);
+				l->compressed_size += zip->len_buf;
+				zip->written_bytes += zip->len_buf;
+				zip->lzstream.next_out = zip->buf;
+				zip->lzstream.avail_out = zip->len_buf;
+			}
+		} while (zip->lzstream.avail_in != 0);
+		zip->remaining_data_bytes -= s;
+		l->crc32 = __archive_crc32(l->crc32, buff, s);
 		return (s);
 #endif
 
@@ -609,12 +994,42 @@ archive_write_zip_finish_entry(struct archive_write *a)
 	/* Write the data descripter after file data has been written. */
 	int ret;
 	struct zip *zip = a->format_data;
-	uint8_t *d = zip->data_descriptor;
 	struct zip_file_header_link *l = zip->central_directory_end;
-#if HAVE_ZLIB_H
+	struct zip_job *job = zip->job;
+#if defined(HAVE_ZLIB_H) || defined(HAVE_LZMA_H) || \
+    (defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR))
 	size_t reminder;
 #endif
 
+	if (!zip->entry_open)
+		return (ARCHIVE_OK);
+	zip->entry_open = 0;
+
+	if (job != NULL) {
+		zip->job = NULL;
+		if (__archive_parallel_submit(zip->parallel, zip_job_run, job)
+		    == ARCHIVE_OK) {
+			zip->parallel_bytes += job->in_size;
+			/* Keep a few jobs per thread going, within a
+			 * memory budget. */
+			return (zip_parallel_write(a, zip->threads * 4));
+		}
+		/* Do it here instead, after the ones ahead of it. */
+		zip_job_run(job);
+		ret = zip_parallel_write(a, 0);
+		if (ret == ARCHIVE_OK)
+			ret = zip_job_write(a, job);
+		zip_job_free(job);
+		return (ret);
+	}
+
+	/* The file was shorter than the sample. */
+	if (zip->sampling) {
+		ret = zip_sample_write(a);
+		if (ret != ARCHIVE_OK)
+			return (ret);
+	}
+
 	switch(l->compression) {
 	case COMPRESSION_STORE:
 		break;
@@ -637,19 +1052,429 @@ archive_write_zip_finish_entry(struct archive_write *a)
 		}
 		deflateEnd(&zip->stream);
 		break;
+#endif
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+	case COMPRESSION_BZIP2:
+		do {
+			ret = BZ2_bzCompress(&zip->bzstream, BZ_FINISH);
+			if (ret != BZ_FINISH_OK && ret != BZ_STREAM_END)
+				return (ARCHIVE_FATAL);
+			reminder = zip->len_buf - zip->bzstream.avail_out;
+			if (__archive_write_output(a, zip->buf, reminder)
+			    != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+			l->compressed_size += reminder;
+			zip->written_bytes += reminder;
+			zip->bzstream.next_out = (char *)zip->buf;
+			zip->bzstream.avail_out = (unsigned int)zip->len_buf;
+		} while (ret != BZ_STREAM_END);
+		BZ2_bzCompressEnd(&zip->bzstream);
+		zip->bzstream_valid = 0;
+		break;
+#endif
+#ifdef HAVE_LZMA_H
+	case COMPRESSION_LZMA:
+		do {
+			ret = lzma_code(&zip->lzstream, LZMA_FINISH);
+			if (ret != LZMA_OK && ret != LZMA_STREAM_END)
+				return (ARCHIVE_FATAL);
+			reminder = zip->len_buf - zip->lzstream.avail_out;
+			if (__archive_write_output(a, zip->buf, reminder)
+			    != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+			l->compressed_size += reminder;
+			zip->written_bytes += reminder;
+			zip->lzstream.next_out = zip->buf;
+			zip->lzstream.avail_out = zip->len_buf;
+		} while (ret != LZMA_STREAM_END);
+		break;
 #endif
 	}
+	return (zip_write_data_descriptor(a, l));
+}
+
+static int
+zip_write_data_descriptor(struct archive_write *a,
+    struct zip_file_header_link *l)
+{
+	struct zip *zip = a->format_data;
+	uint8_t *d = zip->data_descriptor;
+	size_t size;
+	int ret;
 
 	archive_le32enc(&d[DATA_DESCRIPTOR_CRC32], l->crc32);
-	archive_le32enc(&d[DATA_DESCRIPTOR_COMPRESSED_SIZE],
-		l->compressed_size);
-	ret = __archive_write_output(a, d, SIZE_DATA_DESCRIPTOR);
+	if (l->zip64) {
+		archive_le64enc(&d[DATA_DESCRIPTOR_COMPRESSED_SIZE],
+			l->compressed_size);
+		archive_le64enc(&d[DATA_DESCRIPTOR_ZIP64_UNCOMPRESSED_SIZE],
+			archive_entry_size(l->entry));
+		size = SIZE_DATA_DESCRIPTOR_ZIP64;
+	} else {
+		if (l->compressed_size > ZIP_4GB_MAX) {
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "Compressed data larger than 4GiB requires"
+			    " Zip64 extensions");
+			return (ARCHIVE_FATAL);
+		}
+		archive_le32enc(&d[DATA_DESCRIPTOR_COMPRESSED_SIZE],
+			l->compressed_size);
+		archive_le32enc(&d[DATA_DESCRIPTOR_UNCOMPRESSED_SIZE],
+			archive_entry_size(l->entry));
+		size = SIZE_DATA_DESCRIPTOR;
+	}
+	ret = __archive_write_output(a, d, size);
 	if (ret != ARCHIVE_OK)
 		return (ARCHIVE_FATAL);
-	zip->written_bytes += SIZE_DATA_DESCRIPTOR;
+	zip->written_bytes += size;
 	return (ARCHIVE_OK);
 }
 
+static int
+zip_deflate_init(struct archive_write *a)
+{
+#ifdef HAVE_ZLIB_H
+	struct zip *zip = a->format_data;
+
+	zip->stream.zalloc = Z_NULL;
+	zip->stream.zfree = Z_NULL;
+	zip->stream.opaque = Z_NULL;
+	zip->stream.next_out = zip->buf;
+	zip->stream.avail_out = zip->len_buf;
+	if (deflateInit2(&zip->stream, Z_DEFAULT_COMPRESSION,
+	    Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't init deflate compressor");
+		return (ARCHIVE_FATAL);
+	}
+	return (ARCHIVE_OK);
+#else
+	archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+	    "deflate compression not supported");
+	return (ARCHIVE_FATAL);
+#endif
+}
+
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+static int
+zip_bzip2_init(struct archive_write *a)
+{
+	struct zip *zip = a->format_data;
+
+	if (zip->bzstream_valid)
+		BZ2_bzCompressEnd(&zip->bzstream);
+	memset(&zip->bzstream, 0, sizeof(zip->bzstream));
+	zip->bzstream.next_out = (char *)zip->buf;
+	zip->bzstream.avail_out = (unsigned int)zip->len_buf;
+	if (BZ2_bzCompressInit(&zip->bzstream, 9, 0, 30) != BZ_OK) {
+		zip->bzstream_valid = 0;
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't init bzip2 compressor");
+		return (ARCHIVE_FATAL);
+	}
+	zip->bzstream_valid = 1;
+	return (ARCHIVE_OK);
+}
+#endif
+
+#ifdef HAVE_LZMA_H
+/*
+ * LZMA data in a Zip entry is raw LZMA1 behind a short header: the
+ * version of the library that wrote it, the size of the properties
+ * (always 5) and the properties.  The header goes into the output
+ * buffer first, so it is written and counted with the data.
+ */
+static int
+zip_lzma_init(struct archive_write *a)
+{
+	struct zip *zip = a->format_data;
+	lzma_options_lzma options;
+	lzma_filter filters[2];
+
+	if (lzma_lzma_preset(&options, LZMA_PRESET_DEFAULT)) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Can't init lzma compressor");
+		return (ARCHIVE_FATAL);
+	}
+	filters[0].id = LZMA_FILTER_LZMA1;
+	filters[0].options = &options;
+	filters[1].id = LZMA_VLI_UNKNOWN;
+	filters[1].options = NULL;
+	if (lzma_raw_encoder(&zip->lzstream, filters) != LZMA_OK) {
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't init lzma compressor");
+		return (ARCHIVE_FATAL);
+	}
+	zip->lzstream_valid = 1;
+	zip->buf[0] = LZMA_VERSION_MAJOR;
+	zip->buf[1] = LZMA_VERSION_MINOR;
+	archive_le16enc(zip->buf + 2, 5);
+	if (lzma_properties_encode(&filters[0], zip->buf + 4) != LZMA_OK) {
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Can't init lzma compressor");
+		return (ARCHIVE_FATAL);
+	}
+	zip->lzstream.next_out = zip->buf + 9;
+	zip->lzstream.avail_out = zip->len_buf - 9;
+	return (ARCHIVE_OK);
+}
+#endif
+
+/*
+ * Version needed to extract an entry: 2.0, or later for Zip64 and for
+ * the newer compression methods.
+ */
+static int
+zip_version_extract(enum compression compression, int zip64)
+{
+	switch (compression) {
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+	case COMPRESSION_BZIP2:
+		return (ZIP_VERSION_BZIP2);
+#endif
+#ifdef HAVE_LZMA_H
+	case COMPRESSION_LZMA:
+		return (ZIP_VERSION_LZMA);
+#endif
+	default:
+		return (zip64 ? ZIP_VERSION_ZIP64 : ZIP_VERSION_EXTRACT);
+	}
+}
+
+/*
+ * auto-store: guess whether deflate is worth it from the start of a
+ * file.  Already-compressed data (JPEG, MP4, Zip, ...) barely
+ * shrinks; we ask the fastest deflate level to save at least 1/32
+ * of the sample, using "out" (as big as the sample) for its output.
+ * Returns 1 to deflate, 0 to store, -1 if out of memory.
+ */
+static int
+zip_compressible(const unsigned char *p, size_t len, unsigned char *out)
+{
+#ifdef HAVE_ZLIB_H
+	z_stream stream;
+	int r;
+
+	memset(&stream, 0, sizeof(stream));
+	if (deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED, -15, 8,
+	    Z_DEFAULT_STRATEGY) != Z_OK)
+		return (-1);
+	stream.next_in = (unsigned char *)(uintptr_t)p;
+	stream.avail_in = (uInt)len;
+	stream.next_out = out;
+	stream.avail_out = (uInt)(len - len / 32);
+	r = deflate(&stream, Z_FINISH);
+	deflateEnd(&stream);
+	return (r == Z_STREAM_END);
+#else
+	(void)p; /* UNUSED */
+	(void)len; /* UNUSED */
+	(void)out; /* UNUSED */
+	return (0);
+#endif
+}
+
+/*
+ * Make the local file header of an entry that was going to be
+ * deflated into one for a stored entry.
+ */
+static void
+zip_head_store(struct zip_file_header_link *l, unsigned char *head)
+{
+	int64_t size = archive_entry_size(l->entry);
+
+	l->compression = COMPRESSION_STORE;
+	archive_le16enc(&head[LOCAL_FILE_HEADER_COMPRESSION],
+		COMPRESSION_STORE);
+	if (l->zip64)
+		archive_le64enc(&head[SIZE_LOCAL_FILE_HEADER +
+		    path_length(l->entry) + SIZE_EXTRA_DATA_LOCAL +
+		    EXTRA_DATA_ZIP64_DATA + 8], size);
+	else
+		archive_le32enc(&head[LOCAL_FILE_HEADER_COMPRESSED_SIZE],
+			size);
+}
+
+/*
+ * The sample is complete: settle the method, write the header and
+ * then the sample itself.
+ */
+static int
+zip_sample_write(struct archive_write *a)
+{
+	struct zip *zip = a->format_data;
+	struct zip_file_header_link *l = zip->central_directory_end;
+	ssize_t r;
+	int ret;
+
+	zip->sampling = 0;
+	switch (zip_compressible(zip->sample, zip->sample_used, zip->buf)) {
+	case 0:
+		zip_head_store(l, (unsigned char *)zip->head.s);
+		break;
+	case 1:
+		if (zip_deflate_init(a) != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		break;
+	default:
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't init deflate compressor");
+		return (ARCHIVE_FATAL);
+	}
+	ret = __archive_write_output(a, zip->head.s, zip->head.length);
+	if (ret != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	zip->written_bytes += zip->head.length;
+	r = archive_write_zip_data(a, zip->sample, zip->sample_used);
+	if (r < 0)
+		return ((int)r);
+	return (ARCHIVE_OK);
+}
+
+/*
+ * Deflating entries on worker threads.
+ *
+ * With the threads option, the data of each regular file up to
+ * ZIP_JOB_MAX is collected in memory along with its local file header,
+ * and a worker computes its CRC and deflates it.  Finished jobs are
+ * written out in the order their entries were added, each followed
+ * by its data descriptor, so the archive is the same as one written
+ * without threads.  Other entries wait until the jobs ahead of them
+ * have been written.
+ */
+static void
+zip_job_free(struct zip_job *job)
+{
+	if (job == NULL)
+		return;
+	free(job->head);
+	free(job->in);
+	free(job->out);
+	free(job);
+}
+
+static void
+zip_job_run(void *_job)
+{
+	struct zip_job *job = (struct zip_job *)_job;
+#ifdef HAVE_ZLIB_H
+	z_stream stream;
+	int r;
+
+	job->crc32 = __archive_crc32(0, job->in, job->in_used);
+	if (job->auto_store && job->in_used > 0) {
+		/* Judge from the same sample as the calling thread
+		 * would, so the archive comes out the same. */
+		job->out = malloc(ZIP_SAMPLE_SIZE);
+		if (job->out == NULL) {
+			job->status = ZIP_JOB_NOMEM;
+			return;
+		}
+		r = zip_compressible(job->in, job->in_used < ZIP_SAMPLE_SIZE ?
+		    job->in_used : ZIP_SAMPLE_SIZE, job->out);
+		free(job->out);
+		job->out = NULL;
+		if (r < 0) {
+			job->status = ZIP_JOB_NOMEM;
+			return;
+		}
+		if (r == 0) {
+			job->stored = 1;
+			return;
+		}
+	}
+	memset(&stream, 0, sizeof(stream));
+	if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION,
+	    Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		job->status = ZIP_JOB_NOMEM;
+		return;
+	}
+	job->out_size = deflateBound(&stream, (uLong)job->in_used);
+	job->out = malloc(job->out_size);
+	if (job->out == NULL) {
+		deflateEnd(&stream);
+		job->status = ZIP_JOB_NOMEM;
+		return;
+	}
+	stream.next_in = job->in;
+	stream.avail_in = (uInt)job->in_used;
+	stream.next_out = job->out;
+	stream.avail_out = (uInt)job->out_size;
+	r = deflate(&stream, Z_FINISH);
+	job->out_size = stream.total_out;
+	deflateEnd(&stream);
+	if (r != Z_STREAM_END)
+		job->status = ZIP_JOB_FAILED;
+#else
+	job->status = ZIP_JOB_FAILED;
+#endif
+}
+
+static int
+zip_job_write(struct archive_write *a, struct zip_job *job)
+{
+	struct zip *zip = a->format_data;
+	struct zip_file_header_link *l = job->l;
+	int ret;
+
+	switch (job->status) {
+	case ZIP_JOB_OK:
+		break;
+	case ZIP_JOB_NOMEM:
+		archive_set_error(&a->archive, ENOMEM,
+		    "Can't allocate memory for deflate compression");
+		return (ARCHIVE_FATAL);
+	default:
+		archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+		    "Deflate compression failed");
+		return (ARCHIVE_FATAL);
+	}
+
+	if (job->stored) {
+		zip_head_store(l, job->head);
+		free(job->out);
+		job->out = job->in;
+		job->out_size = job->in_used;
+		job->in = NULL;
+	}
+	l->offset = zip->written_bytes;
+	ret = __archive_write_output(a, job->head, job->head_size);
+	if (ret != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	zip->written_bytes += job->head_size;
+	ret = __archive_write_output(a, job->out, job->out_size);
+	if (ret != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
+	zip->written_bytes += job->out_size;
+	l->crc32 = job->crc32;
+	l->compressed_size = job->out_size;
+	return (zip_write_data_descriptor(a, l));
+}
+
+/*
+ * Write out finished jobs, oldest first, until no more than "keep"
+ * are left and those hold less than the memory budget.
+ */
+static int
+zip_parallel_write(struct archive_write *a, int keep)
+{
+	struct zip *zip = a->format_data;
+	struct zip_job *job;
+	int pending, ret;
+
+	for (;;) {
+		pending = __archive_parallel_pending(zip->parallel);
+		if (pending <= keep && (pending == 0 || zip->parallel_bytes
+		    < (size_t)zip->threads * ZIP_JOB_MAX))
+			return (ARCHIVE_OK);
+		job = (struct zip_job *)__archive_parallel_next(zip->parallel);
+		zip->parallel_bytes -= job->in_size;
+		ret = zip_job_write(a, job);
+		zip_job_free(job);
+		if (ret != ARCHIVE_OK)
+			return (ret);
+	}
+}
+
 static int
 archive_write_zip_close(struct archive_write *a)
 {
@@ -658,11 +1483,17 @@ archive_write_zip_close(struct archive_write *a)
 	uint8_t h[SIZE_FILE_HEADER];
 	uint8_t end[SIZE_CENTRAL_DIRECTORY_END];
 	uint8_t e[SIZE_EXTRA_DATA_CENTRAL];
-	int64_t offset_start, offset_end;
-	int entries;
+	uint8_t z[SIZE_EXTRA_DATA_ZIP64];
+	uint8_t end64[SIZE_ZIP64_END + SIZE_ZIP64_LOCATOR];
+	uint8_t *locator = end64 + SIZE_ZIP64_END;
+	int64_t offset_start, offset_end, size;
+	int64_t entries;
+	size_t zlen;
 	int ret;
 
 	zip = a->format_data;
+	if (zip->parallel != NULL && zip_parallel_write(a, 0) != ARCHIVE_OK)
+		return (ARCHIVE_FATAL);
 	l = zip->central_directory;
 
 	/*
@@ -677,7 +1508,7 @@ archive_write_zip_close(struct archive_write *a)
 	memset(h, 0, sizeof(h));
 	archive_le32enc(&h[FILE_HEADER_SIGNATURE], ZIP_SIGNATURE_FILE_HEADER);
 	archive_le16enc(&h[FILE_HEADER_VERSION_BY], ZIP_VERSION_BY);
-	archive_le16enc(&h[FILE_HEADER_VERSION_EXTRACT], ZIP_VERSION_EXTRACT);
+	archive_le16enc(&z[EXTRA_DATA_ZIP64_ID], ZIP_SIGNATURE_EXTRA_ZIP64);
 
 	entries = 0;
 	offset_start = zip->written_bytes;
@@ -690,16 +1521,43 @@ archive_write_zip_close(struct archive_write *a)
 		archive_le32enc(&h[FILE_HEADER_TIMEDATE],
 			dos_time(archive_entry_mtime(l->entry)));
 		archive_le32enc(&h[FILE_HEADER_CRC32], l->crc32);
-		archive_le32enc(&h[FILE_HEADER_COMPRESSED_SIZE],
-			l->compressed_size);
-		archive_le32enc(&h[FILE_HEADER_UNCOMPRESSED_SIZE],
-			archive_entry_size(l->entry));
+
+		/* Values that don't fit go in the Zip64 field, in
+		 * this order, with 0xffffffff in their usual place.
+		 * A Zip64 local header is matched by Zip64 sizes. */
+		zlen = 0;
+		size = archive_entry_size(l->entry);
+		if (l->zip64 || size >= ZIP_4GB_MAX) {
+			archive_le64enc(&z[EXTRA_DATA_ZIP64_DATA + zlen], size);
+			zlen += 8;
+			size = ZIP_4GB_MAX;
+		}
+		archive_le32enc(&h[FILE_HEADER_UNCOMPRESSED_SIZE], size);
+		size = l->compressed_size;
+		if (l->zip64 || size >= ZIP_4GB_MAX) {
+			archive_le64enc(&z[EXTRA_DATA_ZIP64_DATA + zlen], size);
+			zlen += 8;
+			size = ZIP_4GB_MAX;
+		}
+		archive_le32enc(&h[FILE_HEADER_COMPRESSED_SIZE], size);
+		size = l->offset;
+		if (zip->zip64 == ZIP64_ALWAYS || size >= ZIP_4GB_MAX) {
+			archive_le64enc(&z[EXTRA_DATA_ZIP64_DATA + zlen], size);
+			zlen += 8;
+			size = ZIP_4GB_MAX;
+		}
+		archive_le32enc(&h[FILE_HEADER_OFFSET], size);
+		archive_le16enc(&z[EXTRA_DATA_ZIP64_SIZE], zlen);
+		if (zlen > 0)
+			zlen += 4;
+
+		archive_le16enc(&h[FILE_HEADER_VERSION_EXTRACT],
+			zip_version_extract(l->compression, zlen > 0));
 		archive_le16enc(&h[FILE_HEADER_FILENAME_LENGTH],
 			(uint16_t)path_length(l->entry));
-		archive_le16enc(&h[FILE_HEADER_EXTRA_LENGTH], sizeof(e));
+		archive_le16enc(&h[FILE_HEADER_EXTRA_LENGTH], sizeof(e) + zlen);
 		archive_le16enc(&h[FILE_HEADER_ATTRIBUTES_EXTERNAL+2],
 			archive_entry_mode(l->entry));
-		archive_le32enc(&h[FILE_HEADER_OFFSET], l->offset);
 
 		/* Formatting extra data. */
 		archive_le16enc(&e[EXTRA_DATA_CENTRAL_TIME_ID],
@@ -727,20 +1585,65 @@ archive_write_zip_close(struct archive_write *a)
 			return (ARCHIVE_FATAL);
 		zip->written_bytes += sizeof(e);
 
+		if (zlen > 0) {
+			ret = __archive_write_output(a, z, zlen);
+			if (ret != ARCHIVE_OK)
+				return (ARCHIVE_FATAL);
+			zip->written_bytes += zlen;
+		}
+
 		l = l->next;
 		entries++;
 	}
 	offset_end = zip->written_bytes;
 
+	/* A Zip64 end of central directory record and its locator go
+	 * just before the ordinary end record when a count, size or
+	 * offset there would overflow. */
+	if (zip->zip64 == ZIP64_ALWAYS || entries >= 0xffff ||
+	    offset_end - offset_start >= ZIP_4GB_MAX ||
+	    offset_start >= ZIP_4GB_MAX) {
+		if (zip->zip64 == ZIP64_NEVER) {
+			archive_set_error(&a->archive, ARCHIVE_ERRNO_MISC,
+			    "Archive is too large without Zip64 extensions");
+			return (ARCHIVE_FATAL);
+		}
+		memset(end64, 0, sizeof(end64));
+		archive_le32enc(&end64[ZIP64_END_SIGNATURE],
+			ZIP_SIGNATURE_ZIP64_END);
+		archive_le64enc(&end64[ZIP64_END_SIZE], SIZE_ZIP64_END - 12);
+		archive_le16enc(&end64[ZIP64_END_VERSION_BY],
+			(ZIP_VERSION_BY & 0xff00) | ZIP_VERSION_ZIP64);
+		archive_le16enc(&end64[ZIP64_END_VERSION_EXTRACT],
+			ZIP_VERSION_ZIP64);
+		archive_le64enc(&end64[ZIP64_END_ENTRIES_DISK], entries);
+		archive_le64enc(&end64[ZIP64_END_ENTRIES], entries);
+		archive_le64enc(&end64[ZIP64_END_CD_SIZE],
+			offset_end - offset_start);
+		archive_le64enc(&end64[ZIP64_END_CD_OFFSET], offset_start);
+		archive_le32enc(&locator[ZIP64_LOCATOR_SIGNATURE],
+			ZIP_SIGNATURE_ZIP64_LOCATOR);
+		archive_le64enc(&locator[ZIP64_LOCATOR_OFFSET], offset_end);
+		archive_le32enc(&locator[ZIP64_LOCATOR_DISKS], 1);
+		ret = __archive_write_output(a, end64, sizeof(end64));
+		if (ret != ARCHIVE_OK)
+			return (ARCHIVE_FATAL);
+		zip->written_bytes += sizeof(end64);
+	}
+
 	/* Formatting end of central directory. */
 	memset(end, 0, sizeof(end));
 	archive_le32enc(&end[CENTRAL_DIRECTORY_END_SIGNATURE],
 		ZIP_SIGNATURE_CENTRAL_DIRECTORY_END);
-	archive_le16enc(&end[CENTRAL_DIRECTORY_END_ENTRIES_DISK], entries);
-	archive_le16enc(&end[CENTRAL_DIRECTORY_END_ENTRIES], entries);
+	archive_le16enc(&end[CENTRAL_DIRECTORY_END_ENTRIES_DISK],
+		entries < 0xffff ? entries : 0xffff);
+	archive_le16enc(&end[CENTRAL_DIRECTORY_END_ENTRIES],
+		entries < 0xffff ? entries : 0xffff);
 	archive_le32enc(&end[CENTRAL_DIRECTORY_END_SIZE],
-		offset_end - offset_start);
-	archive_le32enc(&end[CENTRAL_DIRECTORY_END_OFFSET], offset_start);
+		offset_end - offset_start < ZIP_4GB_MAX ?
+		offset_end - offset_start : ZIP_4GB_MAX);
+	archive_le32enc(&end[CENTRAL_DIRECTORY_END_OFFSET],
+		offset_start < ZIP_4GB_MAX ? offset_start : ZIP_4GB_MAX);
 
 	/* Writing end of central directory. */
 	ret = __archive_write_output(a, end, sizeof(end));
@@ -763,9 +1666,23 @@ archive_write_zip_free(struct archive_write *a)
 	   archive_entry_free(l->entry);
 	   free(l);
 	}
-#ifdef HAVE_ZLIB_H
-	free(zip->buf);
+	if (zip->parallel != NULL) {
+		while (__archive_parallel_pending(zip->parallel) > 0)
+			zip_job_free(__archive_parallel_next(zip->parallel));
+		__archive_parallel_free(zip->parallel);
+	}
+	zip_job_free(zip->job);
+	archive_string_free(&zip->head);
+	free(zip->sample);
+#if defined(HAVE_BZLIB_H) && defined(BZ_CONFIG_ERROR)
+	if (zip->bzstream_valid)
+		BZ2_bzCompressEnd(&zip->bzstream);
+#endif
+#ifdef HAVE_LZMA_H
+	if (zip->lzstream_valid)
+		lzma_end(&zip->lzstream);
 #endif
+	free(zip->buf);
 	free(zip);
 	a->format_data = NULL;
 	return (ARCHIVE_OK);
@@ -845,3 +1762,21 @@ write_path(struct archive_entry *entry, struct archive_write *archive)
 
 	return ((int)written_bytes);
 }
+
+static void
+copy_path(struct archive_entry *entry, unsigned char *p)
+{
+	const char *path;
+	size_t pathlen;
+	mode_t type;
+
+	path = archive_entry_pathname(entry);
+	pathlen = strlen(path);
+	type = archive_entry_filetype(entry);
+
+	memcpy(p, path, pathlen);
+
+	/* Folders are recognized by a traling slash. */
+	if ((type == AE_IFDIR) & (path[pathlen - 1] != '/'))
+		p[pathlen] = '/';
+}
@@ -0,0 +1,150 @@
+/*-
+ * Copyright (c) 2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "archive_platform.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * xxHash32, after the description by Yann Collet.  It reads four
+ * lanes of little-endian 32-bit words, so a block of input is
+ * processed without any table lookups.
+ */
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "archive_endian.h"
+#include "archive_xxhash_private.h"
+
+#define	PRIME1	2654435761U
+#define	PRIME2	2246822519U
+#define	PRIME3	3266489917U
+#define	PRIME4	668265263U
+#define	PRIME5	374761393U
+
+#define	ROTL(x, r)	(((x) << (r)) | ((x) >> (32 - (r))))
+
+static inline uint32_t
+round32(uint32_t acc, uint32_t input)
+{
+	acc += input * PRIME2;
+	acc = ROTL(acc, 13);
+	return (acc * PRIME1);
+}
+
+/* Consume as many whole 16-byte stripes as 'len' holds. */
+static const unsigned char *
+stripes(uint32_t v[4], const unsigned char *p, size_t len)
+{
+	const unsigned char *end = p + (len & ~(size_t)15);
+
+	while (p < end) {
+		v[0] = round32(v[0], archive_le32dec(p));
+		v[1] = round32(v[1], archive_le32dec(p + 4));
+		v[2] = round32(v[2], archive_le32dec(p + 8));
+		v[3] = round32(v[3], archive_le32dec(p + 12));
+		p += 16;
+	}
+	return (p);
+}
+
+void
+__archive_xxh32_init(struct archive_xxh32 *s, uint32_t seed)
+{
+	memset(s, 0, sizeof(*s));
+	s->seed = seed;
+	s->v[0] = seed + PRIME1 + PRIME2;
+	s->v[1] = seed + PRIME2;
+	s->v[2] = seed;
+	s->v[3] = seed - PRIME1;
+}
+
+void
+__archive_xxh32_update(struct archive_xxh32 *s, const void *buff, size_t len)
+{
+	const unsigned char *p = buff;
+	size_t n;
+
+	s->total += len;
+	if (s->buf_len > 0) {
+		n = 16 - s->buf_len;
+		if (n > len)
+			n = len;
+		memcpy(s->buf + s->buf_len, p, n);
+		s->buf_len += n;
+		p += n;
+		len -= n;
+		if (s->buf_len < 16)
+			return;
+		stripes(s->v, s->buf, 16);
+		s->buf_len = 0;
+	}
+	n = len & ~(size_t)15;
+	p = stripes(s->v, p, n);
+	len -= n;
+	memcpy(s->buf, p, len);
+	s->buf_len = len;
+}
+
+uint32_t
+__archive_xxh32_digest(const struct archive_xxh32 *s)
+{
+	const unsigned char *p = s->buf;
+	const unsigned char *end = s->buf + s->buf_len;
+	uint32_t h;
+
+	if (s->total >= 16)
+		h = ROTL(s->v[0], 1) + ROTL(s->v[1], 7)
+		    + ROTL(s->v[2], 12) + ROTL(s->v[3], 18);
+	else
+		h = s->seed + PRIME5;
+	h += (uint32_t)s->total;
+	while (p + 4 <= end) {
+		h += archive_le32dec(p) * PRIME3;
+		h = ROTL(h, 17) * PRIME4;
+		p += 4;
+	}
+	while (p < end) {
+		h += (*p++) * PRIME5;
+		h = ROTL(h, 11) * PRIME1;
+	}
+	h ^= h >> 15;
+	h *= PRIME2;
+	h ^= h >> 13;
+	h *= PRIME3;
+	h ^= h >> 16;
+	return (h);
+}
+
+uint32_t
+__archive_xxh32(const void *buff, size_t len, uint32_t seed)
+{
+	struct archive_xxh32 s;
+
+	__archive_xxh32_init(&s, seed);
+	__archive_xxh32_update(&s, buff, len);
+	return (__archive_xxh32_digest(&s));
+}
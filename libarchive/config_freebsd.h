@@ -55,6 +55,7 @@
 #define	HAVE_BZLIB_H 1
 #define	HAVE_CHFLAGS 1
 #define	HAVE_CHOWN 1
+#define	HAVE_CLOCK_GETTIME 1
 #define	HAVE_DECL_INT64_MAX 1
 #define	HAVE_DECL_INT64_MIN 1
 #define	HAVE_DECL_SIZE_MAX 1
@@ -96,9 +97,11 @@
 #define	HAVE_MKDIR 1
 #define	HAVE_MKFIFO 1
 #define	HAVE_MKNOD 1
+#define	HAVE_MMAP 1
 #define	HAVE_PIPE 1
 #define	HAVE_POLL 1
 #define	HAVE_POLL_H 1
+#define	HAVE_PTHREAD_H 1
 #define	HAVE_PWD_H 1
 #define	HAVE_READLINK 1
 #define	HAVE_RMD160 1
@@ -127,6 +130,7 @@
 #define	HAVE_SYMLINK 1
 #define	HAVE_SYS_CDEFS_H 1
 #define	HAVE_SYS_IOCTL_H 1
+#define	HAVE_SYS_MMAN_H 1
 #define	HAVE_SYS_MOUNT_H 1
 #define	HAVE_SYS_PARAM_H 1
 #define	HAVE_SYS_SELECT_H 1
@@ -50,15 +50,101 @@ __FBSDID("$FreeBSD: head/lib/libarchive/filter_fork.c 182958 2008-09-12 05:33:00
 #ifdef HAVE_UNISTD_H
 #  include <unistd.h>
 #endif
+#if defined(HAVE_POSIX_SPAWNP) && defined(HAVE_SPAWN_H)
+#  include <spawn.h>
+extern char **environ;
+#endif
+#ifdef HAVE_STDLIB_H
+#  include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#  include <string.h>
+#endif
 
 #include "filter_fork.h"
 
+/*
+ * Larger pipes let the child run further ahead of us (and us of it)
+ * before either side has to wait.  The kernel may refuse; that's fine.
+ */
+#define	CHILD_PIPE_SIZE	(1024 * 1024)
+
+/*
+ * Split a command line into words the way a shell would for the simple
+ * cases: words are separated by blanks, single quotes protect
+ * everything up to the closing quote, and within double quotes or
+ * unquoted text a backslash protects the next character.  The returned
+ * vector and its strings share one allocation.
+ */
+static char **
+split_command(const char *cmd)
+{
+	char **argv, *buf, *q;
+	const char *p;
+	size_t words;
+	char quote;
+
+	/* Each word needs at least one byte plus a separator. */
+	words = strlen(cmd) / 2 + 2;
+	argv = malloc(words * sizeof(char *) + strlen(cmd) + 1);
+	if (argv == NULL)
+		return (NULL);
+	buf = (char *)(argv + words);
+	words = 0;
+	q = buf;
+	p = cmd;
+	for (;;) {
+		while (*p == ' ' || *p == '\t' || *p == '\n')
+			p++;
+		if (*p == '\0')
+			break;
+		argv[words++] = q;
+		quote = '\0';
+		for (; *p != '\0'; p++) {
+			if (quote == '\'') {
+				if (*p == '\'')
+					quote = '\0';
+				else
+					*q++ = *p;
+			} else if (*p == '\\' && p[1] != '\0')
+				*q++ = *++p;
+			else if (quote == '"') {
+				if (*p == '"')
+					quote = '\0';
+				else
+					*q++ = *p;
+			} else if (*p == '\'' || *p == '"')
+				quote = *p;
+			else if (*p == ' ' || *p == '\t' || *p == '\n')
+				break;
+			else
+				*q++ = *p;
+		}
+		*q++ = '\0';
+	}
+	argv[words] = NULL;
+	if (words == 0) {
+		free(argv);
+		return (NULL);
+	}
+	return (argv);
+}
+
 pid_t
 __archive_create_child(const char *path, int *child_stdin, int *child_stdout)
 {
 	pid_t child;
 	int stdin_pipe[2], stdout_pipe[2], tmp;
+	char **argv;
+#if defined(HAVE_POSIX_SPAWNP) && defined(HAVE_SPAWN_H)
+	posix_spawn_file_actions_t actions;
+	int r;
+#endif
 
+	/* Split before forking; vfork() children must not allocate. */
+	argv = split_command(path);
+	if (argv == NULL)
+		return -1;
 	if (pipe(stdin_pipe) == -1)
 		goto state_allocated;
 	if (stdin_pipe[0] == 1 /* stdout */) {
@@ -76,6 +162,39 @@ __archive_create_child(const char *path, int *child_stdin, int *child_stdout)
 		stdout_pipe[1] = tmp;
 	}
 
+#ifdef F_SETPIPE_SZ
+	fcntl(stdin_pipe[1], F_SETPIPE_SZ, CHILD_PIPE_SIZE);
+	fcntl(stdout_pipe[0], F_SETPIPE_SZ, CHILD_PIPE_SIZE);
+#endif
+
+#if defined(HAVE_POSIX_SPAWNP) && defined(HAVE_SPAWN_H)
+	/*
+	 * posix_spawnp() avoids copying (or even sharing) our address
+	 * space, which matters when the caller is a large process.
+	 */
+	r = posix_spawn_file_actions_init(&actions);
+	if (r != 0)
+		goto stdout_opened;
+	r = posix_spawn_file_actions_addclose(&actions, stdin_pipe[1]);
+	if (r == 0)
+		r = posix_spawn_file_actions_addclose(&actions, stdout_pipe[0]);
+	if (r == 0)
+		r = posix_spawn_file_actions_adddup2(&actions,
+		    stdin_pipe[0], 0 /* stdin */);
+	if (r == 0 && stdin_pipe[0] != 0)
+		r = posix_spawn_file_actions_addclose(&actions, stdin_pipe[0]);
+	if (r == 0)
+		r = posix_spawn_file_actions_adddup2(&actions,
+		    stdout_pipe[1], 1 /* stdout */);
+	if (r == 0 && stdout_pipe[1] != 1)
+		r = posix_spawn_file_actions_addclose(&actions, stdout_pipe[1]);
+	if (r == 0)
+		r = posix_spawnp(&child, argv[0], &actions, NULL, argv,
+		    environ);
+	posix_spawn_file_actions_destroy(&actions);
+	if (r != 0)
+		goto stdout_opened;
+#else
 #if HAVE_VFORK
 	switch ((child = vfork())) {
 #else
@@ -94,17 +213,20 @@ __archive_create_child(const char *path, int *child_stdin, int *child_stdout)
 			_exit(254);
 		if (stdout_pipe[1] != 1 /* stdout */)
 			close(stdout_pipe[1]);
-		execlp(path, path, (char *)NULL);
+		execvp(argv[0], argv);
 		_exit(254);
 	default:
-		close(stdin_pipe[0]);
-		close(stdout_pipe[1]);
-
-		*child_stdin = stdin_pipe[1];
-		fcntl(*child_stdin, F_SETFL, O_NONBLOCK);
-		*child_stdout = stdout_pipe[0];
-		fcntl(*child_stdout, F_SETFL, O_NONBLOCK);
+		break;
 	}
+#endif
+	close(stdin_pipe[0]);
+	close(stdout_pipe[1]);
+
+	*child_stdin = stdin_pipe[1];
+	fcntl(*child_stdin, F_SETFL, O_NONBLOCK);
+	*child_stdout = stdout_pipe[0];
+	fcntl(*child_stdout, F_SETFL, O_NONBLOCK);
+	free(argv);
 
 	return child;
 
@@ -115,6 +237,7 @@ stdin_opened:
 	close(stdin_pipe[0]);
 	close(stdin_pipe[1]);
 state_allocated:
+	free(argv);
 	return -1;
 }
 
@@ -0,0 +1,126 @@
+/*-
+ * Copyright (c) 2003-2007 Tim Kientzle
+ * Copyright (c) 2011 Andres Mejia
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+
+/* Sanity test of the internal checksums used by the CAB and LHA readers. */
+
+#define __LIBARCHIVE_BUILD 1
+#include "archive_checksum_private.h"
+
+static unsigned long
+simple_xor32le(unsigned long sum, const void *_p, size_t s)
+{
+	const unsigned char *p = _p;
+
+	for (; s >= 4; s -= 4, p += 4)
+		sum ^= p[0] | (p[1] << 8) | (p[2] << 16)
+		    | ((unsigned long)p[3] << 24);
+	return (sum);
+}
+
+static unsigned
+bitcrc16(unsigned c, const void *_p, size_t s)
+{
+	/* Slow but obviously correct. */
+	const unsigned char *p = _p;
+	int bitctr;
+
+	for (; s > 0; --s) {
+		c ^= *p++;
+		for (bitctr = 8; bitctr > 0; --bitctr) {
+			if (c & 1) c = (c >> 1) ^ 0xa001;
+			else	   c = (c >> 1);
+		}
+	}
+	return (c);
+}
+
+DEFINE_TEST(test_archive_checksum)
+{
+	const size_t size = 1024 * 1024 + 100;
+	unsigned char *buff;
+	unsigned long expect, sum;
+	unsigned int seed = 1;
+	size_t i, off, len;
+
+	assertEqualInt(0x12345678, __archive_xor32le(0x12345678, "", 0));
+	assertEqualInt(0x12345678, __archive_xor32le(0x12345678, "abc", 3));
+	assertEqualInt(0x64636261 ^ 0x68676665,
+	    __archive_xor32le(0, "abcdefghij", 10));
+	assertEqualInt(0, __archive_crc16(0, "", 0));
+	assertEqualInt(0xbb3d, __archive_crc16(0, "123456789", 9));
+
+	buff = malloc(size);
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		buff[i] = (unsigned char)(seed >> 16);
+	}
+
+	/* Every short length at every alignment, which covers the edges
+	 * between the wide and narrow code. */
+	for (off = 0; off < 16; off++) {
+		for (len = 0; len < 300; len++) {
+			failure("off=%d len=%d", (int)off, (int)len);
+			assertEqualInt(simple_xor32le(0xdeadbeefUL,
+			    buff + off, len),
+			    __archive_xor32le(0xdeadbeefUL, buff + off, len));
+			failure("off=%d len=%d", (int)off, (int)len);
+			assertEqualInt(bitcrc16(0x1234, buff + off, len),
+			    __archive_crc16(0x1234, buff + off, len));
+		}
+		/* Around the size where wider kernels kick in. */
+		for (len = 1000; len < 1100; len += 3) {
+			failure("off=%d len=%d", (int)off, (int)len);
+			assertEqualInt(simple_xor32le(0, buff + off, len),
+			    __archive_xor32le(0, buff + off, len));
+		}
+	}
+
+	/* A long run, all at once and in uneven pieces. */
+	expect = simple_xor32le(0, buff + 3, size - 3);
+	assertEqualInt(expect, __archive_xor32le(0, buff + 3, size - 3));
+	sum = 0;
+	for (off = 3; off + 4 <= size; off += len) {
+		len = ((off * 7) % 5000 + 4) & ~3;
+		if (len > size - off)
+			len = size - off;
+		sum = __archive_xor32le(sum, buff + off, len);
+	}
+	assertEqualInt(expect, sum);
+
+	expect = bitcrc16(0, buff + 3, size - 3);
+	assertEqualInt(expect, __archive_crc16(0, buff + 3, size - 3));
+	sum = 0;
+	for (off = 3; off < size; off += len) {
+		len = (off * 7) % 5000 + 1;
+		if (len > size - off)
+			len = size - off;
+		sum = __archive_crc16((uint16_t)sum, buff + off, len);
+	}
+	assertEqualInt(expect, sum);
+
+	free(buff);
+}
@@ -0,0 +1,114 @@
+/*-
+ * Copyright (c) 2003-2007 Tim Kientzle
+ * Copyright (c) 2011 Andres Mejia
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/* Sanity test of the internal CRC-32 functions. */
+
+#define __LIBARCHIVE_BUILD 1
+#include "archive_crc32.h"
+
+static unsigned long
+bitcrc32(unsigned long c, const void *_p, size_t s)
+{
+	/* Slow but obviously correct. */
+	const unsigned char *p = _p;
+	int bitctr;
+
+	c ^= 0xffffffffUL;
+	for (; s > 0; --s) {
+		c ^= *p++;
+		for (bitctr = 8; bitctr > 0; --bitctr) {
+			if (c & 1) c = (c >> 1) ^ 0xedb88320UL;
+			else	   c = (c >> 1);
+		}
+	}
+	return (c ^ 0xffffffffUL);
+}
+
+DEFINE_TEST(test_archive_crc32)
+{
+	const size_t size = 1024 * 1024 + 100;
+	unsigned char *buff;
+	unsigned long crc, expect, a, b;
+	unsigned int seed = 1;
+	size_t i, off, len;
+
+	assertEqualInt(0, __archive_crc32(0, NULL, 0));
+	assertEqualInt(0, __archive_crc32(0, "", 0));
+	assertEqualInt(0xcbf43926UL, __archive_crc32(0, "123456789", 9));
+	assertEqualInt(0xcbf43926UL, __archive_crc32_portable(0, "123456789", 9));
+
+	buff = malloc(size);
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		buff[i] = (unsigned char)(seed >> 16);
+	}
+
+	/* Every short length at every alignment, which covers the edges
+	 * between the vector and table code. */
+	for (off = 0; off < 16; off++) {
+		for (len = 0; len < 300; len++) {
+			expect = bitcrc32(0x12345678UL, buff + off, len);
+			crc = __archive_crc32(0x12345678UL, buff + off, len);
+			failure("off=%d len=%d", (int)off, (int)len);
+			assertEqualInt(expect, crc);
+			crc = __archive_crc32_portable(0x12345678UL,
+			    buff + off, len);
+			failure("off=%d len=%d", (int)off, (int)len);
+			assertEqualInt(expect, crc);
+		}
+	}
+
+	/* A long run, all at once and in uneven pieces. */
+	expect = bitcrc32(0, buff + 3, size - 3);
+	assertEqualInt(expect, __archive_crc32(0, buff + 3, size - 3));
+	assertEqualInt(expect, __archive_crc32_portable(0, buff + 3, size - 3));
+	crc = 0;
+	for (off = 3; off < size; off += len) {
+		len = (off * 7) % 5000 + 1;
+		if (len > size - off)
+			len = size - off;
+		crc = __archive_crc32(crc, buff + off, len);
+	}
+	assertEqualInt(expect, crc);
+
+	/* Combining the CRCs of two halves gives the CRC of the whole. */
+	for (off = 0; off < 3000; off += 97) {
+		a = __archive_crc32(0, buff, off);
+		b = __archive_crc32(0, buff + off, 3000 - off);
+		failure("split at %d", (int)off);
+		assertEqualInt(__archive_crc32(0, buff, 3000),
+		    __archive_crc32_combine(a, b, 3000 - off));
+	}
+	a = __archive_crc32(0, buff, 1000);
+	b = __archive_crc32(0, buff + 1000, size - 1000);
+	assertEqualInt(__archive_crc32(0, buff, size),
+	    __archive_crc32_combine(a, b, size - 1000));
+	assertEqualInt(a, __archive_crc32_combine(a, 0, 0));
+
+	free(buff);
+}
@@ -143,3 +143,97 @@ DEFINE_TEST(test_archive_sha512)
 	assertEqualInt(ARCHIVE_OK, archive_sha512_final(&ctx, md));
 	assertEqualMem(md, actualmd, sizeof(md));
 }
+
+/*
+ * Longer messages, fed in pieces of awkward sizes so that every path
+ * through the block buffering (and through any hardware kernel the
+ * CPU has) gets used.
+ */
+static const char *
+hexdigest(const unsigned char *md, size_t len, char *out)
+{
+	static const char hex[] = "0123456789abcdef";
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		out[2 * i] = hex[md[i] >> 4];
+		out[2 * i + 1] = hex[md[i] & 0x0f];
+	}
+	out[2 * len] = '\0';
+	return (out);
+}
+
+static const size_t piece_sizes[] = { 1, 3, 55, 56, 63, 64, 65, 111, 112,
+	127, 128, 129, 1000, 4096, 65536 };
+
+#define	TEST_DIGEST(alg, name, mdlen, abc, million) do {		\
+	archive_##alg##_ctx ctx;					\
+	unsigned char md[mdlen];					\
+	char hexbuf[2 * (mdlen) + 1];					\
+	size_t i, done, n;						\
+									\
+	if (ARCHIVE_OK != archive_##alg##_init(&ctx)) {			\
+		skipping("This platform does not support " name);	\
+		break;							\
+	}								\
+	assertEqualInt(ARCHIVE_OK, archive_##alg##_update(&ctx, "abc", 3)); \
+	assertEqualInt(ARCHIVE_OK, archive_##alg##_final(&ctx, md));	\
+	assertEqualString(abc, hexdigest(md, mdlen, hexbuf));		\
+	for (i = 0; i < sizeof(piece_sizes) / sizeof(piece_sizes[0]); i++) { \
+		assertEqualInt(ARCHIVE_OK, archive_##alg##_init(&ctx));	\
+		for (done = 0; done < 1000000; done += n) {		\
+			n = piece_sizes[(i + done) %			\
+			    (sizeof(piece_sizes) / sizeof(piece_sizes[0]))]; \
+			if (n > 1000000 - done)				\
+				n = 1000000 - done;			\
+			assertEqualInt(ARCHIVE_OK,			\
+			    archive_##alg##_update(&ctx, big + done, n)); \
+		}							\
+		assertEqualInt(ARCHIVE_OK, archive_##alg##_final(&ctx, md)); \
+		failure("%s, pieces starting with %d bytes", name,	\
+		    (int)piece_sizes[i]);				\
+		assertEqualString(million, hexdigest(md, mdlen, hexbuf)); \
+	}								\
+} while (0)
+
+DEFINE_TEST(test_archive_digest_vectors)
+{
+	char *big;
+
+	/* The one-million-'a' vectors are from the specifications. */
+	assert((big = malloc(1000000)) != NULL);
+	memset(big, 'a', 1000000);
+
+	TEST_DIGEST(md5, "MD5", 16,
+	    "900150983cd24fb0d6963f7d28e17f72",
+	    "7707d6ae4e027c70eea2a935c2296f21");
+	TEST_DIGEST(rmd160, "RMD160", 20,
+	    "8eb208f7e05d987a9b044a8e98c6b087f15a0bfc",
+	    "52783243c1697bdbe16d37f97f68f08325dc1528");
+	TEST_DIGEST(sha1, "SHA1", 20,
+	    "a9993e364706816aba3e25717850c26c9cd0d89d",
+	    "34aa973cd4c4daa4f61eeb2bdbad27316534016f");
+	TEST_DIGEST(sha256, "SHA256", 32,
+	    "ba7816bf8f01cfea414140de5dae2223"
+	    "b00361a396177a9cb410ff61f20015ad",
+	    "cdc76e5c9914fb9281a1c7e284d73e67"
+	    "f1809a48a497200e046d39ccc7112cd0");
+	TEST_DIGEST(sha384, "SHA384", 48,
+	    "cb00753f45a35e8bb5a03d699ac65007"
+	    "272c32ab0eded1631a8b605a43ff5bed"
+	    "8086072ba1e7cc2358baeca134c825a7",
+	    "9d0e1809716474cb086e834e310a4a1c"
+	    "ed149e9c00f248527972cec5704c2a5b"
+	    "07b8b3dc38ecc4ebae97ddd87f3d8985");
+	TEST_DIGEST(sha512, "SHA512", 64,
+	    "ddaf35a193617abacc417349ae204131"
+	    "12e6fa4e89a97ea20a9eeee64b55d39a"
+	    "2192992a274fc1a836ba3c23a3feebbd"
+	    "454d4423643ce80e2a9ac94fa54ca49f",
+	    "e718483d0ce769644e2e42c7bc15b463"
+	    "8e1f98b13b2044285632a803afa973eb"
+	    "de0ff244877ea60a4cb0432ce577c31b"
+	    "eb009c5c2c49aa2e4eadb217ad8cc09b");
+
+	free(big);
+}
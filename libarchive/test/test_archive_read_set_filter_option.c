@@ -45,6 +45,10 @@ test(int pristine)
 	should(a, ARCHIVE_FAILED, "fubar", "snafu", NULL);
 	should(a, ARCHIVE_FAILED, "fubar", "snafu", "betcha");
 
+	/* A filter that is there but doesn't know the option. */
+	if (!pristine)
+		should(a, ARCHIVE_WARN, "gzip", "fubar", NULL);
+
 	archive_read_finish(a);
 }
 
@@ -53,6 +53,17 @@ test(int pristine)
 	should(a, ARCHIVE_FAILED, NULL, "snafu", NULL);
 	should(a, ARCHIVE_FAILED, NULL, "snafu", "betcha");
 
+	/* Read client options are always accepted without a module. */
+	should(a, ARCHIVE_OK, NULL, "mmap", "1");
+	should(a, ARCHIVE_OK, NULL, "mmap", NULL);
+	should(a, ARCHIVE_FAILED, "fubar", "mmap", "1");
+	should(a, ARCHIVE_OK, NULL, "prefetch", "4");
+	should(a, ARCHIVE_OK, NULL, "prefetch", NULL);
+	should(a, ARCHIVE_WARN, NULL, "prefetch", "many");
+	should(a, ARCHIVE_OK, NULL, "pipeline", "2");
+	should(a, ARCHIVE_WARN, NULL, "pipeline", "100000");
+	should(a, ARCHIVE_OK, NULL, "timing", "1");
+
 	/* ARCHIVE_OK with iso9660 loaded, ARCHIVE_WARN otherwise */
 	should(a, known_option_rv, "iso9660", "joliet", NULL);
 	should(a, known_option_rv, "iso9660", "joliet", NULL);
@@ -0,0 +1,210 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Decompress bzip2 data with bzip2:threads=N and check that the
+ * output is exactly what a serial read produces.
+ */
+
+/* Compress 'data' as a bzip2'd tar archive with one entry. */
+static size_t
+tar_bzip2(char *out, size_t outsize, const char *data, size_t len,
+    const char *options)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	size_t used;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_ustar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_bzip2(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, out, outsize, &used));
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "file");
+	archive_entry_set_mode(ae, AE_IFREG | 0644);
+	archive_entry_set_size(ae, len);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+	assertEqualInt(len, archive_write_data(a, data, len));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (used);
+}
+
+/*
+ * Decompress 'in' into 'out'; returns the size, or -1 after checking
+ * that reading failed with the message 'error'.
+ */
+static ssize_t
+decompress(char *in, size_t inlen, const char *options, char *out,
+    size_t outsize, const char *error)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	size_t total = 0;
+	ssize_t bytes;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_bzip2(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_raw(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_set_options(a, options));
+	/* Small damaged inputs fail as soon as the format looks ahead. */
+	bytes = archive_read_open_memory(a, in, inlen);
+	if (bytes == ARCHIVE_OK)
+		bytes = archive_read_next_header(a, &ae);
+	while (bytes == ARCHIVE_OK) {
+		bytes = archive_read_data(a, out + total, outsize - total);
+		if (bytes <= 0)
+			break;
+		total += bytes;
+		bytes = ARCHIVE_OK;
+	}
+	if (error == NULL)
+		assertEqualInt(0, bytes);
+	else {
+		assert(bytes < 0);
+		assertEqualString(error, archive_error_string(a));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	return (error == NULL ? (ssize_t)total : -1);
+}
+
+static void
+verify(char *in, size_t inlen, const char *options, const char *expect,
+    size_t expectlen)
+{
+	char *out;
+
+	out = malloc(expectlen + 1);
+	assertEqualInt(expectlen,
+	    decompress(in, inlen, options, out, expectlen + 1, NULL));
+	assert(memcmp(out, expect, expectlen) == 0);
+	free(out);
+}
+
+/* Find the bit where the first end-of-stream marker starts. */
+static size_t
+find_eos(const char *buff, size_t len)
+{
+	const unsigned char *u = (const unsigned char *)buff;
+	uint64_t v = 0;
+	size_t bit;
+
+	for (bit = 0; bit < len * 8; bit++) {
+		v = ((v << 1) | ((u[bit >> 3] >> (7 - (bit & 7))) & 1))
+		    & 0xffffffffffffULL;
+		if (v == 0x177245385090ULL)
+			return (bit - 47);
+	}
+	return (0);
+}
+
+DEFINE_TEST(test_read_bzip2_parallel)
+{
+	const size_t size = 8 * 1024 * 1024;
+	struct archive *a;
+	char *in, *expect, *data, *out;
+	size_t inlen, expectlen, len, n, eos;
+	unsigned int seed = 1;
+
+	assert((a = archive_write_new()) != NULL);
+	if (ARCHIVE_OK != archive_write_add_filter_bzip2(a)) {
+		skipping("bzip2 writing not supported on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return;
+	}
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_bzip2(a));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_options(a, "bzip2:threads=many"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_options(a, "bzip2:threads=1025"));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	in = malloc(size);
+	expect = malloc(size);
+	out = malloc(size);
+	data = malloc(3 * 1024 * 1024);
+	for (n = 0; n < 3 * 1024 * 1024; n++) {
+		seed = seed * 1103515245 + 12345;
+		data[n] = "etaoin shrdlu\n"[(seed >> 16) % 14];
+	}
+
+	/* 100k blocks: about thirty of them. */
+	inlen = tar_bzip2(in, size, data, 3 * 1024 * 1024,
+	    "bzip2:compression-level=1");
+	expectlen = decompress(in, inlen, "", expect, size, NULL);
+	assert(expectlen > 3 * 1024 * 1024);
+	verify(in, inlen, "bzip2:threads=4", expect, expectlen);
+	verify(in, inlen, "bzip2:threads=1", expect, expectlen);
+	verify(in, inlen, "bzip2:threads=3,pipeline=2", expect, expectlen);
+
+	/* Concatenated streams with different block sizes, then junk. */
+	n = tar_bzip2(in + inlen, size - inlen, data + 5, 1000000, "");
+	memcpy(in + inlen + n, "garbage!", 8);
+	len = decompress(in, inlen + n + 8, "", expect, size, NULL);
+	assert(len > expectlen);
+	verify(in, inlen + n + 8, "bzip2:threads=4", expect, len);
+
+	/* Runs, which bzip2 shortens before compressing. */
+	memset(data, 'x', 2000000);
+	inlen = tar_bzip2(in, size, data, 2000000, "bzip2:threads=2");
+	expectlen = decompress(in, inlen, "", expect, size, NULL);
+	verify(in, inlen, "bzip2:threads=2", expect, expectlen);
+
+	/* An empty stream before that one. */
+	memmove(in + 14, in, inlen);
+	memcpy(in, "BZh9\x17\x72\x45\x38\x50\x90\0\0\0\0", 14);
+	verify(in, inlen + 14, "bzip2:threads=2", expect, expectlen);
+
+	/* Damage is still caught. */
+	inlen = tar_bzip2(in, size, data + 1000000, 1000000,
+	    "bzip2:compression-level=1");
+	expectlen = decompress(in, inlen, "", expect, size, NULL);
+	in[inlen / 2] ^= 0x10;
+	assertEqualInt(-1, decompress(in, inlen, "bzip2:threads=2", out, size,
+	    "bzip2 data is corrupted"));
+	in[inlen / 2] ^= 0x10;
+	eos = find_eos(in, inlen);
+	assert(eos > 0);
+	in[(eos + 60) / 8] ^= 0x80 >> ((eos + 60) % 8);
+	assertEqualInt(-1, decompress(in, inlen, "bzip2:threads=2", out, size,
+	    "bzip2 data is corrupted"));
+	in[(eos + 60) / 8] ^= 0x80 >> ((eos + 60) % 8);
+	verify(in, inlen, "bzip2:threads=2", expect, expectlen);
+	assertEqualInt(-1, decompress(in, inlen - 30, "bzip2:threads=2", out,
+	    size, "truncated bzip2 input"));
+
+	free(in);
+	free(expect);
+	free(out);
+	free(data);
+}
@@ -290,10 +290,90 @@ test_symlink(void)
 	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
 }
 
+/*
+ * The reference files for these were written by Python's zipfile
+ * module, which sets the LZMA end-of-stream flag.
+ */
+static void
+verify_compression(struct archive *a, const char *format_name)
+{
+	struct archive_entry *ae;
+	char buff[6000], expected[6000];
+	int i;
+
+	for (i = 0; i < 1000; i++)
+		memcpy(expected + i * 6, "hello\n", 6);
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("file1", archive_entry_pathname(ae));
+	assertEqualInt(6000, archive_entry_size(ae));
+	assertEqualInt(6000, archive_read_data(a, buff, sizeof(buff)));
+	assertEqualMem(buff, expected, sizeof(expected));
+	assertEqualInt(0, archive_read_data(a, buff, sizeof(buff)));
+	assertEqualString(format_name, archive_format_name(a));
+
+	/* Skip file2 without reading it. */
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("file2", archive_entry_pathname(ae));
+	assertEqualInt(0, archive_entry_size(ae));
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("file3", archive_entry_pathname(ae));
+	assertEqualInt(6, archive_entry_size(ae));
+	assertEqualInt(6, archive_read_data(a, buff, sizeof(buff)));
+	assertEqualMem(buff, "world\n", 6);
+
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+}
+
+static void
+test_compression(const char *refname, const char *format_name)
+{
+	char *p;
+	size_t s;
+	struct archive *a;
+
+	extract_reference_file(refname);
+
+	/* Verify with seeking reader. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename(a, refname, 10240));
+	verify_compression(a, format_name);
+
+	/* Verify with streaming reader. */
+	p = slurpfile(&s, refname);
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_OK, read_open_memory(a, p, s, 31));
+	verify_compression(a, format_name);
+	free(p);
+}
+
 DEFINE_TEST(test_read_format_zip)
 {
+	struct archive *a;
+
 	test_basic();
 	test_info_zip_ux();
 	test_extract_length_at_end();
 	test_symlink();
+
+	assert((a = archive_read_new()) != NULL);
+	if (ARCHIVE_OK != archive_read_support_filter_bzip2(a)) {
+		skipping("zip:bzip2 decoding is not supported on this platform");
+	} else {
+		test_compression("test_read_format_zip_bzip2.zip",
+		    "ZIP 4.6 (bzip2)");
+	}
+	if (ARCHIVE_OK != archive_read_support_filter_xz(a)) {
+		skipping("zip:lzma decoding is not supported on this platform");
+	} else {
+		test_compression("test_read_format_zip_lzma.zip",
+		    "ZIP 6.3 (lzma)");
+	}
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
 }
@@ -0,0 +1,254 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Read a seekable Zip archive with zip:threads=N; the entries must
+ * come back exactly as they do without it.
+ */
+
+#define	ENTRIES		300
+#define	DATA_SIZE	(17 * 1024 * 1024)
+/* Bigger than the reader hands to worker threads. */
+#define	BIG_ENTRY	150
+
+static size_t
+entry_size(int i)
+{
+	if (i == BIG_ENTRY)
+		return (DATA_SIZE);
+	return ((size_t)(i * 997) % 50000);
+}
+
+static size_t
+write_archive(char *buff, size_t buffsize, const char *data,
+    const char *options)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[32];
+	size_t used;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	for (i = 0; i < ENTRIES; i++) {
+		assert((ae = archive_entry_new()) != NULL);
+		if (i % 10 == 9) {
+			sprintf(path, "dir%d/", i);
+			archive_entry_copy_pathname(ae, path);
+			archive_entry_set_mode(ae, AE_IFDIR | 0755);
+		} else if (i % 50 == 8) {
+			sprintf(path, "link%d", i);
+			archive_entry_copy_pathname(ae, path);
+			archive_entry_set_mode(ae, AE_IFLNK | 0755);
+			archive_entry_copy_symlink(ae, "file0");
+		} else {
+			sprintf(path, "file%d", i);
+			archive_entry_copy_pathname(ae, path);
+			archive_entry_set_mode(ae, AE_IFREG | 0644);
+			archive_entry_set_size(ae, entry_size(i));
+		}
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		if (archive_entry_filetype(ae) == AE_IFREG)
+			assertEqualInt(entry_size(i),
+			    archive_write_data(a, data + i, entry_size(i)));
+		archive_entry_free(ae);
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (used);
+}
+
+static void
+verify_entry(struct archive *a, struct archive_entry *ae, int i,
+    const char *data, char *out)
+{
+	char path[32];
+
+	if (i % 10 == 9) {
+		sprintf(path, "dir%d/", i);
+		assertEqualString(path, archive_entry_pathname(ae));
+		assertEqualInt(AE_IFDIR, archive_entry_filetype(ae));
+	} else if (i % 50 == 8) {
+		sprintf(path, "link%d", i);
+		assertEqualString(path, archive_entry_pathname(ae));
+		assertEqualInt(AE_IFLNK, archive_entry_filetype(ae));
+		assertEqualString("file0", archive_entry_symlink(ae));
+	} else {
+		sprintf(path, "file%d", i);
+		assertEqualString(path, archive_entry_pathname(ae));
+		assertEqualInt(entry_size(i), archive_entry_size(ae));
+		failure("%s", path);
+		assertEqualInt(entry_size(i),
+		    archive_read_data(a, out, DATA_SIZE));
+		failure("%s", path);
+		assert(memcmp(out, data + i, entry_size(i)) == 0);
+	}
+	assertEqualInt(0, archive_read_data(a, out, DATA_SIZE));
+}
+
+static void
+verify_archive(char *buff, size_t used, const char *data,
+    const char *options, char *out)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	int i;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_support_format_zip_seekable(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, buff, used));
+	for (i = 0; i < ENTRIES; i++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		/* Leave some entries unread. */
+		if (i % 13 == 5)
+			continue;
+		verify_entry(a, ae, i, data, out);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+
+	/* Back into the middle and read on. */
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "file141", &ae));
+	for (i = 141; i < 160; i++) {
+		if (i > 141)
+			assertEqualIntA(a, ARCHIVE_OK,
+			    archive_read_next_header(a, &ae));
+		verify_entry(a, ae, i, data, out);
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+/*
+ * Change the CRC of entry i in the central directory.
+ */
+static size_t
+le16(const char *p)
+{
+	const unsigned char *u = (const unsigned char *)p;
+
+	return (u[0] | (u[1] << 8));
+}
+
+static void
+damage_crc(char *buff, size_t used, int i)
+{
+	const unsigned char *eocd = (unsigned char *)buff + used - 22;
+	size_t n;
+
+	assertEqualMem(eocd, "PK\005\006", 4);
+	/* Start of the central directory. */
+	n = eocd[16] | (eocd[17] << 8) | (eocd[18] << 16)
+	    | ((size_t)eocd[19] << 24);
+	for (; n + 46 <= used; n += 46 + le16(buff + n + 28)
+	    + le16(buff + n + 30) + le16(buff + n + 32)) {
+		assertEqualMem(buff + n, "PK\001\002", 4);
+		if (i-- == 0) {
+			buff[n + 16] ^= 1;
+			return;
+		}
+	}
+	assert(0);
+}
+
+static void
+verify_damaged(char *buff, size_t used, const char *options, char *out)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	int i;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_support_format_zip_seekable(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, buff, used));
+	for (i = 0; i < 20; i++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		if (i == 11)
+			assertEqualInt(ARCHIVE_WARN,
+			    archive_read_data(a, out, DATA_SIZE));
+		else if (i % 10 != 9 && i % 50 != 8)
+			assertEqualInt(entry_size(i),
+			    archive_read_data(a, out, DATA_SIZE));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_read_format_zip_parallel)
+{
+	const size_t buffsize = 48 * 1024 * 1024;
+	struct archive *a;
+	char *buff, *data, *out;
+	size_t used, n;
+	unsigned int seed = 7;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_support_format_zip_seekable(a));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_options(a, "zip:threads=x"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_options(a, "zip:threads=1025"));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	buff = malloc(buffsize);
+	out = malloc(DATA_SIZE);
+	data = malloc(DATA_SIZE + ENTRIES);
+	for (n = 0; n < DATA_SIZE + ENTRIES; n++) {
+		seed = seed * 1103515245 + 12345;
+		data[n] = "etaoin shrdlu\n"[(seed >> 16) % 14];
+	}
+
+	used = write_archive(buff, buffsize, data, "zip:compression=store");
+	verify_archive(buff, used, data, "", out);
+	verify_archive(buff, used, data, "zip:threads=4", out);
+
+	/* Without zlib, this is stored, too. */
+	used = write_archive(buff, buffsize, data, "");
+	verify_archive(buff, used, data, "", out);
+	verify_archive(buff, used, data, "zip:threads=4", out);
+	verify_archive(buff, used, data, "zip:threads=1", out);
+
+	/* A bad CRC is still reported. */
+	damage_crc(buff, used, 11);
+	verify_damaged(buff, used, "", out);
+	verify_damaged(buff, used, "zip:threads=3", out);
+
+	free(buff);
+	free(out);
+	free(data);
+}
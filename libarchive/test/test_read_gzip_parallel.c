@@ -0,0 +1,285 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Decompress multi-member gzip streams with gzip:threads=N and check
+ * that the output is exactly what a serial read produces.
+ */
+
+static unsigned long
+bitcrc32(unsigned long c, const void *_p, size_t s)
+{
+	/* Slow but compact replacement for crc32() from zlib. */
+	const unsigned char *p = _p;
+	int bitctr;
+
+	for (; s > 0; --s) {
+		c ^= *p++;
+		for (bitctr = 8; bitctr > 0; --bitctr) {
+			if (c & 1) c = (c >> 1);
+			else	   c = (c >> 1) ^ 0xedb88320;
+			c ^= 0x80000000;
+		}
+	}
+	return (c);
+}
+
+static void
+le16(unsigned char *p, unsigned v)
+{
+	p[0] = v & 0xff;
+	p[1] = (v >> 8) & 0xff;
+}
+
+static void
+le32(unsigned char *p, unsigned long v)
+{
+	le16(p, v & 0xffff);
+	le16(p + 2, (v >> 16) & 0xffff);
+}
+
+/*
+ * Append a gzip member holding 'data' in stored deflate blocks,
+ * with a BGZF block size if 'bgzf' is set.
+ */
+static size_t
+stored_member(unsigned char *out, const char *data, size_t len, int bgzf)
+{
+	unsigned char *p = out;
+	size_t done, n;
+
+	memcpy(p, "\x1f\x8b\x08\x00\0\0\0\0\x00\xff", 10);
+	p += 10;
+	if (bgzf) {
+		out[3] = 4;
+		memcpy(p, "\x06\x00" "BC\x02\x00", 6);
+		le16(p + 6, (unsigned)(31 + len - 1));
+		p += 8;
+	}
+	done = 0;
+	do {
+		n = len - done > 65535 ? 65535 : len - done;
+		*p++ = done + n == len;	/* Stored, maybe last. */
+		le16(p, (unsigned)n);
+		le16(p + 2, (unsigned)~n);
+		p += 4;
+		memcpy(p, data + done, n);
+		p += n;
+		done += n;
+	} while (done < len);
+	le32(p, bitcrc32(0, data, len));
+	le32(p + 4, (unsigned long)len);
+	p += 8;
+	return (p - out);
+}
+
+/* Compress 'data' as a gzip'd tar archive with one entry. */
+static size_t
+tar_member(char *out, size_t outsize, char *tar, size_t *tarlen,
+    const char *data, size_t len)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	size_t used;
+	int gzip;
+
+	for (gzip = 0; gzip < 2; gzip++) {
+		assert((a = archive_write_new()) != NULL);
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_write_set_format_ustar(a));
+		if (gzip)
+			assertEqualIntA(a, ARCHIVE_OK,
+			    archive_write_add_filter_gzip(a));
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_open_memory(a,
+		    gzip ? out : tar, outsize, &used));
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, "file");
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, len);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		assertEqualInt(len, archive_write_data(a, data, len));
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		if (!gzip)
+			*tarlen = used;
+	}
+	return (used);
+}
+
+static void
+verify(char *in, size_t inlen, const char *options,
+    const char *expect, size_t expectlen)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *out;
+	size_t total = 0;
+	ssize_t bytes;
+
+	out = malloc(expectlen + 1);
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_gzip(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_raw(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, in, inlen));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	for (;;) {
+		bytes = archive_read_data(a, out + total,
+		    expectlen + 1 - total);
+		assert(bytes >= 0);
+		if (bytes <= 0)
+			break;
+		total += bytes;
+		if (total > expectlen)
+			break;
+	}
+	assertEqualInt(expectlen, total);
+	assert(memcmp(out, expect, expectlen) == 0);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	free(out);
+}
+
+DEFINE_TEST(test_read_gzip_parallel)
+{
+	const size_t size = 24 * 1024 * 1024;
+	struct archive_entry *ae;
+	struct archive *a;
+	char *in, *expect, *data, *zeros;
+	size_t inlen, expectlen, len, n;
+	unsigned int seed = 1;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	if (ARCHIVE_OK != archive_write_add_filter_gzip(a)) {
+		skipping("gzip writing not supported on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return;
+	}
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	in = malloc(size);
+	expect = malloc(size);
+	data = malloc(10 * 1024 * 1024);
+	for (n = 0; n < 10 * 1024 * 1024; n++) {
+		seed = seed * 1103515245 + 12345;
+		data[n] = (char)(seed >> 16);
+	}
+
+	/* BGZF: stored members with their sizes in the header. */
+	inlen = expectlen = 0;
+	for (i = 0; i < 200; i++) {
+		len = 60000 - i * 7;
+		inlen += stored_member((unsigned char *)in + inlen,
+		    data + i * 1000, len, 1);
+		memcpy(expect + expectlen, data + i * 1000, len);
+		expectlen += len;
+	}
+	/* Empty BGZF end-of-file marker. */
+	inlen += stored_member((unsigned char *)in + inlen, "", 0, 1);
+	verify(in, inlen, "", expect, expectlen);
+	verify(in, inlen, "gzip:threads=4", expect, expectlen);
+	verify(in, inlen, "gzip:threads=1", expect, expectlen);
+	verify(in, inlen, "gzip:threads=4,pipeline=2", expect, expectlen);
+	/* Trailing garbage is ignored as before. */
+	memcpy(in + inlen, "garbage!", 8);
+	verify(in, inlen + 8, "gzip:threads=4", expect, expectlen);
+
+	/*
+	 * Plain members, whose ends have to be guessed.  One of them is
+	 * full of data that looks like gzip headers but isn't.
+	 */
+	inlen = expectlen = 0;
+	for (i = 0; i < 40; i++) {
+		len = 1000 + i * 13000;
+		if (i == 5) {
+			memcpy(expect + expectlen, data, 1500000);
+			for (n = 0; n < 1500000; n += 1000)
+				memcpy(expect + expectlen + n,
+				    "\x1f\x8b\x08\x00\0\0\0\0\x00\x03", 10);
+			inlen += stored_member((unsigned char *)in + inlen,
+			    expect + expectlen, 1500000, 0);
+			expectlen += 1500000;
+		}
+		inlen += tar_member(in + inlen, size - inlen,
+		    expect + expectlen, &n, data + 20000 * i, len);
+		expectlen += n;
+	}
+	verify(in, inlen, "", expect, expectlen);
+	verify(in, inlen, "gzip:threads=4", expect, expectlen);
+	verify(in, inlen, "gzip:threads=3,pipeline=4", expect, expectlen);
+
+	/* A member too big to find the end of, between small ones. */
+	inlen = tar_member(in, size, expect, &expectlen, data, 1000);
+	inlen += tar_member(in + inlen, size - inlen, expect + expectlen, &n,
+	    data, 10 * 1024 * 1024);
+	expectlen += n;
+	inlen += tar_member(in + inlen, size - inlen, expect + expectlen, &n,
+	    data + 3, 3000);
+	expectlen += n;
+	verify(in, inlen, "gzip:threads=4", expect, expectlen);
+
+	/*
+	 * A member that inflates to far more than the worker may
+	 * produce; it has to be streamed on the caller's thread.
+	 */
+	zeros = calloc(1, 12 * 1024 * 1024);
+	inlen = tar_member(in, size, expect, &expectlen, data, 1000);
+	inlen += tar_member(in + inlen, size - inlen, expect + expectlen, &n,
+	    zeros, 12 * 1024 * 1024);
+	expectlen += n;
+	inlen += tar_member(in + inlen, size - inlen, expect + expectlen, &n,
+	    data + 3, 3000);
+	expectlen += n;
+	assert(inlen < 100 * 1024);
+	verify(in, inlen, "gzip:threads=4", expect, expectlen);
+	free(zeros);
+
+	/* Bad data is still caught. */
+	inlen = 0;
+	for (i = 0; i < 3; i++)
+		inlen += stored_member((unsigned char *)in + inlen,
+		    data, 50000, 1);
+	in[inlen - 20] ^= 1;
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_gzip(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_raw(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_set_options(a, "gzip:threads=2"));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, in, inlen));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	while (archive_read_data(a, expect, size) > 0)
+		continue;
+	assertEqualString("gzip data is corrupted", archive_error_string(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	free(in);
+	free(expect);
+	free(data);
+}
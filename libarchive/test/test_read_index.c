@@ -0,0 +1,242 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Build sidecar indexes for tar and cpio archives, both while writing
+ * and while reading, and use them to jump to entries.
+ */
+
+#define	ENTRIES	10
+
+static void
+entry_name(char *name, int i)
+{
+	/* Long enough for a ustar prefix or a GNU extension header. */
+	if (i == 5)
+		sprintf(name, "%0120d/file%d", i, i);
+	else
+		sprintf(name, "file%d", i);
+}
+
+static void
+write_archive(const char *filename, const char *indexname,
+    int (*set_format)(struct archive *), int gzip)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char name[160], data[3000];
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, set_format(a));
+	if (gzip)
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_gzip(a));
+	if (indexname != NULL)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_write_set_index_file(a, indexname));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_open_filename(a, filename));
+	for (i = 0; i < ENTRIES; i++) {
+		assert((ae = archive_entry_new()) != NULL);
+		entry_name(name, i);
+		archive_entry_copy_pathname(ae, name);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, 300 * i);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		memset(data, 'a' + i, sizeof(data));
+		assertEqualInt(300 * i, archive_write_data(a, data, 300 * i));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+}
+
+static void
+verify_entry(struct archive *a, struct archive_entry *ae, int i)
+{
+	char name[160], data[3000], expect[3000];
+
+	assert(ae != NULL);
+	if (ae == NULL)
+		return;
+	entry_name(name, i);
+	assertEqualString(name, archive_entry_pathname(ae));
+	memset(expect, 'a' + i, sizeof(expect));
+	assertEqualInt(300 * i, archive_read_data(a, data, sizeof(data)));
+	assertEqualMem(data, expect, 300 * i);
+}
+
+static struct archive *
+open_archive(const char *filename, const char *indexname)
+{
+	struct archive *a;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_set_index_file(a, indexname));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename(a, filename, 10240));
+	return (a);
+}
+
+static void
+test_format(int (*set_format)(struct archive *))
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char name[160];
+	int64_t position;
+	int i;
+
+	write_archive("test.ar", "written.idx", set_format, 0);
+
+	/* Build a second index by reading the whole archive. */
+	unlink("read.idx");
+	a = open_archive("test.ar", "read.idx");
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	verify_entry(a, ae, 0);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	/* Entries seen so far can already be revisited. */
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "file0", &ae));
+	assertEqualInt(0, archive_read_header_position(a));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "file3", &ae));
+	for (i = 1; i < ENTRIES; i++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		entry_name(name, i);
+		assertEqualString(name, archive_entry_pathname(ae));
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* The reader and writer agree on where everything is. */
+	assertFileExists("read.idx");
+	assertEqualFile("read.idx", "written.idx");
+	assertFileNotExists("read.idx.tmp");
+	assertFileNotExists("written.idx.tmp");
+
+	/* Now use it. */
+	a = open_archive("test.ar", "written.idx");
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "file7", &ae));
+	position = archive_read_header_position(a);
+	assert(position > 0);
+	verify_entry(a, ae, 7);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	verify_entry(a, ae, 8);
+
+	/* Backwards, by index, leaving the data unread. */
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry_index(a, 5, &ae));
+	entry_name(name, 5);
+	assertEqualString(name, archive_entry_pathname(ae));
+	assert(archive_read_header_position(a) < position);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	verify_entry(a, ae, 6);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_seek_entry(a, name, &ae));
+	verify_entry(a, ae, 5);
+
+	/* Misses leave the current position alone. */
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "nonexistent", &ae));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry_index(a, ENTRIES, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	verify_entry(a, ae, 6);
+
+	/* After the end, too. */
+	for (i = 7; i < ENTRIES; i++)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry_index(a, 1, &ae));
+	verify_entry(a, ae, 1);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_read_index)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	int r;
+
+	test_format(archive_write_set_format_ustar);
+	test_format(archive_write_set_format_pax);
+	test_format(archive_write_set_format_gnutar);
+	test_format(archive_write_set_format_cpio_newc);
+	test_format(archive_write_set_format_cpio);
+
+	/* An index for some other archive is caught. */
+	write_archive("test.ar", "other.idx", archive_write_set_format_ustar, 0);
+	write_archive("test.ar", NULL, archive_write_set_format_cpio_newc, 0);
+	a = open_archive("test.ar", "other.idx");
+	assertEqualIntA(a, ARCHIVE_FATAL,
+	    archive_read_seek_entry(a, "file3", &ae));
+	assert(archive_error_string(a) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* Garbage is rejected up front. */
+	assertMakeFile("bad.idx", 0644, "LAINDEX1 this is not an index");
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_FATAL,
+	    archive_read_set_index_file(a, "bad.idx"));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* Formats that don't write headers in place can't be indexed. */
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_index_file(a, "zip.idx"));
+	assertEqualIntA(a, ARCHIVE_FATAL,
+	    archive_write_open_filename(a, "test.zip"));
+	assert(archive_error_string(a) != NULL);
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	/* A compressed stream can't be positioned without checkpoints;
+	 * see test_read_seek_gzip. */
+	assert((a = archive_write_new()) != NULL);
+	r = archive_write_add_filter_gzip(a);
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	if (r != ARCHIVE_OK) {
+		skipping("gzip writing not supported on this platform");
+		return;
+	}
+	write_archive("test.tgz", "tgz.idx", archive_write_set_format_ustar, 1);
+	a = open_archive("test.tgz", "tgz.idx");
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "file3", &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	verify_entry(a, ae, 0);
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
@@ -0,0 +1,236 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Read a tar.bz2.gz with each filter running on its own thread
+ * and verify we get the same results as reading synchronously.
+ */
+
+#define	ENTRIES	8
+#define	ENTRY_SIZE	(300 * 1000)
+
+static void
+fill_entry(char *buff, int n)
+{
+	unsigned int seed = n + 1;
+	int i;
+
+	/* Poorly compressible, so the archive spans many bzip2 blocks. */
+	for (i = 0; i < ENTRY_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		buff[i] = (char)(seed >> 16);
+	}
+}
+
+static void
+read_back(const char *options, const char *archive, size_t used,
+    char *expect, char *data, int entries)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char name[16];
+	int i;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_memory(a, (void *)(uintptr_t)archive, used));
+	assertEqualInt(3, archive_filter_count(a));
+	assertEqualString("gzip", archive_filter_name(a, 0));
+	assertEqualString("bzip2", archive_filter_name(a, 1));
+	assertEqualString("none", archive_filter_name(a, 2));
+	assert(archive_filter_bytes(a, -1) <= (int64_t)used);
+	for (i = 0; i < entries; i++) {
+		assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+		sprintf(name, "file%d", i);
+		assertEqualString(name, archive_entry_pathname(ae));
+		if (i % 3 == 2) {
+			/* Leave some entries for skip. */
+			continue;
+		}
+		fill_entry(expect, i);
+		assertEqualInt(ENTRY_SIZE,
+		    archive_read_data(a, data, ENTRY_SIZE));
+		assertEqualMem(data, expect, ENTRY_SIZE);
+	}
+	if (entries == ENTRIES) {
+		assertEqualIntA(a, ARCHIVE_EOF,
+		    archive_read_next_header(a, &ae));
+		/* Position is counted in front of the helper thread. */
+		assert(archive_filter_bytes(a, 0)
+		    >= ENTRIES * (ENTRY_SIZE + 512) + 1024);
+	}
+	/* Closing while the helper threads are still busy must be fine. */
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+/* A client whose callbacks count what happens to them. */
+struct client_state {
+	const char	*buff;
+	size_t		 used, pos;
+	int		 reads, closes;
+};
+
+static ssize_t
+client_read(struct archive *a, void *data, const void **buff)
+{
+	struct client_state *cs = (struct client_state *)data;
+	size_t n = cs->used - cs->pos;
+
+	(void)a; /* UNUSED */
+	if (n > 10000)
+		n = 10000;
+	*buff = cs->buff + cs->pos;
+	cs->pos += n;
+	cs->reads++;
+	return (n);
+}
+
+static int
+client_close(struct archive *a, void *data)
+{
+	struct client_state *cs = (struct client_state *)data;
+
+	(void)a; /* UNUSED */
+	cs->closes++;
+	return (ARCHIVE_OK);
+}
+
+static void
+read_client(const char *archive, size_t used, char *expect, char *data)
+{
+	struct client_state cs;
+	struct archive_entry *ae;
+	struct archive *a;
+	int i;
+
+	memset(&cs, 0, sizeof(cs));
+	cs.buff = archive;
+	cs.used = used;
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_set_options(a, "pipeline=2"));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open(a, &cs, NULL, client_read, client_close));
+	for (i = 0; i < ENTRIES; i++) {
+		assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+		fill_entry(expect, i);
+		assertEqualInt(ENTRY_SIZE,
+		    archive_read_data(a, data, ENTRY_SIZE));
+		assertEqualMem(data, expect, ENTRY_SIZE);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	/* The helper thread read through the caller's client data. */
+	assert(cs.reads >= (int)(cs.pos / 10000));
+	assert(cs.pos > 0);
+	assertEqualInt(0, cs.closes);
+	/* And the close callback sees the same state, once. */
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(1, cs.closes);
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	assertEqualInt(1, cs.closes);
+}
+
+DEFINE_TEST(test_read_pipeline)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *archive, *expect, *data;
+	size_t buffsize = 4 * 1024 * 1024, used;
+	char name[16];
+	int i, r;
+
+	archive = malloc(buffsize);
+	expect = malloc(ENTRY_SIZE);
+	data = malloc(ENTRY_SIZE);
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_ustar(a));
+	r = archive_write_add_filter_gzip(a);
+	if (r == ARCHIVE_OK)
+		r = archive_write_add_filter_bzip2(a);
+	if (r != ARCHIVE_OK) {
+		skipping("gzip and bzip2 writing not supported on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		free(archive);
+		free(expect);
+		free(data);
+		return;
+	}
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, archive, buffsize, &used));
+	for (i = 0; i < ENTRIES; i++) {
+		assert((ae = archive_entry_new()) != NULL);
+		sprintf(name, "file%d", i);
+		archive_entry_copy_pathname(ae, name);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, ENTRY_SIZE);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		fill_entry(expect, i);
+		assertEqualInt(ENTRY_SIZE,
+		    archive_write_data(a, expect, ENTRY_SIZE));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	read_back("pipeline=0", archive, used, expect, data, ENTRIES);
+	read_back("pipeline=1", archive, used, expect, data, ENTRIES);
+	read_back("pipeline=4", archive, used, expect, data, ENTRIES);
+	read_back("pipeline=4", archive, used, expect, data, 1);
+	read_client(archive, used, expect, data);
+
+	/* A truncated stream reports the error from the right stage. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_set_options(a, "pipeline=2"));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_memory(a, archive, used - 100));
+	for (i = 0; i < ENTRIES; i++) {
+		r = archive_read_next_header(a, &ae);
+		if (r != ARCHIVE_OK)
+			break;
+		r = archive_read_data_skip(a);
+		if (r != ARCHIVE_OK)
+			break;
+	}
+	assertEqualInt(ARCHIVE_FATAL, r);
+	assert(archive_error_string(a) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	free(archive);
+	free(expect);
+	free(data);
+}
@@ -0,0 +1,258 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Jump to entries by name and by index with archive_read_seek_entry().
+ */
+
+static const char *names[] = { "file0", "dir/file1", "file2", "file3" };
+
+static size_t
+write_archive(char *buff, size_t buffsize, int zip)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char data[64];
+	size_t used;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	if (zip)
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	else
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_write_set_format_ustar(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	for (i = 0; i < 4; i++) {
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, names[i]);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, 10 * (i + 1));
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		memset(data, 'a' + i, sizeof(data));
+		assertEqualInt(10 * (i + 1),
+		    archive_write_data(a, data, 10 * (i + 1)));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (used);
+}
+
+static void
+verify_entry(struct archive *a, struct archive_entry *ae, int i)
+{
+	char data[64], expect[64];
+
+	assert(ae != NULL);
+	if (ae == NULL)
+		return;
+	assertEqualString(names[i], archive_entry_pathname(ae));
+	memset(expect, 'a' + i, sizeof(expect));
+	assertEqualInt(10 * (i + 1), archive_read_data(a, data, sizeof(data)));
+	assertEqualMem(data, expect, 10 * (i + 1));
+}
+
+static void
+test_zip(void)
+{
+	struct archive_entry *ae, *held;
+	struct archive *a;
+	char data[64];
+	char *buff;
+	size_t buffsize = 100000, used;
+
+	buff = malloc(buffsize);
+	used = write_archive(buff, buffsize, 1);
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, buff, used));
+
+	/* Straight to an entry in the middle, then read on from there. */
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "file2", &ae));
+	verify_entry(a, ae, 2);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	verify_entry(a, ae, 3);
+
+	/* Backwards, leaving the data unread. */
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "dir/file1", &ae));
+	assertEqualString("dir/file1", archive_entry_pathname(ae));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry_index(a, 0, &ae));
+	verify_entry(a, ae, 0);
+
+	/* Misses leave the current position alone. */
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "nonexistent", &ae));
+	assert(ae == NULL);
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry_index(a, 4, &ae));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry_index(a, -1, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	verify_entry(a, ae, 1);
+
+	/* ... and the current entry, part way through its data. */
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &held));
+	assertEqualInt(5, archive_read_data(a, data, 5));
+	assertEqualMem(data, "ccccc", 5);
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "nonexistent", &ae));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry_index(a, 4, &ae));
+	assertEqualString("file2", archive_entry_pathname(held));
+	assertEqualInt(30, archive_entry_size(held));
+	assertEqualInt(25, archive_read_data(a, data, sizeof(data)));
+	assertEqualMem(data, "ccccccccccccccccccccccccc", 25);
+
+	/* Seeking works after the end of the archive, too. */
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry_index(a, 3, &ae));
+	verify_entry(a, ae, 3);
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* A miss right after open doesn't lose the first entry. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, buff, used));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "file", &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	verify_entry(a, ae, 0);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	free(buff);
+}
+
+static void
+test_streaming(void)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *buff;
+	size_t buffsize = 100000, used;
+
+	buff = malloc(buffsize);
+	used = write_archive(buff, buffsize, 0);
+
+	/* Tar has no directory to look entries up in. */
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, buff, used));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "file2", &ae));
+	assert(archive_error_string(a) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	verify_entry(a, ae, 1);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* Neither does Zip read without seeking. */
+	used = write_archive(buff, buffsize, 1);
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_support_format_zip_streamable(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, buff, used));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "file2", &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	free(buff);
+}
+
+static void
+test_7zip(void)
+{
+	const char *refname = "test_read_format_7zip_lzma1_lzma2.7z";
+	struct archive_entry *ae;
+	struct archive *a;
+	char buff[128];
+
+	assert((a = archive_read_new()) != NULL);
+	if (ARCHIVE_OK != archive_read_support_filter_xz(a)) {
+		skipping("7zip:lzma decoding is not supported on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+		return;
+	}
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* Entries file1..file4 and zfile1..zfile4 are in two folders. */
+	extract_reference_file(refname);
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename(a, refname, 10240));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "zfile3", &ae));
+	assertEqualString("zfile3", archive_entry_pathname(ae));
+	assertEqualInt(39, archive_read_data(a, buff, sizeof(buff)));
+	assertEqualMem(buff, "aaaaaaaaaaaa\nbbbbbbbbbbbb\ncccccccccccc\n", 39);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("zfile4", archive_entry_pathname(ae));
+	assertEqualInt(52, archive_read_data(a, buff, sizeof(buff)));
+	assertEqualMem(buff,
+	    "aaaaaaaaaaaa\nbbbbbbbbbbbb\ncccccccccccc\ndddddddddddd\n", 52);
+
+	/* Back into the first folder. */
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "file2", &ae));
+	assertEqualInt(26, archive_read_data(a, buff, sizeof(buff)));
+	assertEqualMem(buff, "aaaaaaaaaaaa\nbbbbbbbbbbbb\n", 26);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry_index(a, 0, &ae));
+	assertEqualString("dir1/file1", archive_entry_pathname(ae));
+	assertEqualInt(13, archive_read_data(a, buff, sizeof(buff)));
+	assertEqualMem(buff, "aaaaaaaaaaaa\n", 13);
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_seek_entry(a, "file5", &ae));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "dir1/", &ae));
+	assertEqualInt((AE_IFDIR | 0755), archive_entry_mode(ae));
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+
+	assertEqualInt(ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_read_seek_entry)
+{
+	test_zip();
+	test_streaming();
+	test_7zip();
+}
@@ -0,0 +1,189 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Random access to the entries of a tar.xz through the xz Index and
+ * a sidecar index.
+ */
+
+#define	ENTRIES	6
+#define	ENTRY_SIZE	(512 * 1024)
+
+static void
+fill_entry(char *buff, int n)
+{
+	unsigned int seed = n + 1;
+	int i;
+
+	for (i = 0; i < ENTRY_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		buff[i] = 'a' + ((seed >> 16) & 15);
+	}
+}
+
+static void
+verify_entry(struct archive *a, struct archive_entry *ae, int n,
+    char *expect, char *data)
+{
+	char name[16];
+
+	assert(ae != NULL);
+	if (ae == NULL)
+		return;
+	sprintf(name, "file%d", n);
+	assertEqualString(name, archive_entry_pathname(ae));
+	fill_entry(expect, n);
+	assertEqualInt(ENTRY_SIZE, archive_read_data(a, data, ENTRY_SIZE));
+	assertEqualMem(data, expect, ENTRY_SIZE);
+}
+
+static int64_t
+write_archive(const char *options, char *expect)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char name[16];
+	int64_t used;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_ustar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_xz(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_index_file(a, "test.idx"));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_filename(a, "test.txz"));
+	for (i = 0; i < ENTRIES; i++) {
+		assert((ae = archive_entry_new()) != NULL);
+		sprintf(name, "file%d", i);
+		archive_entry_copy_pathname(ae, name);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, ENTRY_SIZE);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		fill_entry(expect, i);
+		assertEqualInt(ENTRY_SIZE,
+		    archive_write_data(a, expect, ENTRY_SIZE));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	used = archive_filter_bytes(a, -1);
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (used);
+}
+
+static struct archive *
+open_archive(const char *options)
+{
+	struct archive *a;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_set_index_file(a, "test.idx"));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_filename(a, "test.txz", 10240));
+	return (a);
+}
+
+static void
+jump_around(const char *options, char *expect, char *data)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+
+	a = open_archive(options);
+	/* Read a little first, so the Index is loaded mid-stream. */
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	verify_entry(a, ae, 0, expect, data);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "file4", &ae));
+	verify_entry(a, ae, 4, expect, data);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "file1", &ae));
+	verify_entry(a, ae, 1, expect, data);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	verify_entry(a, ae, 2, expect, data);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry_index(a, 0, &ae));
+	verify_entry(a, ae, 0, expect, data);
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry_index(a, 5, &ae));
+	verify_entry(a, ae, 5, expect, data);
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "file3", &ae));
+	verify_entry(a, ae, 3, expect, data);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_read_seek_xz)
+{
+	struct archive_read_stats st;
+	struct archive_entry *ae;
+	struct archive *a;
+	char *expect, *data;
+	int64_t used;
+
+	assert((a = archive_write_new()) != NULL);
+	if (ARCHIVE_OK != archive_write_add_filter_xz(a)) {
+		skipping("xz writing not supported on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return;
+	}
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	expect = malloc(ENTRY_SIZE);
+	data = malloc(ENTRY_SIZE);
+
+	/* Many small blocks. */
+	used = write_archive("xz:compression-level=0,xz:threads=2,"
+	    "xz:block-size=200000", expect);
+	jump_around("", expect, data);
+	jump_around("xz:threads=2", expect, data);
+	jump_around("xz:threads=3,pipeline=2", expect, data);
+
+	/* Only the blocks holding the entry are read. */
+	a = open_archive("");
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_seek_entry(a, "file5", &ae));
+	verify_entry(a, ae, 5, expect, data);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_get_stats(a, -1, &st));
+	assert(st.seek_calls > 0);
+	assert(st.bytes_zero_copy + st.bytes_copied < used / 2);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* One big block works too, if not as cheaply. */
+	write_archive("xz:compression-level=0", expect);
+	jump_around("", expect, data);
+
+	free(expect);
+	free(data);
+}
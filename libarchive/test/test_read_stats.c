@@ -0,0 +1,118 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+static char buff[500000];
+static char data[200000];
+
+static void
+verify_stats(const char *options, int timing, size_t used)
+{
+	struct archive_read_stats st;
+	struct archive_entry *ae;
+	struct archive *a;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_all(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory2(a, buff,
+	    used, 7));
+	assertEqualInt(2, archive_filter_count(a));
+
+	/* First entry is read, second is skipped. */
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualInt(sizeof(data), archive_read_data(a, data, sizeof(data)));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_data_skip(a));
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+
+	/* The gzip filter. */
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_get_stats(a, 0, &st));
+	assert(st.read_calls > 0);
+	if (timing)
+		assert(st.read_wall_usec > 0);
+	else {
+		/* Nobody asked before now. */
+		assertEqualInt(0, st.read_wall_usec);
+		assertEqualInt(0, st.read_cpu_usec);
+	}
+	assert(st.read_cpu_usec >= 0);
+	assert(st.bytes_zero_copy + st.bytes_copied + st.skip_bytes
+	    >= archive_filter_bytes(a, 0));
+	assert(st.skip_calls >= 1);
+	assert(st.skip_bytes > 0);
+	assertEqualInt(0, st.seek_calls);
+
+	/* The client pseudo-filter: tiny blocks force copying. */
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_get_stats(a, -1, &st));
+	assert(st.read_calls >= (int64_t)(used / 7));
+	assert(st.bytes_copied > 0);
+	assert(st.buffer_reallocs > 0);
+
+	assertEqualIntA(a, ARCHIVE_FAILED, archive_read_get_stats(a, 2, &st));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_read_stats)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	size_t used;
+	int i;
+
+	/* Write a tar.gz with two entries. */
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_ustar(a));
+	if (archive_write_add_filter_gzip(a) != ARCHIVE_OK) {
+		skipping("gzip writing not supported on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return;
+	}
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, sizeof(buff), &used));
+	/* Poorly compressible, so the entries span several blocks. */
+	for (i = 0; i < (int)sizeof(data); i++)
+		data[i] = (char)rand();
+	for (i = 0; i < 2; i++) {
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, i ? "file2" : "file1");
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, sizeof(data));
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		assertEqualInt(sizeof(data),
+		    archive_write_data(a, data, sizeof(data)));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	verify_stats("", 0, used);
+	verify_stats("pipeline=2", 0, used);
+	verify_stats("timing", 1, used);
+	verify_stats("timing,pipeline=2", 1, used);
+}
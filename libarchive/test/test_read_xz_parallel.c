@@ -0,0 +1,214 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Decompress multi-block xz files with xz:threads=N, which finds the
+ * blocks through the Index at the end of the file, and check that the
+ * output is exactly what a serial read produces.
+ */
+
+/* Compress 'data' as an xz'd tar archive with one entry. */
+static size_t
+tar_member(char *out, size_t outsize, char *tar, size_t *tarlen,
+    const char *data, size_t len, const char *options)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	size_t used;
+	int xz;
+
+	for (xz = 0; xz < 2; xz++) {
+		assert((a = archive_write_new()) != NULL);
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_write_set_format_ustar(a));
+		if (xz) {
+			assertEqualIntA(a, ARCHIVE_OK,
+			    archive_write_add_filter_xz(a));
+			assertEqualIntA(a, ARCHIVE_OK,
+			    archive_write_set_options(a, options));
+		}
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_open_memory(a,
+		    xz ? out : tar, outsize, &used));
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, "file");
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, len);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		assertEqualInt(len, archive_write_data(a, data, len));
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		if (!xz)
+			*tarlen = used;
+	}
+	return (used);
+}
+
+static void
+verify(char *in, size_t inlen, const char *options,
+    const char *expect, size_t expectlen, int indexed)
+{
+	struct archive_read_stats st;
+	struct archive_entry *ae;
+	struct archive *a;
+	char *out;
+	size_t total = 0;
+	ssize_t bytes;
+
+	out = malloc(expectlen + 1);
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_xz(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_raw(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, in, inlen));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	for (;;) {
+		bytes = archive_read_data(a, out + total,
+		    expectlen + 1 - total);
+		assert(bytes >= 0);
+		if (bytes <= 0)
+			break;
+		total += bytes;
+		if (total > expectlen)
+			break;
+	}
+	assertEqualInt(expectlen, total);
+	assert(memcmp(out, expect, expectlen) == 0);
+	/* Only the Index is found by seeking. */
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_get_stats(a, -1, &st));
+	assertEqualInt(indexed, st.seek_calls > 0);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	free(out);
+}
+
+DEFINE_TEST(test_read_xz_parallel)
+{
+	const size_t size = 8 * 1024 * 1024;
+	struct archive_entry *ae;
+	struct archive *a;
+	char *in, *expect, *data;
+	size_t inlen, expectlen, n;
+	unsigned int seed = 1;
+
+	assert((a = archive_write_new()) != NULL);
+	if (ARCHIVE_OK != archive_write_add_filter_xz(a)) {
+		skipping("xz writing not supported on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return;
+	}
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_xz(a));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_options(a, "xz:threads=x"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_options(a, "xz:threads=1025"));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	in = malloc(size);
+	expect = malloc(size);
+	data = malloc(3 * 1024 * 1024);
+	for (n = 0; n < 3 * 1024 * 1024; n++) {
+		seed = seed * 1103515245 + 12345;
+		data[n] = "etaoin shrdlu\n"[(seed >> 16) % 14];
+	}
+
+	/* One stream of many blocks. */
+	inlen = tar_member(in, size, expect, &expectlen, data,
+	    3 * 1024 * 1024,
+	    "xz:compression-level=0,xz:threads=2,xz:block-size=100000");
+	verify(in, inlen, "", expect, expectlen, 0);
+	verify(in, inlen, "xz:threads=4", expect, expectlen, 1);
+	verify(in, inlen, "xz:threads=1", expect, expectlen, 1);
+	verify(in, inlen, "xz:threads=3,pipeline=2", expect, expectlen, 1);
+
+	/* Streams of one block and of many, with Stream Padding. */
+	inlen = tar_member(in, size, expect, &expectlen, data + 7, 20000,
+	    "xz:compression-level=0");
+	memset(in + inlen, 0, 8);
+	inlen += 8;
+	inlen += tar_member(in + inlen, size - inlen, expect + expectlen, &n,
+	    data + 11, 2000000, "xz:compression-level=0,xz:threads=2,"
+	    "xz:block-size=300000");
+	expectlen += n;
+	inlen += tar_member(in + inlen, size - inlen, expect + expectlen, &n,
+	    data, 0, "xz:compression-level=0,xz:threads=2");
+	expectlen += n;
+	memset(in + inlen, 0, 4);
+	inlen += 4;
+	verify(in, inlen, "", expect, expectlen, 0);
+	verify(in, inlen, "xz:threads=2", expect, expectlen, 1);
+
+	/* A single block leaves nothing to share out. */
+	inlen = tar_member(in, size, expect, &expectlen, data, 500000,
+	    "xz:compression-level=0");
+	verify(in, inlen, "xz:threads=2", expect, expectlen, 1);
+
+	/* Trailing garbage hides the Index; the streaming reader
+	 * rejects it as before. */
+	inlen = tar_member(in, size, expect, &expectlen, data, 500000,
+	    "xz:compression-level=0,xz:threads=2,"
+	    "xz:block-size=100000");
+	memcpy(in + inlen, "garbage!", 8);
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_xz(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_raw(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_set_options(a, "xz:threads=2"));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_open_memory(a, in, inlen + 8));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	while (archive_read_data(a, expect, size) > 0)
+		continue;
+	assert(archive_errno(a) != 0);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/* Bad data is still caught. */
+	inlen = tar_member(in, size, expect, &expectlen, data,
+	    3 * 1024 * 1024,
+	    "xz:compression-level=0,xz:threads=2,xz:block-size=100000");
+	in[inlen / 2] ^= 0x10;
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_xz(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_raw(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_set_options(a, "xz:threads=2"));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, in, inlen));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	while (archive_read_data(a, expect, size) > 0)
+		continue;
+	assertEqualString("Lzma library error: Corrupted input data",
+	    archive_error_string(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	free(in);
+	free(expect);
+	free(data);
+}
@@ -0,0 +1,170 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Compress with bzip2:threads=N; the blocks from the workers must be
+ * spliced into one ordinary bzip2 stream.
+ */
+
+#define	FILES	6
+#define	FILE_SIZE	(500 * 1024)
+
+static size_t
+write_archive(char *buff, size_t buffsize, const char *data,
+    size_t filesize, const char *options)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16];
+	size_t used;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_ustar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_bzip2(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	for (i = 0; i < FILES && filesize > 0; i++) {
+		assert((ae = archive_entry_new()) != NULL);
+		sprintf(path, "file%d", i);
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, filesize);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		assertEqualInt(filesize,
+		    archive_write_data(a, data + i * FILE_SIZE, filesize));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (used);
+}
+
+static void
+verify_archive(char *buff, size_t used, const char *data, size_t filesize)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16], *out;
+	int i;
+
+	out = malloc(FILE_SIZE);
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_bzip2(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_tar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, buff, used));
+	for (i = 0; i < FILES && filesize > 0; i++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		sprintf(path, "file%d", i);
+		assertEqualString(path, archive_entry_pathname(ae));
+		assertEqualInt(filesize, archive_read_data(a, out, filesize));
+		assert(memcmp(out, data + i * FILE_SIZE, filesize) == 0);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	free(out);
+}
+
+/* Count the block headers, which the serial reader never sees. */
+static int
+count_blocks(const char *buff, size_t used)
+{
+	const unsigned char *u = (const unsigned char *)buff;
+	size_t bit;
+	int b, blocks = 0;
+	uint64_t v = 0;
+
+	for (bit = 0; bit < used * 8; bit++) {
+		b = (u[bit >> 3] >> (7 - (bit & 7))) & 1;
+		v = ((v << 1) | b) & 0xffffffffffffULL;
+		if (v == 0x314159265359ULL)
+			blocks++;
+	}
+	return (blocks);
+}
+
+DEFINE_TEST(test_write_compress_bzip2_parallel)
+{
+	const size_t buffsize = 8 * 1024 * 1024;
+	struct archive *a;
+	char *buff, *data;
+	size_t serial, parallel, n;
+	unsigned int seed = 7;
+
+	assert((a = archive_write_new()) != NULL);
+	if (ARCHIVE_OK != archive_write_add_filter_bzip2(a)) {
+		skipping("bzip2 writing not supported on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return;
+	}
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "bzip2:threads=x"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "bzip2:threads=1025"));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	buff = malloc(buffsize);
+	data = malloc(FILES * FILE_SIZE);
+	for (n = 0; n < FILES * FILE_SIZE; n++) {
+		seed = seed * 1103515245 + 12345;
+		data[n] = "etaoin shrdlu\n"[(seed >> 16) % 14];
+	}
+
+	serial = write_archive(buff, buffsize, data, FILE_SIZE, "");
+	parallel = write_archive(buff, buffsize, data, FILE_SIZE,
+	    "bzip2:threads=4");
+	failure("threads=4 wrote %d bytes, serial wrote %d bytes",
+	    (int)parallel, (int)serial);
+	assert(parallel < serial + serial / 20);
+	/* One stream of 3MB in 720k blocks. */
+	assertEqualMem(buff, "BZh9", 4);
+	assertEqualInt(5, count_blocks(buff, parallel));
+	verify_archive(buff, parallel, data, FILE_SIZE);
+
+	/* Smaller blocks, and input that is a run of one byte. */
+	parallel = write_archive(buff, buffsize, data, FILE_SIZE,
+	    "bzip2:threads=2,bzip2:compression-level=1");
+	assertEqualMem(buff, "BZh1", 4);
+	verify_archive(buff, parallel, data, FILE_SIZE);
+	memset(data, 'a', FILES * FILE_SIZE);
+	parallel = write_archive(buff, buffsize, data, FILE_SIZE,
+	    "bzip2:compression-level=1,bzip2:threads=3");
+	verify_archive(buff, parallel, data, FILE_SIZE);
+
+	/* Small archives. */
+	parallel = write_archive(buff, buffsize, data, 100, "bzip2:threads=2");
+	assertEqualInt(1, count_blocks(buff, parallel));
+	verify_archive(buff, parallel, data, 100);
+	parallel = write_archive(buff, buffsize, data, 0, "bzip2:threads=2");
+	verify_archive(buff, parallel, data, 0);
+
+	free(buff);
+	free(data);
+}
@@ -0,0 +1,165 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Compress with gzip:threads=N; the result must be one ordinary gzip
+ * member that any reader can handle.
+ */
+
+#define	FILES	8
+#define	FILE_SIZE	(400 * 1024)
+
+static size_t
+write_archive(char *buff, size_t buffsize, const char *data,
+    const char *options, int gzip)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16];
+	size_t used;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_ustar(a));
+	if (gzip)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_write_add_filter_gzip(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	for (i = 0; i < FILES; i++) {
+		assert((ae = archive_entry_new()) != NULL);
+		sprintf(path, "file%d", i);
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, FILE_SIZE);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		assertEqualInt(FILE_SIZE,
+		    archive_write_data(a, data + i * 1000, FILE_SIZE));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (used);
+}
+
+static void
+verify_archive(char *buff, size_t used, const char *data,
+    const char *options)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16], *out;
+	int i;
+
+	out = malloc(FILE_SIZE);
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_gzip(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_tar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, buff, used));
+	for (i = 0; i < FILES; i++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		sprintf(path, "file%d", i);
+		assertEqualString(path, archive_entry_pathname(ae));
+		assertEqualInt(FILE_SIZE,
+		    archive_read_data(a, out, FILE_SIZE));
+		assert(memcmp(out, data + i * 1000, FILE_SIZE) == 0);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	free(out);
+}
+
+static unsigned long
+le32(const char *p)
+{
+	const unsigned char *u = (const unsigned char *)p;
+
+	return (u[0] | (u[1] << 8) | (u[2] << 16)
+	    | ((unsigned long)u[3] << 24));
+}
+
+DEFINE_TEST(test_write_compress_gzip_parallel)
+{
+	const size_t buffsize = 8 * 1024 * 1024;
+	struct archive *a;
+	char *buff, *data;
+	size_t serial, parallel, tarsize, n;
+	unsigned int seed = 7;
+
+	assert((a = archive_write_new()) != NULL);
+	if (ARCHIVE_OK != archive_write_add_filter_gzip(a)) {
+		skipping("gzip writing not supported on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return;
+	}
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "gzip:threads=x"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "gzip:threads=1025"));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	buff = malloc(buffsize);
+	/* Text-like data that repeats at a distance: the window that
+	 * primes each chunk makes a difference here. */
+	data = malloc(FILE_SIZE + FILES * 1000);
+	for (n = 0; n < FILE_SIZE + FILES * 1000; n++) {
+		if (n % 3000 == 0)
+			seed = (unsigned)(n / 3000 % 5) * 7919 + 1;
+		seed = seed * 1103515245 + 12345;
+		data[n] = "etaoin shrdlu\n"[(seed >> 16) % 14];
+	}
+
+	tarsize = write_archive(buff, buffsize, data, "", 0);
+	serial = write_archive(buff, buffsize, data, "", 1);
+	parallel = write_archive(buff, buffsize, data, "gzip:threads=4", 1);
+	failure("threads=4 wrote %d bytes, serial wrote %d bytes",
+	    (int)parallel, (int)serial);
+	assert(parallel < serial + serial / 20);
+
+	/* One member: a header at the front, a trailer at the end. */
+	assertEqualMem(buff, "\x1f\x8b\x08", 3);
+	assertEqualInt(tarsize, le32(buff + parallel - 4));
+	verify_archive(buff, parallel, data, "");
+	/* This reader checks the CRC. */
+	verify_archive(buff, parallel, data, "gzip:threads=2");
+
+	/* Other settings. */
+	parallel = write_archive(buff, buffsize, data,
+	    "gzip:threads=1,gzip:compression-level=1", 1);
+	verify_archive(buff, parallel, data, "gzip:threads=2");
+	parallel = write_archive(buff, buffsize, data,
+	    "gzip:compression-level=0,gzip:threads=3", 1);
+	assert(parallel > tarsize);
+	verify_archive(buff, parallel, data, "gzip:threads=2");
+
+	free(buff);
+	free(data);
+}
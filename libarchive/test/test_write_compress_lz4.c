@@ -0,0 +1,203 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Write lz4 frames with various options and read them back.
+ */
+
+#define	FILES	6
+#define	FILE_SIZE	(200 * 1024)
+
+static size_t
+write_archive(char *buff, size_t buffsize, const char *data,
+    const char *options)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16];
+	size_t used;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_ustar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_lz4(a));
+	assertEqualInt(ARCHIVE_FILTER_LZ4, archive_filter_code(a, 0));
+	assertEqualString("lz4", archive_filter_name(a, 0));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	for (i = 0; i < FILES; i++) {
+		assert((ae = archive_entry_new()) != NULL);
+		sprintf(path, "file%d", i);
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, FILE_SIZE);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		assertEqualInt(FILE_SIZE,
+		    archive_write_data(a, data + i * 1000, FILE_SIZE));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (used);
+}
+
+static void
+verify_archive(char *buff, size_t used, const char *data)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16], *out;
+	int i;
+
+	out = malloc(FILE_SIZE);
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_lz4(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_tar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, buff, used));
+	for (i = 0; i < FILES; i++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		sprintf(path, "file%d", i);
+		assertEqualString(path, archive_entry_pathname(ae));
+		assertEqualInt(FILE_SIZE,
+		    archive_read_data(a, out, FILE_SIZE));
+		assert(memcmp(out, data + i * 1000, FILE_SIZE) == 0);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_FILTER_LZ4, archive_filter_code(a, 0));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	free(out);
+}
+
+/* Read everything and return the error message, if any. */
+static const char *
+read_error(char *buff, size_t used, char *out, size_t outsize)
+{
+	static char msg[128];
+	struct archive_entry *ae;
+	struct archive *a;
+	ssize_t bytes;
+
+	msg[0] = '\0';
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_lz4(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_raw(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, buff, used));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	while ((bytes = archive_read_data(a, out, outsize)) > 0)
+		continue;
+	if (bytes < 0)
+		strncpy(msg, archive_error_string(a), sizeof(msg) - 1);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	return (msg);
+}
+
+DEFINE_TEST(test_write_compress_lz4)
+{
+	const size_t buffsize = 4 * 1024 * 1024;
+	struct archive *a;
+	char *buff, *data;
+	size_t used, used1, used9, n;
+	unsigned int seed = 7;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_lz4(a));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_filter_option(a, NULL, "nonexistent-option", "0"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "lz4:compression-level=abc"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "lz4:compression-level=0"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "lz4:compression-level=10"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "lz4:block-size=3"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "lz4:block-size=8"));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_options(a, "lz4:block-size=4"));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	buff = malloc(buffsize);
+	/* Text-like data with long repeats and some noise. */
+	data = malloc(FILE_SIZE + FILES * 1000);
+	for (n = 0; n < FILE_SIZE + FILES * 1000; n++) {
+		if (n % 3000 == 0)
+			seed = (unsigned)(n / 3000 % 5) * 7919 + 1;
+		seed = seed * 1103515245 + 12345;
+		data[n] = "etaoin shrdlu\n"[(seed >> 16) % 14];
+		if (n > 100000 && n < 140000)
+			data[n] = (char)(seed >> 16);
+	}
+
+	/* Defaults: independent blocks, stream checksum. */
+	used1 = write_archive(buff, buffsize, data, "");
+	assertEqualMem(buff, "\x04\x22\x4d\x18", 4);
+	assertEqualInt(0x64, buff[4] & 0xff);
+	assertEqualInt(0x70, buff[5] & 0xff);
+	verify_archive(buff, used1, data);
+
+	used9 = write_archive(buff, buffsize, data, "lz4:compression-level=9");
+	failure("level 9 wrote %d bytes, level 1 wrote %d bytes",
+	    (int)used9, (int)used1);
+	assert(used9 < used1);
+	verify_archive(buff, used9, data);
+
+	used = write_archive(buff, buffsize, data,
+	    "lz4:block-dependence,lz4:block-checksum,lz4:block-size=4");
+	assertEqualInt(0x54, buff[4] & 0xff);
+	assertEqualInt(0x40, buff[5] & 0xff);
+	verify_archive(buff, used, data);
+
+	used = write_archive(buff, buffsize, data,
+	    "lz4:!stream-checksum,lz4:block-size=5,lz4:compression-level=4");
+	assertEqualInt(0x60, buff[4] & 0xff);
+	assertEqualInt(0x50, buff[5] & 0xff);
+	verify_archive(buff, used, data);
+
+	/* Damage is caught by the block checksum... */
+	used = write_archive(buff, buffsize, data,
+	    "lz4:block-checksum,lz4:block-size=4");
+	buff[used / 2] ^= 0x10;
+	assertEqualString("lz4 block checksum error",
+	    read_error(buff, used, data, FILE_SIZE));
+	/* ...or else by the stream checksum. */
+	used = write_archive(buff, buffsize, data, "lz4:block-size=4");
+	buff[used - 1] ^= 0x01;
+	assertEqualString("lz4 stream checksum error",
+	    read_error(buff, used, data, FILE_SIZE));
+	buff[used - 1] ^= 0x01;
+	assertEqualString("", read_error(buff, used, data, FILE_SIZE));
+	assertEqualString("truncated lz4 input",
+	    read_error(buff, used - 20, data, FILE_SIZE));
+
+	free(buff);
+	free(data);
+}
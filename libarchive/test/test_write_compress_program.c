@@ -27,6 +27,8 @@ __FBSDID("$FreeBSD: head/lib/libarchive/test/test_write_compress_program.c 20124
 
 char buff[1000000];
 char buff2[64];
+char data[600000];
+char data2[600000];
 
 DEFINE_TEST(test_write_compress_program)
 {
@@ -34,7 +36,8 @@ DEFINE_TEST(test_write_compress_program)
 	struct archive *a;
 	size_t used;
 	int blocksize = 1024;
-	int r;
+	unsigned int seed = 1;
+	int i, r;
 
 	if (!canGzip()) {
 		skipping("Cannot run 'gzip'");
@@ -111,4 +114,46 @@ DEFINE_TEST(test_write_compress_program)
 	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
 	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
 	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	/*
+	 * Commands can carry arguments, and a lot of data has to be
+	 * able to flow both ways at once.
+	 */
+	for (i = 0; i < (int)sizeof(data); i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = "0123456789abcdef\n"[(seed >> 16) % 17];
+	}
+	assert((a = archive_write_new()) != NULL);
+	assertA(0 == archive_write_set_format_ustar(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_add_filter_program(a, "gzip -c -9"));
+	assertA(0 == archive_write_open_memory(a, buff, sizeof(buff), &used));
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "big");
+	archive_entry_set_mode(ae, S_IFREG | 0644);
+	archive_entry_set_size(ae, sizeof(data));
+	assertA(0 == archive_write_header(a, ae));
+	archive_entry_free(ae);
+	assertEqualIntA(a, sizeof(data),
+	    archive_write_data(a, data, sizeof(data)));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	if (!canGunzip()) {
+		skipping("Can't run gunzip program on this platform");
+		return;
+	}
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_all(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_read_support_filter_program(a, "gzip -d -c"));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, buff, used));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("big", archive_entry_pathname(ae));
+	assertEqualIntA(a, sizeof(data2),
+	    archive_read_data(a, data2, sizeof(data2)));
+	assert(memcmp(data, data2, sizeof(data)) == 0);
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
 }
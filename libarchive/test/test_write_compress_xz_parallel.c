@@ -0,0 +1,181 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Compress with xz:threads=N; the result must be one xz stream with
+ * a block for every block-size bytes of input.
+ */
+
+#define	FILES	6
+#define	FILE_SIZE	(300 * 1024)
+
+static size_t
+write_archive(char *buff, size_t buffsize, const char *data,
+    size_t filesize, const char *options)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16];
+	size_t used;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_ustar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_xz(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	for (i = 0; i < FILES && filesize > 0; i++) {
+		assert((ae = archive_entry_new()) != NULL);
+		sprintf(path, "file%d", i);
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, filesize);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		assertEqualInt(filesize,
+		    archive_write_data(a, data + i * FILE_SIZE, filesize));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (used);
+}
+
+static void
+verify_archive(char *buff, size_t used, const char *data, size_t filesize)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16], *out;
+	int i;
+
+	out = malloc(FILE_SIZE);
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_xz(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_tar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, buff, used));
+	for (i = 0; i < FILES && filesize > 0; i++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		sprintf(path, "file%d", i);
+		assertEqualString(path, archive_entry_pathname(ae));
+		assertEqualInt(filesize, archive_read_data(a, out, filesize));
+		assert(memcmp(out, data + i * FILE_SIZE, filesize) == 0);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	free(out);
+}
+
+/* Number of records in the index that ends the stream. */
+static int
+count_blocks(const char *buff, size_t used)
+{
+	const unsigned char *footer, *index;
+	size_t backward;
+	int n = 0, shift = 0;
+
+	footer = (const unsigned char *)buff + used - 12;
+	assertEqualMem(footer + 10, "YZ", 2);
+	backward = ((size_t)footer[4] | (footer[5] << 8) | (footer[6] << 16)
+	    | ((size_t)footer[7] << 24)) * 4 + 4;
+	index = footer - backward;
+	assertEqualInt(0, index[0]);
+	do {
+		n |= (*++index & 0x7f) << shift;
+		shift += 7;
+	} while (*index & 0x80);
+	return (n);
+}
+
+DEFINE_TEST(test_write_compress_xz_parallel)
+{
+	const size_t buffsize = 8 * 1024 * 1024;
+	struct archive *a;
+	char *buff, *data;
+	size_t serial, parallel, n;
+	unsigned int seed = 7;
+
+	assert((a = archive_write_new()) != NULL);
+	if (ARCHIVE_OK != archive_write_add_filter_xz(a)) {
+		skipping("xz writing not supported on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return;
+	}
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "xz:threads=x"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "xz:block-size=-1"));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	/* Not for lzma. */
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_lzma(a));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "lzma:threads=2"));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	buff = malloc(buffsize);
+	data = malloc(FILES * FILE_SIZE);
+	for (n = 0; n < FILES * FILE_SIZE; n++) {
+		seed = seed * 1103515245 + 12345;
+		data[n] = "etaoin shrdlu\n"[(seed >> 16) % 14];
+	}
+
+	serial = write_archive(buff, buffsize, data, FILE_SIZE,
+	    "xz:compression-level=0");
+	assertEqualInt(1, count_blocks(buff, serial));
+	/* 1.8MB in blocks of the smallest default size, 1MB. */
+	parallel = write_archive(buff, buffsize, data, FILE_SIZE,
+	    "xz:compression-level=0,xz:threads=2");
+	failure("threads=2 wrote %d bytes, serial wrote %d bytes",
+	    (int)parallel, (int)serial);
+	assert(parallel < serial + serial / 20);
+	assertEqualMem(buff, "\xFD" "7zXZ\0", 6);
+	assertEqualInt(2, count_blocks(buff, parallel));
+	verify_archive(buff, parallel, data, FILE_SIZE);
+
+	/* Smaller blocks. */
+	parallel = write_archive(buff, buffsize, data, FILE_SIZE,
+	    "xz:threads=3,xz:block-size=100000,xz:compression-level=0");
+	assertEqualInt(19, count_blocks(buff, parallel));
+	verify_archive(buff, parallel, data, FILE_SIZE);
+
+	/* Data that doesn't compress; no data at all. */
+	for (n = 0; n < FILES * FILE_SIZE; n++) {
+		seed = seed * 1103515245 + 12345;
+		data[n] = (char)(seed >> 16);
+	}
+	parallel = write_archive(buff, buffsize, data, FILE_SIZE,
+	    "xz:threads=4,xz:block-size=250000");
+	verify_archive(buff, parallel, data, FILE_SIZE);
+	parallel = write_archive(buff, buffsize, data, 0, "xz:threads=2");
+	verify_archive(buff, parallel, data, 0);
+
+	free(buff);
+	free(data);
+}
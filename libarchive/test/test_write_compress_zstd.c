@@ -0,0 +1,219 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Write zstd streams with various options and read them back.
+ */
+
+#define	FILES	6
+#define	FILE_SIZE	(1024 * 1024)
+
+static size_t
+write_archive(char *buff, size_t buffsize, const char *data,
+    const char *options)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16];
+	size_t used;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_ustar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_zstd(a));
+	assertEqualInt(ARCHIVE_FILTER_ZSTD, archive_filter_code(a, 0));
+	assertEqualString("zstd", archive_filter_name(a, 0));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	for (i = 0; i < FILES; i++) {
+		assert((ae = archive_entry_new()) != NULL);
+		sprintf(path, "file%d", i);
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, FILE_SIZE);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		assertEqualInt(FILE_SIZE,
+		    archive_write_data(a, data + i * 1000, FILE_SIZE));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (used);
+}
+
+static void
+verify_archive(char *buff, size_t used, const char *data,
+    const char *options)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16], *out;
+	int i;
+
+	out = malloc(FILE_SIZE);
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_zstd(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_tar(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_open_memory(a, buff, used));
+	for (i = 0; i < FILES; i++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		sprintf(path, "file%d", i);
+		assertEqualString(path, archive_entry_pathname(ae));
+		assertEqualInt(FILE_SIZE,
+		    archive_read_data(a, out, FILE_SIZE));
+		assert(memcmp(out, data + i * 1000, FILE_SIZE) == 0);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_FILTER_ZSTD, archive_filter_code(a, 0));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	free(out);
+}
+
+/* Read everything and return the error message, if any. */
+static const char *
+read_error(char *buff, size_t used, char *out, size_t outsize)
+{
+	static char msg[128];
+	struct archive_entry *ae;
+	struct archive *a;
+	ssize_t bytes;
+	int r;
+
+	msg[0] = '\0';
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_zstd(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_raw(a));
+	r = archive_read_open_memory(a, buff, used);
+	if (r == ARCHIVE_OK)
+		r = archive_read_next_header(a, &ae);
+	if (r == ARCHIVE_OK) {
+		while ((bytes = archive_read_data(a, out, outsize)) > 0)
+			continue;
+		if (bytes < 0)
+			r = ARCHIVE_FATAL;
+	}
+	if (r != ARCHIVE_OK)
+		strncpy(msg, archive_error_string(a), sizeof(msg) - 1);
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	return (msg);
+}
+
+DEFINE_TEST(test_write_compress_zstd)
+{
+	const size_t buffsize = 8 * 1024 * 1024;
+	struct archive *a;
+	char *buff, *data, *big;
+	size_t used, used1, used19, n;
+	unsigned int seed = 7;
+
+	assert((a = archive_write_new()) != NULL);
+	if (ARCHIVE_OK != archive_write_add_filter_zstd(a)) {
+		skipping("zstd writing not supported on this platform");
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return;
+	}
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_filter_option(a, NULL, "nonexistent-option", "0"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "zstd:compression-level=abc"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "zstd:compression-level=99"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "zstd:long=2"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "zstd:long=99"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_options(a, "zstd:threads=x"));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_options(a, "zstd:compression-level=-5"));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_filter_zstd(a));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_read_set_options(a, "zstd:long=x"));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+
+	buff = malloc(buffsize);
+	/* Text-like data with long repeats and some noise. */
+	data = malloc(FILE_SIZE + FILES * 1000);
+	for (n = 0; n < FILE_SIZE + FILES * 1000; n++) {
+		if (n % 3000 == 0)
+			seed = (unsigned)(n / 3000 % 5) * 7919 + 1;
+		seed = seed * 1103515245 + 12345;
+		data[n] = "etaoin shrdlu\n"[(seed >> 16) % 14];
+		if (n > 100000 && n < 140000)
+			data[n] = (char)(seed >> 16);
+	}
+
+	used1 = write_archive(buff, buffsize, data, "zstd:compression-level=1");
+	assertEqualMem(buff, "\x28\xb5\x2f\xfd", 4);
+	verify_archive(buff, used1, data, "");
+	used19 = write_archive(buff, buffsize, data,
+	    "zstd:compression-level=19");
+	failure("level 19 wrote %d bytes, level 1 wrote %d bytes",
+	    (int)used19, (int)used1);
+	assert(used19 < used1);
+	verify_archive(buff, used19, data, "");
+	used = write_archive(buff, buffsize, data,
+	    "zstd:compression-level=-5");
+	verify_archive(buff, used, data, "");
+	used = write_archive(buff, buffsize, data, "zstd:threads=4");
+	verify_archive(buff, used, data, "");
+	used = write_archive(buff, buffsize, data,
+	    "zstd:threads=2,zstd:long=20");
+	verify_archive(buff, used, data, "");
+
+	/* A long window has to be allowed by the reader. */
+	used = write_archive(buff, buffsize, data, "zstd:long");
+	verify_archive(buff, used, data, "");
+	used = write_archive(buff, buffsize, data, "zstd:long=28");
+	verify_archive(buff, used, data, "zstd:long=28");
+	assert(strncmp(read_error(buff, used, data, FILE_SIZE),
+	    "zstd decompression failed: ", 27) == 0);
+
+	/* Two streams back to back read as one. */
+	big = malloc(2 * buffsize);
+	used = write_archive(buff, buffsize, data, "zstd:compression-level=2");
+	memcpy(big, buff, used);
+	memcpy(big + used, buff, used);
+	assertEqualString("", read_error(big, 2 * used, data, FILE_SIZE));
+
+	/* Damaged and truncated data. */
+	assertEqualString("truncated zstd input",
+	    read_error(buff, used - 10, data, FILE_SIZE));
+	buff[used - 2] ^= 0x01;	/* In the checksum. */
+	assert(strncmp(read_error(buff, used, data, FILE_SIZE),
+	    "zstd decompression failed: ", 27) == 0);
+
+	free(big);
+	free(buff);
+	free(data);
+}
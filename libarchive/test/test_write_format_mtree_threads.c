@@ -0,0 +1,127 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * With mtree:threads=N the sums are computed on worker threads; the
+ * manifest must come out exactly as it does without.
+ */
+
+static const size_t sizes[] = { 0, 1, 5000, 65536, 700001, 3 * 1024 * 1024 };
+
+static size_t
+write_mtree(char *buff, size_t buffsize, const char *data,
+    const char *options, size_t piece)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[16];
+	size_t used, i, done, n;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_mtree(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		assert((ae = archive_entry_new()) != NULL);
+		sprintf(path, "./file%d", (int)i);
+		archive_entry_copy_pathname(ae, path);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_mtime(ae, 1300000000, 0);
+		archive_entry_set_size(ae, sizes[i]);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		for (done = 0; done < sizes[i]; done += n) {
+			n = sizes[i] - done < piece ? sizes[i] - done : piece;
+			assertEqualInt(n,
+			    archive_write_data(a, data + i + done, n));
+		}
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (used);
+}
+
+DEFINE_TEST(test_write_format_mtree_threads)
+{
+	const size_t buffsize = 64 * 1024;
+	struct archive *a;
+	char *data, *serial, *parallel;
+	size_t serial_used, parallel_used, n;
+	unsigned int seed = 11;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_mtree(a));
+	assertEqualIntA(a, ARCHIVE_WARN,
+	    archive_write_set_format_option(a, "mtree", "threads", "x"));
+	assertEqualIntA(a, ARCHIVE_WARN,
+	    archive_write_set_format_option(a, "mtree", "threads", "1025"));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_format_option(a, "mtree", "threads", "1024"));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	data = malloc(3 * 1024 * 1024 + 16);
+	serial = malloc(buffsize);
+	parallel = malloc(buffsize);
+	for (n = 0; n < 3 * 1024 * 1024 + 16; n++) {
+		seed = seed * 1103515245 + 12345;
+		data[n] = (char)(seed >> 16);
+	}
+
+	serial_used = write_mtree(serial, buffsize, data, "mtree:all", 10000);
+	serial[serial_used] = '\0';
+	assert(strstr(serial, " sha256digest=") != NULL ||
+	    strstr(serial, " md5digest=") == NULL);
+
+	/* Pieces that straddle the staging buffers every which way. */
+	parallel_used = write_mtree(parallel, buffsize, data,
+	    "mtree:all,mtree:threads=4", 10000);
+	assertEqualInt(serial_used, parallel_used);
+	assertEqualMem(serial, parallel, serial_used);
+
+	parallel_used = write_mtree(parallel, buffsize, data,
+	    "mtree:all,mtree:threads=2", 1024 * 1024 + 1);
+	assertEqualInt(serial_used, parallel_used);
+	assertEqualMem(serial, parallel, serial_used);
+
+	/* More threads than sums. */
+	parallel_used = write_mtree(parallel, buffsize, data,
+	    "mtree:all,mtree:threads=16", 77);
+	assertEqualInt(serial_used, parallel_used);
+	assertEqualMem(serial, parallel, serial_used);
+
+	/* Just one sum: done on the calling thread. */
+	serial_used = write_mtree(serial, buffsize, data, "mtree:cksum", 4096);
+	parallel_used = write_mtree(parallel, buffsize, data,
+	    "mtree:cksum,mtree:threads=4", 4096);
+	assertEqualInt(serial_used, parallel_used);
+	assertEqualMem(serial, parallel, serial_used);
+
+	free(data);
+	free(serial);
+	free(parallel);
+}
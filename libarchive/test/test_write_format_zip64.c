@@ -0,0 +1,285 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Zip64 extensions: forced with zip:zip64, refused with zip:!zip64,
+ * and used automatically for an archive with more than 65535 entries.
+ */
+
+#define	FILE_SIZE	1000
+/* More than the 16-bit entry count of the old end record can hold. */
+#define	MANY_ENTRIES	70000
+
+/* Quick and dirty: Read little-endian integers from Zip file. */
+static unsigned i2(const char *p) { return ((p[0] & 0xff) | ((p[1] & 0xff) << 8)); }
+static unsigned i4(const char *p) { return (i2(p) | (i2(p + 2) << 16)); }
+static uint64_t i8(const char *p) { return (i4(p) | ((uint64_t)i4(p + 4) << 32)); }
+
+static void
+read_back(char *buff, size_t used, int seekable, const char *file_data)
+{
+	struct archive *a;
+	struct archive_entry *ae;
+	char data[FILE_SIZE];
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_zip(a));
+	if (seekable)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    read_open_memory_seek(a, buff, used, 7));
+	else
+		assertEqualIntA(a, ARCHIVE_OK,
+		    read_open_memory(a, buff, used, 7));
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("file", archive_entry_pathname(ae));
+	if (seekable)
+		assertEqualInt(FILE_SIZE, archive_entry_size(ae));
+	assertEqualInt(FILE_SIZE, archive_read_data(a, data, sizeof(data)));
+	assertEqualMem(data, file_data, FILE_SIZE);
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_next_header(a, &ae));
+	assertEqualString("dir/", archive_entry_pathname(ae));
+	assertEqualInt(AE_IFDIR, archive_entry_filetype(ae));
+
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+}
+
+static void
+verify_zip64(const char *compression)
+{
+	struct archive *a;
+	struct archive_entry *ae;
+	char file_data[FILE_SIZE];
+	char buff[100000];
+	const char *buffend, *p, *q, *e;
+	size_t used;
+	uint64_t compressed_size, cd_offset, cd_size;
+	int i;
+
+	for (i = 0; i < FILE_SIZE; i++)
+		file_data[i] = "Zip64 "[i % 6];
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_format_option(a, "zip", "compression",
+		compression));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_format_option(a, "zip", "zip64", "1"));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_none(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, sizeof(buff), &used));
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "file");
+	archive_entry_set_mode(ae, AE_IFREG | 0644);
+	archive_entry_set_size(ae, FILE_SIZE);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+	assertEqualInt(FILE_SIZE, archive_write_data(a, file_data, FILE_SIZE));
+
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "dir/");
+	archive_entry_set_mode(ae, AE_IFDIR | 0755);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	buffend = buff + used;
+
+	/* Local file header: sizes are in the Zip64 extra field. */
+	q = buff;
+	assertEqualMem(q, "PK\003\004", 4);
+	assertEqualInt(45, i2(q + 4));
+	assertEqualInt(0xffffffff, i4(q + 18));
+	assertEqualInt(0xffffffff, i4(q + 22));
+	assertEqualInt(4, i2(q + 26));
+	assertEqualInt(32 + 20, i2(q + 28));
+	e = q + 30 + 4 + 32;
+	assertEqualInt(0x0001, i2(e));
+	assertEqualInt(16, i2(e + 2));
+	assertEqualInt(FILE_SIZE, i8(e + 4));
+
+	/* Data descriptor with 64-bit sizes. */
+	q = buffend - 22 - 20 - 56;
+	cd_offset = i8(q + 48);
+	cd_size = i8(q + 40);
+	p = buff + cd_offset;
+	compressed_size = i8(p + 46 + 4 + 13 + 4 + 8);
+	if (strcmp(compression, "store") == 0)
+		assertEqualInt(FILE_SIZE, compressed_size);
+	q = buff + 30 + 4 + 52 + compressed_size;
+	assertEqualMem(q, "PK\007\010", 4);
+	assertEqualInt(i4(p + 16), i4(q + 4));
+	assertEqualInt(compressed_size, i8(q + 8));
+	assertEqualInt(FILE_SIZE, i8(q + 16));
+	assertEqualMem(q + 24, "PK\003\004", 4);
+
+	/* Central directory: sizes and offset in the Zip64 field. */
+	assertEqualMem(p, "PK\001\002", 4);
+	assertEqualInt(45, i2(p + 6));
+	assertEqualInt(0xffffffff, i4(p + 20));
+	assertEqualInt(0xffffffff, i4(p + 24));
+	assertEqualInt(13 + 28, i2(p + 30));
+	assertEqualInt(0xffffffff, i4(p + 42));
+	e = p + 46 + 4 + 13;
+	assertEqualInt(0x0001, i2(e));
+	assertEqualInt(24, i2(e + 2));
+	assertEqualInt(FILE_SIZE, i8(e + 4));
+	assertEqualInt(0, i8(e + 20));
+
+	/* Zip64 end of central directory record and locator. */
+	q = buffend - 22 - 20;
+	assertEqualMem(q, "PK\006\007", 4);
+	assertEqualInt(0, i4(q + 4));
+	assertEqualInt(buffend - 22 - 20 - 56 - buff, i8(q + 8));
+	assertEqualInt(1, i4(q + 16));
+	q = buffend - 22 - 20 - 56;
+	assertEqualMem(q, "PK\006\006", 4);
+	assertEqualInt(44, i8(q + 4));
+	assertEqualInt(45, i2(q + 14));
+	assertEqualInt(2, i8(q + 24));
+	assertEqualInt(2, i8(q + 32));
+	assertEqualInt(q - (buff + cd_offset), cd_size);
+
+	/* The ordinary end record still has the values that fit. */
+	q = buffend - 22;
+	assertEqualMem(q, "PK\005\006", 4);
+	assertEqualInt(2, i2(q + 10));
+	assertEqualInt(cd_size, i4(q + 12));
+	assertEqualInt(cd_offset, i4(q + 16));
+
+	read_back(buff, used, 1, file_data);
+	read_back(buff, used, 0, file_data);
+}
+
+DEFINE_TEST(test_write_format_zip64)
+{
+	struct archive *a;
+	struct archive_entry *ae;
+	char *buff;
+	size_t buffsize = 16 * 1024 * 1024;
+	size_t used;
+	const char *q;
+	char name[16];
+	int i;
+
+	verify_zip64("store");
+#ifdef HAVE_ZLIB_H
+	verify_zip64("deflate");
+#else
+	skipping("Zip64 with deflate compression");
+#endif
+
+	/* With !zip64, a file that needs Zip64 is refused. */
+	buff = malloc(buffsize);
+	assert(buff != NULL);
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_format_option(a, "zip", "zip64", NULL));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_none(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_copy_pathname(ae, "big");
+	archive_entry_set_mode(ae, AE_IFREG | 0644);
+	archive_entry_set_size(ae, 5 * (int64_t)1024 * 1024 * 1024);
+	assertEqualIntA(a, ARCHIVE_FAILED, archive_write_header(a, ae));
+	archive_entry_copy_pathname(ae, "small");
+	archive_entry_set_size(ae, 0);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	archive_entry_free(ae);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	assertEqualInt(20, i2(buff + 4));
+	assertEqualInt(32, i2(buff + 28));
+	assertEqualMem(buff + used - 22, "PK\005\006", 4);
+	assertEqualInt(1, i2(buff + used - 22 + 10));
+	for (q = buff; q + 4 <= buff + used; q++)
+		if (memcmp(q, "PK\006\006", 4) == 0)
+			break;
+	assert(q + 4 > buff + used);
+
+	/* By default, too many entries for the old end record bring in
+	 * the Zip64 records, but nothing else. */
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_add_filter_none(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	assert((ae = archive_entry_new()) != NULL);
+	archive_entry_set_mode(ae, AE_IFREG | 0644);
+	archive_entry_set_size(ae, 0);
+	for (i = 0; i < MANY_ENTRIES; i++) {
+		sprintf(name, "f%05d", i);
+		archive_entry_copy_pathname(ae, name);
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+	}
+	archive_entry_free(ae);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	assertEqualInt(20, i2(buff + 4));
+	q = buff + used - 22;
+	assertEqualMem(q, "PK\005\006", 4);
+	assertEqualInt(0xffff, i2(q + 8));
+	assertEqualInt(0xffff, i2(q + 10));
+	assertEqualInt(20, i2(buff + i4(q + 16) + 6));
+	assertEqualInt(13, i2(buff + i4(q + 16) + 30));
+	q = buff + used - 22 - 20 - 56;
+	assertEqualMem(q, "PK\006\006", 4);
+	assertEqualInt(MANY_ENTRIES, i8(q + 32));
+
+	/* Both readers see every entry. */
+	for (i = 0; i < 2; i++) {
+		int count = 0;
+
+		assert((a = archive_read_new()) != NULL);
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_support_format_zip(a));
+		if (i == 0)
+			assertEqualIntA(a, ARCHIVE_OK,
+			    read_open_memory_seek(a, buff, used, 10240));
+		else
+			assertEqualIntA(a, ARCHIVE_OK,
+			    read_open_memory(a, buff, used, 10240));
+		while (archive_read_next_header(a, &ae) == ARCHIVE_OK) {
+			sprintf(name, "f%05d", count);
+			if (!assertEqualString(name,
+			    archive_entry_pathname(ae)))
+				break;
+			count++;
+		}
+		assertEqualInt(MANY_ENTRIES, count);
+		assertEqualIntA(a, ARCHIVE_OK, archive_read_free(a));
+	}
+	free(buff);
+}
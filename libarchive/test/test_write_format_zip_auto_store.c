@@ -0,0 +1,202 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * With zip:auto-store, files that deflate can't shrink are stored.
+ * (Empty files are always deflated, as without the option.)
+ */
+
+#define	ENTRIES		6
+#define	BIG		(200 * 1024)
+
+static const char *names[ENTRIES] = {
+	"text", "random", "small-random", "empty", "big-random", "big-text"
+};
+static const int methods[ENTRIES] = { 8, 0, 0, 8, 0, 8 };
+
+static size_t
+entry_size(int i)
+{
+	switch (i) {
+	case 0: return (5000);
+	case 1: return (5000);
+	case 2: return (40);
+	case 3: return (0);
+	default: return (BIG);
+	}
+}
+
+static void
+fill(char *p, size_t size, int text, unsigned seed)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		p[i] = text ? "etaoin shrdlu\n"[(seed >> 16) % 14] :
+		    (char)(seed >> 16);
+	}
+}
+
+static size_t
+write_archive(char *buff, size_t buffsize, char **data,
+    const char *options)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	size_t used;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	for (i = 0; i < ENTRIES; i++) {
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, names[i]);
+		archive_entry_set_mode(ae, AE_IFREG | 0644);
+		archive_entry_set_size(ae, entry_size(i));
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		/* Past the sample in a single call, then the rest. */
+		if (entry_size(i) > 70000) {
+			assertEqualInt(70000,
+			    archive_write_data(a, data[i], 70000));
+			assertEqualInt(entry_size(i) - 70000,
+			    archive_write_data(a, data[i] + 70000,
+			    entry_size(i) - 70000));
+		} else
+			assertEqualInt(entry_size(i),
+			    archive_write_data(a, data[i], entry_size(i)));
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (used);
+}
+
+static void
+verify_archive(char *buff, size_t used, char **data, int seekable)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *out = malloc(BIG);
+	int i;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_zip(a));
+	if (seekable)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    read_open_memory_seek(a, buff, used, 7));
+	else
+		assertEqualIntA(a, ARCHIVE_OK,
+		    read_open_memory(a, buff, used, 7));
+	for (i = 0; i < ENTRIES; i++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		assertEqualString(names[i], archive_entry_pathname(ae));
+		failure("%s", names[i]);
+		assertEqualInt(entry_size(i), archive_read_data(a, out, BIG));
+		failure("%s", names[i]);
+		assert(memcmp(out, data[i], entry_size(i)) == 0);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	free(out);
+}
+
+static int
+i2(const char *p)
+{
+	return ((p[0] & 0xff) | ((p[1] & 0xff) << 8));
+}
+
+static int
+i4(const char *p)
+{
+	return (i2(p) | (i2(p + 2) << 16));
+}
+
+DEFINE_TEST(test_write_format_zip_auto_store)
+{
+	const size_t buffsize = ENTRIES * BIG;
+	char *data[ENTRIES];
+	char *buff1, *buff2;
+	const char *p;
+	size_t used1, used2;
+	int i;
+
+#ifndef HAVE_ZLIB_H
+	skipping("auto-store needs deflate compression");
+	return;
+#endif
+	for (i = 0; i < ENTRIES; i++) {
+		data[i] = malloc(BIG);
+		fill(data[i], BIG, methods[i] == 8, i);
+	}
+	buff1 = malloc(buffsize);
+	buff2 = malloc(buffsize);
+
+	used1 = write_archive(buff1, buffsize, data, "zip:auto-store");
+
+	/* Check the method of each entry in the central directory and
+	 * in its local file header. */
+	p = buff1 + i4(buff1 + used1 - 22 + 16);
+	for (i = 0; i < ENTRIES; i++) {
+		assertEqualMem(p, "PK\001\002", 4);
+		failure("%s", names[i]);
+		assertEqualInt(methods[i], i2(p + 10));
+		failure("%s", names[i]);
+		assertEqualInt(methods[i], i2(buff1 + i4(p + 42) + 8));
+		if (methods[i] == 0)
+			assertEqualInt(entry_size(i), i4(p + 20));
+		else if (entry_size(i) > 0)
+			assert(i4(p + 20) < (int)entry_size(i) * 3 / 4);
+		p += 46 + i2(p + 28) + i2(p + 30) + i2(p + 32);
+	}
+	verify_archive(buff1, used1, data, 1);
+	verify_archive(buff1, used1, data, 0);
+
+	/* Worker threads come to the same decisions. */
+	used2 = write_archive(buff2, buffsize, data,
+	    "zip:auto-store,zip:threads=2");
+	assertEqualInt(used1, used2);
+	assert(memcmp(buff1, buff2, used1) == 0);
+
+	/* Without the option, everything is deflated. */
+	used2 = write_archive(buff2, buffsize, data, "zip:threads=0");
+	p = buff2 + i4(buff2 + used2 - 22 + 16);
+	for (i = 0; i < ENTRIES; i++) {
+		assertEqualInt(8, i2(p + 10));
+		p += 46 + i2(p + 28) + i2(p + 30) + i2(p + 32);
+	}
+
+	for (i = 0; i < ENTRIES; i++)
+		free(data[i]);
+	free(buff1);
+	free(buff2);
+}
@@ -0,0 +1,228 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Write bzip2 (method 12) and LZMA (method 14) entries and read them
+ * back with both the seeking and the streaming reader.
+ */
+
+#define	ENTRIES		5
+#define	BIG		(200 * 1024)
+
+static const char *names[ENTRIES] = {
+	"text", "random", "empty", "big-text", "dir/"
+};
+
+static size_t
+entry_size(int i)
+{
+	switch (i) {
+	case 0: return (5000);
+	case 1: return (5000);
+	case 3: return (BIG);
+	default: return (0);
+	}
+}
+
+static void
+fill(char *p, size_t size, int text, unsigned seed)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		seed = seed * 1103515245 + 12345;
+		p[i] = text ? "etaoin shrdlu\n"[(seed >> 16) % 14] :
+		    (char)(seed >> 16);
+	}
+}
+
+static size_t
+write_archive(char *buff, size_t buffsize, char **data,
+    const char *options)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	size_t used, n;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	for (i = 0; i < ENTRIES; i++) {
+		assert((ae = archive_entry_new()) != NULL);
+		archive_entry_copy_pathname(ae, names[i]);
+		archive_entry_set_mode(ae, (i == ENTRIES - 1 ?
+		    AE_IFDIR | 0755 : AE_IFREG | 0644));
+		archive_entry_set_size(ae, entry_size(i));
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		archive_entry_free(ae);
+		/* Several calls, so the compressor sees more than one. */
+		for (n = 0; n < entry_size(i); n += 3000) {
+			size_t s = entry_size(i) - n;
+			if (s > 3000)
+				s = 3000;
+			assertEqualInt(s, archive_write_data(a, data[i] + n, s));
+		}
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (used);
+}
+
+static void
+verify_archive(char *buff, size_t used, char **data, int seekable)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char *out = malloc(BIG);
+	int i;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_zip(a));
+	if (seekable)
+		assertEqualIntA(a, ARCHIVE_OK,
+		    read_open_memory_seek(a, buff, used, 7));
+	else
+		assertEqualIntA(a, ARCHIVE_OK,
+		    read_open_memory(a, buff, used, 7));
+	for (i = 0; i < ENTRIES; i++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		assertEqualString(names[i], archive_entry_pathname(ae));
+		/* Leave "random" for the skip code to get past. */
+		if (i == 1)
+			continue;
+		failure("%s", names[i]);
+		assertEqualInt(entry_size(i), archive_read_data(a, out, BIG));
+		failure("%s", names[i]);
+		assert(memcmp(out, data[i], entry_size(i)) == 0);
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+	free(out);
+}
+
+static int
+i2(const char *p)
+{
+	return ((p[0] & 0xff) | ((p[1] & 0xff) << 8));
+}
+
+static int
+i4(const char *p)
+{
+	return (i2(p) | (i2(p + 2) << 16));
+}
+
+static void
+test_compression(const char *name, int method, int version, char **data)
+{
+	const size_t buffsize = ENTRIES * BIG;
+	char options[64];
+	char *buff1, *buff2;
+	const char *p;
+	size_t used1, used2;
+	struct archive *a;
+	int i;
+
+	/* Check that the method is supported here. */
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	if (ARCHIVE_OK != archive_write_set_format_option(a, "zip",
+	    "compression", name)) {
+		skipping("zip:%s writing not supported on this platform",
+		    name);
+		assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+		return;
+	}
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	buff1 = malloc(buffsize);
+	buff2 = malloc(buffsize);
+	sprintf(options, "zip:compression=%s", name);
+	used1 = write_archive(buff1, buffsize, data, options);
+
+	/* Check the method, the version needed to extract and the
+	 * flags of each entry in the central directory and in its
+	 * local file header.  LZMA data always ends with a marker. */
+	p = buff1 + i4(buff1 + used1 - 22 + 16);
+	for (i = 0; i < ENTRIES; i++) {
+		const char *h;
+
+		assertEqualMem(p, "PK\001\002", 4);
+		h = buff1 + i4(p + 42);
+		assertEqualMem(h, "PK\003\004", 4);
+		failure("%s", names[i]);
+		assertEqualInt(method, i2(p + 10));
+		assertEqualInt(method, i2(h + 8));
+		assertEqualInt(version, i2(p + 6));
+		assertEqualInt(version, i2(h + 4));
+		assertEqualInt(method == 14 ? 2 : 0, i2(p + 8) & 2);
+		assertEqualInt(method == 14 ? 2 : 0, i2(h + 6) & 2);
+		if (i == 3)
+			assert(i4(p + 20) < (int)entry_size(i) / 2);
+		p += 46 + i2(p + 28) + i2(p + 30) + i2(p + 32);
+	}
+	verify_archive(buff1, used1, data, 1);
+	verify_archive(buff1, used1, data, 0);
+
+	/* Only deflate goes to the workers; the output is the same. */
+	sprintf(options, "zip:compression=%s,zip:threads=2", name);
+	used2 = write_archive(buff2, buffsize, data, options);
+	assertEqualInt(used1, used2);
+	assert(memcmp(buff1, buff2, used1) == 0);
+
+	/* With Zip64 extensions, the method still decides the version. */
+	sprintf(options, "zip:compression=%s,zip:zip64", name);
+	used2 = write_archive(buff2, buffsize, data, options);
+	p = buff2 + i4(buff2 + used2 - 22 + 16);
+	assertEqualInt(version, i2(p + 6));
+	verify_archive(buff2, used2, data, 1);
+	verify_archive(buff2, used2, data, 0);
+
+	free(buff1);
+	free(buff2);
+}
+
+DEFINE_TEST(test_write_format_zip_compression)
+{
+	char *data[ENTRIES];
+	int i;
+
+	for (i = 0; i < ENTRIES; i++) {
+		data[i] = malloc(BIG);
+		fill(data[i], BIG, i != 1, i);
+	}
+
+	test_compression("bzip2", 12, 46, data);
+	test_compression("lzma", 14, 63, data);
+
+	for (i = 0; i < ENTRIES; i++)
+		free(data[i]);
+}
@@ -0,0 +1,197 @@
+/*-
+ * Copyright (c) 2003-2011 Tim Kientzle
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR(S) ``AS IS'' AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.
+ * IN NO EVENT SHALL THE AUTHOR(S) BE LIABLE FOR ANY DIRECT, INDIRECT,
+ * INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT
+ * NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF
+ * THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include "test.h"
+__FBSDID("$FreeBSD$");
+
+/*
+ * Write a Zip archive with zip:threads=N; it must be byte-for-byte
+ * the archive written without it.
+ */
+
+#define	ENTRIES		200
+#define	DATA_SIZE	(17 * 1024 * 1024)
+/* Bigger than the writer hands to worker threads. */
+#define	BIG_ENTRY	120
+
+static size_t
+entry_size(int i)
+{
+	if (i == BIG_ENTRY)
+		return (DATA_SIZE);
+	if (i % 7 == 3)
+		return (0);
+	return ((size_t)(i * 1499) % 70000);
+}
+
+static size_t
+write_archive(char *buff, size_t buffsize, const char *data,
+    const char *options)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[32];
+	size_t used, size, n;
+	int i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_options(a, options));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_open_memory(a, buff, buffsize, &used));
+	for (i = 0; i < ENTRIES; i++) {
+		assert((ae = archive_entry_new()) != NULL);
+		if (i % 10 == 9) {
+			sprintf(path, "dir%d/", i);
+			archive_entry_copy_pathname(ae, path);
+			archive_entry_set_mode(ae, AE_IFDIR | 0755);
+		} else if (i % 50 == 8) {
+			sprintf(path, "link%d", i);
+			archive_entry_copy_pathname(ae, path);
+			archive_entry_set_mode(ae, AE_IFLNK | 0755);
+			archive_entry_copy_symlink(ae, "file0");
+		} else {
+			sprintf(path, "file%d", i);
+			archive_entry_copy_pathname(ae, path);
+			archive_entry_set_mode(ae, AE_IFREG | 0644);
+			archive_entry_set_size(ae, entry_size(i));
+		}
+		assertEqualIntA(a, ARCHIVE_OK, archive_write_header(a, ae));
+		/* Hand over the data in uneven pieces. */
+		size = archive_entry_filetype(ae) == AE_IFREG ?
+		    entry_size(i) : 0;
+		for (n = 0; n < size; n += 4093 + i) {
+			size_t len = size - n < 4093 + (size_t)i ?
+			    size - n : 4093 + (size_t)i;
+			assertEqualInt(len,
+			    archive_write_data(a, data + i + n, len));
+		}
+		archive_entry_free(ae);
+	}
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_close(a));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+	return (used);
+}
+
+static void
+verify_archive(char *buff, size_t used, const char *data, char *out)
+{
+	struct archive_entry *ae;
+	struct archive *a;
+	char path[32];
+	int i;
+
+	assert((a = archive_read_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_read_support_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    read_open_memory(a, buff, used, 10240));
+	for (i = 0; i < ENTRIES; i++) {
+		assertEqualIntA(a, ARCHIVE_OK,
+		    archive_read_next_header(a, &ae));
+		if (i % 10 == 9) {
+			sprintf(path, "dir%d/", i);
+			assertEqualString(path, archive_entry_pathname(ae));
+		} else if (i % 50 == 8) {
+			sprintf(path, "link%d", i);
+			assertEqualString(path, archive_entry_pathname(ae));
+		} else {
+			sprintf(path, "file%d", i);
+			assertEqualString(path, archive_entry_pathname(ae));
+			failure("%s", path);
+			assertEqualInt(entry_size(i),
+			    archive_read_data(a, out, DATA_SIZE));
+			failure("%s", path);
+			assert(memcmp(out, data + i, entry_size(i)) == 0);
+		}
+	}
+	assertEqualIntA(a, ARCHIVE_EOF, archive_read_next_header(a, &ae));
+	assertEqualInt(ARCHIVE_OK, archive_read_free(a));
+}
+
+DEFINE_TEST(test_write_format_zip_parallel)
+{
+	const size_t buffsize = 2 * DATA_SIZE + 8 * 1024 * 1024;
+	char *data, *out, *buff1, *buff2;
+	size_t used1, used2;
+	struct archive *a;
+	unsigned seed = 7;
+	size_t i;
+
+	assert((a = archive_write_new()) != NULL);
+	assertEqualIntA(a, ARCHIVE_OK, archive_write_set_format_zip(a));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_format_option(a, "zip", "threads", "x"));
+	assertEqualIntA(a, ARCHIVE_FAILED,
+	    archive_write_set_format_option(a, "zip", "threads", "1025"));
+	assertEqualIntA(a, ARCHIVE_OK,
+	    archive_write_set_format_option(a, "zip", "threads", "0"));
+	assertEqualInt(ARCHIVE_OK, archive_write_free(a));
+
+	data = malloc(DATA_SIZE + ENTRIES);
+	out = malloc(DATA_SIZE);
+	buff1 = malloc(buffsize);
+	buff2 = malloc(buffsize);
+	if (!assert(data != NULL && out != NULL && buff1 != NULL &&
+	    buff2 != NULL)) {
+		free(data);
+		free(out);
+		free(buff1);
+		free(buff2);
+		return;
+	}
+	/* Text-like data, so deflate has something to do. */
+	for (i = 0; i < DATA_SIZE + ENTRIES; i++) {
+		seed = seed * 1103515245 + 12345;
+		data[i] = "etaoin shrdlu\n"[(seed >> 16) % 14];
+	}
+
+#ifdef HAVE_ZLIB_H
+	used1 = write_archive(buff1, buffsize, data, "zip:threads=0");
+	used2 = write_archive(buff2, buffsize, data, "zip:threads=3");
+	assertEqualInt(used1, used2);
+	assert(memcmp(buff1, buff2, used1) == 0);
+	verify_archive(buff2, used2, data, out);
+
+	/* Zip64 records come out the same way. */
+	used1 = write_archive(buff1, buffsize, data, "zip:zip64");
+	used2 = write_archive(buff2, buffsize, data, "zip:zip64,zip:threads=2");
+	assertEqualInt(used1, used2);
+	assert(memcmp(buff1, buff2, used1) == 0);
+#else
+	skipping("Deflate compression on worker threads");
+#endif
+
+	/* Stored entries are written on the calling thread. */
+	used1 = write_archive(buff1, buffsize, data, "zip:compression=store");
+	used2 = write_archive(buff2, buffsize, data,
+	    "zip:compression=store,zip:threads=2");
+	assertEqualInt(used1, used2);
+	assert(memcmp(buff1, buff2, used1) == 0);
+	verify_archive(buff2, used2, data, out);
+
+	free(data);
+	free(out);
+	free(buff1);
+	free(buff2);
+}
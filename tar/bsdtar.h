@@ -123,6 +123,7 @@ enum {
 	OPTION_HELP,
 	OPTION_INCLUDE,
 	OPTION_KEEP_NEWER_FILES,
+	OPTION_LZ4,
 	OPTION_LZIP,
 	OPTION_LZMA,
 	OPTION_NEWER_CTIME,
@@ -143,7 +144,8 @@ enum {
 	OPTION_UID,
 	OPTION_UNAME,
 	OPTION_USE_COMPRESS_PROGRAM,
-	OPTION_VERSION
+	OPTION_VERSION,
+	OPTION_ZSTD
 };
 
 int	bsdtar_getopt(struct bsdtar *);
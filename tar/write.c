@@ -175,6 +175,9 @@ tar_mode_c(struct bsdtar *bsdtar)
 		case 'J':
 			r = archive_write_set_compression_xz(a);
 			break;
+		case OPTION_LZ4:
+			r = archive_write_add_filter_lz4(a);
+			break;
 		case OPTION_LZIP:
 			r = archive_write_set_compression_lzip(a);
 			break;
@@ -187,6 +190,9 @@ tar_mode_c(struct bsdtar *bsdtar)
 		case 'Z':
 			r = archive_write_set_compression_compress(a);
 			break;
+		case OPTION_ZSTD:
+			r = archive_write_add_filter_zstd(a);
+			break;
 		default:
 			lafe_errc(1, 0,
 			    "Unrecognized compression option -%c",